@@ -5,6 +5,9 @@
 # include <unistd.h>
 # include <pwd.h>
 #include <time.h>
+#include <pthread.h>
+#include <cpuid.h>
+#include <sys/resource.h>
 #include "sgx_tgmp.h"
 
 # define MAX_PATH FILENAME_MAX
@@ -12,9 +15,39 @@
 #include "sgx_urts.h"
 #include "App.h"
 #include "Enclave_u.h"
+#include "te_g2.h"
+#include "checkpoint.h"
+#include "checkpoint_format.h"
+#include "async_ocall.h"
+#include "ring_buffer.h"
+#include "epc_bench.h"
+#include "edl_bench.h"
+#include "modexp_batch.h"
+#include "scan_bench.h"
+#include "trace.h"
+#include "metrics.h"
+#include "dispatch.h"
+#include "startup_prof.h"
+#include "enclave_pool.h"
+#include "launch_cache.h"
 
-/* Global EID shared by multiple threads */
-sgx_enclave_id_t global_eid = 0;
+/* Holds the current enclave id, with admission; see dispatch_admission.
+ * app_recreate replaces the id under the dispatcher's lock, so code that
+ * calls the enclave directly reads it with app_eid and not from a global. */
+static dispatch_t app_dispatch;
+
+static sgx_enclave_id_t app_eid(void)
+{
+    return dispatch_eid(&app_dispatch);
+}
+
+/* Spares for app_recreate, with APP_ENCLAVE_POOL=<spares> set. */
+static enclave_pool_t app_pool;
+static int app_pool_on;
+
+/* Launch token from the last creation, reused by the next ones. */
+static sgx_launch_token_t app_token;
+static pthread_mutex_t app_token_lock = PTHREAD_MUTEX_INITIALIZER;
 
 typedef struct _sgx_errlist_t {
     sgx_status_t err;
@@ -120,6 +153,123 @@ void print_error_message(sgx_status_t ret)
     	printf("Error code is 0x%X. Please refer to the \"Intel SGX SDK Developer Reference\" for more details.\n", ret);
 }
 
+/* CPUID.(EAX=12H,ECX=0):EAX[1] */
+static int cpu_has_sgx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid_count(0x12, 0, &eax, &ebx, &ecx, &edx) && (eax & 2);
+}
+
+/* Trusted tracepoints are stamped with RDTSC, which SGX1 parts fault on
+ * inside an enclave; only SGX2 allows it. */
+static void trace_enclave_enable(sgx_enclave_id_t eid)
+{
+    sgx_status_t status;
+
+    if (trace_enabled && cpu_has_sgx2())
+        ecall_trace_enable(eid, &status, 1);
+}
+
+/* Collects the enclave's trace buffer; call before destroying the enclave. */
+static void trace_enclave_drain(void)
+{
+    sgx_enclave_id_t eid = app_eid();
+    trace_trusted_event_t events[TRACE_DRAIN_BATCH];
+    uint32_t count = 0, dropped = 0;
+    sgx_status_t ret, status;
+
+    if (!trace_enabled)
+        return;
+    do {
+        ret = ecall_trace_drain(eid, &status, (uint8_t *) events, sizeof events,
+                                &count, &dropped);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS)
+            break;
+        trace_add_trusted(events, count, dropped);
+    } while (count == TRACE_DRAIN_BATCH);
+}
+
+typedef struct {
+    uint64_t *values;
+    uint32_t count;
+    sgx_status_t status;
+} metrics_pull_call_t;
+
+static sgx_status_t metrics_pull_ecall(sgx_enclave_id_t eid, void *p)
+{
+    metrics_pull_call_t *c = (metrics_pull_call_t *) p;
+
+    return ecall_metrics_snapshot(eid, &c->status, (uint8_t *) c->values,
+                                  c->count * sizeof *c->values);
+}
+
+/* metrics_trusted_fn for the exporter thread. */
+static int metrics_enclave_pull(uint64_t *values, uint32_t count)
+{
+    metrics_pull_call_t c = { values, count, SGX_ERROR_UNEXPECTED };
+    sgx_status_t ret;
+
+    ret = dispatch_call(&app_dispatch, metrics_pull_ecall, &c, DISPATCH_IDEMPOTENT);
+    return ret == SGX_SUCCESS && c.status == SGX_SUCCESS ? 0 : -1;
+}
+
+/* Creates an enclave ready to replace the current one; the enclave_pool_create_t
+ * of app_pool. */
+static sgx_status_t app_create_enclave(sgx_enclave_id_t *eid, void *ctx)
+{
+    sgx_launch_token_t token;
+    startup_prof_t prof;
+    sgx_status_t ret;
+    int updated = 0;
+
+    (void) ctx;
+    pthread_mutex_lock(&app_token_lock);
+    memcpy(token, app_token, sizeof token);
+    pthread_mutex_unlock(&app_token_lock);
+    startup_prof_begin();
+    ret = sgx_create_enclave(ENCLAVE_FILENAME, SGX_DEBUG_FLAG, &token, &updated, eid, NULL);
+    startup_prof_end(&prof);
+    if (ret != SGX_SUCCESS)
+        return ret;
+    /* Keep the refreshed token, or every later spare asks the AESM again. */
+    if (updated) {
+        pthread_mutex_lock(&app_token_lock);
+        memcpy(app_token, token, sizeof app_token);
+        pthread_mutex_unlock(&app_token_lock);
+    }
+    trace_enclave_enable(*eid);
+    return SGX_SUCCESS;
+}
+
+/* dispatch_recreate_t for app_dispatch. Runs with every dispatched call
+ * drained, so it must not go through initialize_enclave: that would take
+ * the metrics lock, which the exporter holds while it dispatches. */
+static sgx_status_t app_recreate(sgx_enclave_id_t *eid, void *ctx)
+{
+    sgx_enclave_id_t spare;
+    sgx_status_t ret;
+
+    (void) ctx;
+    sgx_destroy_enclave(*eid);
+    if (app_pool_on) {
+        /* A power transition takes the spares down too. An empty ecall
+         * tells; the first dead spare throws out every spare made before
+         * the loss, and the filler's next one is fresh. */
+        while ((ret = enclave_pool_take(&app_pool, &spare)) == SGX_SUCCESS &&
+               ecall_empty(spare) == SGX_ERROR_ENCLAVE_LOST) {
+            sgx_destroy_enclave(spare);
+            enclave_pool_invalidate(&app_pool);
+        }
+    } else {
+        ret = app_create_enclave(&spare, NULL);
+    }
+    if (ret != SGX_SUCCESS)
+        return ret;
+    *eid = spare;
+    return SGX_SUCCESS;
+}
+
 /* Initialize the enclave:
  *   Call sgx_create_enclave to initialize an enclave instance
  */
@@ -127,16 +277,47 @@ int initialize_enclave(void)
 {
     printf("Starting initialize enclave\n");
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    sgx_enclave_id_t eid;
+    startup_prof_t prof;
+    launch_cache_t cache;
+    uint64_t check_ns;
+    int warm, updated = 0;
     
+    /* the token of the last run, if it was for this image */
+    check_ns = metrics_now_ns();
+    warm = launch_cache_load(TOKEN_FILENAME, ENCLAVE_FILENAME, &cache);
+    check_ns = metrics_now_ns() - check_ns;
+
     /* Call sgx_create_enclave to initialize an enclave instance */
     /* Debug Support: set 2nd parameter to 1 */
-    ret = sgx_create_enclave(ENCLAVE_FILENAME, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL);
+    startup_prof_begin();
+    ret = sgx_create_enclave(ENCLAVE_FILENAME, SGX_DEBUG_FLAG, &cache.token, &updated, &eid, NULL);
+    startup_prof_end(&prof);
     if (ret != SGX_SUCCESS) {
         print_error_message(ret);
         return -1;
     }
 
     printf("Creating enclave succeed\n");
+    pthread_mutex_lock(&app_token_lock);
+    memcpy(app_token, cache.token, sizeof app_token);
+    pthread_mutex_unlock(&app_token_lock);
+    if (warm == 0)
+        cache.cold_ns = prof.total_ns;
+    if ((warm == 0 || updated) && launch_cache_store(TOKEN_FILENAME, &cache) != 0)
+        printf("Warning: cannot write %s\n", TOKEN_FILENAME);
+
+    /* eadd+eextend covers only the Min sizes of Enclave.config.xml when the
+     * platform has EDMM, which needs SGX2 */
+    printf("sgx2,%d\n", cpu_has_sgx2());
+    startup_prof_print(&prof);
+    printf("launch cache,%s,%lf ms to check\n", warm == 1 ? "warm" : "cold", (double) check_ns / 1e6);
+    if (warm == 1)
+        printf("cold start,%lf\nwarm start,%lf\n", (double) cache.cold_ns / 1e6,
+               (double) prof.total_ns / 1e6);
+    dispatch_rebind(&app_dispatch, eid);
+    trace_enclave_enable(eid);
+    metrics_set_trusted(metrics_enclave_pull);
 
     return 0;
 }
@@ -148,8 +329,23 @@ long ocall_get_time(){
     return t;
 }
 
+uint64_t ocall_get_time_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Empty on purpose, see Enclave/edl_bench.c. */
+void ocall_edl_empty(){}
+void ocall_edl_in(const uint8_t *buf, size_t len){ (void) buf; (void) len; }
+void ocall_edl_out(uint8_t *buf, size_t len){ (void) buf; (void) len; }
+void ocall_edl_inout(uint8_t *buf, size_t len){ (void) buf; (void) len; }
+void ocall_edl_user_check(uint8_t *buf, size_t len){ (void) buf; (void) len; }
+void ocall_edl_in_count(const uint64_t *buf, size_t n){ (void) buf; (void) n; }
+
 
 void test_large_input(){
+    sgx_enclave_id_t eid = app_eid();
     sgx_status_t ret;
     clock_t s, e, t;
     long inside_t;
@@ -168,7 +364,7 @@ void test_large_input(){
         input[i] = i % 128;
     }
     s = clock();
-    ecall_test_large_input(global_eid, &inside_t, input_size, input);
+    ecall_test_large_input(eid, &inside_t, input_size, input);
     e = clock();
     t = e - s;
     printf("%d,%ld\n", input_size, t - inside_t);
@@ -179,7 +375,7 @@ void test_large_input(){
 
         s = clock();
 
-        ret = ecall_test_large_input(global_eid, &inside_t, input_size, input);
+        ret = ecall_test_large_input(eid, &inside_t, input_size, input);
 
         e = clock();
         t = e - s;
@@ -195,6 +391,7 @@ void test_large_input(){
 
 // more enclaves? large enclave?
 void test_large_epc(){
+    sgx_enclave_id_t eid = app_eid();
 
     sgx_status_t ret;
     clock_t s, e, t;
@@ -203,37 +400,29 @@ void test_large_epc(){
     int begin, end, delt, size;
     begin = delt = 1e7, end = 2e8;
 
-    printf("ecall_test_large_input(μs): \n");
-
-    size = end;
-    ret = ecall_test_large_epc(global_eid, &inside_t, size);
-
-    if (ret != SGX_SUCCESS) {
-        print_error_message(ret);
-    } else {
-//            printf("size=%d: (inside)%ld - (outside)%ld = %ld\n", size, inside_t, t, inside_t - t);
-        printf("%d,%ld,%ld,%ld\n", size, inside_t, t, inside_t - t);
-    }
+    printf("ecall_test_large_epc(μs): \n");
+    printf("size(bytes),inside fill(μs),outside fill(μs),difference(μs)\n");
 
     for (int j = begin; j <= end; j += delt) {
         size = j;
-//        printf("%d\n", size);
 
         s = clock();
         uint8_t *arr = (uint8_t*) malloc(size);
+        if (arr == NULL)
+            break;
 
         for (int i = 0; i < size; ++i) {
-            arr[i] = arr[size - i] = (unsigned char)i % 128;
+            arr[i] = arr[size - 1 - i] = (unsigned char)i % 128;
         }
         e = clock();
         t = e - s;
+        free(arr);
 
-        ret = ecall_test_large_epc(global_eid, &inside_t, size);
+        ret = ecall_test_large_epc(eid, &inside_t, size);
 
         if (ret != SGX_SUCCESS) {
             print_error_message(ret);
         } else {
-//            printf("size=%d: (inside)%ld - (outside)%ld = %ld\n", size, inside_t, t, inside_t - t);
             printf("%d,%ld,%ld,%ld\n", size, inside_t, t, inside_t - t);
         }
 
@@ -241,9 +430,147 @@ void test_large_epc(){
 
 }
 
+/* EPC size from CPUID leaf 0x12: the sum of all EPC sections. */
+static uint64_t epc_size_bytes(void) {
+    unsigned int eax, ebx, ecx, edx;
+    uint64_t total = 0;
+
+    for (unsigned int sub = 2; sub < 2 + 8; ++sub) {
+        if (!__get_cpuid_count(0x12, sub, &eax, &ebx, &ecx, &edx) || (eax & 0xf) != 1)
+            break;
+        total += (uint64_t)(ecx & 0xfffff000) | ((uint64_t)(edx & 0xfffff) << 32);
+    }
+    return total ? total : 128ull << 20;
+}
+
+/* EPC paging curves: bandwidth, time per access and page faults for
+ * sequential, strided and random reads and writes over working sets from
+ * below L3 to four times the EPC. Faults are counted around the timed run
+ * only, after ecall_epc_prepare has brought the working set to steady state.
+ * Bandwidth counts the 8 bytes each access asks for. */
+void test_epc_bench(){
+    sgx_enclave_id_t eid = app_eid();
+    static const char *patterns[] = {"sequential", "strided", "random"};
+    sgx_status_t ret, status;
+    uint64_t epc = epc_size_bytes(), max_ws, ws, elapsed, checksum;
+    struct rusage before, after;
+
+    max_ws = 4 * epc < EPC_BENCH_MAX_BYTES ? 4 * epc : EPC_BENCH_MAX_BYTES;
+    max_ws -= max_ws % EPC_LINE;
+    ret = ecall_epc_alloc(eid, &status, max_ws);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        return;
+    }
+
+    printf("EPC paging (EPC %lu bytes): \n", (unsigned long) epc);
+    printf("pattern,op,working set(bytes),MB/s,ns/access,minor faults,major faults\n");
+    for (uint32_t pattern = EPC_PATTERN_SEQUENTIAL; pattern <= EPC_PATTERN_RANDOM; ++pattern) {
+        for (ws = EPC_BENCH_MIN_BYTES; ; ws = ws * 2 < max_ws ? ws * 2 : max_ws) {
+            ret = ecall_epc_prepare(eid, &status, pattern, ws, ws ^ pattern);
+            for (uint32_t write = 0; write <= 1 && ret == SGX_SUCCESS && status == SGX_SUCCESS;
+                 ++write) {
+                getrusage(RUSAGE_SELF, &before);
+                ret = ecall_epc_run(eid, &status, pattern, write, ws, EPC_BENCH_STRIDE,
+                                    EPC_BENCH_ACCESSES, &elapsed, &checksum);
+                getrusage(RUSAGE_SELF, &after);
+                if (ret != SGX_SUCCESS || status != SGX_SUCCESS || elapsed == 0)
+                    break;
+                printf("%s,%s,%lu,%lf,%lf,%ld,%ld\n", patterns[pattern],
+                       write ? "write" : "read", (unsigned long) ws,
+                       (double) EPC_BENCH_ACCESSES * 8 * 1e3 / (double) elapsed,
+                       (double) elapsed / (double) EPC_BENCH_ACCESSES,
+                       after.ru_minflt - before.ru_minflt, after.ru_majflt - before.ru_majflt);
+            }
+            if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+                print_error_message(ret != SGX_SUCCESS ? ret : status);
+                break;
+            }
+            if (ws == max_ws)
+                break;
+        }
+    }
+    ecall_epc_free(eid);
+}
+
+static sgx_status_t edl_ecall(sgx_enclave_id_t eid, uint32_t kind, uint8_t *buf, size_t len){
+    int ok;
+    switch (kind) {
+    case EDL_BENCH_EMPTY:
+        return ecall_empty(eid);
+    case EDL_BENCH_IN:
+        return ecall_edl_in(eid, buf, len);
+    case EDL_BENCH_OUT:
+        return ecall_edl_out(eid, buf, len);
+    case EDL_BENCH_INOUT:
+        return ecall_edl_inout(eid, buf, len);
+    case EDL_BENCH_USER_CHECK:
+        return ecall_edl_user_check(eid, &ok, buf, len);
+    default:
+        return ecall_edl_in_count(eid, (const uint64_t *) buf, len / sizeof(uint64_t));
+    }
+}
+
+/* Cost of every EDL parameter shape for ecalls and ocalls, 0 bytes to 1 GiB.
+ * "over empty" subtracts the parameterless call of the same direction, which
+ * leaves the marshalling, and GB/s is the payload over that time. Each
+ * ocall point is timed inside the enclave, so its ecall is not counted. */
+void test_edl_matrix(){
+    sgx_enclave_id_t eid = app_eid();
+    static const char *kinds[] = {"empty", "in", "out", "in/out", "user_check", "in/count"};
+    sgx_status_t ret = SGX_SUCCESS, status;
+    double base[2] = {0, 0}, ns;
+    unsigned long iters;
+    uint64_t len, s, e;
+    uint8_t *buf;
+
+    buf = (uint8_t *) calloc(1, EDL_BENCH_MAX_BYTES);
+    if (buf == NULL) {
+        printf("Error: cannot allocate the EDL benchmark buffer\n");
+        return;
+    }
+
+    printf("EDL transition matrix: \n");
+    printf("direction,attributes,payload(bytes),calls,ns/call,ns/call over empty,GB/s\n");
+    for (int ocall = 0; ocall <= 1; ++ocall) {
+        for (uint32_t kind = EDL_BENCH_EMPTY; kind < EDL_BENCH_KINDS; ++kind) {
+            for (len = 0; len <= edl_bench_max_bytes(ocall, kind); len = len ? len * 4 : 1) {
+                if ((kind == EDL_BENCH_EMPTY && len) ||
+                    (kind == EDL_BENCH_IN_COUNT && len % sizeof(uint64_t)))
+                    continue;
+                iters = edl_bench_iters(len);
+                if (ocall) {
+                    ret = ecall_edl_ocall_bench(eid, &status, kind, len, iters, &e);
+                    if (ret == SGX_SUCCESS)
+                        ret = status;
+                    s = 0;
+                } else {
+                    s = ocall_get_time_ns();
+                    for (unsigned long i = 0; i < iters && ret == SGX_SUCCESS; ++i)
+                        ret = edl_ecall(eid, kind, buf, len);
+                    e = ocall_get_time_ns();
+                }
+                if (ret != SGX_SUCCESS) {
+                    print_error_message(ret);
+                    free(buf);
+                    return;
+                }
+                ns = (double)(e - s) / iters;
+                if (kind == EDL_BENCH_EMPTY)
+                    base[ocall] = ns;
+                printf("%s,%s,%lu,%lu,%lf,%lf,%lf\n", ocall ? "ocall" : "ecall", kinds[kind],
+                       (unsigned long) len, iters, ns, ns - base[ocall],
+                       ns > base[ocall] ? (double) len / (ns - base[ocall]) : 0.0);
+            }
+        }
+    }
+    free(buf);
+}
+
 long net_overload = 1000000;
 
 void test_parallel(){
+    sgx_enclave_id_t eid = app_eid();
     sgx_status_t ret;
     clock_t s, e, t;
 
@@ -261,7 +588,7 @@ void test_parallel(){
         input[i] = i + 10;
     }
 //    s = clock();
-//    ecall_test_parallel(global_eid, &v, n * 4, input, output);
+//    ecall_test_parallel(eid, &v, n * 4, input, output);
 //    e = clock();
 //    t = e - s;
 //    printf("%d,%ld\n", n, t + net_overload);
@@ -272,7 +599,7 @@ void test_parallel(){
 
         s = clock();
 
-        ret = ecall_test_parallel(global_eid, &v, n * 4, input, output);
+        ret = ecall_test_parallel(eid, &v, n * 4, input, output);
 
         e = clock();
         t = e - s;
@@ -287,6 +614,7 @@ void test_parallel(){
 }
 
 void test_non_parallel(){
+    sgx_enclave_id_t eid = app_eid();
     sgx_status_t ret;
     clock_t s, e, t;
 
@@ -309,7 +637,7 @@ void test_non_parallel(){
         t = 0;
         for (int i = 0; i < n; ++i) {
             s = clock();
-            ret = ecall_test_non_parallel(global_eid, &output[i], input[i]);
+            ret = ecall_test_non_parallel(eid, &output[i], input[i]);
             e = clock();
             t += e - s + net_overload;
         }
@@ -324,12 +652,597 @@ void test_non_parallel(){
     }
 }
 
+/* in^100000 mod 2^32 - 1 over batches of inputs, as in test_parallel, with
+ * each kernel of ecall_modexp_batch. Every point does the same number of
+ * inputs; results are checked against the GMP kernel. */
+void test_modexp_batch(){
+    sgx_enclave_id_t eid = app_eid();
+    const char *names[MODEXP_KERNELS] = { "gmp", "scalar", "avx2", "avx512" };
+    const uint32_t total = 1 << 20;
+    uint32_t *in, *out, *ref, used, batch, i, k, same;
+    sgx_status_t ret, status;
+    struct timespec s, e;
+
+    in = (uint32_t *) malloc(MODEXP_BATCH_MAX * sizeof *in);
+    out = (uint32_t *) malloc(MODEXP_BATCH_MAX * sizeof *out);
+    ref = (uint32_t *) malloc(MODEXP_BATCH_MAX * sizeof *ref);
+    if (in == NULL || out == NULL || ref == NULL)
+        goto out;
+    for (i = 0; i < MODEXP_BATCH_MAX; ++i)
+        in[i] = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+
+    printf("modexp batch(inputs/s): \n");
+    printf("kernel,batch,inputs/s,matches gmp\n");
+    for (batch = MODEXP_BATCH_LANES; batch <= MODEXP_BATCH_MAX; batch *= 16) {
+        ret = ecall_modexp_batch(eid, &status, MODEXP_KERNEL_GMP, 100000, in, ref, batch,
+                                 &used);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            print_error_message(ret != SGX_SUCCESS ? ret : status);
+            goto out;
+        }
+        for (k = 0; k < MODEXP_KERNELS; ++k) {
+            clock_gettime(CLOCK_MONOTONIC, &s);
+            for (i = 0; i < total / batch; ++i) {
+                ret = ecall_modexp_batch(eid, &status, k, 100000, in, out, batch, &used);
+                if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+                    print_error_message(ret != SGX_SUCCESS ? ret : status);
+                    goto out;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &e);
+            if (used != k)
+                continue; /* not allowed by the enclave's XFRM */
+            same = memcmp(out, ref, batch * sizeof *out) == 0;
+            printf("%s,%u,%lf,%u\n", names[k], batch, (double) (total / batch * batch) /
+                   ((double)(e.tv_sec - s.tv_sec) + (double)(e.tv_nsec - s.tv_nsec) * 1e-9), same);
+        }
+    }
+out:
+    free(in);
+    free(out);
+    free(ref);
+}
+
+typedef struct {
+    uint32_t kernel;
+    const uint8_t *buf;
+    uint64_t len;
+    scan_result_t result;
+    sgx_status_t ret;
+} scan_arg_t;
+
+static void *scan_worker(void *p) {
+    sgx_enclave_id_t eid = app_eid();
+    scan_arg_t *arg = (scan_arg_t *) p;
+    sgx_status_t status;
+
+    arg->ret = ecall_scan(eid, &status, arg->kernel, arg->buf, arg->len,
+                          (uint8_t *) &arg->result, sizeof arg->result);
+    if (arg->ret == SGX_SUCCESS)
+        arg->ret = status;
+    return NULL;
+}
+
+/* Bulk scan kernels over 1 GiB of App memory, split across 1 to 8 enclave
+ * threads and merged with scan_combine. Bytes per cycle count TSC cycles,
+ * i.e. at the nominal clock. Every split must agree with one thread. */
+void test_scan(){
+    const char *names[SCAN_KERNELS] = { "sum", "adler32", "crc32c", "hash", "histogram" };
+    const uint64_t len = 1ull << 30;
+    scan_arg_t args[8];
+    pthread_t threads[8];
+    scan_result_t total, single = { 0 };
+    uint64_t chunk, tsc, x = 88172645463325252ull, i;
+    uint32_t k, t, n, started;
+    struct timespec s, e;
+    uint8_t *buf;
+
+    buf = (uint8_t *) malloc(len);
+    if (buf == NULL)
+        return;
+    for (i = 0; i < len; i += sizeof x) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(buf + i, &x, sizeof x);
+    }
+
+    printf("scan(bytes/cycle): \n");
+    printf("kernel,threads,GB/s,bytes/cycle,matches 1 thread\n");
+    for (k = 0; k < SCAN_KERNELS; ++k) {
+        for (t = 1; t <= 8; t *= 2) {
+            chunk = len / t / SCAN_ALIGN * SCAN_ALIGN;
+            for (n = 0; n < t; ++n) {
+                args[n].kernel = k;
+                args[n].buf = buf + n * chunk;
+                args[n].len = n == t - 1 ? len - n * chunk : chunk;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &s);
+            tsc = __builtin_ia32_rdtsc();
+            for (started = 0; started < t; ++started)
+                if (pthread_create(&threads[started], NULL, scan_worker, &args[started]) != 0)
+                    break;
+            for (n = 0; n < started; ++n)
+                pthread_join(threads[n], NULL);
+            tsc = __builtin_ia32_rdtsc() - tsc;
+            clock_gettime(CLOCK_MONOTONIC, &e);
+            if (started < t)
+                goto out;
+            for (n = 0; n < t; ++n) {
+                if (args[n].ret != SGX_SUCCESS) {
+                    print_error_message(args[n].ret);
+                    goto out;
+                }
+            }
+            total = args[0].result;
+            for (n = 1; n < t; ++n)
+                scan_combine(k, &total, &args[n].result, args[n].len);
+            if (t == 1)
+                single = total;
+            printf("%s,%u,%lf,%lf,%d\n", names[k], t, (double) len / 1e9 /
+                   ((double)(e.tv_sec - s.tv_sec) + (double)(e.tv_nsec - s.tv_nsec) * 1e-9),
+                   (double) len / (double) tsc, memcmp(&total, &single, sizeof total) == 0);
+        }
+    }
+out:
+    free(buf);
+}
+
+/* Random scalar in [1, r): the top byte keeps it below the group order. */
+static void te_random_scalar(uint8_t k[TE_FR_BYTES]) {
+    for (int i = 0; i < TE_FR_BYTES; ++i) {
+        k[i] = rand() & 0xff;
+    }
+    k[0] &= 0x1f;
+    k[TE_FR_BYTES - 1] |= 1;
+}
+
+/* Enclave TE share holder: per-share latency of ecall_te_decryption_shares
+ * against the same G2 code with the share in untrusted memory. */
+void test_te_share(){
+    sgx_enclave_id_t eid = app_eid();
+    sgx_status_t ret, status;
+    clock_t s, e;
+    double in_t, out_t;
+    te_g2_ctx_t ctx;
+    te_scalar_recoding_t rec;
+    te_g2_t g, u, *pts;
+    uint8_t share[TE_FR_BYTES], k[TE_FR_BYTES];
+    uint8_t *sealed, *points, *in_shares, *out_shares;
+    uint32_t sealed_len = 0, index = 0;
+    uint64_t t0;
+    int max_batch = 1024;
+
+    ret = ecall_te_share_sealed_size(eid, &sealed_len);
+    if (ret != SGX_SUCCESS) {
+        print_error_message(ret);
+        return;
+    }
+    sealed = (uint8_t *) malloc(sealed_len);
+    te_random_scalar(share);
+    ret = ecall_te_share_provision(eid, &status, share, 1, 1, 1, sealed, sealed_len);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        free(sealed);
+        return;
+    }
+    /* load it back the way a restarted share holder would */
+    ret = ecall_te_share_load(eid, &status, sealed, sealed_len, &index);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        free(sealed);
+        return;
+    }
+
+    te_g2_ctx_init(&ctx);
+    te_g2_init(&g);
+    te_g2_init(&u);
+    te_g2_generator(&ctx, &g);
+    pts = (te_g2_t *) malloc(max_batch * sizeof(te_g2_t));
+    points = (uint8_t *) malloc(max_batch * TE_G2_BYTES);
+    in_shares = (uint8_t *) malloc(max_batch * TE_G2_BYTES);
+    out_shares = (uint8_t *) malloc(max_batch * TE_G2_BYTES);
+    for (int j = 0; j < max_batch; ++j) {
+        te_g2_init(&pts[j]);
+        te_random_scalar(k);
+        te_scalar_recode(&ctx, &rec, k);
+        te_g2_mul(&ctx, &pts[j], &g, &rec);
+    }
+    te_g2_encode_batch(&ctx, points, pts, max_batch);
+    te_scalar_recode(&ctx, &rec, share);
+
+    printf("te decryption shares(μs per share), signer %u: \n", index);
+    printf("batch,enclave,untrusted\n");
+    for (int batch = 1; batch <= max_batch; batch *= 4) {
+        s = clock();
+        TRACE_BEGIN("ecall", "ecall_te_decryption_shares");
+        t0 = metrics_now_ns();
+        ret = ecall_te_decryption_shares(eid, &status, points, in_shares,
+                                         batch * TE_G2_BYTES);
+        metrics_ecall_done(t0, 2 * batch * TE_G2_BYTES);
+        TRACE_END("ecall", "ecall_te_decryption_shares");
+        e = clock();
+        in_t = (double)(e - s) * 1e6 / CLOCKS_PER_SEC / batch;
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            print_error_message(ret != SGX_SUCCESS ? ret : status);
+            break;
+        }
+
+        s = clock();
+        for (int j = 0; j < batch; ++j) {
+            te_g2_decode(&ctx, &u, points + j * TE_G2_BYTES);
+            te_g2_mul(&ctx, &pts[j], &u, &rec);
+        }
+        te_g2_encode_batch(&ctx, out_shares, pts, batch);
+        e = clock();
+        out_t = (double)(e - s) * 1e6 / CLOCKS_PER_SEC / batch;
+
+        if (memcmp(in_shares, out_shares, batch * TE_G2_BYTES) != 0) {
+            printf("Error: enclave and untrusted decryption shares differ\n");
+            break;
+        }
+        printf("%d,%lf,%lf\n", batch, in_t, out_t);
+    }
+
+    for (int j = 0; j < max_batch; ++j) {
+        te_g2_clear(&pts[j]);
+    }
+    te_g2_clear(&g);
+    te_g2_clear(&u);
+    te_g2_ctx_clear(&ctx);
+    free(pts);
+    free(points);
+    free(in_shares);
+    free(out_shares);
+    free(sealed);
+}
+
+/* Checkpoint: flush cost by number of dirty pages, then a restart where the
+ * new enclave only has the log and gets its TE share back from it. */
+void test_checkpoint(){
+    sgx_enclave_id_t eid = app_eid();
+    sgx_status_t ret, status;
+    clock_t s, e;
+    double provision_t, restore_t;
+    uint8_t share[TE_FR_BYTES], *sealed;
+    uint32_t sealed_len = 0, pages = 0, index = 0;
+    uint64_t t0;
+
+    if (ckpt_host_open(CKPT_FILENAME) != 0) {
+        printf("Error: cannot open checkpoint log %s\n", CKPT_FILENAME);
+        return;
+    }
+    ret = ecall_ckpt_open(eid, &status);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        ckpt_host_close();
+        return;
+    }
+
+    ecall_te_share_sealed_size(eid, &sealed_len);
+    sealed = (uint8_t *) malloc(sealed_len);
+    te_random_scalar(share);
+    s = clock();
+    ret = ecall_te_share_provision(eid, &status, share, 1, 1, 1, sealed, sealed_len);
+    e = clock();
+    free(sealed);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        ckpt_host_close();
+        return;
+    }
+    provision_t = (double)(e - s) * 1e6 / CLOCKS_PER_SEC;
+
+    printf("ecall_ckpt_flush(μs): \n");
+    printf("dirty pages,flush(μs)\n");
+    for (uint32_t n = 1; n <= CKPT_MAX_PAGES; n *= 4) {
+        ret = ecall_ckpt_touch(eid, &status, 0, n);
+        if (ret == SGX_SUCCESS && status == SGX_SUCCESS) {
+            s = clock();
+            TRACE_BEGIN("ecall", "ecall_ckpt_flush");
+            t0 = metrics_now_ns();
+            ret = ecall_ckpt_flush(eid, &status, &pages);
+            metrics_ecall_done(t0, sizeof pages);
+            TRACE_END("ecall", "ecall_ckpt_flush");
+            e = clock();
+        }
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            print_error_message(ret != SGX_SUCCESS ? ret : status);
+            ckpt_host_close();
+            return;
+        }
+        printf("%u,%lf\n", pages, (double)(e - s) * 1e6 / CLOCKS_PER_SEC);
+    }
+
+    /* restart: the new instance only has what was flushed */
+    trace_enclave_drain();
+    metrics_set_trusted(NULL);
+    sgx_destroy_enclave(eid);
+    if (initialize_enclave() < 0) {
+        ckpt_host_close();
+        return;
+    }
+    eid = app_eid();
+    s = clock();
+    ret = SGX_ERROR_UNEXPECTED;
+    if (ckpt_host_open(CKPT_FILENAME) == 0)
+        ret = ecall_ckpt_open(eid, &status);
+    if (ret == SGX_SUCCESS && status == SGX_SUCCESS)
+        ret = ecall_te_share_restore(eid, &status, &index);
+    e = clock();
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        ckpt_host_close();
+        return;
+    }
+    restore_t = (double)(e - s) * 1e6 / CLOCKS_PER_SEC;
+    printf("share provisioning(μs),cold start from checkpoint(μs)\n");
+    printf("%lf,%lf\n", provision_t, restore_t);
+    ckpt_host_close();
+}
+
+/* Asynchronous ocalls: per-request cost of a synchronous ocall, a fire and
+ * forget post and a submit-and-wait round trip through the ring. */
+void test_async_ocall(){
+    sgx_enclave_id_t eid = app_eid();
+    static const char *modes[] = {"sync ocall", "post", "submit+wait"};
+    sgx_status_t ret, status;
+    aocall_ring_t *ring;
+    uint64_t dropped;
+    clock_t s, e;
+
+    ring = aocall_host_start();
+    if (ring == NULL) {
+        printf("Error: cannot start the async ocall service thread\n");
+        return;
+    }
+    ret = ecall_aocall_register(eid, &status, ring);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        print_error_message(ret != SGX_SUCCESS ? ret : status);
+        aocall_host_stop();
+        return;
+    }
+
+    printf("async ocall(ns/op): \n");
+    printf("mode,requests,ns/op,dropped\n");
+    for (uint32_t mode = 0; mode < 3; ++mode) {
+        for (uint32_t n = 1000; n <= 100000; n *= 10) {
+            s = clock();
+            ret = ecall_aocall_bench(eid, &status, mode, n, &dropped);
+            e = clock();
+            if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+                print_error_message(ret != SGX_SUCCESS ? ret : status);
+                break;
+            }
+            printf("%s,%u,%lf,%lu\n", modes[mode], n,
+                   (double)(e - s) * 1e9 / CLOCKS_PER_SEC / n, (unsigned long) dropped);
+        }
+    }
+
+    ecall_aocall_register(eid, &status, NULL);
+    aocall_host_stop();
+}
+
+typedef struct {
+    rb_t rb;
+    uint32_t batch;
+    uint64_t count;
+    int stop; /* set when the consumer gave up */
+} rb_producer_arg_t;
+
+static void *rb_producer(void *p) {
+    rb_producer_arg_t *arg = (rb_producer_arg_t *) p;
+    uint8_t *buf = (uint8_t *) calloc(arg->batch, arg->rb.elem_size);
+    uint64_t next = 0;
+    uint32_t n, i;
+    int k;
+
+    while (buf != NULL && next < arg->count) {
+        n = arg->count - next < arg->batch ? (uint32_t)(arg->count - next) : arg->batch;
+        for (i = 0; i < n; ++i) {
+            uint64_t v = next + i;
+            memcpy(buf + (size_t) i * arg->rb.elem_size, &v, sizeof v);
+        }
+        for (i = 0; i < n; i += (uint32_t) k) {
+            k = rb_spsc_push(&arg->rb, buf + (size_t) i * arg->rb.elem_size, n - i);
+            if (k < 0 || __atomic_load_n(&arg->stop, __ATOMIC_RELAXED))
+                goto out;
+        }
+        next += n;
+    }
+out:
+    free(buf);
+    return NULL;
+}
+
+/* Shared-memory ring: messages per second from an App thread to an enclave
+ * consumer, by batch size, with no edger8r marshalling per message. */
+void test_ring_buffer(){
+    sgx_enclave_id_t eid = app_eid();
+    const uint32_t capacity = 4096, elem_size = 64;
+    const uint64_t count = 1 << 22;
+    sgx_status_t ret, status;
+    rb_producer_arg_t arg;
+    pthread_t producer;
+    uint64_t checksum;
+    void *mem;
+    struct timespec s, e; /* wall clock: clock() would add up both threads */
+
+    printf("ring buffer(msgs/s): \n");
+    printf("batch,msgs/s,checksum ok\n");
+    for (uint32_t batch = 1; batch <= 256; batch *= 4) {
+        if (posix_memalign(&mem, RB_CACHE_LINE, rb_bytes(RB_SPSC, capacity, elem_size)) != 0)
+            return;
+        rb_init(mem, RB_SPSC, capacity, elem_size);
+        rb_attach(&arg.rb, mem, RB_SPSC, capacity, elem_size);
+        arg.batch = batch;
+        arg.count = count;
+        arg.stop = 0;
+        if (pthread_create(&producer, NULL, rb_producer, &arg) != 0) {
+            free(mem);
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &s);
+        ret = ecall_rb_drain(eid, &status, mem, capacity, elem_size, batch, count, &checksum);
+        clock_gettime(CLOCK_MONOTONIC, &e);
+        __atomic_store_n(&arg.stop, 1, __ATOMIC_RELAXED);
+        pthread_join(producer, NULL);
+        free(mem);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            print_error_message(ret != SGX_SUCCESS ? ret : status);
+            return;
+        }
+        printf("%u,%lf,%d\n", batch, (double) count /
+               ((double)(e.tv_sec - s.tv_sec) + (double)(e.tv_nsec - s.tv_nsec) * 1e-9),
+               checksum == count * (count - 1) / 2);
+    }
+}
+
+typedef struct {
+    dispatch_t *d; /* NULL: call the enclave directly */
+    uint32_t calls;
+    uint32_t failed;
+} admission_arg_t;
+
+static sgx_status_t admission_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    (void) arg;
+    return ecall_empty(eid);
+}
+
+static void *admission_worker(void *p) {
+    sgx_enclave_id_t eid = app_eid();
+    admission_arg_t *arg = (admission_arg_t *) p;
+    sgx_status_t ret;
+
+    for (uint32_t i = 0; i < arg->calls; ++i) {
+        if (arg->d == NULL)
+            ret = ecall_empty(eid);
+        else
+            ret = dispatch_call(arg->d, admission_ecall, NULL, 0);
+        if (ret != SGX_SUCCESS)
+            arg->failed++;
+    }
+    return NULL;
+}
+
+/* Twice as many threads as TCSs making empty ecalls: directly, where the
+ * surplus threads get SGX_ERROR_OUT_OF_TCS, and through admission, where
+ * they queue on the host. */
+void test_admission(){
+    const char *modes[] = { "direct", "admitted" };
+    const uint32_t nthreads = 2 * ENCLAVE_TCS_NUM, calls = 20000;
+    admission_arg_t args[2 * ENCLAVE_TCS_NUM];
+    pthread_t threads[2 * ENCLAVE_TCS_NUM];
+    struct timespec s, e;
+    dispatch_t d;
+    uint32_t failed, n;
+
+    printf("TCS admission(calls/s): \n");
+    printf("mode,threads,calls/s,failed calls\n");
+    for (int mode = 0; mode < 2; ++mode) {
+        if (mode > 0 && (dispatch_init(&d, app_eid(), NULL, NULL) != 0 ||
+                         dispatch_admission(&d, NULL, ENCLAVE_TCS_NUM) != 0))
+            return;
+        clock_gettime(CLOCK_MONOTONIC, &s);
+        for (n = 0; n < nthreads; ++n) {
+            args[n].d = mode > 0 ? &d : NULL;
+            args[n].calls = calls;
+            args[n].failed = 0;
+            if (pthread_create(&threads[n], NULL, admission_worker, &args[n]) != 0)
+                break;
+        }
+        failed = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            pthread_join(threads[i], NULL);
+            failed += args[i].failed;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &e);
+        if (mode > 0)
+            dispatch_destroy(&d);
+        printf("%s,%u,%lf,%u\n", modes[mode], n, (double) n * calls /
+               ((double)(e.tv_sec - s.tv_sec) + (double)(e.tv_nsec - s.tv_nsec) * 1e-9), failed);
+    }
+}
+
+/* Failover onto a pool spare against creating the replacement: the time
+ * from losing the enclave to the first ecall on the new one. */
+void test_enclave_pool(){
+    enclave_pool_t pool;
+    sgx_enclave_id_t eid;
+    struct timespec s, e;
+    sgx_status_t ret;
+    dispatch_t d;
+
+    if (dispatch_init(&d, app_eid(), NULL, NULL) != 0)
+        return;
+    printf("enclave pool failover(us): \n");
+    printf("mode,us\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    ret = app_create_enclave(&eid, NULL);
+    if (ret == SGX_SUCCESS) {
+        dispatch_rebind(&d, eid);
+        ret = dispatch_call(&d, admission_ecall, NULL, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    if (ret != SGX_SUCCESS) {
+        print_error_message(ret);
+        dispatch_destroy(&d);
+        return;
+    }
+    printf("create,%lf\n", (double)(e.tv_sec - s.tv_sec) * 1e6 + (double)(e.tv_nsec - s.tv_nsec) * 1e-3);
+    sgx_destroy_enclave(eid);
+
+    if (enclave_pool_init(&pool, 2, app_create_enclave, NULL) != 0) {
+        dispatch_destroy(&d);
+        return;
+    }
+    for (int i = 0; i < 4; ++i) {
+        /* failover from a full pool */
+        while (enclave_pool_ready(&pool) < 2)
+            usleep(10000);
+        clock_gettime(CLOCK_MONOTONIC, &s);
+        ret = enclave_pool_take(&pool, &eid);
+        if (ret == SGX_SUCCESS) {
+            dispatch_rebind(&d, eid);
+            ret = dispatch_call(&d, admission_ecall, NULL, 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &e);
+        if (ret != SGX_SUCCESS) {
+            print_error_message(ret);
+            break;
+        }
+        printf("pool,%lf\n", (double)(e.tv_sec - s.tv_sec) * 1e6 + (double)(e.tv_nsec - s.tv_nsec) * 1e-3);
+        sgx_destroy_enclave(eid);
+    }
+    enclave_pool_destroy(&pool);
+    dispatch_destroy(&d);
+}
+
 /* Application entry */
 int SGX_CDECL main(int argc, char *argv[])
 {
     (void)(argc);
     (void)(argv);
+    const char *trace_file = getenv("TRACE_FILE");
+    const char *metrics_file = getenv("METRICS_FILE");
+    const char *metrics_socket = getenv("METRICS_SOCKET");
+    const char *metrics_interval = getenv("METRICS_INTERVAL_MS");
+    const char *pool_size = getenv("APP_ENCLAVE_POOL");
+
+    if (dispatch_init(&app_dispatch, 0, app_recreate, NULL) != 0 ||
+        dispatch_admission(&app_dispatch, "app", ENCLAVE_TCS_NUM) != 0) {
+        printf("Error: cannot set up ecall dispatch\n");
+        return -1;
+    }
 
+    if (trace_file != NULL && trace_start(trace_file) != 0)
+        printf("Error: cannot trace to %s\n", trace_file);
+    if ((metrics_file != NULL || metrics_socket != NULL) &&
+        metrics_start(metrics_file, metrics_socket,
+                      metrics_interval != NULL ? (uint32_t) atoi(metrics_interval) : 0) != 0)
+        printf("Error: cannot export metrics\n");
 
     /* Initialize the enclave */
     if(initialize_enclave() < 0){
@@ -337,13 +1250,37 @@ int SGX_CDECL main(int argc, char *argv[])
         getchar();
         return -1; 
     }
+    if (pool_size != NULL && atoi(pool_size) > 0) {
+        if (enclave_pool_init(&app_pool, (uint32_t) atoi(pool_size), app_create_enclave, NULL) == 0)
+            app_pool_on = 1;
+        else
+            printf("Error: cannot start a pool of %s enclaves\n", pool_size);
+    }
 
 //    test_large_input();
 //    test_large_epc();
+//    test_epc_bench();
+//    test_edl_matrix();
     test_parallel();
     test_non_parallel();
+    test_te_share();
+    test_checkpoint();
+    test_async_ocall();
+    test_ring_buffer();
+    test_modexp_batch();
+    test_scan();
+    test_admission();
+    test_enclave_pool();
     /* Destroy the enclave */
-    sgx_destroy_enclave(global_eid);
+    trace_enclave_drain();
+    metrics_stop();
+    metrics_set_trusted(NULL);
+    sgx_destroy_enclave(app_eid());
+    if (app_pool_on)
+        enclave_pool_destroy(&app_pool);
+    dispatch_destroy(&app_dispatch);
+    if (trace_enabled)
+        trace_stop();
     
     printf("Info: SampleEnclave successfully returned.\n");
 
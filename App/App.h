@@ -51,8 +51,12 @@
 
 # define TOKEN_FILENAME   "enclave.token"
 # define ENCLAVE_FILENAME "enclave.signed.so"
+# define CKPT_FILENAME    "enclave.ckpt"
 
-extern sgx_enclave_id_t global_eid;    /* global enclave id */
+/* TCSNum in Enclave/Enclave.config.xml; the Makefile passes it in */
+#ifndef ENCLAVE_TCS_NUM
+# error "ENCLAVE_TCS_NUM is not set; it comes from TCSNum of the enclave config"
+#endif
 
 #if defined(__cplusplus)
 extern "C" {
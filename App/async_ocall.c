@@ -0,0 +1,193 @@
+#include "async_ocall.h"
+#include "Enclave_u.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Empty polls before the service thread starts sleeping, and the bounds of
+ * its exponential sleep. */
+#define AOCALL_IDLE_SPIN 2048
+#define AOCALL_SLEEP_MIN_NS 1000
+#define AOCALL_SLEEP_MAX_NS 1000000
+
+static aocall_ring_t *aocall_ring;
+static rb_t aocall_rb;
+static aocall_handler_t aocall_handlers[AOCALL_OP_MAX];
+static pthread_t aocall_thread;
+static int aocall_running;
+
+/* Parked ocall_aocall_wait callers. The service thread only takes the lock
+ * when somebody is waiting. */
+static pthread_mutex_t aocall_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aocall_cond = PTHREAD_COND_INITIALIZER;
+static int aocall_waiters;
+
+static int64_t aocall_op_nop(const uint8_t *payload, uint32_t len) {
+    (void) payload;
+    return len;
+}
+
+static int64_t aocall_op_log(const uint8_t *payload, uint32_t len) {
+    fwrite(payload, 1, len, stdout);
+    if (len == 0 || payload[len - 1] != '\n')
+        fputc('\n', stdout);
+    return len;
+}
+
+static int64_t aocall_op_time(const uint8_t *payload, uint32_t len) {
+    (void) payload;
+    (void) len;
+    return (int64_t) clock();
+}
+
+static int64_t aocall_dispatch(uint32_t op, const uint8_t *payload, uint32_t len) {
+    aocall_handler_t h;
+
+    if (op >= AOCALL_OP_MAX || len > AOCALL_PAYLOAD)
+        return -1;
+    h = __atomic_load_n(&aocall_handlers[op], __ATOMIC_ACQUIRE);
+    return h != NULL ? h(payload, len) : -1;
+}
+
+/* Seqlock write, see aocall_poll in the enclave. */
+static void aocall_complete(uint64_t ticket, int64_t result) {
+    aocall_completion_t *c = &aocall_ring->done[ticket & (AOCALL_RING_SLOTS - 1)];
+
+    __atomic_store_n(&c->ticket, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&c->result, result, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->ticket, ticket, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&aocall_waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&aocall_lock);
+        pthread_cond_broadcast(&aocall_cond);
+        pthread_mutex_unlock(&aocall_lock);
+    }
+}
+
+/* Services at most one request; returns 0 when the ring was empty. The
+ * request is copied out, so producers can reuse the slot while the handler
+ * runs. */
+static int aocall_service_one(void) {
+    aocall_request_t req;
+    int64_t result;
+
+    if (rb_mpmc_pop(&aocall_rb, &req) != 0)
+        return 0;
+    result = aocall_dispatch(req.op, req.payload, req.len);
+    metrics_add(METRIC_AOCALLS, 1);
+    if (req.ticket)
+        aocall_complete(req.ticket, result);
+    return 1;
+}
+
+static void *aocall_service(void *arg) {
+    struct timespec ts;
+    long sleep_ns = AOCALL_SLEEP_MIN_NS;
+    int idle = 0;
+
+    (void) arg;
+    for (;;) {
+        if (aocall_service_one()) {
+            idle = 0;
+            sleep_ns = AOCALL_SLEEP_MIN_NS;
+            continue;
+        }
+        if (!__atomic_load_n(&aocall_running, __ATOMIC_ACQUIRE))
+            break;
+        if (++idle < AOCALL_IDLE_SPIN) {
+            __builtin_ia32_pause();
+            continue;
+        }
+        ts.tv_sec = 0;
+        ts.tv_nsec = sleep_ns;
+        nanosleep(&ts, NULL);
+        if (sleep_ns < AOCALL_SLEEP_MAX_NS)
+            sleep_ns *= 2;
+    }
+
+    /* release parked waiters; their tickets will never complete */
+    pthread_mutex_lock(&aocall_lock);
+    pthread_cond_broadcast(&aocall_cond);
+    pthread_mutex_unlock(&aocall_lock);
+    return NULL;
+}
+
+aocall_ring_t *aocall_host_start(void) {
+    aocall_ring_t *ring;
+
+    if (aocall_ring != NULL)
+        return aocall_ring;
+    if (posix_memalign((void **) &ring, RB_CACHE_LINE, sizeof *ring) != 0)
+        return NULL;
+    memset(ring, 0, sizeof *ring);
+    rb_init(ring->requests, RB_MPMC, AOCALL_RING_SLOTS, sizeof(aocall_request_t));
+    rb_attach(&aocall_rb, ring->requests, RB_MPMC, AOCALL_RING_SLOTS, sizeof(aocall_request_t));
+
+    aocall_host_register(AOCALL_OP_NOP, aocall_op_nop);
+    aocall_host_register(AOCALL_OP_LOG, aocall_op_log);
+    aocall_host_register(AOCALL_OP_TIME, aocall_op_time);
+
+    aocall_ring = ring;
+    aocall_running = 1;
+    if (pthread_create(&aocall_thread, NULL, aocall_service, NULL) != 0) {
+        aocall_ring = NULL;
+        aocall_running = 0;
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void aocall_host_stop(void) {
+    if (aocall_ring == NULL)
+        return;
+    __atomic_store_n(&aocall_running, 0, __ATOMIC_RELEASE);
+    pthread_join(aocall_thread, NULL);
+    free(aocall_ring);
+    aocall_ring = NULL;
+}
+
+int aocall_host_register(uint32_t op, aocall_handler_t handler) {
+    if (op >= AOCALL_OP_MAX)
+        return -1;
+    __atomic_store_n(&aocall_handlers[op], handler, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* OCall functions */
+
+/* Parks the calling enclave thread until `ticket` completes. Returns -1 if
+ * the completion was overwritten or the service thread stopped. */
+int ocall_aocall_wait(uint64_t ticket, int64_t *result) {
+    aocall_completion_t *c;
+    uint64_t t;
+
+    if (aocall_ring == NULL)
+        return -1;
+    c = &aocall_ring->done[ticket & (AOCALL_RING_SLOTS - 1)];
+
+    pthread_mutex_lock(&aocall_lock);
+    __atomic_add_fetch(&aocall_waiters, 1, __ATOMIC_SEQ_CST);
+    while ((t = __atomic_load_n(&c->ticket, __ATOMIC_SEQ_CST)) < ticket &&
+           __atomic_load_n(&aocall_running, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&aocall_cond, &aocall_lock);
+    __atomic_sub_fetch(&aocall_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&aocall_lock);
+
+    /* the service thread is the only writer, so a matching ticket is stable
+     * until it completes AOCALL_RING_SLOTS more requests */
+    if (t != ticket)
+        return -1;
+    *result = __atomic_load_n(&c->result, __ATOMIC_RELAXED);
+    return __atomic_load_n(&c->ticket, __ATOMIC_ACQUIRE) == ticket ? 0 : -1;
+}
+
+/* Fallback for requests that did not fit in the ring. */
+int64_t ocall_aocall_sync(uint32_t op, const uint8_t *payload, uint32_t len) {
+    return aocall_dispatch(op, payload, len);
+}
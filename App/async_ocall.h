@@ -0,0 +1,32 @@
+#ifndef _APP_ASYNC_OCALL_H_
+#define _APP_ASYNC_OCALL_H_
+
+#include <stdint.h>
+#include "async_ocall_ring.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Untrusted side of the asynchronous ocall ring (Include/async_ocall_ring.h). */
+
+typedef int64_t (*aocall_handler_t)(const uint8_t *payload, uint32_t len);
+
+/* Allocates the ring and starts the thread servicing it. The ring still has
+ * to be handed to the enclave with ecall_aocall_register. Returns NULL on
+ * error. */
+aocall_ring_t *aocall_host_start(void);
+
+/* Drains what is left in the ring and stops the service thread. Unregister
+ * the ring from the enclave first. */
+void aocall_host_stop(void);
+
+/* Installs the handler for op; NOP, LOG and TIME have defaults. Returns -1
+ * if op is out of range. */
+int aocall_host_register(uint32_t op, aocall_handler_t handler);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_APP_ASYNC_OCALL_H_ */
@@ -0,0 +1,287 @@
+#include "checkpoint.h"
+#include "checkpoint_format.h"
+#include "Enclave_u.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Largest sealed record accepted from the log or from the enclave. */
+#define CKPT_MAX_SEALED (2 * CKPT_PAGE_SIZE + 1024)
+
+typedef struct {
+    off_t offset; /* of the sealed data */
+    uint32_t len; /* 0: none */
+    uint64_t seq;
+} ckpt_loc_t;
+
+/* The enclave holds its checkpoint lock across every ocall below, so this
+ * state is never touched by two threads at once. */
+static int ckpt_fd = -1;
+static char ckpt_path[FILENAME_MAX];
+static off_t ckpt_end;
+static ckpt_loc_t ckpt_pages[CKPT_MAX_PAGES];
+static ckpt_loc_t ckpt_pending[CKPT_MAX_PAGES];
+static ckpt_loc_t ckpt_commit;
+
+static int ckpt_pwrite_all(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = (const char *) buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n <= 0)
+            return -1;
+        p += n;
+        off += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static int ckpt_pread_all(int fd, void *buf, size_t len, off_t off) {
+    char *p = (char *) buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n <= 0)
+            return -1;
+        p += n;
+        off += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static int ckpt_header_valid(const ckpt_record_header_t *h) {
+    return h->magic == CKPT_MAGIC && h->sealed_len > 0 && h->sealed_len <= CKPT_MAX_SEALED &&
+           ((h->type == CKPT_RECORD_PAGE && h->page < CKPT_MAX_PAGES) ||
+            (h->type == CKPT_RECORD_COMMIT && h->page == 0));
+}
+
+/* Page records of a flush become visible only with its commit record. */
+static void ckpt_apply(const ckpt_record_header_t *h, off_t data) {
+    ckpt_loc_t loc;
+
+    loc.offset = data;
+    loc.len = h->sealed_len;
+    loc.seq = h->seq;
+    if (h->type == CKPT_RECORD_PAGE) {
+        ckpt_pending[h->page] = loc;
+        return;
+    }
+    for (int i = 0; i < CKPT_MAX_PAGES; ++i) {
+        if (ckpt_pending[i].len) {
+            ckpt_pages[i] = ckpt_pending[i];
+            ckpt_pending[i].len = 0;
+        }
+    }
+    ckpt_commit = loc;
+}
+
+static int ckpt_replay(void) {
+    ckpt_record_header_t h;
+    off_t off = 0, committed = 0;
+    struct stat st;
+
+    if (fstat(ckpt_fd, &st) != 0)
+        return -1;
+    while (off + (off_t) sizeof h <= st.st_size) {
+        if (ckpt_pread_all(ckpt_fd, &h, sizeof h, off) != 0 || !ckpt_header_valid(&h) ||
+            off + (off_t) sizeof h + h.sealed_len > st.st_size)
+            break;
+        ckpt_apply(&h, off + sizeof h);
+        off += sizeof h + h.sealed_len;
+        if (h.type == CKPT_RECORD_COMMIT)
+            committed = off;
+    }
+
+    /* A torn or uncommitted tail belongs to a flush that never completed. */
+    memset(ckpt_pending, 0, sizeof ckpt_pending);
+    if (committed != st.st_size && ftruncate(ckpt_fd, committed) != 0)
+        return -1;
+    ckpt_end = committed;
+    return 0;
+}
+
+/* Copies one indexed record into the compacted log at *off. */
+static int ckpt_copy_record(int fd, uint8_t *buf, uint32_t type, uint32_t page,
+                            ckpt_loc_t *loc, off_t *off) {
+    ckpt_record_header_t h;
+
+    h.magic = CKPT_MAGIC;
+    h.type = type;
+    h.page = page;
+    h.sealed_len = loc->len;
+    h.seq = loc->seq;
+    if (ckpt_pread_all(ckpt_fd, buf, loc->len, loc->offset) != 0 ||
+        ckpt_pwrite_all(fd, &h, sizeof h, *off) != 0 ||
+        ckpt_pwrite_all(fd, buf, loc->len, *off + sizeof h) != 0)
+        return -1;
+    loc->offset = *off + sizeof h;
+    *off += sizeof h + loc->len;
+    return 0;
+}
+
+/* fsyncs the directory holding path, which makes a rename into it durable. */
+static int ckpt_fsync_dir(const char *path) {
+    char dir[FILENAME_MAX];
+    const char *slash = strrchr(path, '/');
+    int fd, ret;
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        memcpy(dir, path, (size_t) (slash - path));
+        dir[slash - path] = '\0';
+    }
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+/* Rewrites the log as the live page records plus the last commit once
+ * superseded records take up more than three quarters of it. Sealed data
+ * is copied verbatim; the enclave does not take part. */
+static int ckpt_compact(void) {
+    char tmp[FILENAME_MAX + 8];
+    ckpt_loc_t pages[CKPT_MAX_PAGES], commit;
+    off_t live = 0, off = 0;
+    uint8_t *buf;
+    int fd, ret = -1;
+
+    if (ckpt_commit.len == 0)
+        return 0;
+    for (int i = 0; i < CKPT_MAX_PAGES; ++i) {
+        if (ckpt_pages[i].len)
+            live += sizeof(ckpt_record_header_t) + ckpt_pages[i].len;
+    }
+    live += sizeof(ckpt_record_header_t) + ckpt_commit.len;
+    if (ckpt_end <= 4 * live)
+        return 0;
+
+    snprintf(tmp, sizeof tmp, "%s.tmp", ckpt_path);
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return -1;
+    buf = (uint8_t *) malloc(CKPT_MAX_SEALED);
+    memcpy(pages, ckpt_pages, sizeof pages);
+    commit = ckpt_commit;
+
+    if (buf != NULL) {
+        ret = 0;
+        for (int i = 0; i < CKPT_MAX_PAGES && ret == 0; ++i) {
+            if (pages[i].len)
+                ret = ckpt_copy_record(fd, buf, CKPT_RECORD_PAGE, i, &pages[i], &off);
+        }
+        if (ret == 0)
+            ret = ckpt_copy_record(fd, buf, CKPT_RECORD_COMMIT, 0, &commit, &off);
+        if (ret == 0 && (fsync(fd) != 0 || rename(tmp, ckpt_path) != 0))
+            ret = -1;
+    }
+    free(buf);
+    if (ret != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    close(ckpt_fd);
+    ckpt_fd = fd;
+    memcpy(ckpt_pages, pages, sizeof pages);
+    ckpt_commit = commit;
+    ckpt_end = off;
+    return ckpt_fsync_dir(ckpt_path);
+}
+
+int ckpt_host_open(const char *path) {
+    ckpt_host_close();
+    if (strlen(path) >= sizeof ckpt_path)
+        return -1;
+    strcpy(ckpt_path, path);
+
+    ckpt_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (ckpt_fd < 0)
+        return -1;
+    memset(ckpt_pages, 0, sizeof ckpt_pages);
+    memset(ckpt_pending, 0, sizeof ckpt_pending);
+    memset(&ckpt_commit, 0, sizeof ckpt_commit);
+    ckpt_end = 0;
+    if (ckpt_replay() != 0 || ckpt_compact() != 0) {
+        ckpt_host_close();
+        return -1;
+    }
+    return 0;
+}
+
+void ckpt_host_close(void) {
+    if (ckpt_fd >= 0)
+        close(ckpt_fd);
+    ckpt_fd = -1;
+}
+
+/* OCall functions */
+
+/* One ocall per batch of sealed records. Batches holding a commit are
+ * flushed to disk before the commit is indexed. */
+int ocall_ckpt_append(const uint8_t *records, uint32_t len) {
+    ckpt_record_header_t h;
+    uint32_t off = 0;
+    int commit = 0;
+
+    if (ckpt_fd < 0)
+        return -1;
+    /* validate the whole batch before any of it reaches the log */
+    while (off < len) {
+        if (len - off < sizeof h)
+            return -1;
+        memcpy(&h, records + off, sizeof h);
+        if (!ckpt_header_valid(&h) || h.sealed_len > len - off - sizeof h)
+            return -1;
+        commit |= h.type == CKPT_RECORD_COMMIT;
+        off += sizeof h + h.sealed_len;
+    }
+
+    if (ckpt_pwrite_all(ckpt_fd, records, len, ckpt_end) != 0 ||
+        (commit && fdatasync(ckpt_fd) != 0)) {
+        /* drop whatever part of the batch did get written */
+        if (ftruncate(ckpt_fd, ckpt_end) != 0)
+            perror("ftruncate");
+        return -1;
+    }
+
+    for (off = 0; off < len; off += sizeof h + h.sealed_len) {
+        memcpy(&h, records + off, sizeof h);
+        ckpt_apply(&h, ckpt_end + off + sizeof h);
+    }
+    ckpt_end += len;
+    return 0;
+}
+
+int ocall_ckpt_read_page(uint32_t page, uint64_t seq, uint8_t *sealed, uint32_t len) {
+    if (ckpt_fd < 0 || page >= CKPT_MAX_PAGES || ckpt_pages[page].len != len ||
+        ckpt_pages[page].seq != seq)
+        return -1;
+    if (ckpt_pread_all(ckpt_fd, sealed, len, ckpt_pages[page].offset) != 0)
+        return -1;
+    return (int) len;
+}
+
+/* Returns 0 when nothing was ever committed. */
+int ocall_ckpt_read_manifest(uint8_t *sealed, uint32_t len, uint64_t *seq) {
+    *seq = 0;
+    if (ckpt_fd < 0)
+        return -1;
+    if (ckpt_commit.len == 0)
+        return 0;
+    if (ckpt_commit.len != len ||
+        ckpt_pread_all(ckpt_fd, sealed, len, ckpt_commit.offset) != 0)
+        return -1;
+    *seq = ckpt_commit.seq;
+    return (int) len;
+}
@@ -0,0 +1,22 @@
+#ifndef _APP_CHECKPOINT_H_
+#define _APP_CHECKPOINT_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Untrusted side of the enclave checkpoint: the append-only log behind
+ * ocall_ckpt_append / ocall_ckpt_read_page / ocall_ckpt_read_manifest.
+ *
+ * ckpt_host_open replays the log into an index of the latest committed
+ * record for every page, drops a torn or uncommitted tail left by a crash,
+ * and compacts the log when superseded records dominate it. Must be called
+ * before ecall_ckpt_open. Returns 0 on success, -1 on error. */
+int ckpt_host_open(const char *path);
+void ckpt_host_close(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_APP_CHECKPOINT_H_ */
@@ -0,0 +1,259 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_rwlockattr_setkind_np */
+#endif
+#include "dispatch.h"
+#include "metrics.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+static __thread uint32_t dispatch_seed;
+
+/* Backoff of ns plus up to half again, so parked callers do not all retry
+ * at the same instant. */
+static uint64_t dispatch_jitter(uint64_t ns) {
+    uint32_t x = dispatch_seed;
+
+    if (x == 0)
+        x = (uint32_t) metrics_now_ns() | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    dispatch_seed = x;
+    return ns + x % (ns / 2 + 1);
+}
+
+static void dispatch_write_slots(metrics_emit_fn emit, void *out, const dispatch_t *d,
+                                 const char *name, size_t field) {
+    uint32_t i;
+
+    emit(out, "# TYPE %s counter\n", name);
+    for (i = 0; i < d->slots; ++i)
+        emit(out, "%s{dispatcher=\"%s\",slot=\"%u\"} %llu\n", name, d->name, i,
+             (unsigned long long) __atomic_load_n(
+                 (const uint64_t *) ((const char *) &d->slot[i] + field), __ATOMIC_RELAXED));
+}
+
+static void dispatch_write_metrics(metrics_emit_fn emit, void *out, void *ctx) {
+    const dispatch_t *d = (const dispatch_t *) ctx;
+
+    dispatch_write_slots(emit, out, d, "dispatch_slot_calls_total",
+                         offsetof(dispatch_slot_t, calls));
+    dispatch_write_slots(emit, out, d, "dispatch_slot_wait_ns_total",
+                         offsetof(dispatch_slot_t, wait_ns));
+    dispatch_write_slots(emit, out, d, "dispatch_slot_busy_ns_total",
+                         offsetof(dispatch_slot_t, busy_ns));
+    emit(out, "# TYPE dispatch_queued gauge\n");
+    emit(out, "dispatch_queued{dispatcher=\"%s\"} %u\n", d->name,
+         __atomic_load_n(&d->queued, __ATOMIC_RELAXED));
+}
+
+int dispatch_init(dispatch_t *d, sgx_enclave_id_t eid, dispatch_recreate_t recreate, void *ctx) {
+    pthread_rwlockattr_t rwattr;
+    pthread_condattr_t cattr;
+    int rc;
+
+    memset(d, 0, sizeof *d);
+    d->eid = eid;
+    d->recreate = recreate;
+    d->recreate_ctx = ctx;
+
+    /* a recreate must not starve behind a steady stream of calls; this also
+     * means a dispatched call must not dispatch again from an ocall */
+    pthread_rwlockattr_init(&rwattr);
+    pthread_rwlockattr_setkind_np(&rwattr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    rc = pthread_rwlock_init(&d->lock, &rwattr);
+    pthread_rwlockattr_destroy(&rwattr);
+    if (rc != 0)
+        return -1;
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    rc = pthread_cond_init(&d->wait_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    if (rc != 0 || pthread_mutex_init(&d->wait_lock, NULL) != 0) {
+        if (rc == 0)
+            pthread_cond_destroy(&d->wait_cond);
+        pthread_rwlock_destroy(&d->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void dispatch_destroy(dispatch_t *d) {
+    if (d->slots) {
+        if (d->name != NULL)
+            metrics_remove_writer(dispatch_write_metrics, d);
+        pthread_cond_destroy(&d->slot_cond);
+        pthread_mutex_destroy(&d->slot_lock);
+    }
+    pthread_cond_destroy(&d->wait_cond);
+    pthread_mutex_destroy(&d->wait_lock);
+    pthread_rwlock_destroy(&d->lock);
+}
+
+/* Takes a free slot, queueing until there is one. The most recently freed
+ * slot goes first. */
+static dispatch_slot_t *dispatch_slot_get(dispatch_t *d) {
+    uint64_t t0 = metrics_now_ns(), wait;
+    dispatch_slot_t *s;
+
+    pthread_mutex_lock(&d->slot_lock);
+    if (d->free_top == 0) {
+        __atomic_add_fetch(&d->queued, 1, __ATOMIC_RELAXED);
+        metrics_gauge_add(METRIC_ADMISSION_QUEUED, 1);
+        while (d->free_top == 0)
+            pthread_cond_wait(&d->slot_cond, &d->slot_lock);
+        __atomic_sub_fetch(&d->queued, 1, __ATOMIC_RELAXED);
+        metrics_gauge_add(METRIC_ADMISSION_QUEUED, -1);
+    }
+    s = &d->slot[d->free_slots[--d->free_top]];
+    pthread_mutex_unlock(&d->slot_lock);
+
+    wait = metrics_now_ns() - t0;
+    metrics_record(METRIC_ADMISSION_WAIT_NS, wait);
+    __atomic_fetch_add(&s->wait_ns, wait, __ATOMIC_RELAXED);
+    return s;
+}
+
+static void dispatch_slot_put(dispatch_t *d, dispatch_slot_t *s) {
+    pthread_mutex_lock(&d->slot_lock);
+    d->free_slots[d->free_top++] = s->index;
+    pthread_cond_signal(&d->slot_cond);
+    pthread_mutex_unlock(&d->slot_lock);
+}
+
+static void dispatch_leave(dispatch_t *d, dispatch_slot_t *s, uint64_t t0) {
+    __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->busy_ns, metrics_now_ns() - t0, __ATOMIC_RELAXED);
+    dispatch_slot_put(d, s);
+}
+
+int dispatch_admission(dispatch_t *d, const char *name, uint32_t slots) {
+    uint32_t i;
+
+    if (slots == 0 || slots > DISPATCH_MAX_SLOTS || d->slots)
+        return -1;
+    if (pthread_mutex_init(&d->slot_lock, NULL) != 0)
+        return -1;
+    if (pthread_cond_init(&d->slot_cond, NULL) != 0) {
+        pthread_mutex_destroy(&d->slot_lock);
+        return -1;
+    }
+    for (i = 0; i < slots; ++i) {
+        d->slot[i].index = i;
+        d->free_slots[i] = slots - 1 - i; /* slot 0 on top */
+    }
+    d->free_top = slots;
+    d->name = name;
+    d->slots = slots;
+    if (name != NULL)
+        metrics_add_writer(dispatch_write_metrics, d);
+    return 0;
+}
+
+void dispatch_rebind(dispatch_t *d, sgx_enclave_id_t eid) {
+    pthread_rwlock_wrlock(&d->lock);
+    d->eid = eid;
+    d->generation++;
+    pthread_rwlock_unlock(&d->lock);
+}
+
+sgx_enclave_id_t dispatch_eid(dispatch_t *d) {
+    sgx_enclave_id_t eid;
+
+    pthread_rwlock_rdlock(&d->lock);
+    eid = d->eid;
+    pthread_rwlock_unlock(&d->lock);
+    return eid;
+}
+
+/* A TCS was just released; wake parked callers, if any. */
+static void dispatch_wake(dispatch_t *d) {
+    if (__atomic_load_n(&d->waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&d->wait_lock);
+        pthread_cond_broadcast(&d->wait_cond);
+        pthread_mutex_unlock(&d->wait_lock);
+    }
+}
+
+/* Sleeps until a call returns or ns pass. A wakeup lost between the BUSY
+ * and this wait only costs the timeout. */
+static void dispatch_park(dispatch_t *d, uint64_t ns) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns += (uint64_t) ts.tv_nsec;
+    ts.tv_sec += (time_t) (ns / 1000000000ull);
+    ts.tv_nsec = (long) (ns % 1000000000ull);
+
+    pthread_mutex_lock(&d->wait_lock);
+    __atomic_add_fetch(&d->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_timedwait(&d->wait_cond, &d->wait_lock, &ts);
+    __atomic_sub_fetch(&d->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&d->wait_lock);
+}
+
+/* Recreates the enclave unless somebody already did since `generation`. */
+static sgx_status_t dispatch_recover(dispatch_t *d, uint64_t generation) {
+    sgx_status_t ret = SGX_SUCCESS;
+
+    pthread_rwlock_wrlock(&d->lock);
+    if (d->generation == generation) {
+        if (d->recreate == NULL) {
+            ret = SGX_ERROR_ENCLAVE_LOST;
+        } else {
+            ret = d->recreate(&d->eid, d->recreate_ctx);
+            if (ret == SGX_SUCCESS) {
+                d->generation++;
+                metrics_add(METRIC_DISPATCH_RECREATES, 1);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&d->lock);
+    return ret;
+}
+
+sgx_status_t dispatch_call(dispatch_t *d, dispatch_fn_t fn, void *arg, unsigned flags) {
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t backoff = DISPATCH_BACKOFF_MIN_NS, waited = 0, generation, t0, start = 0;
+    dispatch_slot_t *slot = NULL;
+    int attempt;
+
+    if (d->slots) {
+        slot = dispatch_slot_get(d);
+        start = metrics_now_ns();
+    }
+    for (attempt = 0; attempt < DISPATCH_MAX_ATTEMPTS; ++attempt) {
+        pthread_rwlock_rdlock(&d->lock);
+        generation = d->generation;
+        ret = fn(d->eid, arg);
+        pthread_rwlock_unlock(&d->lock);
+
+        if (ret == SGX_ERROR_BUSY || ret == SGX_ERROR_OUT_OF_TCS) {
+            metrics_add(METRIC_DISPATCH_RETRIES, 1);
+            t0 = metrics_now_ns();
+            dispatch_park(d, dispatch_jitter(backoff));
+            waited += metrics_now_ns() - t0;
+            backoff = backoff * 2 < DISPATCH_BACKOFF_MAX_NS ? backoff * 2 : DISPATCH_BACKOFF_MAX_NS;
+            continue;
+        }
+        dispatch_wake(d);
+        if (ret == SGX_ERROR_ENCLAVE_LOST) {
+            ret = dispatch_recover(d, generation);
+            if (ret == SGX_SUCCESS && (flags & DISPATCH_IDEMPOTENT)) {
+                metrics_add(METRIC_DISPATCH_REPLAYS, 1);
+                continue;
+            }
+            if (ret == SGX_SUCCESS)
+                ret = SGX_ERROR_ENCLAVE_LOST;
+        }
+        break;
+    }
+    if (slot != NULL)
+        dispatch_leave(d, slot, start);
+    if (waited)
+        metrics_record(METRIC_DISPATCH_WAIT_NS, waited);
+    return ret;
+}
@@ -0,0 +1,103 @@
+#ifndef _APP_DISPATCH_H_
+#define _APP_DISPATCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sgx_eid.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Ecall dispatch with retry.
+ *
+ * SGX_ERROR_BUSY and SGX_ERROR_OUT_OF_TCS mean that every TCS is in use.
+ * Instead of spinning, the caller sleeps on a condition variable until
+ * another dispatched call returns or its backoff runs out. The backoff
+ * doubles from DISPATCH_BACKOFF_MIN_NS to DISPATCH_BACKOFF_MAX_NS, with
+ * jitter, for at most DISPATCH_MAX_ATTEMPTS attempts.
+ *
+ * On SGX_ERROR_ENCLAVE_LOST the first caller to see it recreates the
+ * enclave through the recreate callback. Calls already running drain out
+ * first, and new calls wait for the recreate. A call flagged
+ * DISPATCH_IDEMPOTENT is then replayed on the new enclave. Any other call
+ * returns SGX_ERROR_ENCLAVE_LOST, because the state it relied on is gone.
+ *
+ * Retries, recreates, replays and time spent waiting go to the metrics
+ * registry (Include/metrics.h).
+ *
+ * Admission (dispatch_admission) caps concurrent calls at the enclave's TCS
+ * count. Callers queue on the host instead of running into
+ * SGX_ERROR_OUT_OF_TCS. Each slot's calls, admission wait and busy time are
+ * exported with slot labels. */
+
+#define DISPATCH_MAX_ATTEMPTS 16
+#define DISPATCH_BACKOFF_MIN_NS 10000
+#define DISPATCH_BACKOFF_MAX_NS 10000000
+
+#define DISPATCH_MAX_SLOTS 64
+
+#define DISPATCH_IDEMPOTENT 1
+
+/* Makes the ecall on eid; returns the bridge status, with the ecall's own
+ * result left in *arg. */
+typedef sgx_status_t (*dispatch_fn_t)(sgx_enclave_id_t eid, void *arg);
+
+/* Replaces a lost enclave: destroys *eid and stores the new id. */
+typedef sgx_status_t (*dispatch_recreate_t)(sgx_enclave_id_t *eid, void *ctx);
+
+typedef struct dispatch dispatch_t;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t wait_ns; /* admission wait of the calls that got this slot */
+    uint64_t busy_ns;
+    uint32_t index;
+} dispatch_slot_t;
+
+struct dispatch {
+    pthread_rwlock_t lock; /* shared by calls, exclusive for recreate */
+    pthread_mutex_t wait_lock;
+    pthread_cond_t wait_cond;
+    int waiters;
+    sgx_enclave_id_t eid;
+    uint64_t generation;
+    dispatch_recreate_t recreate;
+    void *recreate_ctx;
+
+    /* admission; slots == 0 when off */
+    const char *name;
+    uint32_t slots;
+    pthread_mutex_t slot_lock;
+    pthread_cond_t slot_cond;
+    uint32_t queued;
+    uint32_t free_top;
+    uint32_t free_slots[DISPATCH_MAX_SLOTS];
+    dispatch_slot_t slot[DISPATCH_MAX_SLOTS];
+};
+
+/* recreate may be NULL, in which case a lost enclave stays lost. Returns 0
+ * or -1. */
+int dispatch_init(dispatch_t *d, sgx_enclave_id_t eid, dispatch_recreate_t recreate, void *ctx);
+void dispatch_destroy(dispatch_t *d);
+
+/* Turns on admission with `slots` slots (the enclave's TCSNum). Call once,
+ * before the dispatcher is shared. name labels the per-slot metrics; give
+ * it to one dispatcher per process, NULL for the others. Returns 0 or -1. */
+int dispatch_admission(dispatch_t *d, const char *name, uint32_t slots);
+
+/* Points the dispatcher at an enclave recreated outside of it. */
+void dispatch_rebind(dispatch_t *d, sgx_enclave_id_t eid);
+
+sgx_status_t dispatch_call(dispatch_t *d, dispatch_fn_t fn, void *arg, unsigned flags);
+
+/* Current enclave id; changes after a recreate. */
+sgx_enclave_id_t dispatch_eid(dispatch_t *d);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_APP_DISPATCH_H_ */
@@ -0,0 +1,175 @@
+#include "enclave_pool.h"
+#include "metrics.h"
+
+#include <string.h>
+#include <time.h>
+#include "sgx_urts.h"
+
+/* Sleeps on fill_cond for ns at most; lock held. */
+static void enclave_pool_backoff(enclave_pool_t *p, uint64_t ns) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns += (uint64_t) ts.tv_nsec;
+    ts.tv_sec += (time_t) (ns / 1000000000ull);
+    ts.tv_nsec = (long) (ns % 1000000000ull);
+    pthread_cond_timedwait(&p->fill_cond, &p->lock, &ts);
+}
+
+static void *enclave_pool_fill(void *arg) {
+    enclave_pool_t *p = (enclave_pool_t *) arg;
+    uint64_t backoff = ENCLAVE_POOL_BACKOFF_MIN_NS;
+    sgx_enclave_id_t eid = 0;
+    sgx_status_t ret;
+    uint64_t generation;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop) {
+        if (p->ready == p->size) {
+            pthread_cond_wait(&p->fill_cond, &p->lock);
+            continue;
+        }
+        generation = p->generation;
+        pthread_mutex_unlock(&p->lock);
+        ret = p->create(&eid, p->create_ctx);
+        pthread_mutex_lock(&p->lock);
+
+        if (generation != p->generation) {
+            /* started before a loss; takers keep waiting for the next one */
+            if (ret == SGX_SUCCESS) {
+                pthread_mutex_unlock(&p->lock);
+                sgx_destroy_enclave(eid);
+                pthread_mutex_lock(&p->lock);
+            }
+            continue;
+        }
+        p->attempts++;
+        p->last_error = ret;
+        pthread_cond_broadcast(&p->ready_cond);
+        if (ret == SGX_SUCCESS) {
+            p->spare[p->ready++] = eid;
+            metrics_gauge_add(METRIC_ENCLAVE_POOL_READY, 1);
+            backoff = ENCLAVE_POOL_BACKOFF_MIN_NS;
+            continue;
+        }
+        metrics_add(METRIC_ENCLAVE_POOL_FAILURES, 1);
+        /* a taker with nothing to take cuts this short */
+        if (!p->stop)
+            enclave_pool_backoff(p, backoff);
+        backoff = backoff * 2 < ENCLAVE_POOL_BACKOFF_MAX_NS ? backoff * 2
+                                                             : ENCLAVE_POOL_BACKOFF_MAX_NS;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int enclave_pool_init(enclave_pool_t *p, uint32_t size, enclave_pool_create_t create, void *ctx) {
+    pthread_condattr_t cattr;
+    int rc;
+
+    if (size == 0 || size > ENCLAVE_POOL_MAX || create == NULL)
+        return -1;
+    memset(p, 0, sizeof *p);
+    p->size = size;
+    p->create = create;
+    p->create_ctx = ctx;
+    p->last_error = SGX_SUCCESS;
+
+    if (pthread_mutex_init(&p->lock, NULL) != 0)
+        return -1;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    rc = pthread_cond_init(&p->fill_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    if (rc != 0) {
+        pthread_mutex_destroy(&p->lock);
+        return -1;
+    }
+    if (pthread_cond_init(&p->ready_cond, NULL) != 0) {
+        pthread_cond_destroy(&p->fill_cond);
+        pthread_mutex_destroy(&p->lock);
+        return -1;
+    }
+    if (pthread_create(&p->filler, NULL, enclave_pool_fill, p) != 0) {
+        pthread_cond_destroy(&p->ready_cond);
+        pthread_cond_destroy(&p->fill_cond);
+        pthread_mutex_destroy(&p->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void enclave_pool_destroy(enclave_pool_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->fill_cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->filler, NULL);
+
+    while (p->ready) {
+        sgx_destroy_enclave(p->spare[--p->ready]);
+        metrics_gauge_add(METRIC_ENCLAVE_POOL_READY, -1);
+    }
+    pthread_cond_destroy(&p->ready_cond);
+    pthread_cond_destroy(&p->fill_cond);
+    pthread_mutex_destroy(&p->lock);
+}
+
+sgx_status_t enclave_pool_take(enclave_pool_t *p, sgx_enclave_id_t *eid) {
+    uint64_t t0 = metrics_now_ns(), attempts;
+    sgx_status_t ret = SGX_SUCCESS;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->ready == 0) {
+        metrics_add(METRIC_ENCLAVE_POOL_EMPTY, 1);
+        attempts = p->attempts;
+        pthread_cond_signal(&p->fill_cond);
+        while (p->ready == 0 && !p->stop) {
+            if (p->attempts != attempts) {
+                if (p->last_error != SGX_SUCCESS)
+                    break;
+                attempts = p->attempts; /* another taker got that one */
+            }
+            pthread_cond_wait(&p->ready_cond, &p->lock);
+        }
+        if (p->ready == 0)
+            ret = p->stop ? SGX_ERROR_UNEXPECTED : p->last_error;
+    }
+    if (ret == SGX_SUCCESS) {
+        /* the newest spare is the likeliest to still be in the EPC */
+        *eid = p->spare[--p->ready];
+        metrics_gauge_add(METRIC_ENCLAVE_POOL_READY, -1);
+        metrics_add(METRIC_ENCLAVE_POOL_TAKES, 1);
+        pthread_cond_signal(&p->fill_cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    metrics_record(METRIC_ENCLAVE_POOL_WAIT_NS, metrics_now_ns() - t0);
+    return ret;
+}
+
+void enclave_pool_invalidate(enclave_pool_t *p) {
+    sgx_enclave_id_t stale[ENCLAVE_POOL_MAX];
+    uint32_t n, i;
+
+    pthread_mutex_lock(&p->lock);
+    p->generation++;
+    n = p->ready;
+    memcpy(stale, p->spare, n * sizeof stale[0]);
+    p->ready = 0;
+    metrics_gauge_add(METRIC_ENCLAVE_POOL_READY, -(int64_t) n);
+    /* refill now, even from the middle of a backoff */
+    pthread_cond_signal(&p->fill_cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 0; i < n; ++i)
+        sgx_destroy_enclave(stale[i]);
+}
+
+uint32_t enclave_pool_ready(enclave_pool_t *p) {
+    uint32_t ready;
+
+    pthread_mutex_lock(&p->lock);
+    ready = p->ready;
+    pthread_mutex_unlock(&p->lock);
+    return ready;
+}
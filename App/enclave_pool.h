@@ -0,0 +1,86 @@
+#ifndef _APP_ENCLAVE_POOL_H_
+#define _APP_ENCLAVE_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sgx_eid.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Pool of spare enclaves.
+ *
+ * Creating an enclave takes from milliseconds to seconds, most of it in
+ * EADD/EEXTEND (App/startup_prof.h). The pool keeps up to `size` enclaves
+ * that are already created and set up. A filler thread makes them, off the
+ * critical path, and makes a new one each time one is taken. Replacing a
+ * lost enclave, or adding one under load, is then a matter of taking a
+ * spare.
+ *
+ * The create callback does everything a spare needs before it can serve:
+ * creation, per-enclave setup and, for enclaves that attest, attestation.
+ * It runs only on the filler thread, one creation at a time. When it
+ * fails, the filler retries with a backoff from ENCLAVE_POOL_BACKOFF_MIN_NS
+ * to ENCLAVE_POOL_BACKOFF_MAX_NS.
+ *
+ * SGX_ERROR_ENCLAVE_LOST usually means a power transition, which takes the
+ * spares down with the enclave they were to replace. The owner then calls
+ * enclave_pool_invalidate before taking a spare. That destroys the ready
+ * spares and moves the pool to a new generation; a creation that started
+ * in an older generation is destroyed when it finishes instead of being
+ * handed out.
+ *
+ * The ready count, takes, empty takes and failed creations go to the
+ * metrics registry (Include/metrics.h). */
+
+#define ENCLAVE_POOL_MAX 8
+#define ENCLAVE_POOL_BACKOFF_MIN_NS 100000000ull
+#define ENCLAVE_POOL_BACKOFF_MAX_NS 10000000000ull
+
+/* Creates and sets up one enclave in *eid. */
+typedef sgx_status_t (*enclave_pool_create_t)(sgx_enclave_id_t *eid, void *ctx);
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t fill_cond;  /* to the filler: a spare was taken, or stop */
+    pthread_cond_t ready_cond; /* to takers: a creation finished */
+    pthread_t filler;
+    int stop;
+    uint32_t size;
+    uint32_t ready;
+    sgx_enclave_id_t spare[ENCLAVE_POOL_MAX];
+    uint64_t generation; /* bumped by enclave_pool_invalidate */
+    uint64_t attempts; /* finished creations, good or not */
+    sgx_status_t last_error;
+    enclave_pool_create_t create;
+    void *create_ctx;
+} enclave_pool_t;
+
+/* Starts the filler for a pool of `size` spares, 1 to ENCLAVE_POOL_MAX.
+ * Returns 0 or -1. */
+int enclave_pool_init(enclave_pool_t *p, uint32_t size, enclave_pool_create_t create, void *ctx);
+
+/* Stops the filler and destroys the spares. Takers must be gone. */
+void enclave_pool_destroy(enclave_pool_t *p);
+
+/* Takes a spare into *eid, the one made last. With none ready, waits for
+ * the creation under way and returns its error if it fails. The enclave is
+ * the caller's to destroy. */
+sgx_status_t enclave_pool_take(enclave_pool_t *p, sgx_enclave_id_t *eid);
+
+/* Destroys every spare, and discards the creation under way when it
+ * finishes: they were made before an enclave loss and are presumed lost
+ * too. The filler starts over at once. */
+void enclave_pool_invalidate(enclave_pool_t *p);
+
+/* Spares ready now. */
+uint32_t enclave_pool_ready(enclave_pool_t *p);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_APP_ENCLAVE_POOL_H_ */
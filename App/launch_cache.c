@@ -0,0 +1,91 @@
+#include "launch_cache.h"
+#include "scan_bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LAUNCH_CACHE_CHUNK 16384 /* a multiple of 8 */
+
+/* Reads up to len bytes; fewer only at end of file. */
+static ssize_t launch_read_full(int fd, uint8_t *buf, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += (size_t) n;
+    }
+    return (ssize_t) done;
+}
+
+/* SCAN_HASH and size of the file at path; 0 or -1. */
+static int launch_image_id(const char *path, uint64_t *size, uint64_t *hash) {
+    uint8_t buf[LAUNCH_CACHE_CHUNK];
+    uint64_t h = 0, w;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    *size = 0;
+    while ((n = launch_read_full(fd, buf, sizeof buf)) > 0) {
+        for (ssize_t i = 0; i < n; i += 8) {
+            w = 0;
+            memcpy(&w, buf + i, n - i < 8 ? (size_t) (n - i) : 8);
+            h = scan_p61_reduce(scan_p61_mul(h, SCAN_HASH_KEY) + scan_p61_reduce(w));
+        }
+        *size += (uint64_t) n;
+        if (n < (ssize_t) sizeof buf)
+            break;
+    }
+    close(fd);
+    *hash = h;
+    return n < 0 ? -1 : 0;
+}
+
+int launch_cache_load(const char *path, const char *image, launch_cache_t *c) {
+    launch_cache_t disk;
+    int fd, valid = 0;
+
+    memset(c, 0, sizeof *c);
+    c->magic = LAUNCH_CACHE_MAGIC;
+    c->version = LAUNCH_CACHE_VERSION;
+    if (launch_image_id(image, &c->image_size, &c->image_hash) != 0)
+        return -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (launch_read_full(fd, (uint8_t *) &disk, sizeof disk) == (ssize_t) sizeof disk &&
+        disk.magic == LAUNCH_CACHE_MAGIC && disk.version == LAUNCH_CACHE_VERSION &&
+        disk.image_size == c->image_size && disk.image_hash == c->image_hash) {
+        *c = disk;
+        valid = 1;
+    }
+    close(fd);
+    return valid;
+}
+
+int launch_cache_store(const char *path, const launch_cache_t *c) {
+    char tmp[FILENAME_MAX + 8];
+    int fd, ret = 0;
+
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return -1;
+    if (write(fd, c, sizeof *c) != (ssize_t) sizeof *c || fsync(fd) != 0)
+        ret = -1;
+    close(fd);
+    if (ret == 0 && rename(tmp, path) != 0)
+        ret = -1;
+    if (ret != 0)
+        unlink(tmp);
+    return ret;
+}
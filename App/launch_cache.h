@@ -0,0 +1,49 @@
+#ifndef _APP_LAUNCH_CACHE_H_
+#define _APP_LAUNCH_CACHE_H_
+
+#include <stdint.h>
+
+#include "sgx_urts.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Startup cache, kept between runs in TOKEN_FILENAME.
+ *
+ * It holds the launch token from the last sgx_create_enclave. Passing it back
+ * lets the loader skip asking the AESM for a new token. Launch control
+ * (FLC) platforms do not use the token, so there the cache only records
+ * timings. The token is tied to the image it was issued for: the cache
+ * records the image's size and SCAN_HASH (Include/scan_bench.h) and is
+ * ignored when either differs. A stale token only costs the AESM round
+ * trip, so a non-cryptographic hash is enough.
+ *
+ * cold_ns is the creation time of the last run without a usable cache, so
+ * a warm run can report both. */
+
+#define LAUNCH_CACHE_MAGIC 0x4e4b544c /* "LTKN" */
+#define LAUNCH_CACHE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t image_size;
+    uint64_t image_hash;
+    uint64_t cold_ns;
+    sgx_launch_token_t token;
+} launch_cache_t;
+
+/* Fills c from the cache at path, for the image at `image`. Returns 1 when
+ * the cache matches the image, 0 when it does not (c then has the image's
+ * identity and an empty token), -1 when the image cannot be read. */
+int launch_cache_load(const char *path, const char *image, launch_cache_t *c);
+
+/* Replaces the cache at path atomically; 0 or -1. */
+int launch_cache_store(const char *path, const launch_cache_t *c);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_APP_LAUNCH_CACHE_H_ */
@@ -0,0 +1,492 @@
+#include "metrics.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define METRICS_HALF (1u << (METRICS_HIST_SUB_BITS - 1))
+/* Upper bound on how long the exporter takes to notice metrics_stop. */
+#define METRICS_POLL_MAX_MS 100
+
+typedef struct {
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} metrics_hist_t;
+
+/* Written only by the owning thread, read by anyone. */
+typedef struct metrics_block {
+    struct metrics_block *next;
+    int owned;
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    metrics_hist_t hist[METRIC_HIST_COUNT];
+} metrics_block_t;
+
+static metrics_block_t *metrics_blocks; /* only ever pushed to */
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+static pthread_key_t metrics_key;
+static __thread metrics_block_t *metrics_tls;
+static int64_t metrics_gauges[METRIC_GAUGE_COUNT];
+
+/* Exporter state, under metrics_lock. */
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_trusted_fn metrics_trusted;
+static uint64_t metrics_trusted_vals[METRIC_T_COUNT];
+static int metrics_trusted_up;
+static uint64_t metrics_prev[METRIC_COUNTER_COUNT], metrics_trusted_prev[METRIC_T_COUNT];
+static double metrics_rate[METRIC_COUNTER_COUNT], metrics_trusted_rate[METRIC_T_COUNT];
+static uint64_t metrics_prev_ns;
+static metrics_writer_fn metrics_writers[METRICS_MAX_WRITERS];
+static void *metrics_writer_ctx[METRICS_MAX_WRITERS];
+
+static pthread_t metrics_thread;
+static int metrics_running;
+static int metrics_listen_fd = -1;
+static uint64_t metrics_interval_ns;
+static char metrics_file[FILENAME_MAX];
+static char metrics_socket[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+#define METRICS_X_NAME(id, name) name,
+static const char *const metrics_counter_names[] = { METRICS_COUNTERS(METRICS_X_NAME) };
+static const char *const metrics_gauge_names[] = { METRICS_GAUGES(METRICS_X_NAME) };
+static const char *const metrics_hist_names[] = { METRICS_HISTOGRAMS(METRICS_X_NAME) };
+static const char *const metrics_trusted_names[] = { METRICS_TRUSTED_COUNTERS(METRICS_X_NAME) };
+#undef METRICS_X_NAME
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void metrics_release(void *p) {
+    __atomic_store_n(&((metrics_block_t *) p)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void metrics_key_init(void) {
+    pthread_key_create(&metrics_key, metrics_release);
+}
+
+/* Slow path of a thread's first update: adopt the block of a thread that
+ * has exited, or push a new one. */
+static metrics_block_t *metrics_block_slow(void) {
+    metrics_block_t *b;
+    int unowned;
+
+    pthread_once(&metrics_once, metrics_key_init);
+    for (b = __atomic_load_n(&metrics_blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+        unowned = 0;
+        if (__atomic_compare_exchange_n(&b->owned, &unowned, 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+    if (b == NULL) {
+        b = (metrics_block_t *) calloc(1, sizeof *b);
+        if (b == NULL)
+            return NULL;
+        b->owned = 1;
+        b->next = __atomic_load_n(&metrics_blocks, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&metrics_blocks, &b->next, b, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(metrics_key, b);
+    return metrics_tls = b;
+}
+
+static inline metrics_block_t *metrics_block(void) {
+    metrics_block_t *b = metrics_tls;
+    return __builtin_expect(b != NULL, 1) ? b : metrics_block_slow();
+}
+
+/* Single writer: a load and a store, never torn on x86-64. */
+static inline void metrics_bump(uint64_t *p, uint64_t n) {
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t metrics_bucket(uint64_t v) {
+    uint32_t shift;
+
+    if (v < 2 * METRICS_HALF)
+        return (uint32_t) v;
+    if (v >> METRICS_HIST_MAX_BITS)
+        return METRICS_HIST_BUCKETS - 1;
+    shift = 63 - __builtin_clzll(v) - (METRICS_HIST_SUB_BITS - 1);
+    return shift * METRICS_HALF + (uint32_t) (v >> shift);
+}
+
+/* Highest value that maps to bucket idx. */
+static uint64_t metrics_bucket_value(uint32_t idx) {
+    uint32_t shift;
+
+    if (idx < 2 * METRICS_HALF)
+        return idx;
+    shift = idx / METRICS_HALF - 1;
+    return ((uint64_t) (idx % METRICS_HALF + METRICS_HALF + 1) << shift) - 1;
+}
+
+void metrics_add(uint32_t counter, uint64_t n) {
+    metrics_block_t *b;
+
+    if (counter >= METRIC_COUNTER_COUNT || (b = metrics_block()) == NULL)
+        return;
+    metrics_bump(&b->counters[counter], n);
+}
+
+void metrics_record(uint32_t hist, uint64_t value) {
+    metrics_block_t *b;
+    metrics_hist_t *h;
+
+    if (hist >= METRIC_HIST_COUNT || (b = metrics_block()) == NULL)
+        return;
+    h = &b->hist[hist];
+    metrics_bump(&h->buckets[metrics_bucket(value)], 1);
+    metrics_bump(&h->sum, value);
+    if (value > h->max)
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_add(uint32_t gauge, int64_t delta) {
+    if (gauge < METRIC_GAUGE_COUNT)
+        __atomic_add_fetch(&metrics_gauges[gauge], delta, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_set(uint32_t gauge, int64_t value) {
+    if (gauge < METRIC_GAUGE_COUNT)
+        __atomic_store_n(&metrics_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+void metrics_ecall_done(uint64_t start_ns, uint64_t bytes) {
+    metrics_add(METRIC_ECALLS, 1);
+    metrics_add(METRIC_ECALL_BYTES, bytes);
+    metrics_record(METRIC_ECALL_NS, metrics_now_ns() - start_ns);
+}
+
+int metrics_add_writer(metrics_writer_fn writer, void *ctx) {
+    int i, rc = -1;
+
+    pthread_mutex_lock(&metrics_lock);
+    for (i = 0; i < METRICS_MAX_WRITERS; ++i) {
+        if (metrics_writers[i] == NULL) {
+            metrics_writers[i] = writer;
+            metrics_writer_ctx[i] = ctx;
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    return rc;
+}
+
+void metrics_remove_writer(metrics_writer_fn writer, void *ctx) {
+    pthread_mutex_lock(&metrics_lock);
+    for (int i = 0; i < METRICS_MAX_WRITERS; ++i) {
+        if (metrics_writers[i] == writer && metrics_writer_ctx[i] == ctx) {
+            metrics_writers[i] = NULL;
+            metrics_writer_ctx[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+static void metrics_emit(void *out, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf((FILE *) out, fmt, ap);
+    va_end(ap);
+}
+
+static void metrics_sum_counters(uint64_t *out) {
+    metrics_block_t *b;
+
+    memset(out, 0, METRIC_COUNTER_COUNT * sizeof *out);
+    for (b = __atomic_load_n(&metrics_blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next)
+        for (int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+            out[i] += __atomic_load_n(&b->counters[i], __ATOMIC_RELAXED);
+}
+
+static void metrics_sum_hist(uint32_t hist, metrics_hist_t *out) {
+    metrics_block_t *b;
+    const metrics_hist_t *h;
+    uint64_t max;
+
+    memset(out, 0, sizeof *out);
+    for (b = __atomic_load_n(&metrics_blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+        h = &b->hist[hist];
+        for (uint32_t i = 0; i < METRICS_HIST_BUCKETS; ++i)
+            out->buckets[i] += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        out->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+        max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+        if (max > out->max)
+            out->max = max;
+    }
+    /* the buckets, not the per-thread counts, so quantiles add up */
+    for (uint32_t i = 0; i < METRICS_HIST_BUCKETS; ++i)
+        out->count += out->buckets[i];
+}
+
+static uint64_t metrics_quantile(const metrics_hist_t *h, double q) {
+    uint64_t rank = (uint64_t) (q * (double) h->count + 0.5), seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+    for (uint32_t i = 0; i < METRICS_HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return metrics_bucket_value(i) < h->max ? metrics_bucket_value(i) : h->max;
+    }
+    return h->max;
+}
+
+uint64_t metrics_hist_quantiles(uint32_t hist, const double *q, uint64_t *out, uint32_t n) {
+    metrics_hist_t *h;
+    uint64_t count;
+
+    memset(out, 0, n * sizeof *out);
+    if (hist >= METRIC_HIST_COUNT || (h = (metrics_hist_t *) malloc(sizeof *h)) == NULL)
+        return 0;
+    metrics_sum_hist(hist, h);
+    count = h->count;
+    for (uint32_t i = 0; count != 0 && i < n; ++i)
+        out[i] = metrics_quantile(h, q[i]);
+    free(h);
+    return count;
+}
+
+/* Pulls the enclave counters and updates the per-second rates. Called once
+ * per interval with metrics_lock held. */
+static void metrics_tick(void) {
+    uint64_t now = metrics_now_ns(), counters[METRIC_COUNTER_COUNT];
+    uint64_t vals[METRIC_T_COUNT];
+    double dt = (double) (now - metrics_prev_ns) * 1e-9;
+    int i;
+
+    metrics_sum_counters(counters);
+    metrics_trusted_up = metrics_trusted != NULL && metrics_trusted(vals, METRIC_T_COUNT) == 0;
+    if (metrics_trusted_up)
+        memcpy(metrics_trusted_vals, vals, sizeof vals);
+    if (metrics_prev_ns != 0 && dt > 0) {
+        for (i = 0; i < METRIC_COUNTER_COUNT; ++i)
+            metrics_rate[i] = (double) (counters[i] - metrics_prev[i]) / dt;
+        for (i = 0; i < METRIC_T_COUNT; ++i)
+            metrics_trusted_rate[i] = metrics_trusted_vals[i] >= metrics_trusted_prev[i] ?
+                (double) (metrics_trusted_vals[i] - metrics_trusted_prev[i]) / dt : 0;
+    }
+    memcpy(metrics_prev, counters, sizeof counters);
+    memcpy(metrics_trusted_prev, metrics_trusted_vals, sizeof metrics_trusted_vals);
+    metrics_prev_ns = now;
+}
+
+/* Prometheus text format; called with metrics_lock held. */
+static int metrics_format(FILE *f, metrics_hist_t *h) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    int i;
+
+    metrics_sum_counters(counters);
+    for (i = 0; i < METRIC_COUNTER_COUNT; ++i)
+        fprintf(f, "# TYPE %s_total counter\n%s_total %llu\n%s_rate %.3f\n",
+                metrics_counter_names[i], metrics_counter_names[i],
+                (unsigned long long) counters[i], metrics_counter_names[i], metrics_rate[i]);
+    for (i = 0; i < METRIC_GAUGE_COUNT; ++i)
+        fprintf(f, "# TYPE %s gauge\n%s %lld\n", metrics_gauge_names[i], metrics_gauge_names[i],
+                (long long) __atomic_load_n(&metrics_gauges[i], __ATOMIC_RELAXED));
+    for (i = 0; i < METRIC_HIST_COUNT; ++i) {
+        metrics_sum_hist(i, h);
+        fprintf(f, "# TYPE %s summary\n", metrics_hist_names[i]);
+        for (size_t q = 0; q < sizeof quantiles / sizeof quantiles[0]; ++q)
+            fprintf(f, "%s{quantile=\"%g\"} %llu\n", metrics_hist_names[i], quantiles[q],
+                    (unsigned long long) (h->count ? metrics_quantile(h, quantiles[q]) : 0));
+        fprintf(f, "%s_sum %llu\n%s_count %llu\n%s_max %llu\n", metrics_hist_names[i],
+                (unsigned long long) h->sum, metrics_hist_names[i],
+                (unsigned long long) h->count, metrics_hist_names[i],
+                (unsigned long long) h->max);
+    }
+    fprintf(f, "enclave_up %d\n", metrics_trusted_up);
+    for (i = 0; i < METRIC_T_COUNT; ++i)
+        fprintf(f, "# TYPE enclave_%s_total counter\nenclave_%s_total %llu\nenclave_%s_rate %.3f\n",
+                metrics_trusted_names[i], metrics_trusted_names[i],
+                (unsigned long long) metrics_trusted_vals[i], metrics_trusted_names[i],
+                metrics_trusted_rate[i]);
+    for (i = 0; i < METRICS_MAX_WRITERS; ++i)
+        if (metrics_writers[i] != NULL)
+            metrics_writers[i](metrics_emit, f, metrics_writer_ctx[i]);
+    return ferror(f) ? -1 : 0;
+}
+
+/* Formats a snapshot into a malloc'd buffer. */
+static char *metrics_snapshot(size_t *len) {
+    metrics_hist_t *h = (metrics_hist_t *) malloc(sizeof *h);
+    char *buf = NULL;
+    FILE *f;
+    int rc;
+
+    *len = 0;
+    if (h == NULL || (f = open_memstream(&buf, len)) == NULL) {
+        free(h);
+        return NULL;
+    }
+    pthread_mutex_lock(&metrics_lock);
+    rc = metrics_format(f, h);
+    pthread_mutex_unlock(&metrics_lock);
+    if (fclose(f) != 0 || rc != 0) {
+        free(buf);
+        buf = NULL;
+    }
+    free(h);
+    return buf;
+}
+
+/* Readers never see a partial file: write a sibling and rename it over. */
+int metrics_write(const char *file) {
+    char tmp[FILENAME_MAX + 8], *buf;
+    size_t len;
+    FILE *f;
+    int rc = -1;
+
+    if ((size_t) snprintf(tmp, sizeof tmp, "%s.tmp", file) >= sizeof tmp ||
+        (buf = metrics_snapshot(&len)) == NULL)
+        return -1;
+    f = fopen(tmp, "w");
+    if (f != NULL) {
+        rc = fwrite(buf, 1, len, f) == len ? 0 : -1;
+        if (fclose(f) != 0)
+            rc = -1;
+        if (rc == 0 && rename(tmp, file) != 0)
+            rc = -1;
+        if (rc != 0)
+            unlink(tmp);
+    }
+    free(buf);
+    return rc;
+}
+
+static void metrics_serve(int fd) {
+    struct timeval tv = {1, 0};
+    size_t len, off = 0;
+    ssize_t n;
+    char *buf;
+
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    buf = metrics_snapshot(&len);
+    while (buf != NULL && off < len && (n = send(fd, buf + off, len - off, MSG_NOSIGNAL)) > 0)
+        off += (size_t) n;
+    free(buf);
+    close(fd);
+}
+
+static void *metrics_export(void *arg) {
+    struct pollfd pfd;
+    uint64_t now, next = 0;
+    int timeout, fd;
+
+    (void) arg;
+    while (__atomic_load_n(&metrics_running, __ATOMIC_ACQUIRE)) {
+        now = metrics_now_ns();
+        if (now >= next) {
+            pthread_mutex_lock(&metrics_lock);
+            metrics_tick();
+            pthread_mutex_unlock(&metrics_lock);
+            if (metrics_file[0])
+                metrics_write(metrics_file);
+            next = now + metrics_interval_ns;
+            continue;
+        }
+        timeout = (int) ((next - now + 999999) / 1000000);
+        if (timeout > METRICS_POLL_MAX_MS)
+            timeout = METRICS_POLL_MAX_MS;
+        pfd.fd = metrics_listen_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+            fd = accept(metrics_listen_fd, NULL, NULL);
+            if (fd >= 0)
+                metrics_serve(fd);
+        }
+    }
+    return NULL;
+}
+
+static int metrics_listen(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path); /* stale socket from a previous run */
+    if (bind(fd, (struct sockaddr *) &addr, sizeof addr) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void metrics_set_trusted(metrics_trusted_fn trusted) {
+    pthread_mutex_lock(&metrics_lock);
+    metrics_trusted = trusted;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+int metrics_start(const char *file, const char *socket_path, uint32_t interval_ms) {
+    if (metrics_running || (file == NULL && socket_path == NULL) ||
+        (file != NULL && strlen(file) >= sizeof metrics_file) ||
+        (socket_path != NULL && strlen(socket_path) >= sizeof metrics_socket))
+        return -1;
+
+    metrics_file[0] = metrics_socket[0] = '\0';
+    if (file != NULL)
+        strcpy(metrics_file, file);
+    if (socket_path != NULL) {
+        metrics_listen_fd = metrics_listen(socket_path);
+        if (metrics_listen_fd < 0)
+            return -1;
+        strcpy(metrics_socket, socket_path);
+    }
+    metrics_interval_ns = (uint64_t) (interval_ms ? interval_ms : METRICS_DEFAULT_INTERVAL_MS) *
+                          1000000ull;
+
+    metrics_running = 1;
+    if (pthread_create(&metrics_thread, NULL, metrics_export, NULL) != 0) {
+        metrics_running = 0;
+        if (metrics_listen_fd >= 0) {
+            close(metrics_listen_fd);
+            unlink(metrics_socket);
+            metrics_listen_fd = -1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Writes a final snapshot, with the enclave counters if a source is set. */
+void metrics_stop(void) {
+    if (!metrics_running)
+        return;
+    __atomic_store_n(&metrics_running, 0, __ATOMIC_RELEASE);
+    pthread_join(metrics_thread, NULL);
+
+    pthread_mutex_lock(&metrics_lock);
+    metrics_tick();
+    pthread_mutex_unlock(&metrics_lock);
+    if (metrics_file[0])
+        metrics_write(metrics_file);
+    if (metrics_listen_fd >= 0) {
+        close(metrics_listen_fd);
+        unlink(metrics_socket);
+        metrics_listen_fd = -1;
+    }
+}
@@ -60,6 +60,10 @@
 #include "sgx_uae_service.h"
 
 #include "service_provider.h"
+#include "trace.h"
+#include "metrics.h"
+#include "dispatch.h"
+#include "ra_dispatch.h"
 
 
 // Needed to calculate keys
@@ -194,29 +198,103 @@ void PRINT_ATTESTATION_SERVICE_RESPONSE(
     }
 }
 
-// This sample code doesn't have any recovery/retry mechanisms for the remote
-// attestation. Since the enclave can be lost due S3 transitions, apps
-// susceptible to S3 transitions should have logic to restart attestation in
-// these scenarios.
 #define _T(x) x
 
+// Arguments of the ecalls made through dispatch_call.
+struct ra_crypt_call {
+    uint8_t *data;
+    int data_len;
+    uint8_t *output;
+    uint8_t *mac;
+    sgx_status_t status;
+};
+
+struct ra_ctx_call {
+    sgx_status_t status;
+    sgx_ra_context_t context;
+};
+
+struct ra_msg1_call {
+    sgx_ra_context_t context;
+    sgx_ra_msg1_t *msg1;
+};
+
+struct ra_msg2_call {
+    sgx_ra_context_t context;
+    const sgx_ra_msg2_t *msg2;
+    uint32_t msg2_size;
+    sgx_ra_msg3_t **msg3;
+    uint32_t *msg3_size;
+};
+
+struct ra_result_call {
+    sgx_status_t status;
+    sgx_ra_context_t context;
+    uint8_t *data;
+    uint32_t data_len;
+    uint8_t *mac;
+};
+
+static sgx_status_t ra_encrypt_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_crypt_call *c = (ra_crypt_call *)arg;
+    return enclave_encrypt(eid, &c->status, c->data, c->data_len, c->output, c->mac);
+}
 
-int ra_decrypt(uint8_t *data, int data_len, uint8_t *output, uint8_t *mac, sgx_enclave_id_t enclave_id, FILE *OUTPUT) {
-    int ret = 0;
-    sgx_status_t status = SGX_SUCCESS;
-    int busy_retry_time;
+static sgx_status_t ra_decrypt_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_crypt_call *c = (ra_crypt_call *)arg;
+    return enclave_decrypt(eid, &c->status, c->data, c->data_len, c->output, c->mac);
+}
 
-    busy_retry_time = 4;
-    do
-    {
-        ret = enclave_decrypt(
-                enclave_id,
-                &status,
-                data,
-                data_len,
-                output,
-                mac);
-    } while (SGX_ERROR_BUSY == ret && busy_retry_time--);
+static sgx_status_t ra_init_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_ctx_call *c = (ra_ctx_call *)arg;
+    return enclave_init_ra(eid, &c->status, false, &c->context);
+}
+
+static sgx_status_t ra_close_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_ctx_call *c = (ra_ctx_call *)arg;
+    return enclave_ra_close(eid, &c->status, c->context);
+}
+
+static sgx_status_t ra_get_msg1_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_msg1_call *c = (ra_msg1_call *)arg;
+    return sgx_ra_get_msg1(c->context, eid, sgx_ra_get_ga, c->msg1);
+}
+
+static sgx_status_t ra_proc_msg2_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_msg2_call *c = (ra_msg2_call *)arg;
+    return sgx_ra_proc_msg2(c->context, eid, sgx_ra_proc_msg2_trusted, sgx_ra_get_msg3_trusted,
+                            c->msg2, c->msg2_size, c->msg3, c->msg3_size);
+}
+
+static sgx_status_t ra_verify_mac_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_result_call *c = (ra_result_call *)arg;
+    return verify_att_result_mac(eid, &c->status, c->context, c->data, c->data_len,
+                                 c->mac, sizeof(sgx_mac_t));
+}
+
+static sgx_status_t ra_put_secret_ecall(sgx_enclave_id_t eid, void *arg)
+{
+    ra_result_call *c = (ra_result_call *)arg;
+    return put_secret_data(eid, &c->status, c->context, c->data, c->data_len, c->mac);
+}
+
+
+int ra_decrypt(uint8_t *data, int data_len, uint8_t *output, uint8_t *mac, sgx_enclave_id_t enclave_id, FILE *OUTPUT) {
+    ra_crypt_call call = {data, data_len, output, mac, SGX_SUCCESS};
+    uint64_t t0 = metrics_now_ns();
+    int ret;
+
+    TRACE_BEGIN("ecall", "enclave_decrypt");
+    ret = dispatch_call(ra_dispatch(enclave_id), ra_decrypt_ecall, &call, RA_CRYPT_DISPATCH_FLAGS);
+    metrics_ecall_done(t0, 2 * (uint64_t) data_len + sizeof(sgx_mac_t));
+    TRACE_END("ecall", "enclave_decrypt");
     if(ret != SGX_SUCCESS) {
         fprintf(OUTPUT, "\nError: INTERNAL ERROR - memcpy failed in [%s]-[%d].",
                 __FUNCTION__, __LINE__);
@@ -228,20 +306,14 @@ CLEANUP:
 }
 
 int ra_encrypt(uint8_t *data, int data_len, uint8_t *output, uint8_t *mac, sgx_enclave_id_t enclave_id, FILE *OUTPUT){
-    int ret = 0;
-    sgx_status_t status = SGX_SUCCESS;
-
-    int busy_retry_time = 4;
-    do
-    {
-        ret = enclave_encrypt(
-                enclave_id,
-                &status,
-                data,
-                data_len,
-                output,
-                mac);
-    } while (SGX_ERROR_BUSY == ret && busy_retry_time--);
+    ra_crypt_call call = {data, data_len, output, mac, SGX_SUCCESS};
+    uint64_t t0 = metrics_now_ns();
+    int ret;
+
+    TRACE_BEGIN("ecall", "enclave_encrypt");
+    ret = dispatch_call(ra_dispatch(enclave_id), ra_encrypt_ecall, &call, RA_CRYPT_DISPATCH_FLAGS);
+    metrics_ecall_done(t0, 2 * (uint64_t) data_len + sizeof(sgx_mac_t));
+    TRACE_END("ecall", "enclave_encrypt");
     if(ret != SGX_SUCCESS) {
         fprintf(OUTPUT, "\nError: INTERNAL ERROR - memcpy failed in [%s]-[%d].",
                 __FUNCTION__, __LINE__);
@@ -261,8 +333,7 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
     ra_samp_response_header_t *p_msg2_full = NULL;
     sgx_ra_msg3_t *p_msg3 = NULL;
     ra_samp_response_header_t *p_att_result_msg_full = NULL;
-    int enclave_lost_retry_time = 1;
-    int busy_retry_time = 4;
+    dispatch_t *ra_d = ra_dispatch(enclave_id);
     sgx_ra_context_t context = INT_MAX;
     sgx_status_t status = SGX_SUCCESS;
     ra_samp_request_header_t *p_msg3_full = NULL;
@@ -271,12 +342,26 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
     int32_t verification_samples = sizeof(msg1_samples) / sizeof(msg1_samples[0]);
 
     FILE *OUTPUT = stdout;
+    TRACE_SCOPE("ra", "remote_attestation");
+    uint64_t ra_start_ns = metrics_now_ns();
+
+    // One "ra" span per protocol message; the previous one ends when the
+    // next begins, and the last at CLEANUP.
+    const char *ra_phase = NULL;
+#define RA_PHASE(name) do {                         \
+        if (ra_phase != NULL)                       \
+            TRACE_END("ra", ra_phase);              \
+        ra_phase = (name);                          \
+        if (ra_phase != NULL)                       \
+            TRACE_BEGIN("ra", ra_phase);            \
+    } while (0)
 
 #define VERIFICATION_INDEX_IS_VALID() (verify_index > 0 && \
                                        verify_index <= verification_samples)
 #define GET_VERIFICATION_ARRAY_INDEX() (verify_index - 1)
 
     // Preparation for remote attestation by configuring extended epid group id.
+    RA_PHASE("msg0");
     {
         uint32_t extended_epid_group_id = 0;
         ret = sgx_get_extended_epid_group_id(&extended_epid_group_id);
@@ -285,12 +370,14 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
             ret = -1;
             fprintf(OUTPUT, "\nError, call sgx_get_extended_epid_group_id fail [%s].",
                     __FUNCTION__);
+            RA_PHASE(NULL);
+            metrics_add(METRIC_RA_FAILURES, 1);
             return ret;
         }
         fprintf(OUTPUT, "\nCall sgx_get_extended_epid_group_id success.");
 
         p_msg0_full = (ra_samp_request_header_t *)
-                malloc(sizeof(ra_samp_request_header_t) + sizeof(uint32_t));
+                ra_msg_get(sizeof(ra_samp_request_header_t) + sizeof(uint32_t));
         if (NULL == p_msg0_full)
         {
             ret = -1;
@@ -329,16 +416,15 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
     // app or if the ISV app detects it doesn't have the credentials
     // (shared secret) from a previous attestation required for secure
     // communication with the server.
+    RA_PHASE("msg1");
     {
         // ISV application creates the ISV enclave.
-        do
-        {
-            ret = enclave_init_ra(enclave_id,
-                                  &status,
-                                  false,
-                                  &context);
-            //Ideally, this check would be around the full attestation flow.
-        } while (SGX_ERROR_ENCLAVE_LOST == ret && enclave_lost_retry_time--);
+        ra_ctx_call init = {SGX_SUCCESS, INT_MAX};
+        TRACE_BEGIN("ecall", "enclave_init_ra");
+        ret = dispatch_call(ra_d, ra_init_ecall, &init, RA_INIT_DISPATCH_FLAGS);
+        TRACE_END("ecall", "enclave_init_ra");
+        status = init.status;
+        context = init.context;
 
         if (SGX_SUCCESS != ret || status)
         {
@@ -347,11 +433,12 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
                     __FUNCTION__);
             goto CLEANUP;
         }
+        metrics_gauge_add(METRIC_RA_SESSIONS_ACTIVE, 1);
         fprintf(OUTPUT, "\nCall enclave_init_ra success.");
 
         // isv application call uke sgx_ra_get_msg1
         p_msg1_full = (ra_samp_request_header_t *)
-                malloc(sizeof(ra_samp_request_header_t) + sizeof(sgx_ra_msg1_t));
+                ra_msg_get(sizeof(ra_samp_request_header_t) + sizeof(sgx_ra_msg1_t));
         if (NULL == p_msg1_full)
         {
             ret = -1;
@@ -359,15 +446,11 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
         }
         p_msg1_full->type = TYPE_RA_MSG1;
         p_msg1_full->size = sizeof(sgx_ra_msg1_t);
-        do
-        {
-            printf("retry time: %d\n", busy_retry_time);
-            ret = sgx_ra_get_msg1(context, enclave_id, sgx_ra_get_ga,
-                                  (sgx_ra_msg1_t *)((uint8_t *)p_msg1_full + sizeof(ra_samp_request_header_t)));
-            if (!(SGX_ERROR_BUSY == ret && busy_retry_time--))
-                break;
-            sleep(3); // Wait 3s between retries
-        } while (SGX_ERROR_BUSY == ret && busy_retry_time--);
+        ra_msg1_call msg1 = {context,
+                             (sgx_ra_msg1_t *)((uint8_t *)p_msg1_full + sizeof(ra_samp_request_header_t))};
+        TRACE_BEGIN("ecall", "sgx_ra_get_msg1");
+        ret = dispatch_call(ra_d, ra_get_msg1_ecall, &msg1, 0);
+        TRACE_END("ecall", "sgx_ra_get_msg1");
         if (SGX_SUCCESS != ret)
         {
             ret = -1;
@@ -400,13 +483,7 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
         // The ISV application sends msg1 to the SP to get msg2,
         // msg2 needs to be freed when no longer needed.
         // The ISV decides whether to use linkable or unlinkable signatures.
-        p_msg2_full = (ra_samp_response_header_t *)malloc(180);
-        memset(p_msg2_full, 0, 180);
-        if (NULL == p_msg2_full)
-        {
-            ret = -1;
-            goto CLEANUP;
-        }
+        // ra_network_send_receive receives msg2 into a pooled buffer.
         puts("\nHERE!!!");
         ret = ra_network_send_receive("http://SampleServiceProvider.intel.com/",
                                       p_msg1_full,
@@ -425,12 +502,12 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
                 fprintf(OUTPUT, "\nInstead, we will pretend we received the "
                                 "following MSG2 - \n");
 
-                SAFE_FREE(p_msg2_full);
+                ra_msg_put(p_msg2_full);
                 ra_samp_response_header_t *precomputed_msg2 =
                         (ra_samp_response_header_t *)msg2_samples[GET_VERIFICATION_ARRAY_INDEX()];
                 const size_t msg2_full_size = sizeof(ra_samp_response_header_t) + precomputed_msg2->size;
                 p_msg2_full =
-                        (ra_samp_response_header_t *)malloc(msg2_full_size);
+                        (ra_samp_response_header_t *)ra_msg_get(msg2_full_size);
                 if (NULL == p_msg2_full)
                 {
                     ret = -1;
@@ -451,6 +528,7 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
         {
             // Successfully sent msg1 and received a msg2 back.
             // Time now to check msg2.
+            RA_PHASE("msg2");
             if (TYPE_RA_MSG2 != p_msg2_full->type)
             {
 
@@ -530,20 +608,12 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
         }
         else
         {
-            busy_retry_time = 2;
             // The ISV app now calls uKE sgx_ra_proc_msg2,
             // The ISV app is responsible for freeing the returned p_msg3!!
-            do
-            {
-                ret = sgx_ra_proc_msg2(context,
-                                       enclave_id,
-                                       sgx_ra_proc_msg2_trusted,
-                                       sgx_ra_get_msg3_trusted,
-                                       p_msg2_body,
-                                       p_msg2_full->size,
-                                       &p_msg3,
-                                       &msg3_size);
-            } while (SGX_ERROR_BUSY == ret && busy_retry_time--);
+            ra_msg2_call msg2 = {context, p_msg2_body, p_msg2_full->size, &p_msg3, &msg3_size};
+            TRACE_BEGIN("ecall", "sgx_ra_proc_msg2");
+            ret = dispatch_call(ra_d, ra_proc_msg2_ecall, &msg2, 0);
+            TRACE_END("ecall", "sgx_ra_proc_msg2");
             if (!p_msg3)
             {
                 fprintf(OUTPUT, "\nError, call sgx_ra_proc_msg2 fail. "
@@ -569,7 +639,8 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
 
         PRINT_BYTE_ARRAY(OUTPUT, p_msg3, msg3_size);
 
-        p_msg3_full = (ra_samp_request_header_t *)malloc(
+        RA_PHASE("msg3");
+        p_msg3_full = (ra_samp_request_header_t *)ra_msg_get(
                 sizeof(ra_samp_request_header_t) + msg3_size);
         if (NULL == p_msg3_full)
         {
@@ -594,8 +665,6 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
         // demonstration.  Note that the attestation result message makes use
         // of both the MK for the MAC and the SK for the secret. These keys are
         // established from the SIGMA secure channel binding.
-        p_att_result_msg_full = (ra_samp_response_header_t *)malloc(180);
-        memset(p_msg2_full, 0, 180);
         ret = ra_network_send_receive("http://SampleServiceProvider.intel.com/",
                                       p_msg3_full,
                                       &p_att_result_msg_full,
@@ -662,13 +731,14 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
         // The format of the attestation result message is ISV specific.
         // This is a simple form for demonstration. In a real product,
         // the ISV may want to communicate more information.
-        ret = verify_att_result_mac(enclave_id,
-                                    &status,
-                                    context,
-                                    (uint8_t *)&p_att_result_msg_body->platform_info_blob,
-                                    sizeof(ias_platform_info_blob_t),
-                                    (uint8_t *)&p_att_result_msg_body->mac,
-                                    sizeof(sgx_mac_t));
+        ra_result_call verify = {SGX_SUCCESS, context,
+                                 (uint8_t *)&p_att_result_msg_body->platform_info_blob,
+                                 sizeof(ias_platform_info_blob_t),
+                                 (uint8_t *)&p_att_result_msg_body->mac};
+        TRACE_BEGIN("ecall", "verify_att_result_mac");
+        ret = dispatch_call(ra_d, ra_verify_mac_ecall, &verify, 0);
+        TRACE_END("ecall", "verify_att_result_mac");
+        status = verify.status;
         if ((SGX_SUCCESS != ret) ||
             (SGX_SUCCESS != status))
         {
@@ -717,12 +787,14 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
             PRINT_BYTE_ARRAY(OUTPUT, &p_att_result_msg_body->secret, 40);
             fprintf(OUTPUT, "\nthe context is:\n");
             PRINT_BYTE_ARRAY(OUTPUT, &context, sizeof(context));
-            ret = put_secret_data(enclave_id,
-                                  &status,
-                                  context,
-                                  p_att_result_msg_body->secret.payload,
-                                  p_att_result_msg_body->secret.payload_size,
-                                  p_att_result_msg_body->secret.payload_tag);
+            ra_result_call secret = {SGX_SUCCESS, context,
+                                     p_att_result_msg_body->secret.payload,
+                                     p_att_result_msg_body->secret.payload_size,
+                                     p_att_result_msg_body->secret.payload_tag};
+            TRACE_BEGIN("ecall", "put_secret_data");
+            ret = dispatch_call(ra_d, ra_put_secret_ecall, &secret, 0);
+            TRACE_END("ecall", "put_secret_data");
+            status = secret.status;
             if ((SGX_SUCCESS != ret) || (SGX_SUCCESS != status))
             {
                 fprintf(OUTPUT, "\nError, attestation result message secret "
@@ -745,12 +817,17 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
     }
 
     CLEANUP:
+    RA_PHASE(NULL);
     // Clean-up
     // Need to close the RA key state.
     if (INT_MAX != context)
     {
         int ret_save = ret;
-        ret = enclave_ra_close(enclave_id, &status, context);
+        ra_ctx_call close_call = {SGX_SUCCESS, context};
+        TRACE_BEGIN("ecall", "enclave_ra_close");
+        ret = dispatch_call(ra_d, ra_close_ecall, &close_call, 0);
+        TRACE_END("ecall", "enclave_ra_close");
+        status = close_call.status;
         if (SGX_SUCCESS != ret || status)
         {
             ret = -1;
@@ -764,7 +841,12 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
             ret = ret_save;
         }
         fprintf(OUTPUT, "\nCall enclave_ra_close success.");
+        metrics_gauge_add(METRIC_RA_SESSIONS_ACTIVE, -1);
     }
+    metrics_add(METRIC_RA_SESSIONS, 1);
+    if (ret != 0)
+        metrics_add(METRIC_RA_FAILURES, 1);
+    metrics_record(METRIC_RA_NS, metrics_now_ns() - ra_start_ns);
 
     ra_free_network_response_buffer(p_msg0_resp_full);
     ra_free_network_response_buffer(p_msg2_full);
@@ -774,11 +856,12 @@ int remote_attestation(sgx_enclave_id_t enclave_id, NetworkClient &client)
 
     // p_msg3 is malloc'd by the untrusted KE library. App needs to free.
     SAFE_FREE(p_msg3);
-    SAFE_FREE(p_msg3_full);
-    SAFE_FREE(p_msg1_full);
-    SAFE_FREE(p_msg0_full);
+    ra_msg_put(p_msg3_full);
+    ra_msg_put(p_msg1_full);
+    ra_msg_put(p_msg0_full);
     printf("\nExit ...\n");
     return ret;
+#undef RA_PHASE
 }
 
 void terminate(NetworkClient client) {
@@ -0,0 +1,78 @@
+#ifndef _APP_RA_DISPATCH_H_
+#define _APP_RA_DISPATCH_H_
+
+#include <pthread.h>
+
+#include "dispatch.h"
+
+/* The dispatcher behind the RA ecalls of App/ra.h.
+ *
+ * Ecalls go through ra_dispatcher (App/dispatch.h), which waits out a busy
+ * enclave with backoff instead of spinning. An application that can rebuild
+ * the ISV enclave after an S3 transition registers a recreate callback with
+ * ra_dispatch_init. Only enclave_init_ra is replayed on the new enclave.
+ * encrypt/decrypt use the session key and secret of the attestation, and the
+ * rest of the attestation depends on key exchange state; all of that died
+ * with the old enclave. Those calls return SGX_ERROR_ENCLAVE_LOST, and the
+ * caller has to attest again.
+ *
+ * Without ra_dispatch_init the first call binds the dispatcher to the
+ * enclave it was given, with no recreate. A call with a different enclave id
+ * than the previous one rebinds it, unless the dispatcher recreated the
+ * enclave itself and already points at that id. */
+
+/* enclave_init_ra starts from nothing, so a replay is safe. */
+#define RA_INIT_DISPATCH_FLAGS DISPATCH_IDEMPOTENT
+/* Not replayed: the session key is gone with the enclave. */
+#define RA_CRYPT_DISPATCH_FLAGS 0
+
+static dispatch_t ra_dispatcher;
+static int ra_dispatcher_ready;
+/* The enclave id the last caller passed in. */
+static sgx_enclave_id_t ra_dispatcher_caller_eid;
+static pthread_mutex_t ra_dispatcher_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int ra_dispatch_init_locked(sgx_enclave_id_t enclave_id, dispatch_recreate_t recreate,
+                                   void *ctx)
+{
+    int ret;
+
+    if (ra_dispatcher_ready)
+        return -1;
+    if ((ret = dispatch_init(&ra_dispatcher, enclave_id, recreate, ctx)) == 0) {
+        __atomic_store_n(&ra_dispatcher_caller_eid, enclave_id, __ATOMIC_RELAXED);
+        __atomic_store_n(&ra_dispatcher_ready, 1, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+int ra_dispatch_init(sgx_enclave_id_t enclave_id, dispatch_recreate_t recreate, void *ctx)
+{
+    int ret;
+
+    pthread_mutex_lock(&ra_dispatcher_lock);
+    ret = ra_dispatch_init_locked(enclave_id, recreate, ctx);
+    pthread_mutex_unlock(&ra_dispatcher_lock);
+    return ret;
+}
+
+static dispatch_t *ra_dispatch(sgx_enclave_id_t enclave_id)
+{
+    if (__atomic_load_n(&ra_dispatcher_ready, __ATOMIC_ACQUIRE) &&
+        __atomic_load_n(&ra_dispatcher_caller_eid, __ATOMIC_RELAXED) == enclave_id)
+        return &ra_dispatcher;
+
+    pthread_mutex_lock(&ra_dispatcher_lock);
+    if (!ra_dispatcher_ready) {
+        ra_dispatch_init_locked(enclave_id, NULL, NULL);
+    } else if (ra_dispatcher_caller_eid != enclave_id) {
+        /* After a recreate the dispatcher is already on the caller's new id. */
+        if (dispatch_eid(&ra_dispatcher) != enclave_id)
+            dispatch_rebind(&ra_dispatcher, enclave_id);
+        __atomic_store_n(&ra_dispatcher_caller_eid, enclave_id, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ra_dispatcher_lock);
+    return &ra_dispatcher;
+}
+
+#endif /* !_APP_RA_DISPATCH_H_ */
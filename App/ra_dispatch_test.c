@@ -0,0 +1,126 @@
+/* Tests the binding of the RA dispatcher (App/ra_dispatch.h) and the
+ * flags ra.h calls it with, against fake ecalls: App/ra.h itself needs the
+ * ISV enclave and the key exchange library. Built with `make
+ * ra_dispatch_test`; exits non-zero on failure. */
+
+#include "ra_dispatch.h"
+
+#include <stdio.h>
+
+#define FAKE_ENCLAVES 16
+
+/* One fake enclave per id. A session exists after enclave_init_ra. */
+static struct {
+    int alive;
+    int session;
+    int calls;
+} fake[FAKE_ENCLAVES];
+static sgx_enclave_id_t fake_next = 1;
+
+static int failures;
+
+#define CHECK(cond) do {                                            \
+        if (!(cond)) {                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+static sgx_enclave_id_t fake_create(void)
+{
+    sgx_enclave_id_t eid = fake_next++;
+
+    fake[eid].alive = 1;
+    return eid;
+}
+
+static sgx_status_t fake_recreate(sgx_enclave_id_t *eid, void *ctx)
+{
+    (void) ctx;
+    *eid = fake_create();
+    return SGX_SUCCESS;
+}
+
+/* enclave_init_ra */
+static sgx_status_t fake_init(sgx_enclave_id_t eid, void *arg)
+{
+    (void) arg;
+    fake[eid].calls++;
+    if (!fake[eid].alive)
+        return SGX_ERROR_ENCLAVE_LOST;
+    fake[eid].session = 1;
+    return SGX_SUCCESS;
+}
+
+/* enclave_encrypt; *status is what the enclave would return. */
+static sgx_status_t fake_encrypt(sgx_enclave_id_t eid, void *arg)
+{
+    sgx_status_t *status = (sgx_status_t *) arg;
+
+    fake[eid].calls++;
+    if (!fake[eid].alive)
+        return SGX_ERROR_ENCLAVE_LOST;
+    *status = fake[eid].session ? SGX_SUCCESS : SGX_ERROR_INVALID_STATE;
+    return SGX_SUCCESS;
+}
+
+int main(void)
+{
+    sgx_enclave_id_t first = fake_create(), second, third, outside;
+    sgx_status_t status = SGX_ERROR_UNEXPECTED;
+    uint64_t generation;
+    dispatch_t *d;
+
+    CHECK(ra_dispatch_init(first, fake_recreate, NULL) == 0);
+    CHECK(ra_dispatch_init(first, NULL, NULL) == -1);
+
+    d = ra_dispatch(first);
+    CHECK(dispatch_call(d, fake_init, NULL, RA_INIT_DISPATCH_FLAGS) == SGX_SUCCESS);
+    CHECK(dispatch_call(d, fake_encrypt, &status, RA_CRYPT_DISPATCH_FLAGS) == SGX_SUCCESS);
+    CHECK(status == SGX_SUCCESS);
+
+    /* Lost: encrypt is not replayed on the recreated enclave, which has no
+     * session; the caller sees ENCLAVE_LOST and has to attest again. */
+    fake[first].alive = 0;
+    fake[first].calls = 0;
+    status = SGX_ERROR_UNEXPECTED;
+    CHECK(dispatch_call(ra_dispatch(first), fake_encrypt, &status, RA_CRYPT_DISPATCH_FLAGS) ==
+          SGX_ERROR_ENCLAVE_LOST);
+    CHECK(fake[first].calls == 1);
+    CHECK(status == SGX_ERROR_UNEXPECTED);
+    second = dispatch_eid(d);
+    CHECK(second != first && fake[second].alive);
+    CHECK(fake[second].calls == 0);
+
+    /* A caller that still passes the old id does not move the dispatcher
+     * back onto the dead enclave. */
+    CHECK(ra_dispatch(first) == d);
+    CHECK(dispatch_eid(d) == second);
+
+    /* enclave_init_ra is replayed on the recreated enclave. */
+    fake[second].alive = 0;
+    CHECK(dispatch_call(ra_dispatch(first), fake_init, NULL, RA_INIT_DISPATCH_FLAGS) ==
+          SGX_SUCCESS);
+    third = dispatch_eid(d);
+    CHECK(third != second && fake[third].session);
+
+    /* The caller picking up the recreated id changes nothing. */
+    generation = d->generation;
+    ra_dispatch(third);
+    CHECK(dispatch_eid(d) == third);
+    CHECK(d->generation == generation);
+
+    /* A caller moving to an enclave of its own rebinds the dispatcher. */
+    outside = fake_create();
+    CHECK(dispatch_call(ra_dispatch(outside), fake_init, NULL, RA_INIT_DISPATCH_FLAGS) ==
+          SGX_SUCCESS);
+    CHECK(dispatch_eid(d) == outside);
+    CHECK(fake[outside].calls == 1 && fake[third].calls == 1);
+
+    if (failures) {
+        fprintf(stderr, "ra_dispatch_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("ra_dispatch_test: ok\n");
+    return 0;
+}
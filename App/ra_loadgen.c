@@ -0,0 +1,488 @@
+/* RA load generator.
+ *
+ * Replays the remote attestation flow of App/ra.h against a running service
+ * provider from many connections at once, to size the service provider on
+ * its own: no enclave and no SGX hardware are involved. A session opens a
+ * connection and sends MSG0, MSG1 and MSG3 built from the SDK's
+ * pre-generated samples (sample_messages.h), waiting for MSG2 and for the
+ * attestation result in between, as the client does with a verification
+ * index. Like the client, it leaves a gap after MSG0, which gets no reply,
+ * so the service provider does not read MSG0 and MSG1 as one message.
+ *
+ * Sessions arrive open loop, as a Poisson process at -r sessions/s whether
+ * or not earlier ones have finished, so a slow service provider shows up
+ * as latency and not as a lower offered load. An arrival that finds all -c
+ * connections busy is dropped and counted. Session latency runs from when
+ * the session was due, not from when the loop got to it. With -r 0 each
+ * connection runs sessions back to back instead (closed loop).
+ *
+ * The service provider keys every session afresh, so the sample MSG3,
+ * MACed for the session the samples came from, fails its integrity check:
+ * msg3 times the service provider up to that check, and its replies count
+ * as rejected.
+ *
+ * Latencies go to the metrics registry (Include/metrics.h) and are printed
+ * at the end; with -m they are also exported during the run. */
+
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sgx_key_exchange.h"
+
+#include "sample_messages.h"
+
+static uint8_t *msg1_samples[] = {msg1_sample1, msg1_sample2};
+static uint8_t *msg3_samples[] = {msg3_sample1, msg3_sample2};
+
+/* ra_samp_request_header_t and ra_samp_response_header_t of
+ * service_provider/network_ra.h, which is C++ only. */
+#pragma pack(1)
+typedef struct {
+    uint8_t type;
+    uint32_t size;
+    uint8_t align[3];
+} lg_request_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t status[2];
+    uint32_t size;
+    uint8_t align[1];
+} lg_response_t;
+#pragma pack()
+
+/* ra_msg_type_t */
+#define LG_TYPE_MSG0 0
+#define LG_TYPE_MSG1 1
+#define LG_TYPE_MSG2 2
+#define LG_TYPE_MSG3 3
+#define LG_TYPE_ATT_RESULT 4
+
+#define LG_RX_MAX BUFSIZ /* what the client reads a reply into */
+#define LG_EVENTS 256
+#define LG_DRAIN_NS 10000000000ull /* for sessions in flight at the end */
+
+enum { LG_CONNECT, LG_MSG0, LG_MSG1, LG_MSG3, LG_SESSION, LG_PHASES };
+
+static const char *const lg_phase_names[LG_PHASES] = {"connect", "msg0", "msg1", "msg3",
+                                                      "session"};
+static const uint32_t lg_phase_hist[LG_PHASES] = {METRIC_RA_CONNECT_NS, METRIC_RA_MSG0_NS,
+                                                  METRIC_RA_MSG1_NS, METRIC_RA_MSG3_NS,
+                                                  METRIC_RA_NS};
+
+typedef struct lg_conn {
+    int fd;          /* -1: free */
+    int phase;       /* LG_CONNECT to LG_MSG3 */
+    int gap;         /* MSG0 sent, MSG1 not yet */
+    uint64_t due_ns; /* when the session was due */
+    uint64_t phase_ns;
+    uint64_t wake_ns; /* end of the gap */
+    const uint8_t *tx;
+    size_t tx_len, tx_off;
+    size_t rx_len;
+    struct lg_conn *next; /* free list or gap queue */
+    uint8_t rx[LG_RX_MAX];
+} lg_conn_t;
+
+typedef struct {
+    uint64_t done, rejected, failed;
+} lg_count_t;
+
+static struct sockaddr_in lg_addr;
+static int lg_epoll = -1;
+static uint64_t lg_gap_ns = 50000000ull;
+static uint8_t *lg_msg[LG_SESSION]; /* request per phase; none for connect */
+static size_t lg_msg_len[LG_SESSION];
+static lg_conn_t *lg_free;
+static lg_conn_t *lg_gap_head, *lg_gap_tail; /* FIFO: every gap is as long */
+static uint32_t lg_active;
+static lg_count_t lg_count[LG_PHASES];
+static uint64_t lg_dropped;
+
+static uint8_t *lg_build(uint8_t type, const void *body, uint32_t size, size_t *len) {
+    lg_request_t *req;
+
+    *len = sizeof *req + size;
+    req = (lg_request_t *) calloc(1, *len);
+    if (req == NULL)
+        return NULL;
+    req->type = type;
+    req->size = size;
+    memcpy(req + 1, body, size);
+    return (uint8_t *) req;
+}
+
+static void lg_record(lg_conn_t *c, int phase, uint64_t now) {
+    metrics_record(lg_phase_hist[phase], now - (phase == LG_SESSION ? c->due_ns : c->phase_ns));
+    lg_count[phase].done++;
+}
+
+static void lg_start(lg_conn_t *c, uint64_t due_ns);
+
+/* Ends the session on c. failed: the current phase did not finish. */
+static void lg_finish(lg_conn_t *c, int failed, int rejected, int restart) {
+    if (failed) {
+        lg_count[c->phase].failed++;
+        lg_count[LG_SESSION].failed++;
+    } else if (rejected) {
+        lg_count[LG_SESSION].rejected++;
+    }
+    close(c->fd);
+    c->fd = -1;
+    lg_active--;
+    if (restart) {
+        lg_start(c, metrics_now_ns());
+        return;
+    }
+    c->next = lg_free;
+    lg_free = c;
+}
+
+/* Writes what is left of c->tx. 1 when all of it is out, 0 when the socket
+ * is full, -1 on error. */
+static int lg_flush(lg_conn_t *c) {
+    ssize_t n;
+
+    while (c->tx_off < c->tx_len) {
+        n = send(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        c->tx_off += (size_t) n;
+    }
+    return 1;
+}
+
+/* Starts phase on c, which sends its request. */
+static int lg_send(lg_conn_t *c, int phase, uint64_t now) {
+    c->phase = phase;
+    c->phase_ns = now;
+    c->tx = lg_msg[phase];
+    c->tx_len = lg_msg_len[phase];
+    c->tx_off = 0;
+    c->rx_len = 0;
+    return lg_flush(c);
+}
+
+/* The request of the current phase is out. MSG0 is done, timed to the
+ * last send; the others wait for their reply. */
+static void lg_sent(lg_conn_t *c, uint64_t now) {
+    if (c->phase != LG_MSG0)
+        return;
+    now = metrics_now_ns();
+    lg_record(c, LG_MSG0, now);
+    c->gap = 1;
+    c->wake_ns = now + lg_gap_ns;
+    c->next = NULL;
+    if (lg_gap_tail != NULL)
+        lg_gap_tail->next = c;
+    else
+        lg_gap_head = c;
+    lg_gap_tail = c;
+}
+
+static void lg_start(lg_conn_t *c, uint64_t due_ns) {
+    struct epoll_event ev;
+    int one = 1;
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    c->due_ns = due_ns;
+    c->phase = LG_CONNECT;
+    c->phase_ns = metrics_now_ns();
+    c->gap = 0;
+    if (c->fd < 0) {
+        lg_count[LG_CONNECT].failed++;
+        lg_count[LG_SESSION].failed++;
+        c->next = lg_free;
+        lg_free = c;
+        return;
+    }
+    lg_active++;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(lg_epoll, EPOLL_CTL_ADD, c->fd, &ev) != 0 ||
+        (connect(c->fd, (struct sockaddr *) &lg_addr, sizeof lg_addr) != 0 &&
+         errno != EINPROGRESS))
+        lg_finish(c, 1, 0, 0);
+}
+
+/* Handles a whole reply in c->rx. */
+static void lg_reply(lg_conn_t *c, int closed_loop, uint64_t now) {
+    const lg_response_t *resp = (const lg_response_t *) c->rx;
+    int rejected = resp->status[0] != 0 || resp->status[1] != 0;
+
+    if (c->phase == LG_MSG1 && resp->type == LG_TYPE_MSG2) {
+        lg_record(c, LG_MSG1, now);
+        if (rejected) {
+            lg_count[LG_MSG1].rejected++;
+            lg_finish(c, 0, 1, closed_loop);
+        } else if (lg_send(c, LG_MSG3, now) < 0) {
+            lg_finish(c, 1, 0, closed_loop);
+        }
+    } else if (c->phase == LG_MSG3 && resp->type == LG_TYPE_ATT_RESULT) {
+        lg_record(c, LG_MSG3, now);
+        lg_record(c, LG_SESSION, now);
+        if (rejected)
+            lg_count[LG_MSG3].rejected++;
+        lg_finish(c, 0, rejected, closed_loop);
+    } else {
+        lg_finish(c, 1, 0, closed_loop);
+    }
+}
+
+static void lg_event(lg_conn_t *c, uint32_t events, int closed_loop) {
+    uint64_t now = metrics_now_ns();
+    socklen_t len = sizeof(int);
+    int err = 0, rc;
+    ssize_t n;
+
+    if (c->phase == LG_CONNECT) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            lg_finish(c, 1, 0, closed_loop);
+            return;
+        }
+        lg_record(c, LG_CONNECT, now);
+        rc = lg_send(c, LG_MSG0, now);
+        if (rc < 0) {
+            lg_finish(c, 1, 0, closed_loop);
+            return;
+        }
+        if (rc > 0)
+            lg_sent(c, now);
+        return;
+    }
+    if ((events & EPOLLOUT) && !c->gap && c->tx_off < c->tx_len) {
+        rc = lg_flush(c);
+        if (rc < 0) {
+            lg_finish(c, 1, 0, closed_loop);
+            return;
+        }
+        if (rc > 0)
+            lg_sent(c, now);
+    }
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)))
+        return;
+    for (;;) {
+        n = recv(c->fd, c->rx + c->rx_len, sizeof c->rx - c->rx_len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        /* closed, failed, a reply to MSG0 or one too big for the client */
+        if (n <= 0 || c->phase == LG_MSG0 || c->gap || c->tx_off < c->tx_len) {
+            if (c->gap) /* the gap queue still holds it */
+                c->gap = 2;
+            else
+                lg_finish(c, 1, 0, closed_loop);
+            return;
+        }
+        c->rx_len += (size_t) n;
+        if (c->rx_len >= sizeof(lg_response_t) &&
+            c->rx_len >= sizeof(lg_response_t) + ((lg_response_t *) c->rx)->size) {
+            lg_reply(c, closed_loop, now);
+            return;
+        }
+        if (c->rx_len == sizeof c->rx) {
+            lg_finish(c, 1, 0, closed_loop);
+            return;
+        }
+    }
+}
+
+/* Sends MSG1 on the connections whose gap is over. */
+static void lg_wake(uint64_t now, int closed_loop) {
+    lg_conn_t *c;
+    int rc;
+
+    while ((c = lg_gap_head) != NULL && (c->wake_ns <= now || c->gap == 2)) {
+        lg_gap_head = c->next;
+        if (lg_gap_head == NULL)
+            lg_gap_tail = NULL;
+        if (c->gap == 2) { /* the server closed or spoke during the gap */
+            c->gap = 0;
+            lg_finish(c, 1, 0, closed_loop);
+            continue;
+        }
+        c->gap = 0;
+        rc = lg_send(c, LG_MSG1, now);
+        if (rc < 0)
+            lg_finish(c, 1, 0, closed_loop);
+    }
+}
+
+static void lg_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-r sessions/s] [-c connections] [-d seconds] [-g gap_ms] [-i 1|2]\n"
+            "          [-S seed] [-m metrics_file] host port\n"
+            "  -r  open-loop arrival rate; 0 runs every connection closed loop (default 100)\n"
+            "  -c  most connections at once (default 1000)\n"
+            "  -d  how long sessions keep arriving (default 10)\n"
+            "  -g  pause after MSG0, as in App/ra.h (default 50)\n"
+            "  -i  which sample messages to replay (default 1)\n",
+            prog);
+}
+
+static void lg_report(double secs, double rate, uint32_t conns, uint64_t timed_out) {
+    static const double q[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t v[sizeof q / sizeof q[0]];
+
+    if (rate > 0)
+        printf("ra load: open loop, %lf sessions/s offered, %u connections, %lf s, "
+               "%llu dropped, %llu timed out\n",
+               rate, conns, secs, (unsigned long long) lg_dropped,
+               (unsigned long long) timed_out);
+    else
+        printf("ra load: closed loop, %u connections, %lf s, %llu timed out\n", conns, secs,
+               (unsigned long long) timed_out);
+    printf("phase,done,rejected,failed,per s,p50(ms),p90(ms),p99(ms),p99.9(ms)\n");
+    for (int p = 0; p < LG_PHASES; ++p) {
+        metrics_hist_quantiles(lg_phase_hist[p], q, v, sizeof q / sizeof q[0]);
+        printf("%s,%llu,%llu,%llu,%lf,%lf,%lf,%lf,%lf\n", lg_phase_names[p],
+               (unsigned long long) lg_count[p].done, (unsigned long long) lg_count[p].rejected,
+               (unsigned long long) lg_count[p].failed, (double) lg_count[p].done / secs,
+               (double) v[0] / 1e6, (double) v[1] / 1e6, (double) v[2] / 1e6,
+               (double) v[3] / 1e6);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct epoll_event events[LG_EVENTS];
+    uint64_t start, now, stop, deadline, next, wait_ns, timed_out = 0;
+    unsigned short xsubi[3] = {1, 0, 0};
+    uint32_t conns = 1000, index = 1;
+    double rate = 100, secs = 10;
+    const char *metrics_file = NULL;
+    lg_conn_t *pool, *c;
+    struct rlimit rl;
+    int opt, n, closed_loop;
+
+    while ((opt = getopt(argc, argv, "r:c:d:g:i:S:m:")) != -1) {
+        switch (opt) {
+        case 'r': rate = atof(optarg); break;
+        case 'c': conns = (uint32_t) atoi(optarg); break;
+        case 'd': secs = atof(optarg); break;
+        case 'g': lg_gap_ns = (uint64_t) atoll(optarg) * 1000000ull; break;
+        case 'i': index = (uint32_t) atoi(optarg); break;
+        case 'S': xsubi[0] = (unsigned short) atoi(optarg); break;
+        case 'm': metrics_file = optarg; break;
+        default: lg_usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 2 || conns == 0 || secs <= 0 || rate < 0 ||
+        index < 1 || index > sizeof msg1_samples / sizeof msg1_samples[0]) {
+        lg_usage(argv[0]);
+        return 1;
+    }
+    memset(&lg_addr, 0, sizeof lg_addr);
+    lg_addr.sin_family = AF_INET;
+    lg_addr.sin_port = htons((unsigned short) atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &lg_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", argv[optind]);
+        return 1;
+    }
+    closed_loop = rate <= 0;
+
+    /* a descriptor per connection, plus a few */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        conns + 16 > rl.rlim_cur) {
+        conns = rl.rlim_cur > 64 ? (uint32_t) rl.rlim_cur - 16 : 48;
+        fprintf(stderr, "descriptor limit: using %u connections\n", conns);
+    }
+
+    {
+        uint32_t egid = 0;
+        lg_msg[LG_MSG0] = lg_build(LG_TYPE_MSG0, &egid, sizeof egid, &lg_msg_len[LG_MSG0]);
+    }
+    lg_msg[LG_MSG1] = lg_build(LG_TYPE_MSG1, msg1_samples[index - 1], sizeof(sgx_ra_msg1_t),
+                               &lg_msg_len[LG_MSG1]);
+    lg_msg[LG_MSG3] = lg_build(LG_TYPE_MSG3, msg3_samples[index - 1], MSG3_BODY_SIZE,
+                               &lg_msg_len[LG_MSG3]);
+    pool = (lg_conn_t *) calloc(conns, sizeof *pool);
+    lg_epoll = epoll_create1(0);
+    if (lg_msg[LG_MSG0] == NULL || lg_msg[LG_MSG1] == NULL || lg_msg[LG_MSG3] == NULL ||
+        pool == NULL || lg_epoll < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (uint32_t i = conns; i-- > 0;) {
+        pool[i].fd = -1;
+        pool[i].next = lg_free;
+        lg_free = &pool[i];
+    }
+    if (metrics_file != NULL && metrics_start(metrics_file, NULL, METRICS_DEFAULT_INTERVAL_MS) != 0)
+        fprintf(stderr, "cannot export metrics to %s\n", metrics_file);
+
+    start = next = metrics_now_ns();
+    stop = start + (uint64_t) (secs * 1e9);
+    deadline = stop + LG_DRAIN_NS;
+    if (closed_loop)
+        while ((c = lg_free) != NULL) {
+            lg_free = c->next;
+            lg_start(c, start);
+        }
+
+    for (;;) {
+        now = metrics_now_ns();
+        if (now >= stop && closed_loop)
+            closed_loop = -1; /* no more restarts */
+        while (!closed_loop && next <= now && next < stop) {
+            if ((c = lg_free) != NULL) {
+                lg_free = c->next;
+                lg_start(c, next);
+            } else {
+                lg_dropped++;
+            }
+            next += (uint64_t) (-log(1.0 - erand48(xsubi)) / rate * 1e9);
+        }
+        lg_wake(now, closed_loop > 0);
+        if ((now >= stop && lg_active == 0) || now >= deadline)
+            break;
+
+        wait_ns = (now < stop ? stop : deadline) - now;
+        if (!closed_loop && next < stop && next - now < wait_ns)
+            wait_ns = next > now ? next - now : 0;
+        if (lg_gap_head != NULL && lg_gap_head->wake_ns - now < wait_ns)
+            wait_ns = lg_gap_head->wake_ns > now ? lg_gap_head->wake_ns - now : 0;
+        if (wait_ns > 1000000000ull)
+            wait_ns = 1000000000ull;
+        n = epoll_wait(lg_epoll, events, LG_EVENTS, (int) ((wait_ns + 999999) / 1000000));
+        for (int i = 0; i < n; ++i) {
+            c = (lg_conn_t *) events[i].data.ptr;
+            if (c->fd >= 0)
+                lg_event(c, events[i].events, closed_loop > 0);
+        }
+    }
+
+    for (uint32_t i = 0; i < conns; ++i)
+        if (pool[i].fd >= 0) {
+            lg_finish(&pool[i], 1, 0, 0);
+            timed_out++;
+        }
+    lg_report((double) (stop - start) / 1e9, rate, conns, timed_out);
+
+    if (metrics_file != NULL) {
+        metrics_write(metrics_file);
+        metrics_stop();
+    }
+    close(lg_epoll);
+    free(pool);
+    for (int p = 0; p < LG_SESSION; ++p)
+        free(lg_msg[p]);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* RTLD_NEXT */
+#endif
+#include "startup_prof.h"
+#include "metrics.h"
+
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/* ioctl type of the in-kernel and out-of-tree SGX drivers, and the numbers
+ * of the calls the loader makes. */
+#define SGX_IOC_MAGIC 0xa4
+#define SGX_IOC_NR_CREATE 0x00
+#define SGX_IOC_NR_ADD_PAGES 0x01
+#define SGX_IOC_NR_INIT 0x02
+
+/* struct sgx_enclave_add_pages of the in-kernel driver: src, offset,
+ * length, secinfo, flags, count. The older drivers add one page per call
+ * with a different struct. */
+#define SGX_ADD_PAGES_SIZE 48
+#define SGX_ADD_PAGES_LENGTH 16
+
+static int (*startup_real_ioctl)(int, unsigned long, ...);
+/* sgx_create_enclave makes its ioctls on the calling thread, so creations
+ * on different threads are profiled apart. */
+static __thread int startup_active;
+static __thread uint64_t startup_begin_ns, startup_first_ns;
+static __thread startup_prof_t startup_cur; /* being filled in */
+/* fd of the SGX device seen in this profile, -1 before the first */
+static __thread int startup_sgx_fd = -1;
+static startup_prof_t startup_last;         /* exported */
+static int startup_exported;
+
+/* Whether fd is open on an SGX device node; the loader opens /dev/sgx_enclave,
+ * /dev/sgx/enclave or /dev/isgx. Another driver may reuse the ioctl type. */
+static int startup_is_sgx_fd(int fd) {
+    char link[32], path[32];
+    ssize_t n;
+
+    if (fd == startup_sgx_fd)
+        return 1;
+    snprintf(link, sizeof link, "/proc/self/fd/%d", fd);
+    n = readlink(link, path, sizeof path - 1);
+    if (n <= 0)
+        return 0;
+    path[n] = '\0';
+    if (strncmp(path, "/dev/sgx", 8) != 0 && strcmp(path, "/dev/isgx") != 0)
+        return 0;
+    startup_sgx_fd = fd;
+    return 1;
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+    uint64_t t0, ns, len;
+    va_list ap;
+    void *arg;
+    int ret;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    if (startup_real_ioctl == NULL)
+        *(void **) &startup_real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+    if (!startup_active || _IOC_TYPE(request) != SGX_IOC_MAGIC || !startup_is_sgx_fd(fd))
+        return startup_real_ioctl(fd, request, arg);
+
+    t0 = metrics_now_ns();
+    ret = startup_real_ioctl(fd, request, arg);
+    ns = metrics_now_ns() - t0;
+
+    if (startup_first_ns == 0)
+        startup_first_ns = t0;
+    startup_cur.sgx_ioctls++;
+    switch (_IOC_NR(request)) {
+    case SGX_IOC_NR_CREATE:
+        startup_cur.ecreate_ns += ns;
+        break;
+    case SGX_IOC_NR_ADD_PAGES:
+        startup_cur.add_ns += ns;
+        startup_cur.add_calls++;
+        if (_IOC_SIZE(request) == SGX_ADD_PAGES_SIZE && ret == 0) {
+            memcpy(&len, (const char *) arg + SGX_ADD_PAGES_LENGTH, sizeof len);
+            startup_cur.add_bytes += len;
+        }
+        break;
+    case SGX_IOC_NR_INIT:
+        startup_cur.init_ns += ns;
+        break;
+    }
+    return ret;
+}
+
+static void startup_write_metrics(metrics_emit_fn emit, void *out, void *ctx) {
+    static const char *const phases[] = { "load", "ecreate", "add", "init", "other", "total" };
+    uint64_t v[6];
+
+    (void) ctx;
+    v[0] = __atomic_load_n(&startup_last.load_ns, __ATOMIC_RELAXED);
+    v[1] = __atomic_load_n(&startup_last.ecreate_ns, __ATOMIC_RELAXED);
+    v[2] = __atomic_load_n(&startup_last.add_ns, __ATOMIC_RELAXED);
+    v[3] = __atomic_load_n(&startup_last.init_ns, __ATOMIC_RELAXED);
+    v[4] = __atomic_load_n(&startup_last.other_ns, __ATOMIC_RELAXED);
+    v[5] = __atomic_load_n(&startup_last.total_ns, __ATOMIC_RELAXED);
+    emit(out, "# TYPE enclave_startup_ns gauge\n");
+    for (int i = 0; i < 6; ++i)
+        emit(out, "enclave_startup_ns{phase=\"%s\"} %llu\n", phases[i], (unsigned long long) v[i]);
+    emit(out, "# TYPE enclave_startup_add_bytes gauge\n");
+    emit(out, "enclave_startup_add_bytes %llu\n",
+         (unsigned long long) __atomic_load_n(&startup_last.add_bytes, __ATOMIC_RELAXED));
+}
+
+void startup_prof_begin(void) {
+    /* registered on the first creation, from main; a recreate from the
+     * dispatcher must not take the metrics lock */
+    if (!__atomic_exchange_n(&startup_exported, 1, __ATOMIC_RELAXED))
+        metrics_add_writer(startup_write_metrics, NULL);
+    memset(&startup_cur, 0, sizeof startup_cur);
+    startup_first_ns = 0;
+    startup_sgx_fd = -1;
+    startup_begin_ns = metrics_now_ns();
+    startup_active = 1;
+}
+
+void startup_prof_end(startup_prof_t *prof) {
+    uint64_t end = metrics_now_ns();
+
+    startup_active = 0;
+    *prof = startup_cur;
+    prof->total_ns = end - startup_begin_ns;
+    prof->load_ns = (startup_first_ns ? startup_first_ns : end) - startup_begin_ns;
+    prof->other_ns = prof->total_ns - prof->load_ns - prof->ecreate_ns - prof->add_ns -
+                     prof->init_ns;
+
+    __atomic_store_n(&startup_last.load_ns, prof->load_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&startup_last.ecreate_ns, prof->ecreate_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&startup_last.add_ns, prof->add_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&startup_last.add_bytes, prof->add_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&startup_last.init_ns, prof->init_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&startup_last.other_ns, prof->other_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&startup_last.total_ns, prof->total_ns, __ATOMIC_RELAXED);
+    metrics_record(METRIC_ENCLAVE_CREATE_NS, prof->total_ns);
+}
+
+void startup_prof_print(const startup_prof_t *prof) {
+    printf("enclave startup(ms): \n");
+    printf("load,%lf\n", (double) prof->load_ns / 1e6);
+    printf("ecreate,%lf\n", (double) prof->ecreate_ns / 1e6);
+    printf("eadd+eextend,%lf,%llu calls,%llu bytes\n", (double) prof->add_ns / 1e6,
+           (unsigned long long) prof->add_calls, (unsigned long long) prof->add_bytes);
+    printf("einit,%lf\n", (double) prof->init_ns / 1e6);
+    printf("other,%lf\n", (double) prof->other_ns / 1e6);
+    printf("total,%lf\n", (double) prof->total_ns / 1e6);
+    if (prof->sgx_ioctls == 0)
+        printf("note: no SGX ioctl seen (simulation mode, or ioctl() not interposed); "
+               "ecreate, eadd and einit are counted in load\n");
+}
@@ -0,0 +1,61 @@
+#ifndef _APP_STARTUP_PROF_H_
+#define _APP_STARTUP_PROF_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Enclave creation profiler.
+ *
+ * sgx_create_enclave does its work through SGX driver ioctls: one ECREATE,
+ * then EADD and EEXTEND for every measured page (ADD_PAGES), then EINIT.
+ * Linking startup_prof.c replaces libc's ioctl() for the whole process:
+ * every ioctl of every thread and library goes through its wrapper, which
+ * passes it on to the libc one. Only SGX ioctls on an SGX device fd (/dev/sgx*
+ * or /dev/isgx), made between startup_prof_begin and startup_prof_end on the
+ * same thread, are timed; anything else costs a thread-local test. A
+ * creation splits into:
+ *
+ *   load     opening and parsing the image, until ECREATE
+ *   ecreate  the ECREATE ioctl
+ *   add      ADD_PAGES ioctls: EADD + EEXTEND in the driver, which grow
+ *            with the committed heap and stacks
+ *   init     the EINIT ioctl, including launch token checks
+ *   other    the rest: the loader between ioctls, other SGX ioctls (EDMM)
+ *            and the first trusted runtime setup after EINIT
+ *
+ * The wrapper only sees the calls the loader makes through the dynamic
+ * symbol ioctl, so the App links with --export-dynamic to keep it visible
+ * to the URTS and PSW libraries it dlopens. A profile that saw no SGX ioctl
+ * (simulation mode, or a loader that reaches the driver another way) has
+ * sgx_ioctls == 0 and all of it in load; startup_prof_print says so.
+ *
+ * Creations on different threads are profiled apart. The last profile to
+ * end is exported as enclave_startup_ns{phase=...} and every total goes to
+ * the enclave_create_ns histogram. */
+
+typedef struct {
+    uint64_t load_ns;
+    uint64_t ecreate_ns;
+    uint64_t add_ns;
+    uint64_t add_calls;
+    uint64_t add_bytes; /* 0 when the driver does not report it */
+    uint64_t init_ns;
+    uint64_t other_ns;
+    uint64_t sgx_ioctls; /* SGX ioctls timed, of every kind */
+    uint64_t total_ns;
+} startup_prof_t;
+
+void startup_prof_begin(void);
+void startup_prof_end(startup_prof_t *prof);
+
+/* One line per phase on stdout, in ms. */
+void startup_prof_print(const startup_prof_t *prof);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_APP_STARTUP_PROF_H_ */
@@ -0,0 +1,214 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Enclave threads are shown as tids from here on, in order of appearance. */
+#define TRACE_ENCLAVE_TID_BASE 1000000
+#define TRACE_ENCLAVE_THREADS 64
+
+typedef struct {
+    uint64_t ns;
+    const char *cat;
+    const char *name;
+    char phase;
+} trace_rec_t;
+
+typedef struct trace_buf {
+    struct trace_buf *next;
+    long tid;
+    uint32_t count;
+    uint32_t dropped;
+    trace_rec_t ev[TRACE_THREAD_EVENTS];
+} trace_buf_t;
+
+volatile int trace_enabled;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static char trace_path[FILENAME_MAX];
+static trace_buf_t *trace_bufs;
+static uint64_t trace_generation;
+static __thread trace_buf_t *trace_tls;
+static __thread uint64_t trace_tls_generation;
+
+static trace_trusted_event_t *trace_trusted;
+static uint32_t trace_trusted_count, trace_trusted_cap;
+static uint64_t trace_trusted_dropped;
+
+/* TSC to CLOCK_MONOTONIC, measured at trace_start. */
+static uint64_t trace_tsc0, trace_ns0;
+static double trace_ns_per_tsc;
+
+static const char *const trace_trusted_cat[] = {
+#define TRACE_X_CAT(id, cat, name) cat,
+    TRACE_TRUSTED_POINTS(TRACE_X_CAT)
+#undef TRACE_X_CAT
+};
+static const char *const trace_trusted_name[] = {
+#define TRACE_X_NAME(id, cat, name) name,
+    TRACE_TRUSTED_POINTS(TRACE_X_NAME)
+#undef TRACE_X_NAME
+};
+
+static inline uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void trace_calibrate(void) {
+    uint64_t tsc1, ns1;
+
+    trace_ns0 = trace_now_ns();
+    trace_tsc0 = __builtin_ia32_rdtsc();
+    do {
+        ns1 = trace_now_ns();
+    } while (ns1 - trace_ns0 < 10000000);
+    tsc1 = __builtin_ia32_rdtsc();
+    trace_ns_per_tsc = (double) (ns1 - trace_ns0) / (double) (tsc1 - trace_tsc0);
+}
+
+/* Slow path of a thread's first event in a session. */
+static trace_buf_t *trace_thread_buf(void) {
+    trace_buf_t *b = (trace_buf_t *) malloc(sizeof *b);
+
+    if (b == NULL)
+        return NULL;
+    b->tid = syscall(SYS_gettid);
+    b->count = 0;
+    b->dropped = 0;
+    pthread_mutex_lock(&trace_lock);
+    b->next = trace_bufs;
+    trace_bufs = b;
+    trace_tls_generation = trace_generation;
+    pthread_mutex_unlock(&trace_lock);
+    return trace_tls = b;
+}
+
+void trace_event(const char *cat, const char *name, char phase) {
+    trace_buf_t *b = trace_tls;
+    trace_rec_t *r;
+
+    if (b == NULL || trace_tls_generation != __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE)) {
+        b = trace_thread_buf();
+        if (b == NULL)
+            return;
+    }
+    if (b->count == TRACE_THREAD_EVENTS) {
+        b->dropped++;
+        return;
+    }
+    r = &b->ev[b->count++];
+    r->ns = trace_now_ns();
+    r->cat = cat;
+    r->name = name;
+    r->phase = phase;
+}
+
+void trace_add_trusted(const trace_trusted_event_t *events, uint32_t count, uint32_t dropped) {
+    pthread_mutex_lock(&trace_lock);
+    trace_trusted_dropped += dropped;
+    if (trace_trusted_count + count > trace_trusted_cap) {
+        uint32_t cap = trace_trusted_cap ? trace_trusted_cap : TRACE_TRUSTED_EVENTS;
+        trace_trusted_event_t *p;
+
+        while (cap < trace_trusted_count + count)
+            cap *= 2;
+        p = (trace_trusted_event_t *) realloc(trace_trusted, cap * sizeof *p);
+        if (p == NULL) {
+            trace_trusted_dropped += count;
+            pthread_mutex_unlock(&trace_lock);
+            return;
+        }
+        trace_trusted = p;
+        trace_trusted_cap = cap;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (events[i].id < TRACE_T_COUNT &&
+            (events[i].phase == TRACE_PHASE_BEGIN || events[i].phase == TRACE_PHASE_END ||
+             events[i].phase == TRACE_PHASE_INSTANT))
+            trace_trusted[trace_trusted_count++] = events[i];
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_start(const char *path) {
+    if (strlen(path) >= sizeof trace_path)
+        return -1;
+    pthread_mutex_lock(&trace_lock);
+    strcpy(trace_path, path);
+    __atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE); /* fresh thread buffers */
+    pthread_mutex_unlock(&trace_lock);
+    trace_calibrate();
+    trace_enabled = 1;
+    return 0;
+}
+
+static void trace_write_event(FILE *f, int *first, const char *cat, const char *name,
+                              char phase, double us, long pid, long tid) {
+    fprintf(f, "%s\n{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+               "\"pid\":%ld,\"tid\":%ld%s}",
+            *first ? "" : ",", cat, name, phase, us, pid, tid,
+            phase == TRACE_PHASE_INSTANT ? ",\"s\":\"t\"" : "");
+    *first = 0;
+}
+
+int trace_stop(void) {
+    uint64_t enclave_tids[TRACE_ENCLAVE_THREADS];
+    unsigned long long dropped = 0;
+    int n_enclave = 0, first = 1, i;
+    long pid = (long) getpid();
+    trace_buf_t *b, *next;
+    FILE *f;
+
+    trace_enabled = 0;
+    pthread_mutex_lock(&trace_lock);
+    f = fopen(trace_path, "w");
+    if (f != NULL) {
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        for (b = trace_bufs; b != NULL; b = b->next) {
+            for (uint32_t k = 0; k < b->count; ++k)
+                trace_write_event(f, &first, b->ev[k].cat, b->ev[k].name, b->ev[k].phase,
+                                  (double) (b->ev[k].ns - trace_ns0) / 1000.0, pid, b->tid);
+            dropped += b->dropped;
+        }
+        for (uint32_t k = 0; k < trace_trusted_count; ++k) {
+            const trace_trusted_event_t *e = &trace_trusted[k];
+            double us = (double) (int64_t) (e->tsc - trace_tsc0) * trace_ns_per_tsc / 1000.0;
+
+            for (i = 0; i < n_enclave && enclave_tids[i] != e->tid; ++i)
+                ;
+            if (i == n_enclave && n_enclave < TRACE_ENCLAVE_THREADS)
+                enclave_tids[n_enclave++] = e->tid;
+            trace_write_event(f, &first, trace_trusted_cat[e->id], trace_trusted_name[e->id],
+                              (char) e->phase, us, pid, TRACE_ENCLAVE_TID_BASE + i);
+        }
+        for (i = 0; i < n_enclave; ++i) {
+            fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,"
+                       "\"args\":{\"name\":\"enclave thread %d\"}}",
+                    first ? "" : ",", pid, TRACE_ENCLAVE_TID_BASE + i, i);
+            first = 0;
+        }
+        fprintf(f, "\n],\"otherData\":{\"dropped_untrusted\":%llu,\"dropped_trusted\":%llu}}\n",
+                dropped, (unsigned long long) trace_trusted_dropped);
+        fclose(f);
+    }
+
+    for (b = trace_bufs; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+    trace_bufs = NULL;
+    __atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE);
+    free(trace_trusted);
+    trace_trusted = NULL;
+    trace_trusted_count = trace_trusted_cap = 0;
+    trace_trusted_dropped = 0;
+    pthread_mutex_unlock(&trace_lock);
+    return f != NULL ? 0 : -1;
+}
@@ -4,25 +4,29 @@
 #include <stdio.h> /* vsnprintf */
 #include <string.h>
 #include <stdlib.h>
+#include "modred.h"
+#include "scan.h"
+
+/* Moduli of the benchmark kernels; see Include/modred.h. */
+MODRED_MERSENNE(mod_u32, 32) /* UINT32_MAX */
+MODRED_MONTGOMERY(mod_1e9_7, 1000000007)
 
 long ecall_main(int x, int lim){
     long s, e, t;
-    mpz_t  a, b;
-    mpz_init_set_si(a, 78839);
-    mpz_init(b);
+    uint32_t a = 78839;
+    volatile uint32_t b; /* keeps the pow in the timed loop */
     uint8_t *mem;
     int size = 1000000; // 10,000,000
     mem = (uint8_t *) malloc(size);
     mem[lim] = 1;
-    int q = (int)1e9 + 7;
 
     ocall_get_time(&s);
     while(lim--) {
-//        mpz_pow_ui(b, a, x);
-//        mpz_mod_ui(b, b, q);
+        b = mod_1e9_7_pow(a, (uint64_t) x);
         ocall_get_time(&t);
     }
     ocall_get_time(&e);
+    (void) b;
     return e - s;
 }
 
@@ -31,10 +35,9 @@ long ecall_test_large_input(long input_size, uint8_t *input) {
     long s, e, ret;
     ocall_get_time(&s);
     long sum = 0;
-    for (long i = 0; i < input_size; ++i) {
-        sum += input[i];
-        sum %= input_size;
-    }
+    /* one reduction at the end: the bytes cannot overflow 64 bits */
+    if (input_size > 0)
+        sum = (long) (scan_sum(input, (uint64_t) input_size) % (uint64_t) input_size);
     ocall_get_time(&e);
     ret = sum + e;
     ret -= sum + s;
@@ -47,32 +50,32 @@ long ecall_test_large_epc(int size) {
     long sum = 0;
 
     uint8_t *arr = (uint8_t*) malloc(size);
+    if (arr == NULL)
+        return -1;
 
     for (int i = 0; i < size; ++i) {
-        arr[i] = arr[size - i] = i & 7;
+        arr[i] = arr[size - 1 - i] = i & 7;
     }
 
     ocall_get_time(&e);
+    free(arr);
     ret = e - s;
     return ret;
 }
 
 
+/* The pow is pure: the base is read and the result kept through volatiles
+ * so that all 1000 of them are computed. */
 long ecall_test_parallel(int size, unsigned int *input, unsigned int *output) {
 
     int n = size / 4;
-    mpz_t a, b;
-    mpz_init(a);
-    mpz_init(b);
-    unsigned int q = UINT32_MAX;
+    volatile unsigned int base, out;
 
     for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < 1000; ++j) {
-            mpz_set_ui(a, input[i]);
-            mpz_pow_ui(b, a, 100000);
-            mpz_mod_ui(b, b, q);
-            mpz_export(&output[i], 0, -1, sizeof output[i], 0, 0, b);
-        }
+        base = input[i];
+        for (int j = 0; j < 1000; ++j)
+            out = (unsigned int) mod_u32_pow(base, 100000);
+        output[i] = out;
     }
 
     return 0;
@@ -81,20 +84,96 @@ long ecall_test_parallel(int size, unsigned int *input, unsigned int *output) {
 
 unsigned int ecall_test_non_parallel(unsigned int uia) {
 
-    mpz_t a, b;
-    mpz_init(b);
-    unsigned int q = UINT32_MAX, out;
+    volatile unsigned int base = uia, out = 0;
 
-    for (int j = 0; j < 1000; ++j) {
-        mpz_init_set_ui(a, uia);
-        mpz_pow_ui(b, a, 100000);
-        mpz_mod_ui(b, b, q);
-        mpz_export(&out, 0, -1, sizeof out, 0, 0, b);
-    }
+    for (int j = 0; j < 1000; ++j)
+        out = (unsigned int) mod_u32_pow(base, 100000);
 
     return out;
 }
 
 void ecall_empty(){
     int a = 1 + 2;
-}
\ No newline at end of file
+}
+
+/* Sealing for host-side key files (te/te_keystore.h). The enclave never
+ * interprets the data, it only binds it to its own identity and to the
+ * caller's header. The MAC text is SEAL_DATA_TAG followed by that header,
+ * and ecall_unseal_data gives back only blobs carrying it: the TE share and
+ * checkpoint records are sealed under the same key with tags of their own,
+ * and must not come out through here. */
+#define SEAL_DATA_TAG "tcsc-keyfile-v1"
+#define SEAL_DATA_TAG_LEN (sizeof SEAL_DATA_TAG - 1)
+/* Bounds the MAC text; key file headers are 256 bytes. */
+#define SEAL_DATA_MAX_AAD 4096
+
+/* Builds the MAC text for aad; the caller frees it. */
+static uint8_t *seal_data_mac(const uint8_t *aad, uint32_t aad_len) {
+    uint8_t *mac = (uint8_t *) malloc(SEAL_DATA_TAG_LEN + aad_len);
+
+    if (mac == NULL)
+        return NULL;
+    memcpy(mac, SEAL_DATA_TAG, SEAL_DATA_TAG_LEN);
+    if (aad_len)
+        memcpy(mac + SEAL_DATA_TAG_LEN, aad, aad_len);
+    return mac;
+}
+
+uint32_t ecall_sealed_size(uint32_t plain_len, uint32_t aad_len) {
+    if (aad_len > SEAL_DATA_MAX_AAD)
+        return UINT32_MAX;
+    return sgx_calc_sealed_data_size(SEAL_DATA_TAG_LEN + aad_len, plain_len);
+}
+
+sgx_status_t ecall_seal_data(const uint8_t *plain, uint32_t plain_len,
+                             const uint8_t *aad, uint32_t aad_len,
+                             uint8_t *sealed, uint32_t sealed_len) {
+    uint8_t *mac;
+    sgx_status_t ret;
+
+    if ((aad == NULL && aad_len) || aad_len > SEAL_DATA_MAX_AAD ||
+        sealed_len != ecall_sealed_size(plain_len, aad_len))
+        return SGX_ERROR_INVALID_PARAMETER;
+    if ((mac = seal_data_mac(aad, aad_len)) == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+    ret = sgx_seal_data(SEAL_DATA_TAG_LEN + aad_len, mac, plain_len, plain, sealed_len,
+                        (sgx_sealed_data_t *) sealed);
+    free(mac);
+    return ret;
+}
+
+/* Unseals a blob of ecall_seal_data made with the same aad. Anything else,
+ * including a blob with no MAC text, is refused before it is decrypted. */
+sgx_status_t ecall_unseal_data(const uint8_t *sealed, uint32_t sealed_len,
+                               const uint8_t *aad, uint32_t aad_len,
+                               uint8_t *plain, uint32_t plain_len) {
+    const sgx_sealed_data_t *blob = (const sgx_sealed_data_t *) sealed;
+    uint32_t mac_len = SEAL_DATA_TAG_LEN + aad_len, got_len = mac_len, len = plain_len;
+    uint8_t *expect, *got;
+    sgx_status_t ret;
+
+    if (sealed == NULL || (aad == NULL && aad_len) || aad_len > SEAL_DATA_MAX_AAD ||
+        sealed_len < sizeof(sgx_sealed_data_t) ||
+        sealed_len != ecall_sealed_size(plain_len, aad_len) ||
+        sgx_get_encrypt_txt_len(blob) != plain_len ||
+        sgx_get_add_mac_txt_len(blob) != mac_len)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    expect = seal_data_mac(aad, aad_len);
+    got = (uint8_t *) malloc(mac_len);
+    if (expect == NULL || got == NULL) {
+        free(expect);
+        free(got);
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+    ret = sgx_unseal_data(blob, got, &got_len, plain, &len);
+    if (ret == SGX_SUCCESS &&
+        (len != plain_len || got_len != mac_len || memcmp(got, expect, mac_len)))
+        ret = SGX_ERROR_MAC_MISMATCH;
+    /* plain is copied out whatever the status */
+    if (ret != SGX_SUCCESS && plain_len)
+        memset_s(plain, plain_len, 0, plain_len);
+    free(expect);
+    free(got);
+    return ret;
+}
@@ -0,0 +1,171 @@
+#include "Enclave_t.h"
+#include "async_ocall.h"
+#include "trusted_trace.h"
+#include "trusted_metrics.h"
+
+#include "sgx_trts.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Everything read back from the ring is untrusted: the request ring keeps
+ * its geometry in aocall_rb, a host that stalls the ring only makes posts
+ * fail, and results carry no more trust than a plain ocall return value. */
+
+#define AOCALL_SPIN 4096
+
+static aocall_ring_t *aocall_ring;
+static rb_t aocall_rb;
+static uint64_t aocall_next_ticket = 1;
+static uint64_t aocall_drop_count;
+
+static inline void cpu_relax(void) {
+    __builtin_ia32_pause();
+}
+
+/* Register once, before the first post; NULL unregisters. */
+sgx_status_t ecall_aocall_register(void *ring) {
+    aocall_ring_t *r = (aocall_ring_t *) ring;
+
+    if (r != NULL) {
+        if (!sgx_is_outside_enclave(r, sizeof(aocall_ring_t)))
+            return SGX_ERROR_INVALID_PARAMETER;
+        if (rb_attach(&aocall_rb, r->requests, RB_MPMC, AOCALL_RING_SLOTS,
+                      sizeof(aocall_request_t)) != 0)
+            return SGX_ERROR_UNEXPECTED;
+    }
+    __atomic_store_n(&aocall_ring, r, __ATOMIC_RELEASE);
+    return SGX_SUCCESS;
+}
+
+static int aocall_enqueue(uint32_t op, const void *payload, uint32_t len, uint64_t ticket) {
+    aocall_request_t req;
+
+    if (__atomic_load_n(&aocall_ring, __ATOMIC_ACQUIRE) == NULL || len > AOCALL_PAYLOAD)
+        return -1;
+    req.ticket = ticket;
+    req.op = op;
+    req.len = len;
+    if (len)
+        memcpy(req.payload, payload, len);
+    /* the whole request is copied out; keep trusted stack out of it */
+    memset(req.payload + len, 0, AOCALL_PAYLOAD - len);
+    if (rb_mpmc_push(&aocall_rb, &req) != 0)
+        return -1;
+    METRIC_T_INC(METRIC_T_AOCALL_SUBMITTED);
+    return 0;
+}
+
+int aocall_post(uint32_t op, const void *payload, uint32_t len) {
+    if (aocall_enqueue(op, payload, len, 0) == 0)
+        return 0;
+    __atomic_fetch_add(&aocall_drop_count, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+int aocall_submit(uint32_t op, const void *payload, uint32_t len, uint64_t *ticket) {
+    uint64_t t = __atomic_fetch_add(&aocall_next_ticket, 1, __ATOMIC_RELAXED);
+
+    if (aocall_enqueue(op, payload, len, t) != 0)
+        return -1;
+    *ticket = t;
+    return 0;
+}
+
+int aocall_poll(uint64_t ticket, int64_t *result) {
+    aocall_ring_t *ring = __atomic_load_n(&aocall_ring, __ATOMIC_ACQUIRE);
+    aocall_completion_t *c;
+    uint64_t t;
+
+    if (ring == NULL) {
+        *result = AOCALL_LOST;
+        return 1;
+    }
+    /* Seqlock read: the App zeroes the ticket before rewriting a result. */
+    c = &ring->done[ticket & (AOCALL_RING_SLOTS - 1)];
+    t = __atomic_load_n(&c->ticket, __ATOMIC_ACQUIRE);
+    if (t < ticket)
+        return 0;
+    *result = __atomic_load_n(&c->result, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (t != ticket || __atomic_load_n(&c->ticket, __ATOMIC_RELAXED) != ticket)
+        *result = AOCALL_LOST;
+    return 1;
+}
+
+int64_t aocall_wait(uint64_t ticket) {
+    int64_t result;
+    int i, rc = -1;
+
+    for (i = 0; i < AOCALL_SPIN; ++i) {
+        if (aocall_poll(ticket, &result))
+            return result;
+        cpu_relax();
+    }
+    METRIC_T_INC(METRIC_T_AOCALL_PARKED);
+    TRACE_T_BEGIN(TRACE_T_AOCALL_WAIT);
+    if (ocall_aocall_wait(&rc, ticket, &result) != SGX_SUCCESS || rc != 0)
+        result = AOCALL_LOST;
+    TRACE_T_END(TRACE_T_AOCALL_WAIT);
+    return result;
+}
+
+int64_t aocall_call(uint32_t op, const void *payload, uint32_t len) {
+    uint64_t ticket;
+    int64_t result = AOCALL_LOST;
+
+    if (aocall_submit(op, payload, len, &ticket) == 0)
+        return aocall_wait(ticket);
+    METRIC_T_INC(METRIC_T_AOCALL_SYNC);
+    if (len > AOCALL_PAYLOAD ||
+        ocall_aocall_sync(&result, op, (const uint8_t *) payload, len) != SGX_SUCCESS)
+        return AOCALL_LOST;
+    return result;
+}
+
+void aocall_log(const char *fmt, ...) {
+    char buf[AOCALL_PAYLOAD];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if (n >= (int) sizeof buf)
+        n = sizeof buf - 1;
+    aocall_post(AOCALL_OP_LOG, buf, (uint32_t) n);
+}
+
+uint64_t aocall_dropped(void) {
+    return __atomic_load_n(&aocall_drop_count, __ATOMIC_RELAXED);
+}
+
+/* Benchmark: `count` requests as synchronous ocalls (mode 0), fire and
+ * forget posts (mode 1) or submit and wait (mode 2). */
+sgx_status_t ecall_aocall_bench(uint32_t mode, uint32_t count, uint64_t *dropped) {
+    uint64_t before = aocall_dropped();
+    uint32_t i;
+    int64_t r;
+
+    for (i = 0; i < count; ++i) {
+        switch (mode) {
+        case 0:
+            if (ocall_aocall_sync(&r, AOCALL_OP_NOP, NULL, 0) != SGX_SUCCESS)
+                return SGX_ERROR_UNEXPECTED;
+            break;
+        case 1:
+            aocall_post(AOCALL_OP_NOP, &i, sizeof i);
+            break;
+        case 2:
+            if (aocall_call(AOCALL_OP_NOP, &i, sizeof i) == AOCALL_LOST)
+                return SGX_ERROR_UNEXPECTED;
+            break;
+        default:
+            return SGX_ERROR_INVALID_PARAMETER;
+        }
+    }
+    *dropped = aocall_dropped() - before;
+    return SGX_SUCCESS;
+}
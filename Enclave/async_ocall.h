@@ -0,0 +1,42 @@
+#ifndef _ENCLAVE_ASYNC_OCALL_H_
+#define _ENCLAVE_ASYNC_OCALL_H_
+
+#include <stdint.h>
+#include "async_ocall_ring.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Trusted side of the asynchronous ocall ring (Include/async_ocall_ring.h). */
+
+/* Result of a ticket whose completion was overwritten before it was read. */
+#define AOCALL_LOST INT64_MIN
+
+/* Fire and forget. Never blocks: when the ring is full or not registered the
+ * request is dropped and counted. Returns 0 if posted, -1 if dropped. */
+int aocall_post(uint32_t op, const void *payload, uint32_t len);
+
+/* Posts a request whose result will be collected with aocall_poll or
+ * aocall_wait. Returns -1 if the ring is full or not registered. */
+int aocall_submit(uint32_t op, const void *payload, uint32_t len, uint64_t *ticket);
+
+/* 1 and *result set once the request completed, 0 while pending. */
+int aocall_poll(uint64_t ticket, int64_t *result);
+
+/* Spins for a while, then parks in ocall_aocall_wait. */
+int64_t aocall_wait(uint64_t ticket);
+
+/* Submit and wait; falls back to a synchronous ocall when the ring is full. */
+int64_t aocall_call(uint32_t op, const void *payload, uint32_t len);
+
+/* printf-style line through AOCALL_OP_LOG, truncated to one slot. */
+void aocall_log(const char *fmt, ...);
+
+uint64_t aocall_dropped(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_ENCLAVE_ASYNC_OCALL_H_ */
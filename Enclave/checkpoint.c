@@ -0,0 +1,318 @@
+#include "Enclave_t.h"
+#include "checkpoint.h"
+#include "trusted_trace.h"
+#include "trusted_metrics.h"
+
+#include "sgx_thread.h"
+#include "sgx_tseal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Sealed-state checkpoint.
+ *
+ * Every record is sealed with its type, page and flush sequence as
+ * additional MAC text, so the host can neither move a page to another slot
+ * nor mix pages of different flushes: a restored page must carry exactly
+ * the sequence the manifest recorded for it. Rolling the whole log back to
+ * an older commit is not detected; that needs a monotonic counter. */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t page;
+    uint32_t reserved;
+    uint64_t seq;
+} ckpt_aad_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t page_seq[CKPT_MAX_PAGES]; /* 0: never written */
+} ckpt_manifest_t;
+
+#define CKPT_WORDS (CKPT_MAX_PAGES / 64)
+#define CKPT_BYTES ((uint32_t) CKPT_MAX_PAGES * CKPT_PAGE_SIZE)
+
+/* Held across the ocalls below, which also serializes the host side. */
+static sgx_thread_mutex_t ckpt_lock = SGX_THREAD_MUTEX_INITIALIZER;
+static uint8_t *ckpt_data;
+static ckpt_manifest_t ckpt_manifest;
+static uint64_t ckpt_resident[CKPT_WORDS];
+static uint64_t ckpt_dirty[CKPT_WORDS];
+
+static int bit_test(const uint64_t *map, uint32_t i) {
+    return (int) ((map[i / 64] >> (i % 64)) & 1);
+}
+
+static void bit_set(uint64_t *map, uint32_t i) {
+    map[i / 64] |= (uint64_t) 1 << (i % 64);
+}
+
+static uint32_t ckpt_sealed_size(uint32_t plain_len) {
+    return sgx_calc_sealed_data_size(sizeof(ckpt_aad_t), plain_len);
+}
+
+static void ckpt_aad(ckpt_aad_t *aad, uint32_t type, uint32_t page, uint64_t seq) {
+    memset(aad, 0, sizeof *aad);
+    aad->magic = CKPT_MAGIC;
+    aad->type = type;
+    aad->page = page;
+    aad->seq = seq;
+}
+
+/* Unseals a record and checks that it carries exactly the expected MAC text. */
+static sgx_status_t ckpt_unseal(const uint8_t *sealed, uint32_t sealed_len,
+                                const ckpt_aad_t *expect, void *plain, uint32_t plain_len) {
+    const sgx_sealed_data_t *blob = (const sgx_sealed_data_t *) sealed;
+    ckpt_aad_t aad;
+    uint32_t aad_len = sizeof aad, len = plain_len;
+    sgx_status_t ret;
+
+    if (sealed_len != ckpt_sealed_size(plain_len) ||
+        sgx_get_encrypt_txt_len(blob) != plain_len ||
+        sgx_get_add_mac_txt_len(blob) != sizeof aad)
+        return SGX_ERROR_INVALID_PARAMETER;
+    ret = sgx_unseal_data(blob, (uint8_t *) &aad, &aad_len, (uint8_t *) plain, &len);
+    if (ret == SGX_SUCCESS &&
+        (len != plain_len || aad_len != sizeof aad || memcmp(&aad, expect, sizeof aad)))
+        ret = SGX_ERROR_MAC_MISMATCH;
+    return ret;
+}
+
+/* Makes a page resident, fetching and unsealing it on first access. */
+static sgx_status_t ckpt_fault_in(uint32_t page) {
+    uint32_t sealed_len = ckpt_sealed_size(CKPT_PAGE_SIZE);
+    uint64_t seq = ckpt_manifest.page_seq[page];
+    uint8_t *dst = ckpt_data + (size_t) page * CKPT_PAGE_SIZE;
+    uint8_t *sealed;
+    ckpt_aad_t aad;
+    int got = -1;
+    sgx_status_t ret;
+
+    if (bit_test(ckpt_resident, page))
+        return SGX_SUCCESS;
+    if (seq == 0) {
+        memset(dst, 0, CKPT_PAGE_SIZE);
+        bit_set(ckpt_resident, page);
+        return SGX_SUCCESS;
+    }
+
+    sealed = (uint8_t *) malloc(sealed_len);
+    if (sealed == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+    TRACE_T_BEGIN(TRACE_T_CKPT_FAULT);
+    ret = ocall_ckpt_read_page(&got, page, seq, sealed, sealed_len);
+    if (ret == SGX_SUCCESS && got != (int) sealed_len)
+        ret = SGX_ERROR_UNEXPECTED;
+    if (ret == SGX_SUCCESS) {
+        ckpt_aad(&aad, CKPT_RECORD_PAGE, page, seq);
+        ret = ckpt_unseal(sealed, sealed_len, &aad, dst, CKPT_PAGE_SIZE);
+    }
+    if (ret == SGX_SUCCESS) {
+        bit_set(ckpt_resident, page);
+        METRIC_T_INC(METRIC_T_CKPT_PAGES_UNSEALED);
+    }
+    TRACE_T_END(TRACE_T_CKPT_FAULT);
+    free(sealed);
+    return ret;
+}
+
+static sgx_status_t ckpt_access(uint32_t offset, uint8_t *rbuf, const uint8_t *wbuf, uint32_t len) {
+    uint32_t page, in, n;
+    sgx_status_t ret = SGX_SUCCESS;
+
+    sgx_thread_mutex_lock(&ckpt_lock);
+    if (ckpt_data == NULL)
+        ret = SGX_ERROR_INVALID_STATE;
+    else if (offset > CKPT_BYTES || len > CKPT_BYTES - offset)
+        ret = SGX_ERROR_INVALID_PARAMETER;
+
+    while (ret == SGX_SUCCESS && len) {
+        page = offset / CKPT_PAGE_SIZE;
+        in = offset % CKPT_PAGE_SIZE;
+        n = CKPT_PAGE_SIZE - in < len ? CKPT_PAGE_SIZE - in : len;
+        ret = ckpt_fault_in(page);
+        if (ret != SGX_SUCCESS)
+            break;
+        if (wbuf) {
+            memcpy(ckpt_data + offset, wbuf, n);
+            bit_set(ckpt_dirty, page);
+            wbuf += n;
+        } else {
+            memcpy(rbuf, ckpt_data + offset, n);
+            rbuf += n;
+        }
+        offset += n;
+        len -= n;
+    }
+    sgx_thread_mutex_unlock(&ckpt_lock);
+    return ret;
+}
+
+sgx_status_t ckpt_read(uint32_t offset, void *buf, uint32_t len) {
+    return ckpt_access(offset, (uint8_t *) buf, NULL, len);
+}
+
+sgx_status_t ckpt_write(uint32_t offset, const void *buf, uint32_t len) {
+    return ckpt_access(offset, NULL, (const uint8_t *) buf, len);
+}
+
+/* Starts from the last committed manifest; pages come in lazily. Anything
+ * not flushed before is dropped. */
+sgx_status_t ecall_ckpt_open(void) {
+    uint32_t sealed_len = ckpt_sealed_size(sizeof(ckpt_manifest_t));
+    uint8_t *sealed;
+    uint64_t seq = 0;
+    ckpt_aad_t aad;
+    int got = -1;
+    sgx_status_t ret;
+
+    sealed = (uint8_t *) malloc(sealed_len);
+    if (sealed == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    sgx_thread_mutex_lock(&ckpt_lock);
+    if (ckpt_data == NULL)
+        ckpt_data = (uint8_t *) malloc(CKPT_BYTES);
+    memset(ckpt_resident, 0, sizeof ckpt_resident);
+    memset(ckpt_dirty, 0, sizeof ckpt_dirty);
+    memset(&ckpt_manifest, 0, sizeof ckpt_manifest);
+
+    if (ckpt_data == NULL) {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+    } else {
+        ret = ocall_ckpt_read_manifest(&got, sealed, sealed_len, &seq);
+        if (ret == SGX_SUCCESS && got > 0) {
+            if (got != (int) sealed_len) {
+                ret = SGX_ERROR_UNEXPECTED;
+            } else {
+                ckpt_aad(&aad, CKPT_RECORD_COMMIT, 0, seq);
+                ret = ckpt_unseal(sealed, sealed_len, &aad, &ckpt_manifest, sizeof ckpt_manifest);
+                if (ret == SGX_SUCCESS && ckpt_manifest.seq != seq)
+                    ret = SGX_ERROR_MAC_MISMATCH;
+            }
+            if (ret != SGX_SUCCESS)
+                memset(&ckpt_manifest, 0, sizeof ckpt_manifest);
+        } else if (ret == SGX_SUCCESS && got < 0) {
+            ret = SGX_ERROR_UNEXPECTED;
+        }
+    }
+    sgx_thread_mutex_unlock(&ckpt_lock);
+
+    free(sealed);
+    return ret;
+}
+
+/* Seals the pages written since the last flush, CKPT_FLUSH_PAGES per ocall,
+ * then the manifest. The flush takes effect once the host has the manifest;
+ * on failure the pages stay dirty and the previous commit stays current. */
+sgx_status_t ecall_ckpt_flush(uint32_t *pages) {
+    uint32_t page_len = sizeof(ckpt_record_header_t) + ckpt_sealed_size(CKPT_PAGE_SIZE);
+    uint32_t commit_len = sizeof(ckpt_record_header_t) + ckpt_sealed_size(sizeof(ckpt_manifest_t));
+    uint32_t batch_len = CKPT_FLUSH_PAGES * page_len;
+    uint32_t used = 0, count = 0, page;
+    ckpt_manifest_t *next;
+    ckpt_record_header_t *hdr;
+    ckpt_aad_t aad;
+    uint8_t *batch;
+    int rc = 0;
+    sgx_status_t ret = SGX_SUCCESS;
+
+    *pages = 0;
+    if (batch_len < commit_len)
+        batch_len = commit_len;
+    batch = (uint8_t *) malloc(batch_len);
+    next = (ckpt_manifest_t *) malloc(sizeof *next);
+    if (batch == NULL || next == NULL) {
+        free(batch);
+        free(next);
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    TRACE_T_BEGIN(TRACE_T_CKPT_FLUSH);
+    sgx_thread_mutex_lock(&ckpt_lock);
+    if (ckpt_data == NULL) {
+        ret = SGX_ERROR_INVALID_STATE;
+        goto out;
+    }
+    memcpy(next, &ckpt_manifest, sizeof *next);
+    next->seq = ckpt_manifest.seq + 1;
+
+    for (page = 0; page < CKPT_MAX_PAGES; ++page) {
+        if (!bit_test(ckpt_dirty, page))
+            continue;
+        hdr = (ckpt_record_header_t *) (batch + used);
+        hdr->magic = CKPT_MAGIC;
+        hdr->type = CKPT_RECORD_PAGE;
+        hdr->page = page;
+        hdr->sealed_len = ckpt_sealed_size(CKPT_PAGE_SIZE);
+        hdr->seq = next->seq;
+        ckpt_aad(&aad, CKPT_RECORD_PAGE, page, next->seq);
+        ret = sgx_seal_data(sizeof aad, (const uint8_t *) &aad, CKPT_PAGE_SIZE,
+                            ckpt_data + (size_t) page * CKPT_PAGE_SIZE, hdr->sealed_len,
+                            (sgx_sealed_data_t *) (hdr + 1));
+        if (ret != SGX_SUCCESS)
+            goto out;
+        next->page_seq[page] = next->seq;
+        used += page_len;
+        if (++count % CKPT_FLUSH_PAGES == 0) {
+            ret = ocall_ckpt_append(&rc, batch, used);
+            if (ret == SGX_SUCCESS && rc != 0)
+                ret = SGX_ERROR_UNEXPECTED;
+            if (ret != SGX_SUCCESS)
+                goto out;
+            used = 0;
+        }
+    }
+    if (count == 0)
+        goto out;
+    if (used) {
+        ret = ocall_ckpt_append(&rc, batch, used);
+        if (ret == SGX_SUCCESS && rc != 0)
+            ret = SGX_ERROR_UNEXPECTED;
+        if (ret != SGX_SUCCESS)
+            goto out;
+    }
+
+    hdr = (ckpt_record_header_t *) batch;
+    hdr->magic = CKPT_MAGIC;
+    hdr->type = CKPT_RECORD_COMMIT;
+    hdr->page = 0;
+    hdr->sealed_len = ckpt_sealed_size(sizeof *next);
+    hdr->seq = next->seq;
+    ckpt_aad(&aad, CKPT_RECORD_COMMIT, 0, next->seq);
+    ret = sgx_seal_data(sizeof aad, (const uint8_t *) &aad, sizeof *next, (const uint8_t *) next,
+                        hdr->sealed_len, (sgx_sealed_data_t *) (hdr + 1));
+    if (ret == SGX_SUCCESS)
+        ret = ocall_ckpt_append(&rc, batch, commit_len);
+    if (ret == SGX_SUCCESS && rc != 0)
+        ret = SGX_ERROR_UNEXPECTED;
+    if (ret == SGX_SUCCESS) {
+        memcpy(&ckpt_manifest, next, sizeof *next);
+        memset(ckpt_dirty, 0, sizeof ckpt_dirty);
+        *pages = count;
+        METRIC_T_ADD(METRIC_T_CKPT_PAGES_SEALED, count);
+    }
+
+out:
+    sgx_thread_mutex_unlock(&ckpt_lock);
+    TRACE_T_END(TRACE_T_CKPT_FLUSH);
+    free(batch);
+    free(next);
+    return ret;
+}
+
+/* Benchmark helper: dirties `count` pages starting at `first`. */
+sgx_status_t ecall_ckpt_touch(uint32_t first, uint32_t count) {
+    uint32_t i;
+    uint64_t stamp;
+    sgx_status_t ret = SGX_SUCCESS;
+
+    for (i = 0; i < count && ret == SGX_SUCCESS; ++i) {
+        if (first + i >= CKPT_MAX_PAGES)
+            return SGX_ERROR_INVALID_PARAMETER;
+        stamp = ((uint64_t) (first + i) << 32) | i;
+        /* the last word of each page, clear of the fixed regions */
+        ret = ckpt_write((first + i + 1) * CKPT_PAGE_SIZE - sizeof stamp, &stamp, sizeof stamp);
+    }
+    return ret;
+}
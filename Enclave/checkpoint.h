@@ -0,0 +1,27 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+#include "sgx_error.h"
+#include "checkpoint_format.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Trusted side of the checkpoint. State is addressed by byte offset into
+ * CKPT_MAX_PAGES * CKPT_PAGE_SIZE bytes; pages are fetched and unsealed on
+ * first access after ecall_ckpt_open and re-sealed by ecall_ckpt_flush only
+ * when written since the last flush. */
+
+/* Fixed regions of the checkpointed state. */
+#define CKPT_TE_SHARE_OFFSET 0
+
+sgx_status_t ckpt_read(uint32_t offset, void *buf, uint32_t len);
+sgx_status_t ckpt_write(uint32_t offset, const void *buf, uint32_t len);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_CHECKPOINT_H_ */
@@ -0,0 +1,81 @@
+#include "Enclave_t.h"
+#include "edl_bench.h"
+
+#include "sgx_trts.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/* EDL transition matrix, driven by test_edl_matrix in App.c. The ecall
+ * bodies are deliberately empty: whatever a call costs beyond ecall_empty is
+ * the marshalling edger8r generates for its parameter attributes. The
+ * user_check variant does the bounds check a real interface would need. */
+
+void ecall_edl_in(const uint8_t *buf, size_t len) {
+    (void) buf;
+    (void) len;
+}
+
+void ecall_edl_out(uint8_t *buf, size_t len) {
+    (void) buf;
+    (void) len;
+}
+
+void ecall_edl_inout(uint8_t *buf, size_t len) {
+    (void) buf;
+    (void) len;
+}
+
+int ecall_edl_user_check(uint8_t *buf, size_t len) {
+    return len == 0 || sgx_is_outside_enclave(buf, len);
+}
+
+void ecall_edl_in_count(const uint64_t *buf, size_t n) {
+    (void) buf;
+    (void) n;
+}
+
+/* Times `iters` ocalls of one shape with a `len`-byte trusted buffer. The
+ * user_check ocall gets an enclave pointer the App never dereferences. */
+sgx_status_t ecall_edl_ocall_bench(uint32_t kind, uint64_t len, uint32_t iters,
+                                   uint64_t *elapsed_ns) {
+    sgx_status_t ret = SGX_SUCCESS;
+    uint64_t s, e;
+    uint8_t *buf;
+    uint32_t i;
+
+    if (kind >= EDL_BENCH_KINDS || elapsed_ns == NULL || len > edl_bench_max_bytes(1, kind) ||
+        (kind == EDL_BENCH_IN_COUNT && len % sizeof(uint64_t) != 0))
+        return SGX_ERROR_INVALID_PARAMETER;
+    buf = (uint8_t *) calloc(1, len ? len : 1);
+    if (buf == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    ocall_get_time_ns(&s);
+    for (i = 0; i < iters && ret == SGX_SUCCESS; ++i) {
+        switch (kind) {
+        case EDL_BENCH_EMPTY:
+            ret = ocall_edl_empty();
+            break;
+        case EDL_BENCH_IN:
+            ret = ocall_edl_in(buf, len);
+            break;
+        case EDL_BENCH_OUT:
+            ret = ocall_edl_out(buf, len);
+            break;
+        case EDL_BENCH_INOUT:
+            ret = ocall_edl_inout(buf, len);
+            break;
+        case EDL_BENCH_USER_CHECK:
+            ret = ocall_edl_user_check(buf, len);
+            break;
+        default:
+            ret = ocall_edl_in_count((const uint64_t *) buf, len / sizeof(uint64_t));
+            break;
+        }
+    }
+    ocall_get_time_ns(&e);
+
+    free(buf);
+    *elapsed_ns = e - s;
+    return ret;
+}
@@ -0,0 +1,118 @@
+#include "Enclave_t.h"
+#include "epc_bench.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* EPC paging benchmark, driven by test_epc_bench in App.c.
+ *
+ * One buffer is allocated up front and every run uses a prefix of it as its
+ * working set. ecall_epc_prepare writes the whole working set, so the timed
+ * run starts from the steady state of that size instead of from first-touch
+ * faults. Patterns (EPC_PATTERN_* in Include/epc_bench.h):
+ *
+ * - sequential and strided walk 8-byte words `stride` bytes apart and wrap
+ *   onto the next word when they run off the end;
+ * - random reads chase a single cycle through all cache lines (Sattolo), so
+ *   every access depends on the previous one and ns/access is a latency;
+ *   random writes hit xorshift-chosen lines, one word past the chain link. */
+
+static uint8_t *epc_buf;
+static uint64_t epc_buf_bytes;
+
+static inline uint64_t xorshift64(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+sgx_status_t ecall_epc_alloc(uint64_t bytes) {
+    free(epc_buf);
+    epc_buf_bytes = 0;
+    epc_buf = (uint8_t *) malloc(bytes);
+    if (epc_buf == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+    epc_buf_bytes = bytes;
+    return SGX_SUCCESS;
+}
+
+void ecall_epc_free(void) {
+    free(epc_buf);
+    epc_buf = NULL;
+    epc_buf_bytes = 0;
+}
+
+static int epc_ws_valid(uint64_t working_set) {
+    return epc_buf != NULL && working_set >= 2 * EPC_LINE && working_set <= epc_buf_bytes &&
+           working_set % EPC_LINE == 0;
+}
+
+sgx_status_t ecall_epc_prepare(uint32_t pattern, uint64_t working_set, uint64_t seed) {
+    uint64_t lines = working_set / EPC_LINE, i, j, tmp, *link;
+
+    if (!epc_ws_valid(working_set) || pattern > EPC_PATTERN_RANDOM)
+        return SGX_ERROR_INVALID_PARAMETER;
+    memset(epc_buf, 0, working_set);
+    if (pattern != EPC_PATTERN_RANDOM)
+        return SGX_SUCCESS;
+
+    /* Sattolo's shuffle of the identity yields one cycle over all lines */
+    for (i = 0; i < lines; ++i)
+        *(uint64_t *) (epc_buf + i * EPC_LINE) = i;
+    seed |= 1;
+    for (i = lines - 1; i > 0; --i) {
+        j = xorshift64(&seed) % i;
+        link = (uint64_t *) (epc_buf + j * EPC_LINE);
+        tmp = *(uint64_t *) (epc_buf + i * EPC_LINE);
+        *(uint64_t *) (epc_buf + i * EPC_LINE) = *link;
+        *link = tmp;
+    }
+    return SGX_SUCCESS;
+}
+
+sgx_status_t ecall_epc_run(uint32_t pattern, uint32_t write, uint64_t working_set,
+                           uint64_t stride, uint64_t accesses, uint64_t *elapsed_ns,
+                           uint64_t *checksum) {
+    uint64_t s, e, sum = 0, off = 0, base = 0, line = 0, seed = 88172645463325252ull;
+    uint64_t lines = working_set / EPC_LINE, n;
+
+    if (!epc_ws_valid(working_set) || pattern > EPC_PATTERN_RANDOM)
+        return SGX_ERROR_INVALID_PARAMETER;
+    if (pattern == EPC_PATTERN_SEQUENTIAL)
+        stride = sizeof(uint64_t);
+    if (stride == 0 || stride % sizeof(uint64_t) != 0 || stride >= working_set)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ocall_get_time_ns(&s);
+    if (pattern == EPC_PATTERN_RANDOM && !write) {
+        for (n = 0; n < accesses; ++n) {
+            line = *(volatile uint64_t *) (epc_buf + line * EPC_LINE);
+            sum += line;
+        }
+    } else if (pattern == EPC_PATTERN_RANDOM) {
+        for (n = 0; n < accesses; ++n) {
+            line = xorshift64(&seed) % lines;
+            *(volatile uint64_t *) (epc_buf + line * EPC_LINE + sizeof(uint64_t)) = n;
+        }
+    } else {
+        for (n = 0; n < accesses; ++n) {
+            if (write)
+                *(volatile uint64_t *) (epc_buf + off) = n;
+            else
+                sum += *(volatile uint64_t *) (epc_buf + off);
+            off += stride;
+            if (off >= working_set) {
+                base = (base + sizeof(uint64_t)) % stride;
+                off = base;
+            }
+        }
+    }
+    ocall_get_time_ns(&e);
+
+    *elapsed_ns = e - s;
+    *checksum = sum;
+    return SGX_SUCCESS;
+}
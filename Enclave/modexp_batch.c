@@ -0,0 +1,148 @@
+#include "Enclave_t.h"
+#include "modexp_batch.h"
+#include "modred.h"
+
+#include <stdint.h>
+#include "sgx_tgmp.h"
+#include "sgx_utils.h"
+
+/* Batch modular exponentiation, driven by test_modexp_batch in App.c.
+ *
+ * Every input of a batch shares the exponent, so the square-and-multiply
+ * schedule is the same for all of them and lanes never diverge. A batch
+ * runs as vectors of 64-bit lanes, one 32-bit residue per lane: a lane
+ * product is a single vpmuludq and the reduction mod 2^32 - 1 is two folds
+ * of the high half onto the low half. Two vectors are kept in flight so
+ * the multiplier is not stalled on one dependency chain.
+ *
+ * The vector kernels are compiled for their ISA through target attributes
+ * and the rest of the enclave stays baseline x86-64. There is no CPUID in
+ * an enclave, but the enclave's XFRM says whether it may use YMM (AVX) and
+ * ZMM (AVX-512) state at all; the caller's kernel is capped to that. */
+
+MODRED_MERSENNE(modexp_q, 32)
+
+typedef uint64_t modexp_v8_t __attribute__((vector_size(64)));
+
+#define MODEXP_MASK 0xffffffffull
+
+/* p = a * b mod 2^32 - 1 on lanes below 2^32. The result stays below 2^32
+ * but is not canonical: 2^32 - 1 may stand for 0. The masks let the
+ * compiler use the 32x32->64 lane multiply. */
+#define MODEXP_MUL(p, a, b)                                  \
+    do {                                                     \
+        (p) = ((a) & MODEXP_MASK) * ((b) & MODEXP_MASK);     \
+        (p) = ((p) & MODEXP_MASK) + ((p) >> 32);             \
+        (p) = ((p) & MODEXP_MASK) + ((p) >> 32);             \
+    } while (0)
+
+/* XFRM bits for SSE+AVX, and for the three AVX-512 state components. */
+#define MODEXP_XFRM_AVX 0x06ull
+#define MODEXP_XFRM_AVX512 0xe0ull
+
+static uint32_t modexp_widest = MODEXP_KERNELS; /* not known yet */
+
+/* The widest kernel the enclave's XFRM allows. */
+static uint32_t modexp_widest_kernel(void) {
+    uint32_t widest = __atomic_load_n(&modexp_widest, __ATOMIC_RELAXED);
+    uint64_t xfrm;
+
+    if (widest == MODEXP_KERNELS) {
+        xfrm = sgx_self_report()->body.attributes.xfrm;
+        widest = MODEXP_KERNEL_SCALAR;
+        if ((xfrm & MODEXP_XFRM_AVX) == MODEXP_XFRM_AVX)
+            widest = (xfrm & MODEXP_XFRM_AVX512) == MODEXP_XFRM_AVX512 ? MODEXP_KERNEL_AVX512
+                                                                       : MODEXP_KERNEL_AVX2;
+        __atomic_store_n(&modexp_widest, widest, __ATOMIC_RELAXED);
+    }
+    return widest;
+}
+
+/* Body of the vector kernels, for e >= 1. Returns how many inputs it did,
+ * a multiple of MODEXP_BATCH_LANES. */
+static inline __attribute__((always_inline)) uint32_t
+modexp_vector(const uint32_t *in, uint32_t *out, uint32_t n, uint64_t e) {
+    modexp_v8_t a0 = { 0 }, a1 = { 0 }, r0, r1;
+    uint32_t i, j;
+    int bit;
+
+    for (i = 0; i + MODEXP_BATCH_LANES <= n; i += MODEXP_BATCH_LANES) {
+        for (j = 0; j < 8; ++j) {
+            a0[j] = in[i + j];
+            a1[j] = in[i + 8 + j];
+        }
+        /* the top bit of e is set: start from a */
+        r0 = a0;
+        r1 = a1;
+        for (bit = 62 - __builtin_clzll(e); bit >= 0; --bit) {
+            MODEXP_MUL(r0, r0, r0);
+            MODEXP_MUL(r1, r1, r1);
+            if ((e >> bit) & 1) {
+                MODEXP_MUL(r0, r0, a0);
+                MODEXP_MUL(r1, r1, a1);
+            }
+        }
+        r0 &= ~(modexp_v8_t) (r0 == MODEXP_MASK);
+        r1 &= ~(modexp_v8_t) (r1 == MODEXP_MASK);
+        for (j = 0; j < 8; ++j) {
+            out[i + j] = (uint32_t) r0[j];
+            out[i + 8 + j] = (uint32_t) r1[j];
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static uint32_t
+modexp_avx2(const uint32_t *in, uint32_t *out, uint32_t n, uint64_t e) {
+    return modexp_vector(in, out, n, e);
+}
+
+__attribute__((target("avx512f"))) static uint32_t
+modexp_avx512(const uint32_t *in, uint32_t *out, uint32_t n, uint64_t e) {
+    return modexp_vector(in, out, n, e);
+}
+
+static void modexp_gmp(const uint32_t *in, uint32_t *out, uint32_t n, uint64_t e) {
+    mpz_t a, q;
+    uint32_t i;
+
+    mpz_init(a);
+    mpz_init_set_ui(q, UINT32_MAX);
+    for (i = 0; i < n; ++i) {
+        mpz_set_ui(a, in[i]);
+        mpz_powm_ui(a, a, e, q);
+        out[i] = (uint32_t) mpz_get_ui(a);
+    }
+    mpz_clear(a);
+    mpz_clear(q);
+}
+
+/* out[i] = in[i]^e mod 2^32 - 1 with the widest allowed kernel up to
+ * `kernel`; *used says which one ran. */
+sgx_status_t ecall_modexp_batch(uint32_t kernel, uint64_t e, const uint32_t *in,
+                                uint32_t *out, uint32_t n, uint32_t *used) {
+    uint32_t i, done = 0;
+
+    if (kernel >= MODEXP_KERNELS || n > MODEXP_BATCH_MAX)
+        return SGX_ERROR_INVALID_PARAMETER;
+    if (kernel > modexp_widest_kernel())
+        kernel = modexp_widest_kernel();
+    *used = kernel;
+
+    if (kernel == MODEXP_KERNEL_GMP) {
+        modexp_gmp(in, out, n, e);
+        return SGX_SUCCESS;
+    }
+    if (e == 0) {
+        for (i = 0; i < n; ++i)
+            out[i] = 1;
+        return SGX_SUCCESS;
+    }
+    if (kernel == MODEXP_KERNEL_AVX512)
+        done = modexp_avx512(in, out, n, e);
+    else if (kernel == MODEXP_KERNEL_AVX2)
+        done = modexp_avx2(in, out, n, e);
+    for (i = done; i < n; ++i)
+        out[i] = (uint32_t) modexp_q_pow(in[i], e);
+    return SGX_SUCCESS;
+}
@@ -0,0 +1,50 @@
+#include "Enclave_t.h"
+#include "ring_buffer.h"
+
+#include "sgx_trts.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Empty polls in a row after which the producer is considered gone. */
+#define RB_STALL_SPINS (1u << 26)
+
+/* Drains `count` elements from an SPSC ring the App is filling, `batch` at a
+ * time, and folds the first 8 bytes of every element into *checksum. */
+sgx_status_t ecall_rb_drain(void *mem, uint32_t capacity, uint32_t elem_size, uint32_t batch,
+                            uint64_t count, uint64_t *checksum) {
+    uint64_t done = 0, sum = 0, v;
+    uint32_t stall = 0;
+    uint8_t *buf;
+    rb_t rb;
+    int n;
+
+    if (batch == 0 || batch > capacity ||
+        rb_attach(&rb, mem, RB_SPSC, capacity, elem_size) != 0 ||
+        !sgx_is_outside_enclave(mem, rb_bytes(RB_SPSC, capacity, elem_size)))
+        return SGX_ERROR_INVALID_PARAMETER;
+    buf = (uint8_t *) malloc((size_t) batch * elem_size);
+    if (buf == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    while (done < count) {
+        n = rb_spsc_pop(&rb, buf, count - done < batch ? (uint32_t) (count - done) : batch);
+        if (n < 0 || (n == 0 && ++stall == RB_STALL_SPINS)) {
+            free(buf);
+            return SGX_ERROR_UNEXPECTED;
+        }
+        if (n == 0) {
+            __builtin_ia32_pause();
+            continue;
+        }
+        stall = 0;
+        for (int i = 0; i < n; ++i) {
+            v = 0;
+            memcpy(&v, buf + (size_t) i * elem_size, elem_size < sizeof v ? elem_size : sizeof v);
+            sum += v;
+        }
+        done += (uint64_t) n;
+    }
+    free(buf);
+    *checksum = sum;
+    return SGX_SUCCESS;
+}
@@ -0,0 +1,206 @@
+#include "Enclave_t.h"
+#include "scan.h"
+#include "scan_bench.h"
+
+#include <stdint.h>
+#include <string.h>
+#include "sgx_trts.h"
+
+/* Bulk scan kernels, driven by test_scan in App.c.
+ *
+ * Each one is meant to keep up with memory rather than with a division per
+ * byte: reductions are deferred for as long as the accumulators cannot
+ * overflow, and independent chains keep the core busy.
+ *
+ * - sum: psadbw adds 16 bytes into two 64-bit lanes per instruction.
+ * - Adler-32: plain 32-bit sums, reduced once every SCAN_ADLER_NMAX bytes.
+ * - CRC-32C: the SSE4.2 crc32 instruction, three streams over neighbouring
+ *   blocks at once to cover its latency. The streams are joined with
+ *   precomputed GF(2) shift matrices.
+ * - hash: four Horner chains over every fourth word, reduced with the
+ *   2^61 - 1 fold of Include/modred.h, and joined at the end.
+ * - histogram: four tables of 32-bit counts, so that runs of one byte
+ *   value do not serialise on one counter, flushed every SCAN_HIST_FLUSH
+ *   bytes.
+ *
+ * SSE2 is baseline x86-64; every CPU with SGX has SSE4.2. */
+
+#define SCAN_CRC_BLOCK 4096
+#define SCAN_HIST_FLUSH (1ull << 30)
+
+typedef char scan_v16qi_t __attribute__((vector_size(16)));
+typedef long long scan_v2di_t __attribute__((vector_size(16)));
+
+uint64_t scan_sum(const uint8_t *p, uint64_t len) {
+    const scan_v16qi_t zero = { 0 };
+    scan_v2di_t acc0 = { 0 }, acc1 = { 0 };
+    scan_v16qi_t v0, v1;
+    uint64_t i, sum;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        memcpy(&v0, p + i, sizeof v0);
+        memcpy(&v1, p + i + 16, sizeof v1);
+        acc0 += __builtin_ia32_psadbw128(v0, zero);
+        acc1 += __builtin_ia32_psadbw128(v1, zero);
+    }
+    acc0 += acc1;
+    sum = (uint64_t) acc0[0] + (uint64_t) acc0[1];
+    for (; i < len; ++i)
+        sum += p[i];
+    return sum;
+}
+
+uint32_t scan_adler32(const uint8_t *p, uint64_t len) {
+    uint32_t a = 1, b = 0, n;
+
+    while (len) {
+        n = len < SCAN_ADLER_NMAX ? (uint32_t) len : SCAN_ADLER_NMAX;
+        len -= n;
+        for (; n >= 8; n -= 8, p += 8) {
+            a += p[0]; b += a;
+            a += p[1]; b += a;
+            a += p[2]; b += a;
+            a += p[3]; b += a;
+            a += p[4]; b += a;
+            a += p[5]; b += a;
+            a += p[6]; b += a;
+            a += p[7]; b += a;
+        }
+        for (; n; --n) {
+            a += *p++;
+            b += a;
+        }
+        a %= SCAN_ADLER_BASE;
+        b %= SCAN_ADLER_BASE;
+    }
+    return b << 16 | a;
+}
+
+/* Columns of the operators that shift a CRC register over one and two
+ * blocks of zeros. No column of an invertible operator is 0, so the last
+ * one doubles as the built flag. */
+static uint32_t scan_crc_shift[2][32];
+
+static void scan_crc_shift_init(void) {
+    uint32_t mat[2][32];
+
+    if (__atomic_load_n(&scan_crc_shift[1][31], __ATOMIC_ACQUIRE))
+        return;
+    for (int n = 0; n < 32; n++) {
+        mat[0][n] = scan_crc32c_shift(1u << n, SCAN_CRC_BLOCK);
+        mat[1][n] = scan_crc32c_shift(1u << n, 2 * SCAN_CRC_BLOCK);
+    }
+    /* identical whoever gets here first; the last column publishes */
+    memcpy(scan_crc_shift, mat, sizeof mat - sizeof mat[1][31]);
+    __atomic_store_n(&scan_crc_shift[1][31], mat[1][31], __ATOMIC_RELEASE);
+}
+
+__attribute__((target("sse4.2"))) static uint64_t
+scan_crc32c_block(uint64_t crc, const uint8_t *p, uint64_t len) {
+    uint64_t w;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&w, p, sizeof w);
+        crc = __builtin_ia32_crc32di(crc, w);
+    }
+    for (; len; --len)
+        crc = __builtin_ia32_crc32qi((uint32_t) crc, *p++);
+    return crc;
+}
+
+__attribute__((target("sse4.2"))) uint32_t scan_crc32c(const uint8_t *p, uint64_t len) {
+    uint64_t crc0 = 0xffffffff, crc1, crc2, w0, w1, w2;
+    uint64_t i;
+
+    if (len >= 3 * SCAN_CRC_BLOCK)
+        scan_crc_shift_init();
+    for (; len >= 3 * SCAN_CRC_BLOCK; len -= 3 * SCAN_CRC_BLOCK, p += 3 * SCAN_CRC_BLOCK) {
+        crc1 = crc2 = 0;
+        for (i = 0; i < SCAN_CRC_BLOCK; i += 8) {
+            memcpy(&w0, p + i, sizeof w0);
+            memcpy(&w1, p + SCAN_CRC_BLOCK + i, sizeof w1);
+            memcpy(&w2, p + 2 * SCAN_CRC_BLOCK + i, sizeof w2);
+            crc0 = __builtin_ia32_crc32di(crc0, w0);
+            crc1 = __builtin_ia32_crc32di(crc1, w1);
+            crc2 = __builtin_ia32_crc32di(crc2, w2);
+        }
+        crc0 = scan_gf2_times(scan_crc_shift[1], (uint32_t) crc0) ^
+               scan_gf2_times(scan_crc_shift[0], (uint32_t) crc1) ^ crc2;
+    }
+    return ~(uint32_t) scan_crc32c_block(crc0, p, len);
+}
+
+uint64_t scan_hash(const uint8_t *p, uint64_t len) {
+    const uint64_t k = SCAN_HASH_KEY, k2 = scan_p61_mul(k, k), k3 = scan_p61_mul(k2, k),
+                   k4 = scan_p61_mul(k2, k2);
+    uint64_t h0 = 0, h1 = 0, h2 = 0, h3 = 0, w[4], h, i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        memcpy(w, p + i, sizeof w);
+        h0 = scan_p61_reduce(scan_p61_mul(h0, k4) + scan_p61_reduce(w[0]));
+        h1 = scan_p61_reduce(scan_p61_mul(h1, k4) + scan_p61_reduce(w[1]));
+        h2 = scan_p61_reduce(scan_p61_mul(h2, k4) + scan_p61_reduce(w[2]));
+        h3 = scan_p61_reduce(scan_p61_mul(h3, k4) + scan_p61_reduce(w[3]));
+    }
+    h = scan_p61_reduce(scan_p61_mul(h0, k3) + scan_p61_mul(h1, k2));
+    h = scan_p61_reduce(h + scan_p61_reduce(scan_p61_mul(h2, k) + h3));
+    for (; i < len; i += 8) {
+        w[0] = 0;
+        memcpy(w, p + i, len - i < 8 ? len - i : 8);
+        h = scan_p61_reduce(scan_p61_mul(h, k) + scan_p61_reduce(w[0]));
+    }
+    return h;
+}
+
+void scan_histogram(const uint8_t *p, uint64_t len, uint64_t *bins) {
+    uint32_t count[4][256];
+    uint64_t i, n;
+
+    while (len) {
+        n = len < SCAN_HIST_FLUSH ? len : SCAN_HIST_FLUSH;
+        memset(count, 0, sizeof count);
+        for (i = 0; i + 4 <= n; i += 4) {
+            count[0][p[i]]++;
+            count[1][p[i + 1]]++;
+            count[2][p[i + 2]]++;
+            count[3][p[i + 3]]++;
+        }
+        for (; i < n; ++i)
+            count[0][p[i]]++;
+        for (i = 0; i < 256; ++i)
+            bins[i] += (uint64_t) count[0][i] + count[1][i] + count[2][i] + count[3][i];
+        p += n;
+        len -= n;
+    }
+}
+
+/* Runs `kernel` over len bytes of App memory at buf, in place. The result
+ * is a scan_result_t. */
+sgx_status_t ecall_scan(uint32_t kernel, const uint8_t *buf, uint64_t len, uint8_t *result,
+                        uint32_t result_len) {
+    scan_result_t r;
+
+    if (kernel >= SCAN_KERNELS || result_len != sizeof r ||
+        (len != 0 && !sgx_is_outside_enclave(buf, len)))
+        return SGX_ERROR_INVALID_PARAMETER;
+    memset(&r, 0, sizeof r);
+    switch (kernel) {
+    case SCAN_SUM:
+        r.value = scan_sum(buf, len);
+        break;
+    case SCAN_ADLER32:
+        r.value = scan_adler32(buf, len);
+        break;
+    case SCAN_CRC32C:
+        r.value = scan_crc32c(buf, len);
+        break;
+    case SCAN_HASH:
+        r.value = scan_hash(buf, len);
+        break;
+    case SCAN_HISTOGRAM:
+        scan_histogram(buf, len, r.histogram);
+        break;
+    }
+    memcpy(result, &r, sizeof r);
+    return SGX_SUCCESS;
+}
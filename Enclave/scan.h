@@ -0,0 +1,25 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Trusted bulk scan kernels (SCAN_* in Include/scan_bench.h), for other
+ * enclave code. */
+
+uint64_t scan_sum(const uint8_t *p, uint64_t len);
+uint32_t scan_adler32(const uint8_t *p, uint64_t len);
+uint32_t scan_crc32c(const uint8_t *p, uint64_t len);
+uint64_t scan_hash(const uint8_t *p, uint64_t len);
+
+/* Adds the byte counts of p to bins[256]. */
+void scan_histogram(const uint8_t *p, uint64_t len, uint64_t *bins);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_SCAN_H_ */
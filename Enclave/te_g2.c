@@ -0,0 +1,572 @@
+#include "te_g2.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Base field modulus, group order and the twist coefficient
+ * b' = 3 / (9 + i) of y^2 = x^3 + b'. */
+static const char *TE_Q =
+    "21888242871839275222246405745257275088696311157297823662689037894645226208583";
+static const char *TE_R =
+    "21888242871839275222246405745257275088548364400416034343698204186575808495617";
+static const char *TE_B0 =
+    "19485874751759354771024239261021720505790618469301721065564631296452457478373";
+static const char *TE_B1 =
+    "266929791119991161246907387137283842545076965332900288569378510910307636690";
+
+static const char *TE_G2_GEN[4] = {
+    "10857046999023057135944570762232829481370756359578518086990519993285655852781",
+    "11559732032986387107991004021392285783925812861821192530917403151452391805634",
+    "8495653923123431417604973247489272438418190587263600148770280649306958101930",
+    "4082367875863433681332203403145435568316851327593401208105741076214120093531",
+};
+
+/* ---- Fq2 = Fq[i] / (i^2 + 1); all values kept reduced to [0, q) ---- */
+
+static void fq2_init(te_fq2_t *a) {
+    mpz_init(a->c0);
+    mpz_init(a->c1);
+}
+
+static void fq2_clear(te_fq2_t *a) {
+    mpz_clear(a->c0);
+    mpz_clear(a->c1);
+}
+
+static void fq2_set(te_fq2_t *c, const te_fq2_t *a) {
+    mpz_set(c->c0, a->c0);
+    mpz_set(c->c1, a->c1);
+}
+
+static void fq2_set_ui(te_fq2_t *c, unsigned long v) {
+    mpz_set_ui(c->c0, v);
+    mpz_set_ui(c->c1, 0);
+}
+
+static int fq2_is_zero(const te_fq2_t *a) {
+    return mpz_sgn(a->c0) == 0 && mpz_sgn(a->c1) == 0;
+}
+
+static int fq2_equal(const te_fq2_t *a, const te_fq2_t *b) {
+    return mpz_cmp(a->c0, b->c0) == 0 && mpz_cmp(a->c1, b->c1) == 0;
+}
+
+static void fq_add(mpz_t c, const mpz_t a, const mpz_t b, const mpz_t q) {
+    mpz_add(c, a, b);
+    if (mpz_cmp(c, q) >= 0)
+        mpz_sub(c, c, q);
+}
+
+static void fq_sub(mpz_t c, const mpz_t a, const mpz_t b, const mpz_t q) {
+    mpz_sub(c, a, b);
+    if (mpz_sgn(c) < 0)
+        mpz_add(c, c, q);
+}
+
+static void fq2_add(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a, const te_fq2_t *b) {
+    fq_add(c->c0, a->c0, b->c0, ctx->q);
+    fq_add(c->c1, a->c1, b->c1, ctx->q);
+}
+
+static void fq2_sub(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a, const te_fq2_t *b) {
+    fq_sub(c->c0, a->c0, b->c0, ctx->q);
+    fq_sub(c->c1, a->c1, b->c1, ctx->q);
+}
+
+static void fq2_neg(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a) {
+    if (mpz_sgn(a->c0))
+        mpz_sub(c->c0, ctx->q, a->c0);
+    else
+        mpz_set_ui(c->c0, 0);
+    if (mpz_sgn(a->c1))
+        mpz_sub(c->c1, ctx->q, a->c1);
+    else
+        mpz_set_ui(c->c1, 0);
+}
+
+static void fq2_dbl(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a) {
+    fq2_add(ctx, c, a, a);
+}
+
+/* Karatsuba: three base field products, c may alias a or b. */
+static void fq2_mul(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a, const te_fq2_t *b) {
+    mpz_mul(ctx->t[0], a->c0, b->c0);
+    mpz_mul(ctx->t[1], a->c1, b->c1);
+    mpz_add(ctx->t[2], a->c0, a->c1);
+    mpz_add(ctx->t[3], b->c0, b->c1);
+    mpz_mul(ctx->t[2], ctx->t[2], ctx->t[3]);
+    mpz_sub(ctx->t[2], ctx->t[2], ctx->t[0]);
+    mpz_sub(ctx->t[2], ctx->t[2], ctx->t[1]);
+    mpz_sub(ctx->t[0], ctx->t[0], ctx->t[1]);
+    mpz_mod(c->c0, ctx->t[0], ctx->q);
+    mpz_mod(c->c1, ctx->t[2], ctx->q);
+}
+
+static void fq2_sqr(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a) {
+    mpz_add(ctx->t[0], a->c0, a->c1);
+    mpz_sub(ctx->t[1], a->c0, a->c1);
+    mpz_mul(ctx->t[2], a->c0, a->c1);
+    mpz_mul(ctx->t[0], ctx->t[0], ctx->t[1]);
+    mpz_mul_2exp(ctx->t[2], ctx->t[2], 1);
+    mpz_mod(c->c0, ctx->t[0], ctx->q);
+    mpz_mod(c->c1, ctx->t[2], ctx->q);
+}
+
+/* 1 / (a0 + a1 i) = (a0 - a1 i) / (a0^2 + a1^2); a must be nonzero. */
+static void fq2_inv(te_g2_ctx_t *ctx, te_fq2_t *c, const te_fq2_t *a) {
+    mpz_mul(ctx->t[0], a->c0, a->c0);
+    mpz_mul(ctx->t[1], a->c1, a->c1);
+    mpz_add(ctx->t[0], ctx->t[0], ctx->t[1]);
+    mpz_mod(ctx->t[0], ctx->t[0], ctx->q);
+    mpz_invert(ctx->t[0], ctx->t[0], ctx->q);
+    mpz_mul(ctx->t[1], a->c0, ctx->t[0]);
+    mpz_mul(ctx->t[2], a->c1, ctx->t[0]);
+    mpz_neg(ctx->t[2], ctx->t[2]);
+    mpz_mod(c->c0, ctx->t[1], ctx->q);
+    mpz_mod(c->c1, ctx->t[2], ctx->q);
+}
+
+static void fq_import(mpz_t v, const uint8_t *in) {
+    mpz_import(v, TE_FQ_BYTES, 1, 1, 1, 0, in);
+}
+
+/* v in [0, q) as exactly TE_FQ_LIMBS limbs, and back. */
+static void fq_to_limbs(mp_limb_t *out, const mpz_t v) {
+    size_t n = mpz_size(v);
+    memcpy(out, mpz_limbs_read(v), n * sizeof(mp_limb_t));
+    memset(out + n, 0, (TE_FQ_LIMBS - n) * sizeof(mp_limb_t));
+}
+
+static void fq_from_limbs(mpz_t v, const mp_limb_t *in) {
+    memcpy(mpz_limbs_write(v, TE_FQ_LIMBS), in, TE_FQ_LIMBS * sizeof(mp_limb_t));
+    mpz_limbs_finish(v, TE_FQ_LIMBS);
+}
+
+static void limbs_wipe(mp_limb_t *p, size_t n) {
+    volatile mp_limb_t *v = p;
+    size_t i;
+    for (i = 0; i < n; ++i)
+        v[i] = 0;
+}
+
+/* All ones when a == b, else zero, without a branch. */
+static mp_limb_t ct_eq_mask(unsigned a, unsigned b) {
+    return (mp_limb_t) 0 - (mp_limb_t) (((a ^ b) - 1u) >> (sizeof(unsigned) * 8 - 1));
+}
+
+static void fq_export(uint8_t *out, const mpz_t v) {
+    size_t len = (mpz_sizeinbase(v, 2) + 7) / 8;
+    memset(out, 0, TE_FQ_BYTES);
+    if (mpz_sgn(v))
+        mpz_export(out + TE_FQ_BYTES - len, NULL, 1, 1, 1, 0, v);
+}
+
+/* ---- points ---- */
+
+void te_g2_init(te_g2_t *p) {
+    fq2_init(&p->x);
+    fq2_init(&p->y);
+    fq2_init(&p->z);
+}
+
+void te_g2_clear(te_g2_t *p) {
+    fq2_clear(&p->x);
+    fq2_clear(&p->y);
+    fq2_clear(&p->z);
+}
+
+static void g2_set(te_g2_t *c, const te_g2_t *a) {
+    fq2_set(&c->x, &a->x);
+    fq2_set(&c->y, &a->y);
+    fq2_set(&c->z, &a->z);
+}
+
+static void g2_set_infinity(te_g2_t *c) {
+    fq2_set_ui(&c->x, 1);
+    fq2_set_ui(&c->y, 1);
+    fq2_set_ui(&c->z, 0);
+}
+
+static void g2_to_limbs(mp_limb_t *out, const te_g2_t *p) {
+    fq_to_limbs(out, p->x.c0);
+    fq_to_limbs(out + TE_FQ_LIMBS, p->x.c1);
+    fq_to_limbs(out + 2 * TE_FQ_LIMBS, p->y.c0);
+    fq_to_limbs(out + 3 * TE_FQ_LIMBS, p->y.c1);
+    fq_to_limbs(out + 4 * TE_FQ_LIMBS, p->z.c0);
+    fq_to_limbs(out + 5 * TE_FQ_LIMBS, p->z.c1);
+}
+
+static void g2_from_limbs(te_g2_t *p, const mp_limb_t *in) {
+    fq_from_limbs(p->x.c0, in);
+    fq_from_limbs(p->x.c1, in + TE_FQ_LIMBS);
+    fq_from_limbs(p->y.c0, in + 2 * TE_FQ_LIMBS);
+    fq_from_limbs(p->y.c1, in + 3 * TE_FQ_LIMBS);
+    fq_from_limbs(p->z.c0, in + 4 * TE_FQ_LIMBS);
+    fq_from_limbs(p->z.c1, in + 5 * TE_FQ_LIMBS);
+}
+
+/* dbl-2009-l for a = 0; c may alias a. */
+static void g2_dbl(te_g2_ctx_t *ctx, te_g2_t *c, const te_g2_t *a) {
+    te_fq2_t *A = &ctx->f[0], *B = &ctx->f[1], *C = &ctx->f[2], *D = &ctx->f[3];
+    te_fq2_t *E = &ctx->f[4], *F = &ctx->f[5];
+
+    if (fq2_is_zero(&a->z)) {
+        g2_set(c, a);
+        return;
+    }
+    fq2_sqr(ctx, A, &a->x);
+    fq2_sqr(ctx, B, &a->y);
+    fq2_sqr(ctx, C, B);
+    fq2_add(ctx, D, &a->x, B);
+    fq2_sqr(ctx, D, D);
+    fq2_sub(ctx, D, D, A);
+    fq2_sub(ctx, D, D, C);
+    fq2_dbl(ctx, D, D);
+    fq2_dbl(ctx, E, A);
+    fq2_add(ctx, E, E, A);
+    fq2_sqr(ctx, F, E);
+
+    fq2_mul(ctx, &c->z, &a->y, &a->z);
+    fq2_dbl(ctx, &c->z, &c->z);
+    fq2_sub(ctx, &c->x, F, D);
+    fq2_sub(ctx, &c->x, &c->x, D);
+    fq2_sub(ctx, &c->y, D, &c->x);
+    fq2_mul(ctx, &c->y, E, &c->y);
+    fq2_dbl(ctx, C, C);
+    fq2_dbl(ctx, C, C);
+    fq2_dbl(ctx, C, C);
+    fq2_sub(ctx, &c->y, &c->y, C);
+}
+
+/* add-2007-bl; c may alias a or b. */
+static void g2_add(te_g2_ctx_t *ctx, te_g2_t *c, const te_g2_t *a, const te_g2_t *b) {
+    te_fq2_t *Z1Z1 = &ctx->f[6], *Z2Z2 = &ctx->f[7], *U1 = &ctx->f[8], *U2 = &ctx->f[9];
+    te_fq2_t *S1 = &ctx->f[10], *S2 = &ctx->f[11];
+    te_fq2_t *H = &ctx->f[0], *I = &ctx->f[1], *J = &ctx->f[2], *R = &ctx->f[3], *V = &ctx->f[4];
+
+    if (fq2_is_zero(&a->z)) {
+        g2_set(c, b);
+        return;
+    }
+    if (fq2_is_zero(&b->z)) {
+        g2_set(c, a);
+        return;
+    }
+    fq2_sqr(ctx, Z1Z1, &a->z);
+    fq2_sqr(ctx, Z2Z2, &b->z);
+    fq2_mul(ctx, U1, &a->x, Z2Z2);
+    fq2_mul(ctx, U2, &b->x, Z1Z1);
+    fq2_mul(ctx, S1, &a->y, &b->z);
+    fq2_mul(ctx, S1, S1, Z2Z2);
+    fq2_mul(ctx, S2, &b->y, &a->z);
+    fq2_mul(ctx, S2, S2, Z1Z1);
+
+    if (fq2_equal(U1, U2)) {
+        if (fq2_equal(S1, S2))
+            g2_dbl(ctx, c, a);
+        else
+            g2_set_infinity(c);
+        return;
+    }
+
+    fq2_sub(ctx, H, U2, U1);
+    fq2_dbl(ctx, I, H);
+    fq2_sqr(ctx, I, I);
+    fq2_mul(ctx, J, H, I);
+    fq2_sub(ctx, R, S2, S1);
+    fq2_dbl(ctx, R, R);
+    fq2_mul(ctx, V, U1, I);
+
+    /* Z3 first: it is the last use of a->z and b->z. */
+    fq2_add(ctx, &c->z, &a->z, &b->z);
+    fq2_sqr(ctx, &c->z, &c->z);
+    fq2_sub(ctx, &c->z, &c->z, Z1Z1);
+    fq2_sub(ctx, &c->z, &c->z, Z2Z2);
+    fq2_mul(ctx, &c->z, &c->z, H);
+
+    fq2_sqr(ctx, &c->x, R);
+    fq2_sub(ctx, &c->x, &c->x, J);
+    fq2_sub(ctx, &c->x, &c->x, V);
+    fq2_sub(ctx, &c->x, &c->x, V);
+
+    fq2_sub(ctx, &c->y, V, &c->x);
+    fq2_mul(ctx, &c->y, R, &c->y);
+    fq2_mul(ctx, S1, S1, J);
+    fq2_dbl(ctx, S1, S1);
+    fq2_sub(ctx, &c->y, &c->y, S1);
+}
+
+/* ---- context ---- */
+
+void te_g2_ctx_init(te_g2_ctx_t *ctx) {
+    int i;
+
+    mpz_init_set_str(ctx->q, TE_Q, 10);
+    mpz_init_set_str(ctx->r, TE_R, 10);
+    mpz_init_set_str(ctx->b0, TE_B0, 10);
+    mpz_init_set_str(ctx->b1, TE_B1, 10);
+    for (i = 0; i < 4; ++i)
+        mpz_init(ctx->t[i]);
+    for (i = 0; i < 12; ++i)
+        fq2_init(&ctx->f[i]);
+    for (i = 0; i < TE_G2_TABLE; ++i)
+        te_g2_init(&ctx->table[i]);
+    te_g2_init(&ctx->tmp);
+}
+
+void te_g2_ctx_clear(te_g2_ctx_t *ctx) {
+    int i;
+
+    mpz_clear(ctx->q);
+    mpz_clear(ctx->r);
+    mpz_clear(ctx->b0);
+    mpz_clear(ctx->b1);
+    for (i = 0; i < 4; ++i)
+        mpz_clear(ctx->t[i]);
+    for (i = 0; i < 12; ++i)
+        fq2_clear(&ctx->f[i]);
+    for (i = 0; i < TE_G2_TABLE; ++i)
+        te_g2_clear(&ctx->table[i]);
+    te_g2_clear(&ctx->tmp);
+}
+
+void te_g2_generator(te_g2_ctx_t *ctx, te_g2_t *p) {
+    (void) ctx;
+    mpz_set_str(p->x.c0, TE_G2_GEN[0], 10);
+    mpz_set_str(p->x.c1, TE_G2_GEN[1], 10);
+    mpz_set_str(p->y.c0, TE_G2_GEN[2], 10);
+    mpz_set_str(p->y.c1, TE_G2_GEN[3], 10);
+    fq2_set_ui(&p->z, 1);
+}
+
+void te_mpz_wipe(mpz_t v) {
+    size_t n = mpz_size(v);
+    if (n) {
+        volatile mp_limb_t *limbs = mpz_limbs_modify(v, n);
+        size_t i;
+        for (i = 0; i < n; ++i)
+            limbs[i] = 0;
+    }
+    mpz_set_ui(v, 0);
+}
+
+/* ---- scalars ---- */
+
+int te_scalar_recode(te_g2_ctx_t *ctx, te_scalar_recoding_t *rec, const uint8_t k[TE_FR_BYTES]) {
+    mp_limb_t a[TE_FQ_LIMBS], b[TE_FQ_LIMBS], mask;
+    mpz_t s, t;
+    long d;
+    int i, ret = -1;
+
+    mpz_init(s);
+    mpz_init(t);
+    mpz_import(s, TE_FR_BYTES, 1, 1, 1, 0, k);
+    if (mpz_sgn(s) <= 0 || mpz_cmp(s, ctx->r) >= 0)
+        goto out;
+
+    /* The recoding needs an odd scalar; (r - k) * P = -(k * P). Both are
+     * computed and one is picked under a mask. */
+    rec->negate = mpz_even_p(s);
+    mpz_sub(t, ctx->r, s);
+    fq_to_limbs(a, s);
+    fq_to_limbs(b, t);
+    mask = (mp_limb_t) 0 - (mp_limb_t) rec->negate;
+    for (i = 0; i < (int) TE_FQ_LIMBS; ++i)
+        a[i] = (a[i] & ~mask) | (b[i] & mask);
+    fq_from_limbs(s, a);
+
+    /* d = (s mod 2^(W+1)) - 2^W leaves s - d = 2^(W+1) * floor(s / 2^(W+1))
+     * + 2^W, so the next s is 2 * floor(s / 2^(W+1)) + 1: odd again, with
+     * no branch on the digit. */
+    for (i = 0; i < TE_G2_DIGITS - 1; ++i) {
+        d = (long) mpz_fdiv_ui(s, 2 << TE_G2_WINDOW) - (1 << TE_G2_WINDOW);
+        rec->digit[i] = (signed char) d;
+        mpz_fdiv_q_2exp(s, s, TE_G2_WINDOW + 1);
+        mpz_mul_2exp(s, s, 1);
+        mpz_add_ui(s, s, 1);
+    }
+    /* 2^(WINDOW * (DIGITS - 1)) > r, so only the top digit is left. */
+    rec->digit[TE_G2_DIGITS - 1] = (signed char) mpz_get_ui(s);
+    ret = 0;
+
+out:
+    limbs_wipe(a, TE_FQ_LIMBS);
+    limbs_wipe(b, TE_FQ_LIMBS);
+    te_mpz_wipe(s);
+    te_mpz_wipe(t);
+    mpz_clear(s);
+    mpz_clear(t);
+    return ret;
+}
+
+/* ---- encoding ---- */
+
+/* r * p == O. The twist has cofactor points of small order, which would
+ * leak the share modulo those orders, and the (r - k) * P = -(k * P)
+ * recoding only holds in the subgroup. r is public, so a plain
+ * double-and-add does; it uses ctx->tmp, which te_g2_mul overwrites. */
+static int g2_in_subgroup(te_g2_ctx_t *ctx, const te_g2_t *p) {
+    te_g2_t *acc = &ctx->tmp;
+    size_t i = mpz_sizeinbase(ctx->r, 2);
+
+    g2_set(acc, p);
+    while (i-- > 1) {
+        g2_dbl(ctx, acc, acc);
+        if (mpz_tstbit(ctx->r, i - 1))
+            g2_add(ctx, acc, acc, p);
+    }
+    return fq2_is_zero(&acc->z);
+}
+
+int te_g2_decode(te_g2_ctx_t *ctx, te_g2_t *p, const uint8_t in[TE_G2_BYTES]) {
+    te_fq2_t *lhs = &ctx->f[0], *rhs = &ctx->f[1];
+
+    fq_import(p->x.c0, in);
+    fq_import(p->x.c1, in + TE_FQ_BYTES);
+    fq_import(p->y.c0, in + 2 * TE_FQ_BYTES);
+    fq_import(p->y.c1, in + 3 * TE_FQ_BYTES);
+    if (mpz_cmp(p->x.c0, ctx->q) >= 0 || mpz_cmp(p->x.c1, ctx->q) >= 0 ||
+        mpz_cmp(p->y.c0, ctx->q) >= 0 || mpz_cmp(p->y.c1, ctx->q) >= 0)
+        return -1;
+    if (fq2_is_zero(&p->x) && fq2_is_zero(&p->y))
+        return -1;
+    fq2_set_ui(&p->z, 1);
+
+    /* y^2 == x^3 + b' */
+    fq2_sqr(ctx, lhs, &p->y);
+    fq2_sqr(ctx, rhs, &p->x);
+    fq2_mul(ctx, rhs, rhs, &p->x);
+    fq_add(rhs->c0, rhs->c0, ctx->b0, ctx->q);
+    fq_add(rhs->c1, rhs->c1, ctx->b1, ctx->q);
+    if (!fq2_equal(lhs, rhs))
+        return -1;
+    return g2_in_subgroup(ctx, p) ? 0 : -1;
+}
+
+int te_g2_encode_batch(te_g2_ctx_t *ctx, uint8_t *out, te_g2_t *p, size_t n) {
+    te_fq2_t *acc, *inv = &ctx->f[0], *zi = &ctx->f[1], *zi2 = &ctx->f[2];
+    size_t i, m = 0;
+
+    acc = (te_fq2_t *) malloc((n ? n : 1) * sizeof(te_fq2_t));
+    if (acc == NULL)
+        return -1;
+
+    /* Montgomery's trick: acc[i] is the product of the nonzero z up to i. */
+    fq2_set_ui(inv, 1);
+    for (i = 0; i < n; ++i) {
+        fq2_init(&acc[i]);
+        if (!fq2_is_zero(&p[i].z)) {
+            fq2_mul(ctx, inv, inv, &p[i].z);
+            ++m;
+        }
+        fq2_set(&acc[i], inv);
+    }
+    if (m)
+        fq2_inv(ctx, inv, inv);
+
+    for (i = n; i-- > 0;) {
+        uint8_t *o = out + i * TE_G2_BYTES;
+        if (fq2_is_zero(&p[i].z)) {
+            memset(o, 0, TE_G2_BYTES);
+            continue;
+        }
+        /* inv holds 1 / acc[i] here */
+        if (i > 0)
+            fq2_mul(ctx, zi, inv, &acc[i - 1]);
+        else
+            fq2_set(zi, inv);
+        fq2_mul(ctx, inv, inv, &p[i].z);
+
+        fq2_sqr(ctx, zi2, zi);
+        fq2_mul(ctx, &p[i].x, &p[i].x, zi2);
+        fq2_mul(ctx, zi2, zi2, zi);
+        fq2_mul(ctx, &p[i].y, &p[i].y, zi2);
+        fq2_set_ui(&p[i].z, 1);
+
+        fq_export(o, p[i].x.c0);
+        fq_export(o + TE_FQ_BYTES, p[i].x.c1);
+        fq_export(o + 2 * TE_FQ_BYTES, p[i].y.c0);
+        fq_export(o + 3 * TE_FQ_BYTES, p[i].y.c1);
+    }
+
+    for (i = 0; i < n; ++i)
+        fq2_clear(&acc[i]);
+    free(acc);
+    return 0;
+}
+
+/* ---- scalar multiplication ---- */
+
+/* c = ctx->sel[idx], reading every entry. */
+static void g2_select(te_g2_ctx_t *ctx, te_g2_t *c, unsigned idx) {
+    mp_limb_t acc[TE_G2_LIMBS], mask;
+    unsigned e;
+    size_t k;
+
+    memset(acc, 0, sizeof acc);
+    for (e = 0; e < 2 * TE_G2_TABLE; ++e) {
+        mask = ct_eq_mask(e, idx);
+        for (k = 0; k < TE_G2_LIMBS; ++k)
+            acc[k] |= ctx->sel[e][k] & mask;
+    }
+    g2_from_limbs(c, acc);
+    limbs_wipe(acc, TE_G2_LIMBS);
+}
+
+/* Index of digit d into ctx->sel: |d| * P, or -|d| * P from the second
+ * half. */
+static unsigned digit_index(int d) {
+    unsigned neg = (unsigned) d >> (sizeof(unsigned) * 8 - 1);
+    int sign = -(int) neg;
+    unsigned abs = (unsigned) ((d ^ sign) - sign);
+
+    return ((abs - 1) >> 1) + neg * TE_G2_TABLE;
+}
+
+/* p = -p when flag is 1, without a branch on flag. */
+static void g2_cnd_neg(te_g2_ctx_t *ctx, te_g2_t *p, unsigned flag) {
+    mp_limb_t a[2 * TE_FQ_LIMBS], b[2 * TE_FQ_LIMBS];
+    mp_limb_t mask = (mp_limb_t) 0 - (mp_limb_t) flag;
+    size_t k;
+
+    fq2_neg(ctx, &ctx->f[0], &p->y);
+    fq_to_limbs(a, p->y.c0);
+    fq_to_limbs(a + TE_FQ_LIMBS, p->y.c1);
+    fq_to_limbs(b, ctx->f[0].c0);
+    fq_to_limbs(b + TE_FQ_LIMBS, ctx->f[0].c1);
+    for (k = 0; k < 2 * TE_FQ_LIMBS; ++k)
+        a[k] = (a[k] & ~mask) | (b[k] & mask);
+    fq_from_limbs(p->y.c0, a);
+    fq_from_limbs(p->y.c1, a + TE_FQ_LIMBS);
+}
+
+/* p has order r and the digits are odd, so the accumulator is k' * p with
+ * 16 <= k' <= r - 17 (r = 1 mod 32) before each addition of a digit in
+ * [-15, 15]: no addition meets O or doubles, and g2_add and g2_dbl take the
+ * same path for every scalar. */
+void te_g2_mul(te_g2_ctx_t *ctx, te_g2_t *out, const te_g2_t *p, const te_scalar_recoding_t *rec) {
+    te_g2_t *T = ctx->table, *S = &ctx->tmp;
+    int i, j;
+
+    /* T[j] = (2j + 1) * p; sel holds T and then -T */
+    g2_dbl(ctx, S, p);
+    g2_set(&T[0], p);
+    for (j = 1; j < TE_G2_TABLE; ++j)
+        g2_add(ctx, &T[j], &T[j - 1], S);
+    for (j = 0; j < TE_G2_TABLE; ++j) {
+        g2_to_limbs(ctx->sel[j], &T[j]);
+        fq2_neg(ctx, &S->y, &T[j].y);
+        memcpy(ctx->sel[j + TE_G2_TABLE], ctx->sel[j], sizeof ctx->sel[j]);
+        fq_to_limbs(ctx->sel[j + TE_G2_TABLE] + 2 * TE_FQ_LIMBS, S->y.c0);
+        fq_to_limbs(ctx->sel[j + TE_G2_TABLE] + 3 * TE_FQ_LIMBS, S->y.c1);
+    }
+
+    g2_select(ctx, out, digit_index(rec->digit[TE_G2_DIGITS - 1]));
+    for (i = TE_G2_DIGITS - 2; i >= 0; --i) {
+        for (j = 0; j < TE_G2_WINDOW; ++j)
+            g2_dbl(ctx, out, out);
+        g2_select(ctx, S, digit_index(rec->digit[i]));
+        g2_add(ctx, out, out, S);
+    }
+    g2_cnd_neg(ctx, out, (unsigned) rec->negate);
+}
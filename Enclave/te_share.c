@@ -0,0 +1,222 @@
+#include "Enclave_t.h"
+#include "checkpoint.h"
+#include "te_g2.h"
+#include "te_share.h"
+#include "trusted_trace.h"
+#include "trusted_metrics.h"
+
+#include "sgx_thread.h"
+#include "sgx_tseal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Threshold-encryption share holder.
+ *
+ * The share x_i only exists in plaintext inside the enclave. It is
+ * provisioned once, sealed for the host to store, and loaded back from the
+ * sealed blob on later runs. Loading recodes it for scalar multiplication;
+ * the recoding stays in trusted memory and every decryption-share call
+ * reuses it. The host sends only U points and receives x_i * U, the shares
+ * that TEBatch::Merge combines. The host still checks ciphertext validity
+ * (TEBatch::VerifyCiphertexts) before asking for shares; here each U is
+ * checked to lie on the twist and in the order-r subgroup, so small-order
+ * points cannot be used to learn the share.
+ *
+ * The sealed blob carries TE_SHARE_SEAL_TAG as its MAC text, and only blobs
+ * with that tag are loaded. ecall_unseal_data wants a tag of its own, so the
+ * share cannot be unsealed out to the host through it.
+ *
+ * When the checkpoint is open the share blob is also kept in its
+ * CKPT_TE_SHARE_OFFSET region, so a restarted enclave can get it back with
+ * ecall_te_share_restore after ecall_ckpt_open.
+ */
+
+static sgx_thread_mutex_t te_share_lock = SGX_THREAD_MUTEX_INITIALIZER;
+static int te_share_loaded = 0;
+static te_scalar_recoding_t te_share_rec;
+
+#define TE_SHARE_SEAL_TAG "te-share-v1"
+#define TE_SHARE_SEAL_TAG_LEN (sizeof TE_SHARE_SEAL_TAG - 1)
+
+typedef struct {
+    uint32_t version;
+    uint32_t signer_index;
+    uint32_t required_signers;
+    uint32_t total_signers;
+    uint8_t share[TE_FR_BYTES];
+} te_share_blob_t;
+
+/* Recodes and installs the share; the blob has been checked by the caller. */
+static sgx_status_t te_share_install(const te_share_blob_t *blob, int persist) {
+    te_g2_ctx_t ctx;
+    te_scalar_recoding_t rec;
+    sgx_status_t ret = SGX_SUCCESS;
+    int rc;
+
+    TRACE_T_BEGIN(TRACE_T_TE_SHARE_INSTALL);
+    te_g2_ctx_init(&ctx);
+    rc = te_scalar_recode(&ctx, &rec, blob->share);
+    te_g2_ctx_clear(&ctx);
+    TRACE_T_END(TRACE_T_TE_SHARE_INSTALL);
+    METRIC_T_INC(METRIC_T_TE_SHARE_INSTALLS);
+    if (rc != 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    /* Kept first, so a share that could not be checkpointed is not used.
+     * Without an open checkpoint (SGX_ERROR_INVALID_STATE) the sealed blob
+     * is the only copy. */
+    if (persist) {
+        ret = ckpt_write(CKPT_TE_SHARE_OFFSET, blob, sizeof *blob);
+        if (ret == SGX_ERROR_INVALID_STATE)
+            ret = SGX_SUCCESS;
+    }
+    if (ret == SGX_SUCCESS) {
+        sgx_thread_mutex_lock(&te_share_lock);
+        memcpy(&te_share_rec, &rec, sizeof rec);
+        te_share_loaded = 1;
+        sgx_thread_mutex_unlock(&te_share_lock);
+    }
+
+    memset_s(&rec, sizeof rec, 0, sizeof rec);
+    return ret;
+}
+
+static int te_share_blob_valid(const te_share_blob_t *blob) {
+    return blob->version == TE_SHARE_BLOB_VERSION && blob->signer_index >= 1 &&
+           blob->required_signers >= 1 && blob->required_signers <= blob->total_signers &&
+           blob->signer_index <= blob->total_signers;
+}
+
+uint32_t ecall_te_share_sealed_size(void) {
+    return sgx_calc_sealed_data_size(TE_SHARE_SEAL_TAG_LEN, sizeof(te_share_blob_t));
+}
+
+sgx_status_t ecall_te_share_provision(const uint8_t *share, uint32_t signer_index,
+                                      uint32_t required_signers, uint32_t total_signers,
+                                      uint8_t *sealed, uint32_t sealed_len) {
+    te_share_blob_t blob;
+    sgx_status_t ret;
+
+    if (share == NULL || sealed == NULL || sealed_len < ecall_te_share_sealed_size())
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    blob.version = TE_SHARE_BLOB_VERSION;
+    blob.signer_index = signer_index;
+    blob.required_signers = required_signers;
+    blob.total_signers = total_signers;
+    memcpy(blob.share, share, TE_FR_BYTES);
+
+    if (!te_share_blob_valid(&blob))
+        ret = SGX_ERROR_INVALID_PARAMETER;
+    else
+        ret = te_share_install(&blob, 1);
+    if (ret == SGX_SUCCESS)
+        ret = sgx_seal_data(TE_SHARE_SEAL_TAG_LEN, (const uint8_t *) TE_SHARE_SEAL_TAG,
+                            sizeof blob, (const uint8_t *) &blob, sealed_len,
+                            (sgx_sealed_data_t *) sealed);
+
+    memset_s(&blob, sizeof blob, 0, sizeof blob);
+    return ret;
+}
+
+sgx_status_t ecall_te_share_load(const uint8_t *sealed, uint32_t sealed_len,
+                                 uint32_t *signer_index) {
+    const sgx_sealed_data_t *data = (const sgx_sealed_data_t *) sealed;
+    te_share_blob_t blob;
+    uint8_t tag[TE_SHARE_SEAL_TAG_LEN];
+    uint32_t len = sizeof blob, tag_len = sizeof tag;
+    sgx_status_t ret;
+
+    if (sealed == NULL || signer_index == NULL || sealed_len < sizeof(sgx_sealed_data_t) ||
+        sgx_get_encrypt_txt_len(data) != sizeof blob ||
+        sgx_get_add_mac_txt_len(data) != sizeof tag ||
+        sealed_len < ecall_te_share_sealed_size())
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ret = sgx_unseal_data(data, tag, &tag_len, (uint8_t *) &blob, &len);
+    if (ret == SGX_SUCCESS &&
+        (tag_len != sizeof tag || memcmp(tag, TE_SHARE_SEAL_TAG, sizeof tag)))
+        ret = SGX_ERROR_MAC_MISMATCH;
+    if (ret == SGX_SUCCESS && (len != sizeof blob || !te_share_blob_valid(&blob)))
+        ret = SGX_ERROR_INVALID_PARAMETER;
+    if (ret == SGX_SUCCESS)
+        ret = te_share_install(&blob, 1);
+    if (ret == SGX_SUCCESS)
+        *signer_index = blob.signer_index;
+
+    memset_s(&blob, sizeof blob, 0, sizeof blob);
+    return ret;
+}
+
+/* Reinstalls the share from the checkpoint after a restart. */
+sgx_status_t ecall_te_share_restore(uint32_t *signer_index) {
+    te_share_blob_t blob;
+    sgx_status_t ret;
+
+    if (signer_index == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+    ret = ckpt_read(CKPT_TE_SHARE_OFFSET, &blob, sizeof blob);
+    if (ret == SGX_SUCCESS && !te_share_blob_valid(&blob))
+        ret = SGX_ERROR_INVALID_STATE;
+    if (ret == SGX_SUCCESS)
+        ret = te_share_install(&blob, 0);
+    if (ret == SGX_SUCCESS)
+        *signer_index = blob.signer_index;
+
+    memset_s(&blob, sizeof blob, 0, sizeof blob);
+    return ret;
+}
+
+/* points and shares are len bytes: len / TE_G2_BYTES encoded G2 points. The
+ * whole batch is rejected if any point is invalid. */
+sgx_status_t ecall_te_decryption_shares(const uint8_t *points, uint8_t *shares, uint32_t len) {
+    te_g2_ctx_t ctx;
+    te_scalar_recoding_t rec;
+    te_g2_t u, *out;
+    size_t n = len / TE_G2_BYTES, i;
+    int loaded;
+    sgx_status_t ret = SGX_SUCCESS;
+
+    if (points == NULL || shares == NULL || len % TE_G2_BYTES || n == 0 ||
+        n > TE_SHARE_MAX_BATCH)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_thread_mutex_lock(&te_share_lock);
+    loaded = te_share_loaded;
+    if (loaded)
+        memcpy(&rec, &te_share_rec, sizeof rec);
+    sgx_thread_mutex_unlock(&te_share_lock);
+    if (!loaded)
+        return SGX_ERROR_INVALID_STATE;
+
+    out = (te_g2_t *) malloc(n * sizeof(te_g2_t));
+    if (out == NULL) {
+        memset_s(&rec, sizeof rec, 0, sizeof rec);
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+    TRACE_T_BEGIN(TRACE_T_TE_SHARES);
+    te_g2_ctx_init(&ctx);
+    te_g2_init(&u);
+    for (i = 0; i < n; ++i)
+        te_g2_init(&out[i]);
+
+    for (i = 0; i < n && ret == SGX_SUCCESS; ++i) {
+        if (te_g2_decode(&ctx, &u, points + i * TE_G2_BYTES) != 0)
+            ret = SGX_ERROR_INVALID_PARAMETER;
+        else
+            te_g2_mul(&ctx, &out[i], &u, &rec);
+    }
+    if (ret == SGX_SUCCESS && te_g2_encode_batch(&ctx, shares, out, n) != 0)
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+
+    for (i = 0; i < n; ++i)
+        te_g2_clear(&out[i]);
+    free(out);
+    te_g2_clear(&u);
+    te_g2_ctx_clear(&ctx);
+    TRACE_T_END(TRACE_T_TE_SHARES);
+    if (ret == SGX_SUCCESS)
+        METRIC_T_ADD(METRIC_T_TE_SHARES, n);
+    memset_s(&rec, sizeof rec, 0, sizeof rec);
+    return ret;
+}
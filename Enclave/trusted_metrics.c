@@ -0,0 +1,70 @@
+#include "Enclave_t.h"
+#include "trusted_metrics.h"
+
+#include <string.h>
+#include <sgx_thread.h>
+
+/* One slot per TCS, padded so threads do not share lines. A TCS runs one
+ * thread at a time, so its slot needs no atomic add. The slot is keyed on
+ * the TCS (sgx_thread_self) and not kept in TLS: with TCSPolicy 1 the
+ * runtime re-initialises TLS on every root ecall. Slots are claimed on first
+ * use and never given back; TCSNum bounds how many are claimed, and the last
+ * slot is shared (with atomic adds) by any TCS beyond METRICS_T_SLOTS - 1. */
+#define METRICS_T_SLOTS 16
+#define METRICS_T_SHARED (METRICS_T_SLOTS - 1)
+
+typedef struct {
+    uint64_t v[METRIC_T_COUNT];
+} __attribute__((aligned(64))) metrics_t_slot_t;
+
+static metrics_t_slot_t metrics_t_slots[METRICS_T_SLOTS];
+/* TCS owning each unshared slot, 0 while free. */
+static sgx_thread_t metrics_t_owner[METRICS_T_SHARED];
+
+/* Open addressing from a hash of the TCS address; a TCS finds its slot on
+ * the first probe unless it collided when claiming. */
+static int metrics_t_slot_of(sgx_thread_t self) {
+    uint32_t h = (uint32_t) (self >> 12) % METRICS_T_SHARED;
+    sgx_thread_t owner;
+
+    for (uint32_t i = 0; i < METRICS_T_SHARED; ++i) {
+        int s = (int) ((h + i) % METRICS_T_SHARED);
+
+        owner = __atomic_load_n(&metrics_t_owner[s], __ATOMIC_ACQUIRE);
+        if (owner == 0 &&
+            __atomic_compare_exchange_n(&metrics_t_owner[s], &owner, self, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            return s;
+        if (owner == self)
+            return s;
+    }
+    return METRICS_T_SHARED;
+}
+
+void metrics_t_add(uint32_t counter, uint64_t n) {
+    uint64_t *p;
+    int s;
+
+    if (counter >= METRIC_T_COUNT)
+        return;
+    s = metrics_t_slot_of(sgx_thread_self());
+    p = &metrics_t_slots[s].v[counter];
+    if (s == METRICS_T_SHARED)
+        __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/* All counters in one transition; len is in bytes. */
+sgx_status_t ecall_metrics_snapshot(uint8_t *values, uint32_t len) {
+    uint64_t sum[METRIC_T_COUNT];
+
+    if (len != sizeof sum)
+        return SGX_ERROR_INVALID_PARAMETER;
+    memset(sum, 0, sizeof sum);
+    for (int s = 0; s < METRICS_T_SLOTS; ++s)
+        for (int i = 0; i < METRIC_T_COUNT; ++i)
+            sum[i] += __atomic_load_n(&metrics_t_slots[s].v[i], __ATOMIC_RELAXED);
+    memcpy(values, sum, sizeof sum);
+    return SGX_SUCCESS;
+}
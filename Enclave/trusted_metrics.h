@@ -0,0 +1,24 @@
+#ifndef _TRUSTED_METRICS_H_
+#define _TRUSTED_METRICS_H_
+
+#include <stdint.h>
+#include "metrics.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Enclave counters (METRICS_TRUSTED_COUNTERS in Include/metrics.h). Each
+ * enclave thread adds into its own slot; ecall_metrics_snapshot sums them
+ * for the App's exporter. */
+
+void metrics_t_add(uint32_t counter, uint64_t n);
+
+#define METRIC_T_ADD(counter, n) metrics_t_add(counter, n)
+#define METRIC_T_INC(counter) metrics_t_add(counter, 1)
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_TRUSTED_METRICS_H_ */
@@ -0,0 +1,54 @@
+#include "Enclave_t.h"
+#include "trusted_trace.h"
+#include "ring_buffer.h"
+
+#include "sgx_thread.h"
+
+volatile int trace_t_enabled;
+
+static uint8_t trace_t_mem[sizeof(rb_shared_t) +
+                           TRACE_TRUSTED_EVENTS * RB_MPMC_STRIDE(sizeof(trace_trusted_event_t))]
+    __attribute__((aligned(RB_CACHE_LINE)));
+static rb_t trace_t_rb;
+static int trace_t_ready;
+static uint32_t trace_t_dropped;
+
+/* The buffer is set up on the first enable and kept across disables. */
+sgx_status_t ecall_trace_enable(int enable) {
+    if (enable && !trace_t_ready) {
+        rb_init(trace_t_mem, RB_MPMC, TRACE_TRUSTED_EVENTS, sizeof(trace_trusted_event_t));
+        rb_attach(&trace_t_rb, trace_t_mem, RB_MPMC, TRACE_TRUSTED_EVENTS,
+                  sizeof(trace_trusted_event_t));
+        __atomic_store_n(&trace_t_ready, 1, __ATOMIC_RELEASE);
+    }
+    trace_t_enabled = enable && trace_t_ready;
+    return SGX_SUCCESS;
+}
+
+void trace_t_event(uint32_t id, uint32_t phase) {
+    trace_trusted_event_t ev;
+
+    if (!__atomic_load_n(&trace_t_ready, __ATOMIC_ACQUIRE))
+        return;
+    ev.tsc = __builtin_ia32_rdtsc();
+    ev.tid = (uint64_t) sgx_thread_self();
+    ev.id = id;
+    ev.phase = phase;
+    if (rb_mpmc_push(&trace_t_rb, &ev) != 0)
+        __atomic_fetch_add(&trace_t_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* Moves up to TRACE_DRAIN_BATCH events out in one transition. */
+sgx_status_t ecall_trace_drain(uint8_t *events, uint32_t len, uint32_t *count,
+                               uint32_t *dropped) {
+    uint32_t n = len / sizeof(trace_trusted_event_t);
+    int got = 0;
+
+    if (n > TRACE_DRAIN_BATCH)
+        n = TRACE_DRAIN_BATCH;
+    if (__atomic_load_n(&trace_t_ready, __ATOMIC_ACQUIRE))
+        got = rb_mpmc_pop_batch(&trace_t_rb, events, n);
+    *count = (uint32_t) got;
+    *dropped = __atomic_exchange_n(&trace_t_dropped, 0, __ATOMIC_RELAXED);
+    return SGX_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#ifndef _TRUSTED_TRACE_H_
+#define _TRUSTED_TRACE_H_
+
+#include <stdint.h>
+#include "trace.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Trusted tracepoints (TRACE_TRUSTED_POINTS in Include/trace.h). Events
+ * go into a trusted buffer the App drains with ecall_trace_drain; when it
+ * is full they are dropped and counted. Stamped with RDTSC, so tracing is
+ * only switched on (ecall_trace_enable) where RDTSC is legal inside an
+ * enclave. */
+
+extern volatile int trace_t_enabled;
+
+void trace_t_event(uint32_t id, uint32_t phase);
+
+#if defined(TRACE_DISABLE)
+#define TRACE_T_BEGIN(id) do { } while (0)
+#define TRACE_T_END(id) do { } while (0)
+#else
+#define TRACE_T_POINT(id, phase)                       \
+    do {                                               \
+        if (__builtin_expect(trace_t_enabled, 0))      \
+            trace_t_event(id, phase);                  \
+    } while (0)
+#define TRACE_T_BEGIN(id) TRACE_T_POINT(id, TRACE_PHASE_BEGIN)
+#define TRACE_T_END(id) TRACE_T_POINT(id, TRACE_PHASE_END)
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_TRUSTED_TRACE_H_ */
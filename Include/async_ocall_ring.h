@@ -0,0 +1,46 @@
+#ifndef _ASYNC_OCALL_RING_H_
+#define _ASYNC_OCALL_RING_H_
+
+#include <stdint.h>
+#include "ring_buffer.h"
+
+/* Asynchronous ocalls.
+ *
+ * The App allocates an aocall_ring_t in untrusted memory and hands it to the
+ * enclave with ecall_aocall_register. Enclave threads post requests into
+ * the ring without leaving the enclave; one App thread services it. Requests
+ * that want a result carry a ticket, and the App publishes the result in
+ * `done` under that ticket. The enclave polls it, or parks in
+ * ocall_aocall_wait once spinning stops paying off.
+ *
+ * Requests travel through an MPMC ring_buffer.h ring of aocall_request_t. */
+#define AOCALL_RING_SLOTS 1024 /* power of two */
+#define AOCALL_PAYLOAD 240
+
+/* Operations understood by the App. */
+#define AOCALL_OP_NOP 0
+#define AOCALL_OP_LOG 1
+#define AOCALL_OP_TIME 2
+#define AOCALL_OP_MAX 16
+
+typedef struct {
+    uint64_t ticket; /* 0: fire and forget */
+    uint32_t op;
+    uint32_t len;
+    uint8_t payload[AOCALL_PAYLOAD];
+} aocall_request_t;
+
+typedef struct {
+    uint64_t ticket; /* stored last, with release semantics */
+    int64_t result;
+} aocall_completion_t;
+
+typedef struct {
+    uint8_t requests[sizeof(rb_shared_t) +
+                     AOCALL_RING_SLOTS * RB_MPMC_STRIDE(sizeof(aocall_request_t))]
+        __attribute__((aligned(RB_CACHE_LINE)));
+    /* Results of the last AOCALL_RING_SLOTS ticketed requests. */
+    aocall_completion_t done[AOCALL_RING_SLOTS] __attribute__((aligned(RB_CACHE_LINE)));
+} aocall_ring_t;
+
+#endif /* !_ASYNC_OCALL_RING_H_ */
@@ -0,0 +1,29 @@
+#ifndef _CHECKPOINT_FORMAT_H_
+#define _CHECKPOINT_FORMAT_H_
+
+#include <stdint.h>
+
+/* Checkpoint log shared by Enclave/checkpoint.c and App/checkpoint.c.
+ *
+ * Enclave state is kept in CKPT_MAX_PAGES pages of CKPT_PAGE_SIZE bytes.
+ * A flush appends one sealed record per dirty page followed by a sealed
+ * commit record (the manifest: the flush sequence that last wrote each
+ * page). The host only parses record headers; it never sees plaintext.
+ * Records of a flush whose commit never reached the file are ignored. */
+#define CKPT_MAGIC 0x54504b43 /* "CKPT" */
+#define CKPT_PAGE_SIZE 4096
+#define CKPT_MAX_PAGES 256
+#define CKPT_FLUSH_PAGES 64 /* page records per ocall_ckpt_append */
+
+#define CKPT_RECORD_PAGE 1
+#define CKPT_RECORD_COMMIT 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t page;       /* CKPT_RECORD_PAGE only */
+    uint32_t sealed_len; /* bytes of sealed data following the header */
+    uint64_t seq;        /* flush sequence, also bound into the sealed data */
+} ckpt_record_header_t;
+
+#endif /* !_CHECKPOINT_FORMAT_H_ */
@@ -0,0 +1,35 @@
+#ifndef _EDL_BENCH_H_
+#define _EDL_BENCH_H_
+
+/* Shared by Enclave/edl_bench.c and test_edl_matrix in App.c. */
+
+/* Parameter shapes, the same for ecalls and ocalls. */
+#define EDL_BENCH_EMPTY 0      /* no parameters: transition cost only */
+#define EDL_BENCH_IN 1         /* [in,size=len] */
+#define EDL_BENCH_OUT 2        /* [out,size=len] */
+#define EDL_BENCH_INOUT 3      /* [in,out,size=len] */
+#define EDL_BENCH_USER_CHECK 4 /* [user_check], nothing copied */
+#define EDL_BENCH_IN_COUNT 5   /* [in,count=n] of uint64_t */
+#define EDL_BENCH_KINDS 6
+
+/* Payloads go from 0 bytes to edl_bench_max_bytes() in powers of four. Every
+ * point repeats the call until about EDL_BENCH_VOLUME bytes have moved,
+ * between 1 and EDL_BENCH_MAX_ITERS times. */
+#define EDL_BENCH_MAX_BYTES (1ull << 30)
+/* Ocall buffers other than user_check are copied onto the untrusted stack
+ * of the calling thread by sgx_ocalloc, which touches every page, so ocall
+ * payloads stop well short of the default 8 MiB thread stack. */
+#define EDL_BENCH_MAX_OCALL_BYTES (1ull << 20)
+#define EDL_BENCH_VOLUME (1ull << 28)
+#define EDL_BENCH_MAX_ITERS 100000
+
+static inline unsigned long long edl_bench_max_bytes(int ocall, unsigned int kind) {
+    return ocall && kind != EDL_BENCH_USER_CHECK ? EDL_BENCH_MAX_OCALL_BYTES : EDL_BENCH_MAX_BYTES;
+}
+
+static inline unsigned long edl_bench_iters(unsigned long long len) {
+    unsigned long long n = len ? EDL_BENCH_VOLUME / len : EDL_BENCH_MAX_ITERS;
+    return n < 1 ? 1 : n > EDL_BENCH_MAX_ITERS ? EDL_BENCH_MAX_ITERS : (unsigned long) n;
+}
+
+#endif /* !_EDL_BENCH_H_ */
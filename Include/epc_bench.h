@@ -0,0 +1,23 @@
+#ifndef _EPC_BENCH_H_
+#define _EPC_BENCH_H_
+
+/* Shared by Enclave/epc_bench.c and test_epc_bench in App.c. */
+
+#define EPC_LINE 64
+
+#define EPC_PATTERN_SEQUENTIAL 0
+#define EPC_PATTERN_STRIDED 1
+#define EPC_PATTERN_RANDOM 2
+
+/* Strided runs touch one word per page. */
+#define EPC_BENCH_STRIDE 4096
+
+/* Smallest working set, well inside L3, and the cap on the largest one,
+ * which is otherwise four times the EPC. */
+#define EPC_BENCH_MIN_BYTES (1ull << 20)
+#define EPC_BENCH_MAX_BYTES (4ull << 30)
+
+/* Timed accesses per run, whatever the working set. */
+#define EPC_BENCH_ACCESSES (1ull << 24)
+
+#endif /* !_EPC_BENCH_H_ */
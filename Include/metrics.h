@@ -0,0 +1,139 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Runtime metrics: counters, gauges and latency histograms.
+ *
+ * Counters and histograms are kept per thread: an update is a plain store
+ * into a block owned by the calling thread, so it takes no lock and no
+ * atomic read-modify-write. Readers sum the blocks. A thread's block is
+ * handed to the next new thread when it exits, so totals survive thread
+ * churn without the memory growing. Gauges are single shared values.
+ *
+ * Histograms are HDR style: log-linear buckets with METRICS_HIST_SUB_BITS
+ * bits of precision (about 3% relative error) up to 2^METRICS_HIST_MAX_BITS
+ * (~18 minutes in ns); larger values land in the last bucket.
+ *
+ * The enclave keeps its own counters (METRICS_TRUSTED_COUNTERS). The
+ * exporter thread pulls them all in one ecall per interval. Snapshots are
+ * written in the Prometheus text format, to a file that is replaced
+ * atomically and/or to every client that connects to a Unix socket. */
+
+/* Untrusted counters: id, name. Exported as <name>_total and <name>_rate. */
+#define METRICS_COUNTERS(X)                        \
+    X(METRIC_ECALLS, "ecalls")                     \
+    X(METRIC_ECALL_BYTES, "ecall_bytes")           \
+    X(METRIC_AOCALLS, "aocalls_served")            \
+    X(METRIC_RA_SESSIONS, "ra_sessions")           \
+    X(METRIC_RA_FAILURES, "ra_failures")           \
+    X(METRIC_NET_SENT_BYTES, "net_sent_bytes")     \
+    X(METRIC_NET_RECV_BYTES, "net_recv_bytes")     \
+    X(METRIC_CRYPTO_OPS, "crypto_ops")             \
+    X(METRIC_DISPATCH_RETRIES, "dispatch_retries") \
+    X(METRIC_DISPATCH_RECREATES, "dispatch_recreates") \
+    X(METRIC_DISPATCH_REPLAYS, "dispatch_replays") \
+    X(METRIC_ENCLAVE_POOL_TAKES, "enclave_pool_takes") \
+    X(METRIC_ENCLAVE_POOL_EMPTY, "enclave_pool_empty") \
+    X(METRIC_ENCLAVE_POOL_FAILURES, "enclave_pool_failures") \
+    X(METRIC_SP_KEYS_GENERATED, "sp_keys_generated") \
+    X(METRIC_SP_KEY_POOL_MISSES, "sp_key_pool_misses") \
+    X(METRIC_SP_ECDSA_NONCES, "sp_ecdsa_nonces")   \
+    X(METRIC_SP_ECDSA_NONCE_MISSES, "sp_ecdsa_nonce_misses") \
+    X(METRIC_RA_MSG_POOL_MISSES, "ra_msg_pool_misses")
+
+#define METRICS_GAUGES(X)                          \
+    X(METRIC_RA_SESSIONS_ACTIVE, "ra_sessions_active") \
+    X(METRIC_ADMISSION_QUEUED, "admission_queued") \
+    X(METRIC_ENCLAVE_POOL_READY, "enclave_pool_ready") \
+    X(METRIC_SP_KEY_POOL_DEPTH, "sp_key_pool_depth") \
+    X(METRIC_SP_ECDSA_NONCE_DEPTH, "sp_ecdsa_nonce_depth")
+
+/* Latency histograms, in ns. */
+#define METRICS_HISTOGRAMS(X)                      \
+    X(METRIC_ECALL_NS, "ecall_ns")                 \
+    X(METRIC_RA_NS, "ra_ns")                       \
+    X(METRIC_DISPATCH_WAIT_NS, "dispatch_wait_ns") \
+    X(METRIC_ADMISSION_WAIT_NS, "admission_wait_ns") \
+    X(METRIC_ENCLAVE_CREATE_NS, "enclave_create_ns") \
+    X(METRIC_ENCLAVE_POOL_WAIT_NS, "enclave_pool_wait_ns") \
+    X(METRIC_RA_CONNECT_NS, "ra_connect_ns")       \
+    X(METRIC_RA_MSG0_NS, "ra_msg0_ns")             \
+    X(METRIC_RA_MSG1_NS, "ra_msg1_ns")             \
+    X(METRIC_RA_MSG3_NS, "ra_msg3_ns")
+
+/* Enclave counters, exported with an "enclave_" prefix. They restart from
+ * zero when the enclave is recreated. */
+#define METRICS_TRUSTED_COUNTERS(X)                         \
+    X(METRIC_T_TE_SHARES, "te_shares")                      \
+    X(METRIC_T_TE_SHARE_INSTALLS, "te_share_installs")      \
+    X(METRIC_T_CKPT_PAGES_SEALED, "ckpt_pages_sealed")      \
+    X(METRIC_T_CKPT_PAGES_UNSEALED, "ckpt_pages_unsealed")  \
+    X(METRIC_T_AOCALL_SUBMITTED, "aocall_submitted")        \
+    X(METRIC_T_AOCALL_PARKED, "aocall_parked")              \
+    X(METRIC_T_AOCALL_SYNC, "aocall_sync")
+
+#define METRICS_X_ENUM(id, name) id,
+enum { METRICS_COUNTERS(METRICS_X_ENUM) METRIC_COUNTER_COUNT };
+enum { METRICS_GAUGES(METRICS_X_ENUM) METRIC_GAUGE_COUNT };
+enum { METRICS_HISTOGRAMS(METRICS_X_ENUM) METRIC_HIST_COUNT };
+enum { METRICS_TRUSTED_COUNTERS(METRICS_X_ENUM) METRIC_T_COUNT };
+#undef METRICS_X_ENUM
+
+#define METRICS_HIST_SUB_BITS 6
+#define METRICS_HIST_MAX_BITS 40
+#define METRICS_HIST_BUCKETS \
+    ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 2) << (METRICS_HIST_SUB_BITS - 1))
+
+#define METRICS_DEFAULT_INTERVAL_MS 1000
+#define METRICS_MAX_WRITERS 8
+
+/* Fills values[0..count) with the enclave counters; 0 or -1. */
+typedef int (*metrics_trusted_fn)(uint64_t *values, uint32_t count);
+
+void metrics_add(uint32_t counter, uint64_t n);
+void metrics_record(uint32_t hist, uint64_t value);
+void metrics_gauge_add(uint32_t gauge, int64_t delta);
+void metrics_gauge_set(uint32_t gauge, int64_t value);
+
+/* Values of histogram hist at the quantiles q[0..n), each in (0, 1], into
+ * out, summed over all threads. Returns the count; out is zeroed when it
+ * is 0. For reports at the end of a run; the exporter has its own. */
+uint64_t metrics_hist_quantiles(uint32_t hist, const double *q, uint64_t *out, uint32_t n);
+
+/* Starts the exporter thread. Either path may be NULL, not both. */
+int metrics_start(const char *file, const char *socket_path, uint32_t interval_ms);
+void metrics_stop(void);
+
+/* Sets the enclave counter source, NULL for none. Once this returns the old
+ * one is no longer running, so clear it before destroying the enclave. */
+void metrics_set_trusted(metrics_trusted_fn trusted);
+
+/* Writes a snapshot now; 0 or -1. */
+int metrics_write(const char *file);
+
+/* Series that do not fit the fixed lists, such as ones with labels, come
+ * from writers called on every snapshot. emit takes printf arguments and
+ * `out` is passed through to it. */
+typedef void (*metrics_emit_fn)(void *out, const char *fmt, ...);
+typedef void (*metrics_writer_fn)(metrics_emit_fn emit, void *out, void *ctx);
+
+/* 0, or -1 when METRICS_MAX_WRITERS are registered. */
+int metrics_add_writer(metrics_writer_fn writer, void *ctx);
+void metrics_remove_writer(metrics_writer_fn writer, void *ctx);
+
+/* CLOCK_MONOTONIC in ns. */
+uint64_t metrics_now_ns(void);
+
+/* Accounts one ecall that started at start_ns and marshalled `bytes`. */
+void metrics_ecall_done(uint64_t start_ns, uint64_t bytes);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_METRICS_H_ */
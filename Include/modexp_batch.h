@@ -0,0 +1,19 @@
+#ifndef _MODEXP_BATCH_H_
+#define _MODEXP_BATCH_H_
+
+/* Shared by Enclave/modexp_batch.c and test_modexp_batch in App.c. */
+
+/* Kernels of ecall_modexp_batch, all computing in^e mod 2^32 - 1. */
+#define MODEXP_KERNEL_GMP 0    /* mpz_powm_ui per input: the reference */
+#define MODEXP_KERNEL_SCALAR 1 /* word-sized, one input at a time */
+#define MODEXP_KERNEL_AVX2 2   /* 4 lanes per register */
+#define MODEXP_KERNEL_AVX512 3 /* 8 lanes per register */
+#define MODEXP_KERNELS 4
+
+/* Inputs in flight per vector iteration: two independent 8-lane chains. */
+#define MODEXP_BATCH_LANES 16
+
+/* Largest batch per ecall. */
+#define MODEXP_BATCH_MAX (1u << 16)
+
+#endif /* !_MODEXP_BATCH_H_ */
@@ -0,0 +1,111 @@
+#ifndef _MODRED_H_
+#define _MODRED_H_
+
+#include <stdint.h>
+
+/* Modular arithmetic for a modulus fixed at compile time.
+ *
+ * Each macro defines name_reduce, name_mul and name_pow as static inline
+ * functions for one modulus, the C counterpart of a template instantiated
+ * on it. The reduction constants are constant expressions of the modulus,
+ * so they fold into immediates, and everything stays in one or two
+ * registers:
+ *
+ *   MODRED_MERSENNE(name, k)    q = 2^k - 1, 32 <= k <= 63. Since 2^k = 1
+ *                               (mod q), x mod q folds the bits above k
+ *                               onto the low ones. No multiply or divide.
+ *   MODRED_BARRETT(name, q)     2 <= q < 2^32. One high multiply by
+ *                               floor((2^64 - 1) / q) estimates x / q to
+ *                               within one, then one correction.
+ *   MODRED_MONTGOMERY(name, q)  odd q < 2^31. Values are kept as a * 2^32
+ *                               mod q; name_mul then needs two multiplies
+ *                               and a shift. Best for long chains such as
+ *                               name_pow. name_reduce and name_pow take and
+ *                               return plain values.
+ *
+ * name_reduce(x) takes any uint64_t (Montgomery: x < q * 2^32). name_mul and
+ * name_pow take values already below q and return values below q. An
+ * out-of-range modulus fails to compile. */
+
+#define MODRED_CHECK(name, cond) \
+    typedef char name##_modulus_check[(cond) ? 1 : -1]
+
+#define MODRED_MERSENNE(name, k)                                                \
+    MODRED_CHECK(name, (k) >= 32 && (k) <= 63);                                 \
+    static inline uint64_t name##_reduce(uint64_t x) {                          \
+        const uint64_t q = (UINT64_C(1) << (k)) - 1;                            \
+        x = (x & q) + (x >> (k));                                               \
+        x = (x & q) + (x >> (k));                                               \
+        return x >= q ? x - q : x;                                              \
+    }                                                                           \
+    static inline uint64_t name##_mul(uint64_t a, uint64_t b) {                 \
+        const uint64_t q = (UINT64_C(1) << (k)) - 1;                            \
+        unsigned __int128 p;                                                    \
+        if ((k) == 32)                                                          \
+            return name##_reduce(a * b);                                        \
+        p = (unsigned __int128) a * b; /* < 2^2k, so one fold fits 64 bits */   \
+        return name##_reduce(((uint64_t) p & q) + (uint64_t) (p >> (k)));       \
+    }                                                                           \
+    static inline uint64_t name##_pow(uint64_t a, uint64_t e) {                 \
+        uint64_t r = 1;                                                         \
+        a = name##_reduce(a);                                                   \
+        for (; e; e >>= 1, a = name##_mul(a, a))                                \
+            if (e & 1)                                                          \
+                r = name##_mul(r, a);                                           \
+        return name##_reduce(r);                                                \
+    }
+
+#define MODRED_BARRETT(name, q)                                                 \
+    MODRED_CHECK(name, (q) >= 2 && (q) <= UINT32_MAX);                          \
+    static inline uint32_t name##_reduce(uint64_t x) {                          \
+        const uint64_t m = UINT64_MAX / (q);                                    \
+        uint64_t r = x - (uint64_t) (((unsigned __int128) x * m) >> 64) * (q);  \
+        return (uint32_t) (r >= (q) ? r - (q) : r);                             \
+    }                                                                           \
+    static inline uint32_t name##_mul(uint32_t a, uint32_t b) {                 \
+        return name##_reduce((uint64_t) a * b);                                 \
+    }                                                                           \
+    static inline uint32_t name##_pow(uint32_t a, uint64_t e) {                 \
+        uint32_t r = name##_reduce(1);                                          \
+        for (; e; e >>= 1, a = name##_mul(a, a))                                \
+            if (e & 1)                                                          \
+                r = name##_mul(r, a);                                           \
+        return r;                                                               \
+    }
+
+/* -q^-1 mod 2^32 for odd q: Newton's iteration x = x(2 - qx) doubles the
+ * correct low bits, and x = q is right to 3 bits. */
+#define MODRED_INV_STEP(q, x) ((uint32_t) ((x) * (2u - (uint32_t) (q) * (x))))
+#define MODRED_NEG_INV32(q)                                                     \
+    ((uint32_t) (0u - MODRED_INV_STEP(q, MODRED_INV_STEP(q, MODRED_INV_STEP(q,  \
+                      MODRED_INV_STEP(q, (uint32_t) (q)))))))
+
+#define MODRED_MONTGOMERY(name, q)                                              \
+    MODRED_CHECK(name, ((q) & 1) && (q) >= 3 && (q) < (UINT32_C(1) << 31));     \
+    /* t * 2^-32 mod q, for t < q * 2^32 */                                     \
+    static inline uint32_t name##_redc(uint64_t t) {                            \
+        uint32_t m = (uint32_t) t * MODRED_NEG_INV32(q);                        \
+        uint32_t r = (uint32_t) ((t + (uint64_t) m * (q)) >> 32);               \
+        return r >= (q) ? r - (q) : r;                                          \
+    }                                                                           \
+    /* 2^64 mod q, which takes a value into Montgomery form */                  \
+    static inline uint32_t name##_r2(void) {                                    \
+        return (uint32_t) ((UINT64_MAX % (q) + 1) % (q));                       \
+    }                                                                           \
+    static inline uint32_t name##_reduce(uint64_t x) {                          \
+        return name##_redc((uint64_t) name##_redc(x) * name##_r2());            \
+    }                                                                           \
+    static inline uint32_t name##_mul(uint32_t a, uint32_t b) {                 \
+        return name##_redc((uint64_t) name##_redc((uint64_t) a * b) *           \
+                           name##_r2());                                        \
+    }                                                                           \
+    static inline uint32_t name##_pow(uint32_t a, uint64_t e) {                 \
+        uint32_t r = name##_redc(name##_r2()); /* 1 */                          \
+        a = name##_redc((uint64_t) a * name##_r2());                            \
+        for (; e; e >>= 1, a = name##_redc((uint64_t) a * a))                   \
+            if (e & 1)                                                          \
+                r = name##_redc((uint64_t) r * a);                              \
+        return name##_redc(r);                                                  \
+    }
+
+#endif /* !_MODRED_H_ */
@@ -0,0 +1,243 @@
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Bounded lock-free rings of fixed-size elements in memory shared between
+ * the App and the enclave.
+ *
+ * The App allocates rb_bytes() bytes outside the enclave, aligned to
+ * RB_CACHE_LINE, and formats them with rb_init(). Each side then attaches
+ * its own rb_t handle with the same capacity and element size. The handle
+ * lives in the attaching side's private memory and keeps the geometry and
+ * that side's own position there, so shared memory only ever supplies the
+ * other side's index and the slot contents:
+ *
+ * - geometry is never read back from shared memory;
+ * - an index that claims more elements than the ring holds makes the call
+ *   fail instead of walking off the slots;
+ * - pop copies every slot exactly once into the caller's buffer, so a
+ *   trusted consumer validates a private copy the host can no longer
+ *   change.
+ *
+ * SPSC rings have one producer handle and one consumer handle. Their
+ * batch calls move up to n elements with one index update. MPMC rings
+ * (Vyukov's bounded queue) tag every slot with a sequence number. Any
+ * number of handles may push and pop, and a batch is a loop of single
+ * operations. */
+
+#define RB_CACHE_LINE 64
+
+#define RB_SPSC 0
+#define RB_MPMC 1
+
+typedef struct {
+    uint64_t head __attribute__((aligned(RB_CACHE_LINE))); /* next position to write */
+    uint64_t tail __attribute__((aligned(RB_CACHE_LINE))); /* next position to read */
+} rb_shared_t;
+
+/* Distance between MPMC slots: the sequence number, then the element. */
+#define RB_MPMC_STRIDE(elem_size) ((sizeof(uint64_t) + (elem_size) + 7) & ~(size_t) 7)
+#define RB_STRIDE(kind, elem_size) \
+    ((kind) == RB_MPMC ? RB_MPMC_STRIDE(elem_size) : (size_t) (elem_size))
+
+typedef struct {
+    rb_shared_t *shm;
+    uint8_t *slots;
+    uint64_t mask;
+    uint32_t elem_size;
+    uint32_t stride;
+    int kind;
+    /* SPSC only: this side's position and the last seen peer position */
+    uint64_t pos;
+    uint64_t peer;
+} rb_t;
+
+static inline int rb_geometry_valid(uint32_t capacity, uint32_t elem_size) {
+    return capacity != 0 && (capacity & (capacity - 1)) == 0 && elem_size != 0 &&
+           elem_size <= (1u << 20);
+}
+
+static inline size_t rb_bytes(int kind, uint32_t capacity, uint32_t elem_size) {
+    return sizeof(rb_shared_t) + (size_t) capacity * RB_STRIDE(kind, elem_size);
+}
+
+/* Formats an empty ring in mem (rb_bytes() bytes). Owner side only, before
+ * either side attaches. */
+static inline int rb_init(void *mem, int kind, uint32_t capacity, uint32_t elem_size) {
+    size_t stride = RB_STRIDE(kind, elem_size);
+    uint8_t *slots = (uint8_t *) mem + sizeof(rb_shared_t);
+
+    if (mem == NULL || !rb_geometry_valid(capacity, elem_size))
+        return -1;
+    memset(mem, 0, rb_bytes(kind, capacity, elem_size));
+    if (kind == RB_MPMC) {
+        for (uint64_t i = 0; i < capacity; ++i)
+            *(uint64_t *) (slots + i * stride) = i;
+    }
+    return 0;
+}
+
+/* Fills in a handle for a ring formatted by rb_init that has not carried
+ * any traffic yet. */
+static inline int rb_attach(rb_t *rb, void *mem, int kind, uint32_t capacity,
+                            uint32_t elem_size) {
+    if (mem == NULL || (kind != RB_SPSC && kind != RB_MPMC) ||
+        !rb_geometry_valid(capacity, elem_size))
+        return -1;
+    rb->shm = (rb_shared_t *) mem;
+    rb->slots = (uint8_t *) mem + sizeof(rb_shared_t);
+    rb->mask = capacity - 1;
+    rb->elem_size = elem_size;
+    rb->stride = (uint32_t) RB_STRIDE(kind, elem_size);
+    rb->kind = kind;
+    rb->pos = 0;
+    rb->peer = 0;
+    return 0;
+}
+
+/* SPSC producer: pushes up to n elements, returns how many were pushed, or
+ * -1 if the consumer index is impossible. */
+static inline int rb_spsc_push(rb_t *rb, const void *elems, uint32_t n) {
+    const uint8_t *src = (const uint8_t *) elems;
+    uint64_t cap = rb->mask + 1, used, first, k;
+
+    used = rb->pos - rb->peer;
+    if (cap - used < n) {
+        rb->peer = __atomic_load_n(&rb->shm->tail, __ATOMIC_ACQUIRE);
+        used = rb->pos - rb->peer;
+        if (used > cap)
+            return -1;
+    }
+    if (n > cap - used)
+        n = (uint32_t) (cap - used);
+    if (n == 0)
+        return 0;
+
+    /* at most two runs: up to the end of the slots, then from the start */
+    first = rb->pos & rb->mask;
+    k = cap - first < n ? cap - first : n;
+    memcpy(rb->slots + first * rb->elem_size, src, k * rb->elem_size);
+    if (k < n)
+        memcpy(rb->slots, src + k * rb->elem_size, (n - k) * rb->elem_size);
+    rb->pos += n;
+    __atomic_store_n(&rb->shm->head, rb->pos, __ATOMIC_RELEASE);
+    return (int) n;
+}
+
+/* SPSC consumer: pops up to n elements into out, returns how many were
+ * popped, or -1 if the producer index is impossible. */
+static inline int rb_spsc_pop(rb_t *rb, void *out, uint32_t n) {
+    uint8_t *dst = (uint8_t *) out;
+    uint64_t cap = rb->mask + 1, avail, first, k;
+
+    avail = rb->peer - rb->pos;
+    if (avail < n) {
+        rb->peer = __atomic_load_n(&rb->shm->head, __ATOMIC_ACQUIRE);
+        avail = rb->peer - rb->pos;
+        if (avail > cap)
+            return -1;
+    }
+    if (n > avail)
+        n = (uint32_t) avail;
+    if (n == 0)
+        return 0;
+
+    first = rb->pos & rb->mask;
+    k = cap - first < n ? cap - first : n;
+    memcpy(dst, rb->slots + first * rb->elem_size, k * rb->elem_size);
+    if (k < n)
+        memcpy(dst + k * rb->elem_size, rb->slots, (n - k) * rb->elem_size);
+    rb->pos += n;
+    __atomic_store_n(&rb->shm->tail, rb->pos, __ATOMIC_RELEASE);
+    return (int) n;
+}
+
+/* MPMC: 0 if pushed, -1 if full. */
+static inline int rb_mpmc_push(rb_t *rb, const void *elem) {
+    uint64_t pos = __atomic_load_n(&rb->shm->head, __ATOMIC_RELAXED), seq;
+    uint8_t *slot;
+    int64_t diff;
+
+    for (;;) {
+        slot = rb->slots + (pos & rb->mask) * rb->stride;
+        seq = __atomic_load_n((uint64_t *) slot, __ATOMIC_ACQUIRE);
+        diff = (int64_t) (seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&rb->shm->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&rb->shm->head, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(slot + sizeof(uint64_t), elem, rb->elem_size);
+    __atomic_store_n((uint64_t *) slot, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* MPMC: 0 and *out filled if an element was popped, -1 if empty. */
+static inline int rb_mpmc_pop(rb_t *rb, void *out) {
+    uint64_t pos = __atomic_load_n(&rb->shm->tail, __ATOMIC_RELAXED), seq;
+    uint8_t *slot;
+    int64_t diff;
+
+    for (;;) {
+        slot = rb->slots + (pos & rb->mask) * rb->stride;
+        seq = __atomic_load_n((uint64_t *) slot, __ATOMIC_ACQUIRE);
+        diff = (int64_t) (seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&rb->shm->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&rb->shm->tail, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(out, slot + sizeof(uint64_t), rb->elem_size);
+    __atomic_store_n((uint64_t *) slot, pos + rb->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline int rb_mpmc_push_batch(rb_t *rb, const void *elems, uint32_t n) {
+    const uint8_t *src = (const uint8_t *) elems;
+    uint32_t i;
+
+    for (i = 0; i < n && rb_mpmc_push(rb, src + (size_t) i * rb->elem_size) == 0; ++i)
+        ;
+    return (int) i;
+}
+
+static inline int rb_mpmc_pop_batch(rb_t *rb, void *out, uint32_t n) {
+    uint8_t *dst = (uint8_t *) out;
+    uint32_t i;
+
+    for (i = 0; i < n && rb_mpmc_pop(rb, dst + (size_t) i * rb->elem_size) == 0; ++i)
+        ;
+    return (int) i;
+}
+
+/* Either kind. */
+static inline int rb_push(rb_t *rb, const void *elems, uint32_t n) {
+    return rb->kind == RB_MPMC ? rb_mpmc_push_batch(rb, elems, n) : rb_spsc_push(rb, elems, n);
+}
+
+static inline int rb_pop(rb_t *rb, void *out, uint32_t n) {
+    return rb->kind == RB_MPMC ? rb_mpmc_pop_batch(rb, out, n) : rb_spsc_pop(rb, out, n);
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_RING_BUFFER_H_ */
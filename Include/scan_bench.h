@@ -0,0 +1,134 @@
+#ifndef _SCAN_BENCH_H_
+#define _SCAN_BENCH_H_
+
+#include <stdint.h>
+#include "modred.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Bulk scan kernels, shared by Enclave/scan.c and test_scan in App.c.
+ *
+ * ecall_scan runs one kernel over App memory in place. Every kernel's
+ * result for A||B can be built from the results for A and B, so the App
+ * splits a large input across TCS threads and merges the pieces in order
+ * with scan_combine(). Every piece but the last must be a multiple of
+ * SCAN_ALIGN bytes long. */
+
+#define SCAN_SUM 0       /* sum of the bytes */
+#define SCAN_ADLER32 1   /* Adler-32, as zlib */
+#define SCAN_CRC32C 2    /* CRC-32C (Castagnoli), as iSCSI and ext4 */
+#define SCAN_HASH 3      /* polynomial hash of 64-bit words, see below */
+#define SCAN_HISTOGRAM 4 /* byte histogram */
+#define SCAN_KERNELS 5
+
+#define SCAN_ALIGN 8
+
+/* SCAN_HASH is sum(w[i] * K^(m-1-i)) mod 2^61 - 1 over the m little-endian
+ * 64-bit words of the input, the last one zero-padded and each taken mod
+ * 2^61 - 1. Not keyed and not cryptographic. */
+#define SCAN_HASH_KEY UINT64_C(0x0f1e2d3c4b5a6978)
+
+#define SCAN_ADLER_BASE 65521u
+/* Most bytes before the Adler-32 sums must be reduced to stay in 32 bits. */
+#define SCAN_ADLER_NMAX 5552
+
+#define SCAN_CRC32C_POLY 0x82f63b78u /* reflected */
+
+typedef struct {
+    uint64_t value; /* every kernel but SCAN_HISTOGRAM */
+    uint64_t histogram[256];
+} scan_result_t;
+
+MODRED_MERSENNE(scan_p61, 61)
+
+static inline uint32_t scan_gf2_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1)
+            sum ^= *mat;
+    return sum;
+}
+
+static inline void scan_gf2_square(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n++)
+        square[n] = scan_gf2_times(mat, mat[n]);
+}
+
+/* The CRC-32C register after `len` more zero bytes, as zlib's
+ * crc32_combine: squares the one-zero-bit operator up to a byte, then
+ * applies it for every set bit of len. */
+static inline uint32_t scan_crc32c_shift(uint32_t crc, uint64_t len) {
+    uint32_t even[32], odd[32], row = 1;
+
+    if (len == 0)
+        return crc;
+    odd[0] = SCAN_CRC32C_POLY;
+    for (int n = 1; n < 32; n++, row <<= 1)
+        odd[n] = row;
+    scan_gf2_square(even, odd); /* 2 zero bits */
+    scan_gf2_square(odd, even); /* 4 zero bits */
+    do {
+        scan_gf2_square(even, odd);
+        if (len & 1)
+            crc = scan_gf2_times(even, crc);
+        len >>= 1;
+        if (len == 0)
+            break;
+        scan_gf2_square(odd, even);
+        if (len & 1)
+            crc = scan_gf2_times(odd, crc);
+        len >>= 1;
+    } while (len);
+    return crc;
+}
+
+static inline uint32_t scan_adler32_combine(uint32_t a, uint32_t b, uint64_t b_len) {
+    uint32_t rem = (uint32_t) (b_len % SCAN_ADLER_BASE);
+    uint32_t sum1 = a & 0xffff;
+    uint32_t sum2 = rem * sum1 % SCAN_ADLER_BASE;
+
+    sum1 += (b & 0xffff) + SCAN_ADLER_BASE - 1;
+    sum2 += (a >> 16) + (b >> 16) + SCAN_ADLER_BASE - rem;
+    if (sum1 >= SCAN_ADLER_BASE)
+        sum1 -= SCAN_ADLER_BASE;
+    if (sum1 >= SCAN_ADLER_BASE)
+        sum1 -= SCAN_ADLER_BASE;
+    if (sum2 >= SCAN_ADLER_BASE << 1)
+        sum2 -= SCAN_ADLER_BASE << 1;
+    if (sum2 >= SCAN_ADLER_BASE)
+        sum2 -= SCAN_ADLER_BASE;
+    return sum1 | (sum2 << 16);
+}
+
+/* a = result of A||B, given a for A and b for the following b_len bytes. */
+static inline void scan_combine(uint32_t kernel, scan_result_t *a, const scan_result_t *b,
+                                uint64_t b_len) {
+    switch (kernel) {
+    case SCAN_SUM:
+        a->value += b->value;
+        break;
+    case SCAN_ADLER32:
+        a->value = scan_adler32_combine((uint32_t) a->value, (uint32_t) b->value, b_len);
+        break;
+    case SCAN_CRC32C:
+        a->value = scan_crc32c_shift((uint32_t) a->value, b_len) ^ b->value;
+        break;
+    case SCAN_HASH:
+        a->value = scan_p61_reduce(
+            scan_p61_mul(a->value, scan_p61_pow(SCAN_HASH_KEY, (b_len + 7) / 8)) + b->value);
+        break;
+    case SCAN_HISTOGRAM:
+        for (int i = 0; i < 256; i++)
+            a->histogram[i] += b->histogram[i];
+        break;
+    }
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_SCAN_BENCH_H_ */
@@ -0,0 +1,86 @@
+#ifndef _TE_G2_H_
+#define _TE_G2_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sgx_tgmp.h"
+#include "te_share.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* alt_bn128 G2 arithmetic on sgx_tgmp, enough to compute threshold
+ * decryption shares x_i * U inside the enclave. Built into the App as well
+ * so that the benchmark can run the identical code outside the enclave. */
+
+/* Signed fixed-window recoding of the share: every digit is odd and nonzero,
+ * so a scalar multiplication is always TE_G2_DIGITS - 1 rounds of
+ * TE_G2_WINDOW doublings and one addition, whatever the share is. */
+#define TE_G2_WINDOW 4
+#define TE_G2_TABLE (1 << (TE_G2_WINDOW - 1))
+#define TE_G2_DIGITS 65
+
+/* A point as fixed-size limbs, x.c0 x.c1 y.c0 y.c1 z.c0 z.c1, for the
+ * masked table lookup of te_g2_mul. */
+#define TE_FQ_LIMBS ((TE_FQ_BYTES + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t))
+#define TE_G2_LIMBS (6 * TE_FQ_LIMBS)
+
+typedef struct {
+    mpz_t c0, c1;
+} te_fq2_t;
+
+/* Jacobian coordinates; z == 0 is the point at infinity. */
+typedef struct {
+    te_fq2_t x, y, z;
+} te_g2_t;
+
+typedef struct {
+    signed char digit[TE_G2_DIGITS]; /* least significant first */
+    int negate;                      /* share was even, r - share was recoded */
+} te_scalar_recoding_t;
+
+/* Constants and scratch space for one thread. */
+typedef struct {
+    mpz_t q, r, b0, b1;
+    mpz_t t[4];
+    te_fq2_t f[12];
+    te_g2_t table[TE_G2_TABLE];
+    mp_limb_t sel[2 * TE_G2_TABLE][TE_G2_LIMBS]; /* table, then its negation */
+    te_g2_t tmp;
+} te_g2_ctx_t;
+
+void te_g2_ctx_init(te_g2_ctx_t *ctx);
+void te_g2_ctx_clear(te_g2_ctx_t *ctx);
+
+void te_g2_init(te_g2_t *p);
+void te_g2_clear(te_g2_t *p);
+void te_g2_generator(te_g2_ctx_t *ctx, te_g2_t *p);
+
+/* Returns -1 unless 0 < k < r. */
+int te_scalar_recode(te_g2_ctx_t *ctx, te_scalar_recoding_t *rec, const uint8_t k[TE_FR_BYTES]);
+
+/* Returns -1 for non-canonical coordinates, points off the twist, points
+ * outside the order-r subgroup and the point at infinity. */
+int te_g2_decode(te_g2_ctx_t *ctx, te_g2_t *p, const uint8_t in[TE_G2_BYTES]);
+
+/* out = k * p for the recoded secret k; p must come from te_g2_decode or be
+ * the generator. Every digit is looked up by reading the whole table under
+ * masks, and the signs of the digits and of the recoding are applied the
+ * same way, so the branches and memory accesses do not depend on k. The
+ * field arithmetic is still mpz, whose running time can vary with the
+ * values it works on; it is not a constant-time implementation. */
+void te_g2_mul(te_g2_ctx_t *ctx, te_g2_t *out, const te_g2_t *p, const te_scalar_recoding_t *rec);
+
+/* Converts n points to affine with a single field inversion and writes them
+ * out; the points are left normalized. Returns -1 on allocation failure. */
+int te_g2_encode_batch(te_g2_ctx_t *ctx, uint8_t *out, te_g2_t *p, size_t n);
+
+/* Overwrites the limbs of a secret value before it is cleared. */
+void te_mpz_wipe(mpz_t v);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_TE_G2_H_ */
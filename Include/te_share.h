@@ -0,0 +1,20 @@
+#ifndef _TE_SHARE_H_
+#define _TE_SHARE_H_
+
+/* Wire format shared by the enclave TE share holder and its callers.
+ * Field elements are 32-byte big endian; G2 points are affine
+ * X.c0 || X.c1 || Y.c0 || Y.c1, the same encoding as TEWriter::PutG2. */
+#define TE_FQ_BYTES 32
+#define TE_FR_BYTES 32
+#define TE_G2_BYTES (4 * TE_FQ_BYTES)
+
+/* Plain blob sealed by ecall_te_share_provision: version, signer index,
+ * required and total signers (uint32 each) followed by the share. Its sealed
+ * size is ecall_te_share_sealed_size. */
+#define TE_SHARE_BLOB_VERSION 1
+#define TE_SHARE_BLOB_BYTES (4 * 4 + TE_FR_BYTES)
+
+/* Upper bound on points per ecall_te_decryption_shares call. */
+#define TE_SHARE_MAX_BATCH 4096
+
+#endif /* !_TE_SHARE_H_ */
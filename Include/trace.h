@@ -0,0 +1,104 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Tracing, written out as Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ * Untrusted code marks spans with TRACE_BEGIN / TRACE_END. The category and
+ * name must be string literals: a tracepoint only stores the pointers, a
+ * timestamp and the phase into a buffer owned by the calling thread, so it
+ * takes no lock and does no I/O. A full thread buffer drops events and
+ * counts them. While tracing is off a tracepoint is a single predicted
+ * branch; building with -DTRACE_DISABLE removes them entirely.
+ *
+ * The enclave records its own tracepoints (TRACE_TRUSTED_POINTS) into a
+ * trusted buffer stamped with the TSC. The App drains it in batches with
+ * ecall_trace_drain and hands the events to trace_add_trusted, which puts
+ * them on the same time line.
+ *
+ * Nothing is formatted until trace_stop, which must run once the traced
+ * threads are quiet. */
+
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+/* Trusted tracepoints: id, category, name. */
+#define TRACE_TRUSTED_POINTS(X)                                   \
+    X(TRACE_T_TE_SHARES, "crypto", "te_decryption_shares")        \
+    X(TRACE_T_TE_SHARE_INSTALL, "crypto", "te_share_install")     \
+    X(TRACE_T_CKPT_FLUSH, "crypto", "ckpt_seal_flush")            \
+    X(TRACE_T_CKPT_FAULT, "crypto", "ckpt_unseal_page")           \
+    X(TRACE_T_AOCALL_WAIT, "ocall", "aocall_wait")
+
+#define TRACE_X_ENUM(id, cat, name) id,
+enum { TRACE_TRUSTED_POINTS(TRACE_X_ENUM) TRACE_T_COUNT };
+#undef TRACE_X_ENUM
+
+typedef struct {
+    uint64_t tsc;
+    uint64_t tid; /* enclave thread */
+    uint32_t id;
+    uint32_t phase;
+} trace_trusted_event_t;
+
+/* Capacity of the trusted buffer, and events per drain ecall. */
+#define TRACE_TRUSTED_EVENTS 8192
+#define TRACE_DRAIN_BATCH 1024
+
+/* Untrusted events per thread. */
+#define TRACE_THREAD_EVENTS (1 << 16)
+
+extern volatile int trace_enabled;
+
+/* Starts collecting; the JSON goes to path at trace_stop. 0 or -1. */
+int trace_start(const char *path);
+int trace_stop(void);
+
+void trace_event(const char *cat, const char *name, char phase);
+void trace_add_trusted(const trace_trusted_event_t *events, uint32_t count, uint32_t dropped);
+
+#if defined(TRACE_DISABLE)
+#define TRACE_BEGIN(cat, name) do { } while (0)
+#define TRACE_END(cat, name) do { } while (0)
+#define TRACE_INSTANT(cat, name) do { } while (0)
+#else
+#define TRACE_POINT(cat, name, phase)                      \
+    do {                                                   \
+        if (__builtin_expect(trace_enabled, 0))            \
+            trace_event(cat, name, phase);                 \
+    } while (0)
+#define TRACE_BEGIN(cat, name) TRACE_POINT(cat, name, TRACE_PHASE_BEGIN)
+#define TRACE_END(cat, name) TRACE_POINT(cat, name, TRACE_PHASE_END)
+#define TRACE_INSTANT(cat, name) TRACE_POINT(cat, name, TRACE_PHASE_INSTANT)
+#endif
+
+#if defined(__cplusplus)
+}
+
+/* Span covering the rest of the enclosing C++ scope. */
+class TraceScope {
+public:
+    TraceScope(const char *cat, const char *name) : cat_(cat), name_(name) {
+        TRACE_BEGIN(cat_, name_);
+    }
+    ~TraceScope() {
+        TRACE_END(cat_, name_);
+    }
+
+private:
+    const char *cat_;
+    const char *name_;
+};
+
+#define TRACE_SCOPE_VAR2(line) trace_scope_##line
+#define TRACE_SCOPE_VAR(line) TRACE_SCOPE_VAR2(line)
+#define TRACE_SCOPE(cat, name) TraceScope TRACE_SCOPE_VAR(__LINE__)(cat, name)
+#endif
+
+#endif /* !_TRACE_H_ */
@@ -32,10 +32,14 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include "ecp.h"
 
 #include "sample_libcrypto.h"
+#include "trace.h"
+#include "metrics.h"
 
 
 #define MAC_KEY_SIZE       16
@@ -74,6 +78,403 @@ bool verify_cmac128(
     return false;
 }
 
+void sp_wipe(void *p, size_t len)
+{
+    volatile uint8_t *v = (volatile uint8_t *)p;
+    while (len--)
+        *v++ = 0;
+}
+
+// Arithmetic mod n, the order of P-256, on four 64-bit limbs, least
+// significant first. Montgomery form is x * 2^256 mod n. Nothing branches
+// on the values, which are secret.
+typedef unsigned __int128 sp_u128_t;
+
+typedef struct _sp_ecdsa_nonce_t
+{
+    uint64_t r[4];      // R.x mod n
+    uint64_t k_inv[4];  // k^-1, Montgomery form
+} sp_ecdsa_nonce_t;
+
+static const uint64_t g_p256_n[4] = {
+    0xf3b9cac2fc632551ull, 0xbce6faada7179e84ull,
+    0xffffffffffffffffull, 0xffffffff00000000ull
+};
+static const uint64_t g_p256_n_2[4] = {     // n - 2, the inverse exponent
+    0xf3b9cac2fc63254full, 0xbce6faada7179e84ull,
+    0xffffffffffffffffull, 0xffffffff00000000ull
+};
+static const uint64_t g_p256_n_r2[4] = {    // 2^512 mod n
+    0x83244c95be79eea2ull, 0x4699799c49bd6fa6ull,
+    0x2845b2392b6bec59ull, 0x66e12d94f3d95620ull
+};
+#define P256_N_NEG_INV 0xccd1c8aaee00bc4full    // -n^-1 mod 2^64
+
+// r = a - n if hi:a >= n, else a.
+static void sp_n_reduce(uint64_t *r, const uint64_t *a, uint64_t hi)
+{
+    uint64_t d[4], borrow = 0, mask;
+
+    for (int i = 0; i < 4; i++)
+    {
+        sp_u128_t t = (sp_u128_t)a[i] - g_p256_n[i] - borrow;
+        d[i] = (uint64_t)t;
+        borrow = (uint64_t)(t >> 64) & 1;
+    }
+    mask = 0 - (uint64_t)((hi | (borrow ^ 1)) != 0);   // keep d
+    for (int i = 0; i < 4; i++)
+        r[i] = (d[i] & mask) | (a[i] & ~mask);
+}
+
+// r = a * b / 2^256 mod n, for a, b < n.
+static void sp_n_mont_mul(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    uint64_t t[6] = {0}, m;
+    sp_u128_t c;
+
+    for (int i = 0; i < 4; i++)
+    {
+        c = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            c += (sp_u128_t)a[j] * b[i] + t[j];
+            t[j] = (uint64_t)c;
+            c >>= 64;
+        }
+        c += t[4];
+        t[4] = (uint64_t)c;
+        t[5] = (uint64_t)(c >> 64);
+
+        m = t[0] * P256_N_NEG_INV;
+        c = ((sp_u128_t)m * g_p256_n[0] + t[0]) >> 64;
+        for (int j = 1; j < 4; j++)
+        {
+            c += (sp_u128_t)m * g_p256_n[j] + t[j];
+            t[j - 1] = (uint64_t)c;
+            c >>= 64;
+        }
+        c += t[4];
+        t[3] = (uint64_t)c;
+        t[4] = t[5] + (uint64_t)(c >> 64);
+    }
+    sp_n_reduce(r, t, t[4]);
+}
+
+// r = a + b mod n, for a, b < n.
+static void sp_n_add(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    uint64_t s[4];
+    sp_u128_t c = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        c += (sp_u128_t)a[i] + b[i];
+        s[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    sp_n_reduce(r, s, (uint64_t)c);
+}
+
+// r = a^-1, both in Montgomery form, by Fermat.
+static void sp_n_mont_inv(uint64_t *r, const uint64_t *a)
+{
+    uint64_t x[4];
+
+    // the top bit of n - 2 is set: start from a
+    memcpy(x, a, sizeof(x));
+    for (int bit = 254; bit >= 0; bit--)
+    {
+        sp_n_mont_mul(x, x, x);
+        if ((g_p256_n_2[bit / 64] >> (bit % 64)) & 1)
+            sp_n_mont_mul(x, x, a);
+    }
+    memcpy(r, x, sizeof(x));
+    sp_wipe(x, sizeof(x));
+}
+
+// Little-endian bytes, as in the sample_libcrypto key types, to limbs.
+static void sp_n_load_le(uint64_t *r, const uint8_t *p)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        r[i] = 0;
+        for (int j = 7; j >= 0; j--)
+            r[i] = r[i] << 8 | p[8 * i + j];
+    }
+}
+
+static pthread_once_t g_sp_ecdsa_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_sp_ecdsa_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_sp_ecdsa_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t g_sp_ecdsa_depth;
+static sp_ecdsa_nonce_t g_sp_ecdsa_nonce[SP_ECDSA_NONCE_POOL];
+
+// Makes up to SP_ECDSA_NONCE_BATCH nonces; returns how many.
+static uint32_t sp_ecdsa_make_batch(sp_ecdsa_nonce_t *batch,
+                                    sample_ecc_state_handle_t ecc_state)
+{
+    uint64_t k[SP_ECDSA_NONCE_BATCH][4], prefix[SP_ECDSA_NONCE_BATCH][4];
+    uint64_t inv[4];
+    sample_ec256_private_t priv;
+    sample_ec256_public_t pub;
+    uint32_t count = 0;
+
+    while (count < SP_ECDSA_NONCE_BATCH)
+    {
+        TRACE_BEGIN("crypto", "sample_ecc256_create_key_pair");
+        sample_status_t sample_ret = sample_ecc256_create_key_pair(&priv, &pub,
+                                                                   ecc_state);
+        TRACE_END("crypto", "sample_ecc256_create_key_pair");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
+        if (SAMPLE_SUCCESS != sample_ret)
+            break;
+        // R.x < p, and p < 2n
+        sp_n_load_le(batch[count].r, pub.gx);
+        sp_n_reduce(batch[count].r, batch[count].r, 0);
+        if ((batch[count].r[0] | batch[count].r[1] | batch[count].r[2] |
+             batch[count].r[3]) == 0)
+            continue;
+        sp_n_load_le(k[count], priv.r);
+        sp_n_mont_mul(k[count], k[count], g_p256_n_r2);
+        count++;
+    }
+    sp_wipe(&priv, sizeof(priv));
+    if (count == 0)
+        return 0;
+
+    // Montgomery's trick: one inversion of the product of all k, then
+    // each k^-1 from the prefix products.
+    memcpy(prefix[0], k[0], sizeof(prefix[0]));
+    for (uint32_t i = 1; i < count; i++)
+        sp_n_mont_mul(prefix[i], prefix[i - 1], k[i]);
+    sp_n_mont_inv(inv, prefix[count - 1]);
+    for (uint32_t i = count - 1; i > 0; i--)
+    {
+        sp_n_mont_mul(batch[i].k_inv, inv, prefix[i - 1]);
+        sp_n_mont_mul(inv, inv, k[i]);
+    }
+    memcpy(batch[0].k_inv, inv, sizeof(inv));
+
+    sp_wipe(k, sizeof(k));
+    sp_wipe(prefix, sizeof(prefix));
+    sp_wipe(inv, sizeof(inv));
+    return count;
+}
+
+static void *sp_ecdsa_fill(void *arg)
+{
+    sample_ecc_state_handle_t ecc_state = NULL;
+    sp_ecdsa_nonce_t batch[SP_ECDSA_NONCE_BATCH];
+    uint32_t count = 1, i;
+
+    (void)arg;
+    if (SAMPLE_SUCCESS != sample_ecc256_open_context(&ecc_state))
+        return NULL;
+    pthread_mutex_lock(&g_sp_ecdsa_lock);
+    while (count)
+    {
+        while (g_sp_ecdsa_depth > SP_ECDSA_NONCE_LOW)
+            pthread_cond_wait(&g_sp_ecdsa_cond, &g_sp_ecdsa_lock);
+        while (g_sp_ecdsa_depth < SP_ECDSA_NONCE_POOL)
+        {
+            pthread_mutex_unlock(&g_sp_ecdsa_lock);
+            count = sp_ecdsa_make_batch(batch, ecc_state);
+            pthread_mutex_lock(&g_sp_ecdsa_lock);
+            if (count == 0)
+                break;
+            for (i = 0; i < count && g_sp_ecdsa_depth < SP_ECDSA_NONCE_POOL; i++)
+                g_sp_ecdsa_nonce[g_sp_ecdsa_depth++] = batch[i];
+            metrics_add(METRIC_SP_ECDSA_NONCES, i);
+            metrics_gauge_add(METRIC_SP_ECDSA_NONCE_DEPTH, (int64_t)i);
+            sp_wipe(batch, sizeof(batch));
+        }
+    }
+    pthread_mutex_unlock(&g_sp_ecdsa_lock);
+
+    // signing falls back to sample_ecdsa_sign from here on
+    fprintf(stderr, "\nError, cannot generate nonces in [%s].", __FUNCTION__);
+    sample_ecc256_close_context(ecc_state);
+    return NULL;
+}
+
+static void sp_ecdsa_start_filler(void)
+{
+    pthread_t filler;
+
+    if (0 == pthread_create(&filler, NULL, sp_ecdsa_fill, NULL))
+        pthread_detach(filler);
+}
+
+void sp_ecdsa_start(void)
+{
+    pthread_once(&g_sp_ecdsa_once, sp_ecdsa_start_filler);
+}
+
+// Moves up to max nonces out of the pool; returns how many.
+static uint32_t sp_ecdsa_pop(sp_ecdsa_nonce_t *nonce, uint32_t max)
+{
+    uint32_t n = 0;
+
+    sp_ecdsa_start();
+    pthread_mutex_lock(&g_sp_ecdsa_lock);
+    while (n < max && g_sp_ecdsa_depth > 0)
+    {
+        sp_ecdsa_nonce_t *top = &g_sp_ecdsa_nonce[--g_sp_ecdsa_depth];
+        nonce[n++] = *top;
+        sp_wipe(top, sizeof(*top));
+    }
+    if (g_sp_ecdsa_depth <= SP_ECDSA_NONCE_LOW)
+        pthread_cond_signal(&g_sp_ecdsa_cond);
+    pthread_mutex_unlock(&g_sp_ecdsa_lock);
+    metrics_gauge_add(METRIC_SP_ECDSA_NONCE_DEPTH, -(int64_t)n);
+    return n;
+}
+
+// s = k^-1 (e + r d) mod n with a pooled nonce; d_mont is d in Montgomery
+// form.
+static sample_status_t sp_ecdsa_sign_nonce(const uint8_t *p_data,
+                                           uint32_t data_size,
+                                           const uint64_t *d_mont,
+                                           const sp_ecdsa_nonce_t *nonce,
+                                           sample_ec256_signature_t *p_signature)
+{
+    sample_sha256_hash_t hash;
+    uint64_t e[4], s[4];
+    sample_status_t sample_ret;
+
+    sample_ret = sample_sha256_msg(p_data, data_size, &hash);
+    if (SAMPLE_SUCCESS != sample_ret)
+        return sample_ret;
+    // the hash is a big-endian number; below 2^256 < 2n
+    for (int i = 0; i < 4; i++)
+    {
+        e[i] = 0;
+        for (int j = 0; j < 8; j++)
+            e[i] = e[i] << 8 | hash[32 - 8 * (i + 1) + j];
+    }
+    sp_n_reduce(e, e, 0);
+
+    sp_n_mont_mul(s, nonce->r, d_mont);
+    sp_n_add(s, s, e);
+    sp_n_mont_mul(s, s, nonce->k_inv);
+    // s == 0 has probability 2^-256; the verifier would reject it
+    for (int i = 0; i < 4; i++)
+    {
+        p_signature->x[2 * i] = (uint32_t)nonce->r[i];
+        p_signature->x[2 * i + 1] = (uint32_t)(nonce->r[i] >> 32);
+        p_signature->y[2 * i] = (uint32_t)s[i];
+        p_signature->y[2 * i + 1] = (uint32_t)(s[i] >> 32);
+    }
+    sp_wipe(s, sizeof(s));
+    return SAMPLE_SUCCESS;
+}
+
+typedef struct _sp_ecdsa_batch_t
+{
+    const uint8_t *const *p_data;
+    const uint32_t *data_size;
+    uint32_t count;
+    const sample_ec256_private_t *p_private;
+    sample_ec256_signature_t *p_signature;
+    sample_status_t status;
+} sp_ecdsa_batch_t;
+
+static void *sp_ecdsa_sign_range(void *arg)
+{
+    sp_ecdsa_batch_t *b = (sp_ecdsa_batch_t *)arg;
+    sample_ecc_state_handle_t ecc_state = NULL;
+    sp_ecdsa_nonce_t nonce[SP_ECDSA_NONCE_BATCH];
+    uint64_t d_mont[4];
+    uint32_t i = 0, n, j;
+
+    b->status = SAMPLE_SUCCESS;
+    sp_n_load_le(d_mont, b->p_private->r);
+    sp_n_mont_mul(d_mont, d_mont, g_p256_n_r2);
+    while (i < b->count && SAMPLE_SUCCESS == b->status)
+    {
+        n = b->count - i < SP_ECDSA_NONCE_BATCH ? b->count - i
+                                                : SP_ECDSA_NONCE_BATCH;
+        n = sp_ecdsa_pop(nonce, n);
+        if (n == 0)
+            break;
+        for (j = 0; j < n && SAMPLE_SUCCESS == b->status; j++, i++)
+            b->status = sp_ecdsa_sign_nonce(b->p_data[i], b->data_size[i],
+                                            d_mont, &nonce[j],
+                                            &b->p_signature[i]);
+        sp_wipe(nonce, sizeof(nonce));
+    }
+    sp_wipe(d_mont, sizeof(d_mont));
+    if (i == b->count || SAMPLE_SUCCESS != b->status)
+        return NULL;
+
+    // the pool ran dry
+    metrics_add(METRIC_SP_ECDSA_NONCE_MISSES, b->count - i);
+    b->status = sample_ecc256_open_context(&ecc_state);
+    for (; i < b->count && SAMPLE_SUCCESS == b->status; i++)
+        b->status = sample_ecdsa_sign(b->p_data[i], b->data_size[i],
+                                      (sample_ec256_private_t *)b->p_private,
+                                      &b->p_signature[i], ecc_state);
+    if (ecc_state)
+        sample_ecc256_close_context(ecc_state);
+    return NULL;
+}
+
+sample_status_t sp_ecdsa_sign_batch(const uint8_t *const *p_data,
+                                    const uint32_t *data_size,
+                                    uint32_t count,
+                                    const sample_ec256_private_t *p_private,
+                                    sample_ec256_signature_t *p_signature,
+                                    uint32_t threads)
+{
+    sp_ecdsa_batch_t part[SP_ECDSA_MAX_THREADS];
+    pthread_t tid[SP_ECDSA_MAX_THREADS];
+    uint32_t i, started, off = 0, each;
+    sample_status_t status = SAMPLE_SUCCESS;
+
+    if (threads == 0 || threads > SP_ECDSA_MAX_THREADS)
+        threads = SP_ECDSA_MAX_THREADS;
+    if (threads > count)
+        threads = count;
+    for (i = 0; i < threads; i++)
+    {
+        each = (count - off) / (threads - i);
+        part[i].p_data = p_data + off;
+        part[i].data_size = data_size + off;
+        part[i].count = each;
+        part[i].p_private = p_private;
+        part[i].p_signature = p_signature + off;
+        off += each;
+    }
+    // part 0 runs on the caller
+    for (started = 1; started < threads; started++)
+    {
+        if (pthread_create(&tid[started], NULL, sp_ecdsa_sign_range,
+                           &part[started]) != 0)
+            break;
+    }
+    for (i = started; i < threads; i++)
+        sp_ecdsa_sign_range(&part[i]);
+    if (threads)
+        sp_ecdsa_sign_range(&part[0]);
+    for (i = 1; i < started; i++)
+        pthread_join(tid[i], NULL);
+    for (i = 0; i < threads; i++)
+    {
+        if (SAMPLE_SUCCESS != part[i].status)
+            status = part[i].status;
+    }
+    return status;
+}
+
+sample_status_t sp_ecdsa_sign(const uint8_t *p_data,
+                              uint32_t data_size,
+                              const sample_ec256_private_t *p_private,
+                              sample_ec256_signature_t *p_signature)
+{
+    return sp_ecdsa_sign_batch(&p_data, &data_size, 1, p_private,
+                               p_signature, 1);
+}
+
 
 #ifdef SUPPLIED_KEY_DERIVATION
 
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 
 #include "remote_attestation_result.h"
+#include "sample_libcrypto.h"
 
 #ifndef SAMPLE_FEBITSIZE
     #define SAMPLE_FEBITSIZE                    256
@@ -106,6 +107,45 @@ bool verify_cmac128(
     const uint8_t *p_data_buf,
     uint32_t buf_size,
     const uint8_t *p_mac_buf);
+
+// memset that the compiler cannot drop, for secrets about to go out of use.
+void sp_wipe(void *p, size_t len);
+
+// ECDSA P-256 signing with precomputed nonces, for the fixed keys of the
+// service provider (MSG2) and of the simulated attestation server (report).
+//
+// The costly part of a signature, the nonce k and R = kG, does not depend on
+// the message or on the key. A background thread makes them ahead of time:
+// it takes k and R from sample_ecc256_create_key_pair, keeps r = R.x mod n
+// and inverts a whole batch of nonces with a single inversion mod n. A
+// signature is then SHA-256 and s = k^-1 (e + r d) mod n, three
+// multiplications mod n. Every nonce is used once and wiped. Signatures are
+// in the format of sample_ecdsa_sign, which also signs when no nonce is
+// ready.
+//
+// The pool holds up to SP_ECDSA_NONCE_POOL nonces and is refilled when it
+// falls to SP_ECDSA_NONCE_LOW. Its depth, the nonces made and the signatures
+// made without one go to the metrics registry.
+#define SP_ECDSA_NONCE_POOL     256
+#define SP_ECDSA_NONCE_LOW      64
+#define SP_ECDSA_NONCE_BATCH    16
+#define SP_ECDSA_MAX_THREADS    16
+
+// Starts the nonce filler, if not running yet; signing also starts it.
+void sp_ecdsa_start(void);
+
+sample_status_t sp_ecdsa_sign(const uint8_t *p_data,
+                              uint32_t data_size,
+                              const sample_ec256_private_t *p_private,
+                              sample_ec256_signature_t *p_signature);
+
+// Signs count messages with one key, on up to `threads` threads.
+sample_status_t sp_ecdsa_sign_batch(const uint8_t *const *p_data,
+                                    const uint32_t *data_size,
+                                    uint32_t count,
+                                    const sample_ec256_private_t *p_private,
+                                    sample_ec256_signature_t *p_signature,
+                                    uint32_t threads);
 #ifdef  __cplusplus
 }
 #endif
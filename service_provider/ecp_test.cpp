@@ -0,0 +1,148 @@
+// Checks the signatures of sp_ecdsa_sign and sp_ecdsa_sign_batch
+// (service_provider/ecp.cpp) against OpenSSL's ECDSA verifier. Built with
+// `make ecp_test`; exits non-zero on failure.
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include <openssl/sha.h>
+
+#include "ecp.h"
+#include "sample_libcrypto.h"
+
+// More than SP_ECDSA_NONCE_POOL, so the batch also signs through the
+// sample_ecdsa_sign fallback once the pool runs dry.
+#define ECP_TEST_MESSAGES   1000
+#define ECP_TEST_MAX_LEN    64
+#define ECP_TEST_THREADS    4
+
+static int g_failures;
+
+#define CHECK(cond) do {                                            \
+        if (!(cond)) {                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            g_failures++;                                           \
+        }                                                           \
+    } while (0)
+
+// sample_libcrypto keeps numbers little-endian; OpenSSL reads big-endian.
+static BIGNUM *ecp_test_bn(const uint8_t *le)
+{
+    uint8_t be[32];
+
+    for (int i = 0; i < 32; i++)
+        be[i] = le[31 - i];
+    return BN_bin2bn(be, sizeof(be), NULL);
+}
+
+static EC_KEY *ecp_test_key(const sample_ec256_public_t *pub)
+{
+    EC_KEY *key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    BIGNUM *x = ecp_test_bn(pub->gx), *y = ecp_test_bn(pub->gy);
+
+    if (key && 1 != EC_KEY_set_public_key_affine_coordinates(key, x, y))
+    {
+        EC_KEY_free(key);
+        key = NULL;
+    }
+    BN_free(x);
+    BN_free(y);
+    return key;
+}
+
+static int ecp_test_verify(EC_KEY *key, const uint8_t *p_data, uint32_t data_size,
+                           const sample_ec256_signature_t *p_signature)
+{
+    uint8_t hash[SHA256_DIGEST_LENGTH], r[32], s[32];
+    ECDSA_SIG *sig = ECDSA_SIG_new();
+    int ok;
+
+    // the signature words are little-endian limbs
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            r[4 * i + j] = (uint8_t)(p_signature->x[i] >> (8 * j));
+            s[4 * i + j] = (uint8_t)(p_signature->y[i] >> (8 * j));
+        }
+    }
+    ECDSA_SIG_set0(sig, ecp_test_bn(r), ecp_test_bn(s));
+    SHA256(p_data, data_size, hash);
+    ok = ECDSA_do_verify(hash, sizeof(hash), sig, key);
+    ECDSA_SIG_free(sig);
+    return ok;
+}
+
+int main(void)
+{
+    static uint8_t msg[ECP_TEST_MESSAGES][ECP_TEST_MAX_LEN];
+    static sample_ec256_signature_t sig[ECP_TEST_MESSAGES];
+    const uint8_t *p_data[ECP_TEST_MESSAGES];
+    uint32_t data_size[ECP_TEST_MESSAGES];
+    sample_ecc_state_handle_t ecc_state = NULL;
+    sample_ec256_private_t priv;
+    sample_ec256_public_t pub;
+    EC_KEY *key;
+    int bad = 0;
+
+    // give the filler time to put nonces in the pool, so the batch signs
+    // with pooled nonces first
+    sp_ecdsa_start();
+    usleep(200000);
+
+    CHECK(SAMPLE_SUCCESS == sample_ecc256_open_context(&ecc_state));
+    CHECK(SAMPLE_SUCCESS == sample_ecc256_create_key_pair(&priv, &pub, ecc_state));
+    sample_ecc256_close_context(ecc_state);
+    key = ecp_test_key(&pub);
+    CHECK(key != NULL);
+    if (g_failures)
+        return 1;
+
+    srand(1);
+    for (uint32_t i = 0; i < ECP_TEST_MESSAGES; i++)
+    {
+        for (uint32_t j = 0; j < ECP_TEST_MAX_LEN; j++)
+            msg[i][j] = (uint8_t)rand();
+        p_data[i] = msg[i];
+        data_size[i] = 1 + i % ECP_TEST_MAX_LEN;
+    }
+
+    CHECK(SAMPLE_SUCCESS == sp_ecdsa_sign(p_data[0], data_size[0], &priv, &sig[0]));
+    CHECK(1 == ecp_test_verify(key, p_data[0], data_size[0], &sig[0]));
+
+    memset(sig, 0, sizeof(sig));
+    CHECK(SAMPLE_SUCCESS == sp_ecdsa_sign_batch(p_data, data_size, ECP_TEST_MESSAGES,
+                                                &priv, sig, ECP_TEST_THREADS));
+    for (uint32_t i = 0; i < ECP_TEST_MESSAGES; i++)
+    {
+        if (1 != ecp_test_verify(key, p_data[i], data_size[i], &sig[i]))
+            bad++;
+    }
+    CHECK(bad == 0);
+
+    // the verifier does reject: a signature does not carry over to another
+    // message
+    CHECK(1 != ecp_test_verify(key, p_data[1], data_size[1], &sig[0]));
+
+    // no two signatures share a nonce
+    for (uint32_t i = 1; i < ECP_TEST_MESSAGES; i++)
+        CHECK(memcmp(sig[i].x, sig[i - 1].x, sizeof(sig[i].x)) != 0);
+
+    EC_KEY_free(key);
+    memset(&priv, 0, sizeof(priv));
+    if (g_failures)
+    {
+        fprintf(stderr, "ecp_test: %d failed (%d bad signatures)\n", g_failures, bad);
+        return 1;
+    }
+    printf("ecp_test: ok\n");
+    return 0;
+}
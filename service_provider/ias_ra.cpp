@@ -109,7 +109,6 @@ int ias_verify_attestation_evidence(
     ias_att_report_t* p_attestation_verification_report)
 {
     int ret = 0;
-    sample_ecc_state_handle_t ecc_state = NULL;
 
     //unused parameters
     UNUSED(pse_manifest);
@@ -149,22 +148,14 @@ int ias_verify_attestation_evidence(
     // @TODO: Product signing algorithm still TBD.  May be RSA2048 signing.
     // Generate the Service providers ECCDH key pair.
     do {
-        ret = sample_ecc256_open_context(&ecc_state);
-        if (SAMPLE_SUCCESS != ret) {
-            fprintf(stderr, "\nError, cannot get ECC cotext in [%s].",
-                    __FUNCTION__);
-            ret = -1;
-            break;
-        }
-        // Sign
-        ret = sample_ecdsa_sign(
+        // Sign, with a precomputed nonce (ecp.h)
+        ret = sp_ecdsa_sign(
                 (uint8_t *)&p_attestation_verification_report->
                     info_blob.sample_epid_group_status,
                 sizeof(ias_platform_info_blob_t) - sizeof(sample_ec_sign256_t),
-                (sample_ec256_private_t *)&g_rk_priv_key,
+                &g_rk_priv_key,
                 (sample_ec256_signature_t *)&p_attestation_verification_report->
-                    info_blob.signature,
-                ecc_state);
+                    info_blob.signature);
         if (SAMPLE_SUCCESS != ret) {
             fprintf(stderr, "\nError, sign ga_gb fail in [%s].", __FUNCTION__);
             ret = SP_INTERNAL_ERROR;
@@ -176,9 +167,6 @@ int ias_verify_attestation_evidence(
                             info_blob.signature.y);
 
     }while (0);
-    if (ecc_state) {
-        sample_ecc256_close_context(ecc_state);
-    }
     p_attestation_verification_report->pse_status = IAS_PSE_OK;
 
     // For now, don't simulate the policy reports.
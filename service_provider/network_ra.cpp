@@ -36,8 +36,11 @@
 #include <stdio.h>
 #include "network_ra.h"
 #include "service_provider.h"
+#include "trace.h"
+#include "metrics.h"
 //add
 #include <string.h>
+#include <pthread.h>
 
 
 extern void PRINT_BYTE_ARRAY(
@@ -49,7 +52,9 @@ extern void PRINT_BYTE_ARRAY(
 //
 // @param server_url String name of the server URL
 // @param p_req Pointer to the message to be sent.
-// @param p_resp Pointer to a pointer of the response message.
+// @param p_resp Pointer to a pointer of the response message. It is set
+//               to a buffer from ra_msg_get, or NULL when nothing came
+//               back; any buffer it held is released first.
 
 // @return int
 // 修改成真正的网络通讯
@@ -60,19 +65,19 @@ int ra_network_send_receive(const char *server_url,
     FILE *OUTPUT = stdout;
     int ret = 0;
     int len = 0;
-    int msg2len = 0;
 
     if ((NULL == server_url) ||
         (NULL == p_req) ||
         (NULL == p_resp)) {
         return -1;
     }
+    // The request goes out from the caller's buffer and the response is
+    // read into the buffer handed back, with no copy through
+    // sendbuf/recvbuf.
     switch (p_req->type) {
 
         case TYPE_RA_MSG0:
-            memset(network.sendbuf, 0, BUFSIZ);
-            memcpy_s(network.sendbuf, BUFSIZ, p_req, sizeof(ra_samp_request_header_t) + p_req->size);
-            len = network.SendTo(sizeof(ra_samp_request_header_t) + p_req->size);
+            len = network.SendMsg(p_req, sizeof(ra_samp_request_header_t) + p_req->size);
 //            sleep(1);//等待起作用
             if (0 == len) {
                 fprintf(stderr, "\nError,Send MSG0 fail [%s].",
@@ -81,24 +86,21 @@ int ra_network_send_receive(const char *server_url,
             break;
 
         case TYPE_RA_MSG1:
-            memset(network.sendbuf, 0, BUFSIZ);
-            memcpy_s(network.sendbuf, BUFSIZ, p_req, sizeof(ra_samp_request_header_t) + p_req->size);
-            ret = network.SendTo(sizeof(ra_samp_request_header_t) + p_req->size);
+            ret = network.SendMsg(p_req, sizeof(ra_samp_request_header_t) + p_req->size);
             fprintf(stdout, "\nSend MSG1 To Server [%s].", __FUNCTION__);
-            ret = network.RecvFrom();
-            msg2len = sizeof(ra_samp_response_header_t) + sizeof(sample_ra_msg2_t);
-
-            memcpy_s(*p_resp, msg2len, network.recvbuf, ret);
+            ra_msg_put(*p_resp);
+            *p_resp = (ra_samp_response_header_t *) ra_msg_get(BUFSIZ);
+            ret = *p_resp ? network.RecvMsg(*p_resp, BUFSIZ) : 0;
             break;
 
         case TYPE_RA_MSG3:
-            memset(network.sendbuf, 0, BUFSIZ);
-            memcpy_s(network.sendbuf, BUFSIZ, p_req, sizeof(ra_samp_request_header_t) + p_req->size);
-            ret = network.SendTo(sizeof(ra_samp_request_header_t) + p_req->size);
-            ret = network.RecvFrom();
-            memcpy_s(*p_resp, ret, network.recvbuf, ret);
-            fprintf(stderr, "\nMsg3 ret = %d [%s].", ret);
-            PRINT_BYTE_ARRAY(OUTPUT, *p_resp, ret);
+            ret = network.SendMsg(p_req, sizeof(ra_samp_request_header_t) + p_req->size);
+            ra_msg_put(*p_resp);
+            *p_resp = (ra_samp_response_header_t *) ra_msg_get(BUFSIZ);
+            ret = *p_resp ? network.RecvMsg(*p_resp, BUFSIZ) : 0;
+            fprintf(stderr, "\nMsg3 ret = %d [%s].", ret, __FUNCTION__);
+            if (ret > 0)
+                PRINT_BYTE_ARRAY(OUTPUT, *p_resp, ret);
             break;
 
         default:
@@ -107,6 +109,10 @@ int ra_network_send_receive(const char *server_url,
                     p_req->type, __FUNCTION__);
             break;
     }
+    if ((TYPE_RA_MSG1 == p_req->type || TYPE_RA_MSG3 == p_req->type) && ret <= 0) {
+        ra_msg_put(*p_resp);
+        *p_resp = NULL;
+    }
 
     return ret;
 }
@@ -118,9 +124,114 @@ int ra_network_send_receive(const char *server_url,
 // @param resp Pointer to the response buffer to be freed.
 
 void ra_free_network_response_buffer(ra_samp_response_header_t *resp) {
-    if (resp != NULL) {
-        free(resp);
+    ra_msg_put(resp);
+}
+
+// Lies in front of each message. 16 bytes, so messages stay aligned as
+// malloc'd ones are.
+typedef struct ra_msg_buf_t {
+    union {
+        struct ra_msg_buf_t *next; // while cached
+        uint32_t refs;             // while in use
+    };
+    uint32_t cls; // RA_MSG_CLASSES: malloc'd, not pooled
+    uint32_t used; // bytes asked for in ra_msg_get, wiped on release
+} ra_msg_buf_t;
+
+typedef struct {
+    ra_msg_buf_t *free[RA_MSG_CLASSES];
+    uint32_t count[RA_MSG_CLASSES];
+} ra_msg_cache_t;
+
+static __thread ra_msg_cache_t ra_msg_cache;
+static pthread_once_t ra_msg_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ra_msg_key;
+static __thread int ra_msg_registered;
+
+// Frees the cache of an exiting thread.
+static void ra_msg_release(void *arg) {
+    ra_msg_cache_t *cache = (ra_msg_cache_t *) arg;
+    ra_msg_buf_t *b;
+
+    for (int i = 0; i < RA_MSG_CLASSES; ++i)
+        while ((b = cache->free[i]) != NULL) {
+            cache->free[i] = b->next;
+            free(b);
+        }
+    memset(cache, 0, sizeof *cache);
+}
+
+static void ra_msg_key_init(void) {
+    pthread_key_create(&ra_msg_key, ra_msg_release);
+}
+
+// Clears a released message, which may hold MSG2 keys or the provisioned
+// secret, so that neither the next user of the buffer nor the heap sees it.
+// The barrier keeps the compiler from dropping the memset before a free.
+static void ra_msg_wipe(void *msg, size_t len) {
+    memset(msg, 0, len);
+    __asm__ __volatile__("" : : "r"(msg) : "memory");
+}
+
+static uint32_t ra_msg_class(size_t size) {
+    uint32_t cls = 0;
+
+    while (cls < RA_MSG_CLASSES && ((size_t) RA_MSG_MIN_SIZE << cls) < size)
+        cls++;
+    return cls;
+}
+
+void *ra_msg_get(size_t size) {
+    uint32_t cls = ra_msg_class(size);
+    ra_msg_buf_t *b = NULL;
+
+    if (size > UINT32_MAX)
+        return NULL;
+    if (cls < RA_MSG_CLASSES && (b = ra_msg_cache.free[cls]) != NULL) {
+        ra_msg_cache.free[cls] = b->next;
+        ra_msg_cache.count[cls]--;
+    } else {
+        b = (ra_msg_buf_t *) malloc(sizeof *b + (cls < RA_MSG_CLASSES ?
+                                                 (size_t) RA_MSG_MIN_SIZE << cls : size));
+        if (b == NULL)
+            return NULL;
+        metrics_add(METRIC_RA_MSG_POOL_MISSES, 1);
+    }
+    b->refs = 1;
+    b->cls = cls;
+    b->used = (uint32_t) size;
+    return b + 1;
+}
+
+void *ra_msg_ref(void *msg) {
+    if (msg != NULL)
+        __atomic_add_fetch(&((ra_msg_buf_t *) msg - 1)->refs, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+
+void ra_msg_put(void *msg) {
+    ra_msg_buf_t *b;
+    uint32_t cls;
+
+    if (msg == NULL)
+        return;
+    b = (ra_msg_buf_t *) msg - 1;
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    ra_msg_wipe(msg, b->used);
+    cls = b->cls;
+    if (cls >= RA_MSG_CLASSES || ra_msg_cache.count[cls] >= RA_MSG_CACHE) {
+        free(b);
+        return;
     }
+    if (!ra_msg_registered) {
+        pthread_once(&ra_msg_once, ra_msg_key_init);
+        pthread_setspecific(ra_msg_key, &ra_msg_cache);
+        ra_msg_registered = 1;
+    }
+    b->next = ra_msg_cache.free[cls];
+    ra_msg_cache.free[cls] = b;
+    ra_msg_cache.count[cls]++;
 }
 
 int NetworkClient::client(const char *ip, int port) {
@@ -147,18 +258,84 @@ int NetworkClient::client(const char *ip, int port) {
 }
 
 int NetworkEnd::SendTo(int len) {
+    TRACE_SCOPE("net", "send");
     len = send(client_sockfd, sendbuf, len, 0);//发送
+    if (len > 0)
+        metrics_add(METRIC_NET_SENT_BYTES, len);
+    return len;
 }
 
 int NetworkEnd::RecvFrom() {
     /*接收服务端的数据*/
     int len = 0;
+    TRACE_BEGIN("net", "recv");
     len = recv(client_sockfd, recvbuf, BUFSIZ, 0);
+    TRACE_END("net", "recv");
+    if (len > 0)
+        metrics_add(METRIC_NET_RECV_BYTES, len);
     if (len > 0)
         recvbuf[len] = 0;
     return len;
 }
 
+int NetworkEnd::SendMsg(const void *msg, int len) {
+    TRACE_SCOPE("net", "send");
+    const char *p = (const char *) msg;
+    int done = 0, n;
+
+    while (done < len) {
+        n = send(client_sockfd, p + done, len - done, 0);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (done > 0)
+        metrics_add(METRIC_NET_SENT_BYTES, done);
+    return done;
+}
+
+// Reads exactly len bytes, as TCP may hand a message over in pieces.
+// Returns len, or what arrived before the peer closed or recv failed.
+int NetworkEnd::RecvAll(char *p, int len) {
+    int done = 0, n;
+
+    while (done < len) {
+        n = recv(client_sockfd, p + done, len - done, 0);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+int NetworkEnd::RecvMsg(void *msg, int size) {
+    ra_samp_response_header_t *p_resp = (ra_samp_response_header_t *) msg;
+    int hdr = (int) sizeof(ra_samp_response_header_t);
+    int len = 0;
+
+    if (size < hdr)
+        return -1;
+    TRACE_BEGIN("net", "recv");
+    len = RecvAll((char *) msg, hdr);
+    if (len == hdr) {
+        if (p_resp->size > (uint32_t) (size - hdr))
+            len = -1;
+        else
+            len += RecvAll((char *) msg + hdr, (int) p_resp->size);
+    }
+    TRACE_END("net", "recv");
+    if (len > 0)
+        metrics_add(METRIC_NET_RECV_BYTES, len);
+    if (len < 0)
+        return -1;
+    if (len < hdr || len - hdr < (int) p_resp->size) {
+        if (len > 0)
+            fprintf(stderr, "\nError, short message, %d bytes [%s].", len, __FUNCTION__);
+        return 0;
+    }
+    return len;
+}
+
 int NetworkEnd::Cleanupsocket() {
     close(sockfd);
     return 0;
@@ -103,7 +103,17 @@ public:
 
     int SendTo(int len);
     int RecvFrom();
+    // Send or receive a message in place, e.g. one from ra_msg_get, without
+    // going through sendbuf/recvbuf. RecvMsg reads one response, its header
+    // and then header.size bytes of body, into a buffer of size bytes. It
+    // returns the length read, 0 if the peer closed before the whole
+    // message arrived and -1 if the message does not fit.
+    int SendMsg(const void *msg, int len);
+    int RecvMsg(void *msg, int size);
     int Cleanupsocket();
+
+private:
+    int RecvAll(char *p, int len);
 };
 
 class NetworkClient : public NetworkEnd{
@@ -126,6 +136,28 @@ int ra_network_send_receive(const char *server_url,
                             NetworkEnd &network);
 void ra_free_network_response_buffer(ra_samp_response_header_t *resp);
 
+// Message buffers.
+//
+// Requests and responses, on the client and in the service provider, live
+// in buffers from a pool of size classes of RA_MSG_MIN_SIZE << k bytes. Each
+// thread keeps up to RA_MSG_CACHE free buffers per class, so a buffer taken
+// and released on the RA path costs no malloc and no lock; a buffer released
+// on another thread goes to that thread's cache. Larger messages, and
+// requests that find the cache empty, fall back to malloc
+// (ra_msg_pool_misses in Include/metrics.h).
+//
+// A buffer is reference counted. ra_msg_get returns it with one reference,
+// ra_msg_ref adds one for another holder and ra_msg_put drops one; the last
+// put clears the bytes asked for in ra_msg_get and returns it to the pool.
+#define RA_MSG_MIN_SHIFT 8
+#define RA_MSG_MIN_SIZE (1u << RA_MSG_MIN_SHIFT)
+#define RA_MSG_CLASSES 6 // up to 8 KiB, a BUFSIZ reply
+#define RA_MSG_CACHE 8
+
+void *ra_msg_get(size_t size);
+void *ra_msg_ref(void *msg);
+void ra_msg_put(void *msg);
+
 
 #ifdef  __cplusplus
 }
@@ -42,7 +42,10 @@
 #include <stddef.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
 #include "ias_ra.h"
+#include "trace.h"
+#include "metrics.h"
 
 #ifndef SAFE_FREE
 #define SAFE_FREE(ptr) {if (NULL != (ptr)) {free(ptr); (ptr) = NULL;}}
@@ -110,11 +113,106 @@ uint8_t g_secret[8] = {0,1,2,3,4,5,6,7};
 
 sample_spid_t g_spid;
 
+// Pool of ephemeral ECDH key pairs for MSG2. Generating the pair is the
+// largest fixed cost of sp_ra_proc_msg1_req, so a background thread keeps
+// up to SP_KEY_POOL_SIZE of them ready and MSG1 only pops one. The filler
+// wakes when the depth falls to SP_KEY_POOL_LOW and fills the pool back up.
+// Every pair is used once: a popped slot is wiped. An empty pool falls back
+// to generating on the request path.
+#define SP_KEY_POOL_SIZE 64
+#define SP_KEY_POOL_LOW 16
+
+typedef struct _sp_key_pair_t
+{
+    sample_ec256_private_t      b;
+    sample_ec256_public_t       g_b;
+} sp_key_pair_t;
+
+static pthread_once_t g_sp_key_pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_sp_key_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_sp_key_pool_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t g_sp_key_pool_depth;
+static sp_key_pair_t g_sp_key_pool[SP_KEY_POOL_SIZE];
+
+static void *sp_key_pool_fill(void *arg)
+{
+    sample_ecc_state_handle_t ecc_state = NULL;
+    sample_status_t sample_ret = SAMPLE_SUCCESS;
+    sp_key_pair_t pair;
+
+    (void)arg;
+    if (SAMPLE_SUCCESS != sample_ecc256_open_context(&ecc_state))
+    {
+        fprintf(stderr, "\nError, cannot get ECC context in [%s].", __FUNCTION__);
+        return NULL;
+    }
+    pthread_mutex_lock(&g_sp_key_pool_lock);
+    while (SAMPLE_SUCCESS == sample_ret)
+    {
+        while (g_sp_key_pool_depth > SP_KEY_POOL_LOW)
+            pthread_cond_wait(&g_sp_key_pool_cond, &g_sp_key_pool_lock);
+        while (g_sp_key_pool_depth < SP_KEY_POOL_SIZE)
+        {
+            pthread_mutex_unlock(&g_sp_key_pool_lock);
+            TRACE_BEGIN("crypto", "sample_ecc256_create_key_pair");
+            sample_ret = sample_ecc256_create_key_pair(&pair.b, &pair.g_b,
+                                                       ecc_state);
+            TRACE_END("crypto", "sample_ecc256_create_key_pair");
+            metrics_add(METRIC_CRYPTO_OPS, 1);
+            pthread_mutex_lock(&g_sp_key_pool_lock);
+            if (SAMPLE_SUCCESS != sample_ret)
+                break;
+            g_sp_key_pool[g_sp_key_pool_depth++] = pair;
+            metrics_add(METRIC_SP_KEYS_GENERATED, 1);
+            metrics_gauge_add(METRIC_SP_KEY_POOL_DEPTH, 1);
+        }
+    }
+    pthread_mutex_unlock(&g_sp_key_pool_lock);
+
+    // MSG1 keeps generating its own pairs from here on
+    fprintf(stderr, "\nError, cannot generate key pair in [%s].", __FUNCTION__);
+    sp_wipe(&pair, sizeof(pair));
+    sample_ecc256_close_context(ecc_state);
+    return NULL;
+}
+
+static void sp_key_pool_start(void)
+{
+    pthread_t filler;
+
+    if (0 == pthread_create(&filler, NULL, sp_key_pool_fill, NULL))
+        pthread_detach(filler);
+}
+
+// Moves a pooled pair into *pair; false when the pool is empty.
+static bool sp_key_pool_pop(sp_key_pair_t *pair)
+{
+    bool hit = false;
+
+    pthread_once(&g_sp_key_pool_once, sp_key_pool_start);
+    pthread_mutex_lock(&g_sp_key_pool_lock);
+    if (g_sp_key_pool_depth > 0)
+    {
+        sp_key_pair_t *top = &g_sp_key_pool[--g_sp_key_pool_depth];
+        *pair = *top;
+        sp_wipe(top, sizeof(*top));
+        metrics_gauge_add(METRIC_SP_KEY_POOL_DEPTH, -1);
+        hit = true;
+    }
+    if (g_sp_key_pool_depth <= SP_KEY_POOL_LOW)
+        pthread_cond_signal(&g_sp_key_pool_cond);
+    pthread_mutex_unlock(&g_sp_key_pool_lock);
+    if (!hit)
+        metrics_add(METRIC_SP_KEY_POOL_MISSES, 1);
+    return hit;
+}
+
 
 // Verify message 0 then configure extended epid group.
 int sp_ra_proc_msg0_req(const sample_ra_msg0_t *p_msg0,
     uint32_t msg0_size)
 {
+    TRACE_SCOPE("ra", "sp_ra_proc_msg0_req");
     int ret = -1;
 
     if (!p_msg0 ||
@@ -151,6 +249,9 @@ int sp_ra_proc_msg0_req(const sample_ra_msg0_t *p_msg0,
                 }
 
                 g_is_sp_registered = true;
+                // fill the key and nonce pools ahead of the first MSG1
+                pthread_once(&g_sp_key_pool_once, sp_key_pool_start);
+                sp_ecdsa_start();
                 ret = SP_OK;
                 break;
             }
@@ -169,6 +270,7 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
 						uint32_t msg1_size,
 						ra_samp_response_header_t **pp_msg2)
 {
+    TRACE_SCOPE("ra", "sp_ra_proc_msg1_req");
     int ret = 0;
     ra_samp_response_header_t* p_msg2_full = NULL;
     sample_ra_msg2_t *p_msg2 = NULL;
@@ -228,8 +330,21 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
         }
         sample_ec256_public_t pub_key = {{0},{0}};
         sample_ec256_private_t priv_key = {{0}};
-        sample_ret = sample_ecc256_create_key_pair(&priv_key, &pub_key,
-                                                   ecc_state);
+        sp_key_pair_t pair;
+        if (sp_key_pool_pop(&pair))
+        {
+            priv_key = pair.b;
+            pub_key = pair.g_b;
+            sp_wipe(&pair, sizeof(pair));
+        }
+        else
+        {
+            TRACE_BEGIN("crypto", "sample_ecc256_create_key_pair");
+            sample_ret = sample_ecc256_create_key_pair(&priv_key, &pub_key,
+                                                       ecc_state);
+            TRACE_END("crypto", "sample_ecc256_create_key_pair");
+            metrics_add(METRIC_CRYPTO_OPS, 1);
+        }
         if(SAMPLE_SUCCESS != sample_ret)
         {
             fprintf(stderr, "\nError, cannot generate key pair in [%s].",
@@ -250,10 +365,13 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
 
         // Generate the client/SP shared secret
         sample_ec_dh_shared_t dh_key = {{0}};
+        TRACE_BEGIN("crypto", "sample_ecc256_compute_shared_dhkey");
         sample_ret = sample_ecc256_compute_shared_dhkey(&priv_key,
             (sample_ec256_public_t *)&p_msg1->g_a,
             (sample_ec256_dh_shared_t *)&dh_key,
             ecc_state);
+        TRACE_END("crypto", "sample_ecc256_compute_shared_dhkey");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(SAMPLE_SUCCESS != sample_ret)
         {
             fprintf(stderr, "\nError, compute share key fail in [%s].",
@@ -265,8 +383,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
 #ifdef SUPPLIED_KEY_DERIVATION
 
         // smk is only needed for msg2 generation.
+        TRACE_BEGIN("crypto", "derive_key");
         derive_ret = derive_key(&dh_key, SAMPLE_DERIVE_KEY_SMK_SK,
             &g_sp_db.smk_key, &g_sp_db.sk_key);
+        TRACE_END("crypto", "derive_key");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(derive_ret != true)
         {
             fprintf(stderr, "\nError, derive key fail in [%s].", __FUNCTION__);
@@ -275,8 +396,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
         }
 
         // The rest of the keys are the shared secrets for future communication.
+        TRACE_BEGIN("crypto", "derive_key");
         derive_ret = derive_key(&dh_key, SAMPLE_DERIVE_KEY_MK_VK,
             &g_sp_db.mk_key, &g_sp_db.vk_key);
+        TRACE_END("crypto", "derive_key");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(derive_ret != true)
         {
             fprintf(stderr, "\nError, derive key fail in [%s].", __FUNCTION__);
@@ -285,8 +409,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
         }
 #else
         // smk is only needed for msg2 generation.
+        TRACE_BEGIN("crypto", "derive_key");
         derive_ret = derive_key(&dh_key, SAMPLE_DERIVE_KEY_SMK,
                                 &g_sp_db.smk_key);
+        TRACE_END("crypto", "derive_key");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(derive_ret != true)
         {
             fprintf(stderr, "\nError, derive key fail in [%s].", __FUNCTION__);
@@ -295,8 +422,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
         }
 
         // The rest of the keys are the shared secrets for future communication.
+        TRACE_BEGIN("crypto", "derive_key");
         derive_ret = derive_key(&dh_key, SAMPLE_DERIVE_KEY_MK,
                                 &g_sp_db.mk_key);
+        TRACE_END("crypto", "derive_key");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(derive_ret != true)
         {
             fprintf(stderr, "\nError, derive key fail in [%s].", __FUNCTION__);
@@ -304,8 +434,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
             break;
         }
 
+        TRACE_BEGIN("crypto", "derive_key");
         derive_ret = derive_key(&dh_key, SAMPLE_DERIVE_KEY_SK,
                                 &g_sp_db.sk_key);
+        TRACE_END("crypto", "derive_key");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(derive_ret != true)
         {
             fprintf(stderr, "\nError, derive key fail in [%s].", __FUNCTION__);
@@ -313,8 +446,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
             break;
         }
 
+        TRACE_BEGIN("crypto", "derive_key");
         derive_ret = derive_key(&dh_key, SAMPLE_DERIVE_KEY_VK,
                                 &g_sp_db.vk_key);
+        TRACE_END("crypto", "derive_key");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(derive_ret != true)
         {
             fprintf(stderr, "\nError, derive key fail in [%s].", __FUNCTION__);
@@ -324,7 +460,7 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
 #endif
 
         uint32_t msg2_size = sizeof(sample_ra_msg2_t) + sig_rl_size;
-        p_msg2_full = (ra_samp_response_header_t*)malloc(msg2_size
+        p_msg2_full = (ra_samp_response_header_t*)ra_msg_get(msg2_size
                       + sizeof(ra_samp_response_header_t));
         if(!p_msg2_full)
         {
@@ -376,10 +512,12 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
         }
 
         // Sign gb_ga
-        sample_ret = sample_ecdsa_sign((uint8_t *)&gb_ga, sizeof(gb_ga),
-                        (sample_ec256_private_t *)&g_sp_priv_key,
-                        (sample_ec256_signature_t *)&p_msg2->sign_gb_ga,
-                        ecc_state);
+        TRACE_BEGIN("crypto", "sp_ecdsa_sign");
+        sample_ret = sp_ecdsa_sign((uint8_t *)&gb_ga, sizeof(gb_ga),
+                        &g_sp_priv_key,
+                        (sample_ec256_signature_t *)&p_msg2->sign_gb_ga);
+        TRACE_END("crypto", "sp_ecdsa_sign");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(SAMPLE_SUCCESS != sample_ret)
         {
             fprintf(stderr, "\nError, sign ga_gb fail in [%s].", __FUNCTION__);
@@ -390,8 +528,11 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
         // Generate the CMACsmk for gb||SPID||TYPE||KDF_ID||Sigsp(gb,ga)
         uint8_t mac[SAMPLE_EC_MAC_SIZE] = {0};
         uint32_t cmac_size = offsetof(sample_ra_msg2_t, mac);
+        TRACE_BEGIN("crypto", "sample_rijndael128_cmac_msg");
         sample_ret = sample_rijndael128_cmac_msg(&g_sp_db.smk_key,
             (uint8_t *)&p_msg2->g_b, cmac_size, &mac);
+        TRACE_END("crypto", "sample_rijndael128_cmac_msg");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(SAMPLE_SUCCESS != sample_ret)
         {
             fprintf(stderr, "\nError, cmac fail in [%s].", __FUNCTION__);
@@ -418,7 +559,7 @@ int sp_ra_proc_msg1_req(const sample_ra_msg1_t *p_msg1,
     if(ret)
     {
         *pp_msg2 = NULL;
-        SAFE_FREE(p_msg2_full);
+        ra_msg_put(p_msg2_full);
     }
     else
     {
@@ -439,6 +580,7 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
                         uint32_t msg3_size,
                         ra_samp_response_header_t **pp_att_result_msg)
 {
+    TRACE_SCOPE("ra", "sp_ra_proc_msg3_req");
     FILE* OUTPUT = stdout;
     fprintf(OUTPUT, "\n\n\tIn sp_ra_proc_msg3_req\n");
     //free(OUTPUT);
@@ -481,10 +623,13 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
 
         // Verify the message mac using SMK
         sample_cmac_128bit_tag_t mac = {0};
+        TRACE_BEGIN("crypto", "sample_rijndael128_cmac_msg");
         sample_ret = sample_rijndael128_cmac_msg(&g_sp_db.smk_key,
                                            p_msg3_cmaced,
                                            mac_size,
                                            &mac);
+        TRACE_END("crypto", "sample_rijndael128_cmac_msg");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(SAMPLE_SUCCESS != sample_ret)
         {
             fprintf(stderr, "\nError, cmac fail in [%s].", __FUNCTION__);
@@ -558,8 +703,11 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
             ret = SP_INTERNAL_ERROR;
             break;
         }
+        TRACE_BEGIN("crypto", "sample_sha256_get_hash");
         sample_ret = sample_sha256_get_hash(sha_handle,
                                       (sample_sha256_hash_t *)&report_data);
+        TRACE_END("crypto", "sample_sha256_get_hash");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(sample_ret != SAMPLE_SUCCESS)
         {
             fprintf(stderr,"\nError, Get hash failed in [%s].", __FUNCTION__);
@@ -606,7 +754,7 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
         // Respond the client with the results of the attestation.
         uint32_t att_result_msg_size = sizeof(sample_ra_att_result_msg_t);
         p_att_result_msg_full =
-            (ra_samp_response_header_t*)malloc(att_result_msg_size
+            (ra_samp_response_header_t*)ra_msg_get(att_result_msg_size
             + sizeof(ra_samp_response_header_t) + sizeof(g_secret));
         if(!p_att_result_msg_full)
         {
@@ -693,10 +841,13 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
 
         // Generate mac based on the mk key.
         mac_size = sizeof(ias_platform_info_blob_t);
+        TRACE_BEGIN("crypto", "sample_rijndael128_cmac_msg");
         sample_ret = sample_rijndael128_cmac_msg(&g_sp_db.mk_key,
             (const uint8_t*)&p_att_result_msg->platform_info_blob,
             mac_size,
             &p_att_result_msg->mac);
+        TRACE_END("crypto", "sample_rijndael128_cmac_msg");
+        metrics_add(METRIC_CRYPTO_OPS, 1);
         if(SAMPLE_SUCCESS != sample_ret)
         {
             fprintf(stderr, "\nError, cmac fail in [%s].", __FUNCTION__);
@@ -711,6 +862,7 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
            (IAS_PSE_OK == attestation_report.pse_status) &&
            (isv_policy_passed == true))
         {
+            TRACE_BEGIN("crypto", "sample_rijndael128GCM_encrypt");
             ret = sample_rijndael128GCM_encrypt(&g_sp_db.sk_key,
                         &g_secret[0],
                         p_att_result_msg->secret.payload_size,
@@ -720,13 +872,15 @@ int sp_ra_proc_msg3_req(const sample_ra_msg3_t *p_msg3,
                         NULL,
                         0,
                         &p_att_result_msg->secret.payload_tag);
+            TRACE_END("crypto", "sample_rijndael128GCM_encrypt");
+            metrics_add(METRIC_CRYPTO_OPS, 1);
         }
     }while(0);
 
     if(ret)
     {
         *pp_att_result_msg = NULL;
-        SAFE_FREE(p_att_result_msg_full);
+        ra_msg_put(p_att_result_msg_full);
     }
     else
     {
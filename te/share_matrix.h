@@ -0,0 +1,155 @@
+#ifndef TCSC_SHARE_MATRIX_H
+#define TCSC_SHARE_MATRIX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Allocator returning Align-byte aligned storage, so that matrix rows start
+ * on cache-line boundaries.
+ */
+template < class T, size_t Align >
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template < class U >
+    struct rebind {
+        typedef AlignedAllocator< U, Align > other;
+    };
+
+    AlignedAllocator() {}
+    template < class U >
+    AlignedAllocator( const AlignedAllocator< U, Align >& ) {}
+
+    T* allocate( size_t n ) {
+        void* p = nullptr;
+        if ( n > size_t( -1 ) / sizeof( T ) ||
+             posix_memalign( &p, std::max( Align, sizeof( void* ) ), n * sizeof( T ) ) != 0 )
+            throw std::bad_alloc();
+        return static_cast< T* >( p );
+    }
+    void deallocate( T* p, size_t ) { free( p ); }
+
+    template < class U >
+    bool operator==( const AlignedAllocator< U, Align >& ) const {
+        return true;
+    }
+    template < class U >
+    bool operator!=( const AlignedAllocator< U, Align >& ) const {
+        return false;
+    }
+};
+
+/* Strided view over one column of a ShareMatrix; no elements are copied. */
+template < class T >
+class ColumnView {
+public:
+    ColumnView( T* _first, size_t _rows, size_t _stride )
+        : first( _first ), rows( _rows ), stride( _stride ) {}
+
+    size_t size() const { return rows; }
+    T& operator[]( size_t i ) const { return first[i * stride]; }
+
+    std::vector< typename std::remove_const< T >::type > ToVector() const {
+        std::vector< typename std::remove_const< T >::type > v;
+        v.reserve( rows );
+        for ( size_t i = 0; i < rows; ++i )
+            v.push_back( ( *this )[i] );
+        return v;
+    }
+
+private:
+    T* first;
+    size_t rows;
+    size_t stride;
+};
+
+/* Dense row-major rows x cols matrix in one aligned allocation.
+ *
+ * Replaces std::vector<std::vector<T>> for the n x n share matrices of the
+ * DKG: rows are contiguous, the whole matrix is a single allocation, and the
+ * share redistribution step (dealer-major -> receiver-major) is a
+ * cache-blocked transpose instead of n^2 scattered swaps.
+ */
+template < class T >
+class ShareMatrix {
+public:
+    // Tile edge for the blocked transpose; two kBlock x kBlock tiles of 32-byte
+    // field elements stay inside a 32 KiB L1.
+    static const size_t kBlock = 16;
+
+    ShareMatrix() : nrows( 0 ), ncols( 0 ) {}
+    ShareMatrix( size_t rows, size_t cols ) : nrows( rows ), ncols( cols ), data( rows * cols ) {}
+
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+
+    T& operator()( size_t i, size_t j ) { return data[i * ncols + j]; }
+    const T& operator()( size_t i, size_t j ) const { return data[i * ncols + j]; }
+
+    T* Row( size_t i ) { return &data[i * ncols]; }
+    const T* Row( size_t i ) const { return &data[i * ncols]; }
+
+    std::vector< T > RowVector( size_t i ) const { return std::vector< T >( Row( i ), Row( i ) + ncols ); }
+
+    template < class Container >
+    void SetRow( size_t i, const Container& values ) {
+        if ( values.size() != ncols )
+            throw std::invalid_argument( "row size does not match matrix" );
+        std::copy( values.begin(), values.end(), Row( i ) );
+    }
+
+    ColumnView< T > Column( size_t j ) { return ColumnView< T >( &data[j], nrows, ncols ); }
+    ColumnView< const T > Column( size_t j ) const {
+        return ColumnView< const T >( &data[j], nrows, ncols );
+    }
+
+    // In-place transpose of a square matrix, tile by tile.
+    void TransposeInPlace() {
+        if ( nrows != ncols )
+            throw std::logic_error( "in-place transpose needs a square matrix" );
+        const size_t n = nrows;
+        for ( size_t ib = 0; ib < n; ib += kBlock ) {
+            const size_t ie = std::min( n, ib + kBlock );
+            for ( size_t i = ib; i < ie; ++i )
+                for ( size_t j = i + 1; j < ie; ++j )
+                    std::swap( ( *this )( i, j ), ( *this )( j, i ) );
+            for ( size_t jb = ib + kBlock; jb < n; jb += kBlock ) {
+                const size_t je = std::min( n, jb + kBlock );
+                for ( size_t i = ib; i < ie; ++i )
+                    for ( size_t j = jb; j < je; ++j )
+                        std::swap( ( *this )( i, j ), ( *this )( j, i ) );
+            }
+        }
+    }
+
+    // Out-of-place transpose for any shape.
+    ShareMatrix Transposed() const {
+        ShareMatrix t( ncols, nrows );
+        for ( size_t ib = 0; ib < nrows; ib += kBlock ) {
+            const size_t ie = std::min( nrows, ib + kBlock );
+            for ( size_t jb = 0; jb < ncols; jb += kBlock ) {
+                const size_t je = std::min( ncols, jb + kBlock );
+                for ( size_t i = ib; i < ie; ++i )
+                    for ( size_t j = jb; j < je; ++j )
+                        t( j, i ) = ( *this )( i, j );
+            }
+        }
+        return t;
+    }
+
+private:
+    size_t nrows;
+    size_t ncols;
+    std::vector< T, AlignedAllocator< T, 64 > > data;
+};
+
+template < class T >
+const size_t ShareMatrix< T >::kBlock;
+
+#endif  // TCSC_SHARE_MATRIX_H
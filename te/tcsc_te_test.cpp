@@ -9,14 +9,34 @@
 #include <tools/utils.h>
 
 #include <dkg/DKGTEWrapper.h>
+#include "te_batch.h"
+#include "te_hybrid.h"
+#include "te_keystore.h"
+#include "share_matrix.h"
+// Built with -DTCSC_TE_WITH_ENCLAVE and linked with App/Enclave_u.o and
+// sgx_urts, the harness also seals a key file through the enclave given as
+// its first argument (enclave.signed.so by default).
+#ifdef TCSC_TE_WITH_ENCLAVE
+#include "te_enclave_sealer.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <chrono>
 #include <random>
+#include <sstream>
 
-double enc_t[110], dec_t[110];
+double enc_t[1010], dec_t[1010];
 
 std::default_random_engine rand_gen( ( unsigned int ) time( 0 ) );
 
+// Wall-clock microseconds; clock() sums CPU time over the worker threads the
+// batch and hybrid paths start.
+double now_us() {
+    return std::chrono::duration< double, std::micro >(
+        std::chrono::steady_clock::now().time_since_epoch() )
+        .count();
+}
+
 std::string spoilMessage( std::string& message ) {
     std::string mes = message;
     size_t ind = rand_gen() % message.length();
@@ -31,7 +51,7 @@ void test_te(int loops, int n) {
     clock_t s1, s2, e1, e2;
     size_t num_all = n;
     size_t num_signed = 1;
-    std::vector< std::vector< libff::alt_bn128_Fr > > secret_shares_all;
+    ShareMatrix< libff::alt_bn128_Fr > secret_shares_all( num_all, num_all );
     std::vector< std::vector< libff::alt_bn128_G2 > > public_shares_all;
     std::vector< DKGTEWrapper > dkgs;
     std::vector< TEPrivateKeyShare > skeys;
@@ -50,31 +70,22 @@ void test_te(int loops, int n) {
             dkg_wrap.createDKGSecretShares();
         std::shared_ptr< std::vector< libff::alt_bn128_G2 > > public_shares_ptr =
             dkg_wrap.createDKGPublicShares();
-        secret_shares_all.push_back( *secret_shares_ptr );
+        secret_shares_all.SetRow( i, *secret_shares_ptr );
         public_shares_all.push_back( *public_shares_ptr );
     }
 
     for ( size_t i = 0; i < num_all; i++ )
         for ( size_t j = 0; j < num_all; j++ ) {
-            dkgs.at( i ).VerifyDKGShare( j, secret_shares_all.at( i ).at( j ),
+            dkgs.at( i ).VerifyDKGShare( j, secret_shares_all( i, j ),
                                          std::make_shared< std::vector< libff::alt_bn128_G2 > >(
                                              public_shares_all.at( i ) ) );
         }
 
-    std::vector< std::vector< libff::alt_bn128_Fr > > secret_key_shares;
-
-    for ( size_t i = 0; i < num_all; i++ ) {
-        std::vector< libff::alt_bn128_Fr > secret_key_contribution;
-        for ( size_t j = 0; j < num_all; j++ ) {
-            secret_key_contribution.push_back( secret_shares_all.at( j ).at( i ) );
-        }
-        secret_key_shares.push_back( secret_key_contribution );
-    }
-
+    // Holder i receives column i of the dealt matrix.
     for ( size_t i = 0; i < num_all; i++ ) {
         TEPrivateKeyShare pkey_share = dkgs.at( i ).CreateTEPrivateKeyShare(
             i + 1, std::make_shared< std::vector< libff::alt_bn128_Fr > >(
-                secret_key_shares.at( i ) ) );
+                secret_shares_all.Column( i ).ToVector() ) );
         skeys.push_back( pkey_share );
         pkeys.push_back( TEPublicKeyShare( pkey_share, num_signed, num_all ) );
     }
@@ -96,24 +107,25 @@ void test_te(int loops, int n) {
 
     e1 = clock();
     for ( size_t i = 0; i < num_all - num_signed; ++i ) {
-        size_t ind4del = rand_gen() % secret_shares_all.size();
-        auto pos4del = secret_shares_all.begin();
-        advance( pos4del, ind4del );
-        secret_shares_all.erase( pos4del );
+        size_t ind4del = rand_gen() % public_shares_all.size();
         auto pos2 = public_shares_all.begin();
         advance( pos2, ind4del );
         public_shares_all.erase( pos2 );
     }
 
     TEDecryptSet decr_set( num_signed, num_all );
+    std::vector< libff::alt_bn128_G2 > decrypts;
     for ( size_t i = 0; i < num_signed; i++ ) {
         s2 = clock();
         libff::alt_bn128_G2 decrypt = skeys[i].getDecryptionShare( cypher );
         e2 = clock();
-        pkeys[i].Verify( cypher, decrypt );
+        decrypts.push_back( decrypt );
         auto decr_ptr = std::make_shared< libff::alt_bn128_G2 >( decrypt );
         decr_set.addDecrypt( skeys[i].getSignerIndex(), decr_ptr );
     }
+    std::vector< TEPublicKeyShare > signed_pkeys( pkeys.begin(), pkeys.begin() + num_signed );
+    if ( !TEBatch::VerifyMessageShares( cypher, signed_pkeys, decrypts ) )
+        throw std::runtime_error( "decryption share verification failed" );
 
     std::string message_decrypted = decr_set.merge( cypher );
 
@@ -122,6 +134,264 @@ void test_te(int loops, int n) {
 }
 
 
+// Decrypts `batch` ciphertexts per loop through TEBatch: one share call per
+// holder, one randomized pairing product per holder and a parallel merge.
+void test_te_batch( int loops, size_t batch, size_t num_signed, size_t num_all ) {
+    std::vector< DKGTEWrapper > dkgs;
+    std::vector< std::vector< libff::alt_bn128_G2 > > public_shares_all;
+    ShareMatrix< libff::alt_bn128_Fr > secret_shares_all( num_all, num_all );
+
+    for ( size_t i = 0; i < num_all; i++ ) {
+        DKGTEWrapper dkg_wrap( num_signed, num_all );
+        dkgs.push_back( dkg_wrap );
+        secret_shares_all.SetRow( i, *dkg_wrap.createDKGSecretShares() );
+        public_shares_all.push_back( *dkg_wrap.createDKGPublicShares() );
+    }
+
+    std::vector< TEPrivateKeyShare > skeys;
+    std::vector< TEPublicKeyShare > pkeys;
+    secret_shares_all.TransposeInPlace();
+    for ( size_t i = 0; i < num_all; i++ ) {
+        auto contribution = std::make_shared< std::vector< libff::alt_bn128_Fr > >(
+            secret_shares_all.RowVector( i ) );
+        skeys.push_back( dkgs[i].CreateTEPrivateKeyShare( i + 1, contribution ) );
+        pkeys.push_back( TEPublicKeyShare( skeys.back(), num_signed, num_all ) );
+    }
+
+    TEPublicKey common_public = DKGTEWrapper::CreateTEPublicKey(
+        std::make_shared< std::vector< std::vector< libff::alt_bn128_G2 > > >(
+            public_shares_all ),
+        num_signed, num_all );
+
+    std::cout << "batch,share(us/msg),verify(us/msg),merge(us/msg)" << std::endl;
+    for ( int l = 0; l < loops; ++l ) {
+        std::vector< libBLS::Ciphertext > cyphers;
+        for ( size_t j = 0; j < batch; ++j ) {
+            std::string message;
+            for ( size_t length = 0; length < 64; ++length )
+                message += char( rand_gen() % 128 );
+            cyphers.push_back( common_public.encrypt( std::make_shared< std::string >( message ) ) );
+        }
+
+        double s1 = now_us();
+        std::vector< TEBatchShares > shares;
+        for ( size_t i = 0; i < num_signed; i++ )
+            shares.push_back( TEBatch::GetDecryptionShares( skeys[i], cyphers ) );
+        double e1 = now_us();
+
+        for ( size_t i = 0; i < num_signed; i++ ) {
+            if ( !TEBatch::VerifyDecryptionShares( pkeys[i], cyphers, shares[i].shares ) )
+                throw std::runtime_error( "batch decryption share verification failed" );
+        }
+        double e2 = now_us();
+
+        std::vector< std::string > messages =
+            TEBatch::Merge( cyphers, shares, num_signed, num_all );
+        double e3 = now_us();
+
+        std::cout << batch << ',' << ( e1 - s1 ) / batch << ','
+                  << ( e2 - e1 ) / batch << ',' << ( e3 - e2 ) / batch
+                  << std::endl;
+    }
+}
+
+
+// Hybrid mode: the TE encapsulation is paid once per message, so throughput
+// should stay flat as the payload grows.
+void test_te_hybrid( size_t num_signed, size_t num_all ) {
+    std::vector< DKGTEWrapper > dkgs;
+    std::vector< std::vector< libff::alt_bn128_G2 > > public_shares_all;
+    ShareMatrix< libff::alt_bn128_Fr > secret_shares_all( num_all, num_all );
+    for ( size_t i = 0; i < num_all; i++ ) {
+        DKGTEWrapper dkg_wrap( num_signed, num_all );
+        dkgs.push_back( dkg_wrap );
+        secret_shares_all.SetRow( i, *dkg_wrap.createDKGSecretShares() );
+        public_shares_all.push_back( *dkg_wrap.createDKGPublicShares() );
+    }
+    std::vector< TEPrivateKeyShare > skeys;
+    secret_shares_all.TransposeInPlace();
+    for ( size_t i = 0; i < num_all; i++ ) {
+        auto contribution = std::make_shared< std::vector< libff::alt_bn128_Fr > >(
+            secret_shares_all.RowVector( i ) );
+        skeys.push_back( dkgs[i].CreateTEPrivateKeyShare( i + 1, contribution ) );
+    }
+    TEPublicKey common_public = DKGTEWrapper::CreateTEPublicKey(
+        std::make_shared< std::vector< std::vector< libff::alt_bn128_G2 > > >(
+            public_shares_all ),
+        num_signed, num_all );
+
+    std::cout << "payload(bytes),hybrid_enc(MB/s),hybrid_dec(MB/s)" << std::endl;
+    for ( size_t size = 1 << 10; size <= ( 1 << 26 ); size <<= 2 ) {
+        std::string payload( size, '\0' );
+        for ( size_t i = 0; i < size; ++i )
+            payload[i] = char( rand_gen() );
+
+        std::istringstream in( payload );
+        std::ostringstream container;
+        double s1 = now_us();
+        TEHybrid::Encrypt( common_public, in, container );
+        double e1 = now_us();
+
+        std::istringstream cin( container.str() );
+        std::ostringstream plain;
+        double s2 = now_us();
+        TEHybridHeader header = TEHybrid::ReadHeader( cin );
+        TEDecryptSet decr_set( num_signed, num_all );
+        for ( size_t i = 0; i < num_signed; i++ ) {
+            decr_set.addDecrypt( skeys[i].getSignerIndex(),
+                std::make_shared< libff::alt_bn128_G2 >(
+                    skeys[i].getDecryptionShare( header.key_cypher ) ) );
+        }
+        TEHybrid::Decrypt( header, decr_set.merge( header.key_cypher ), cin, plain );
+        double e2 = now_us();
+
+        if ( plain.str() != payload )
+            throw std::runtime_error( "hybrid round trip mismatch" );
+        std::cout << size << ',' << size / ( e1 - s1 ) << ',' << size / ( e2 - s2 ) << std::endl;
+    }
+}
+
+
+// Runs the DKG and returns signer 1's key material.
+TEKeyMaterial dealKeyMaterial( size_t num_signed, size_t num_all ) {
+    std::vector< DKGTEWrapper > dkgs;
+    std::vector< std::vector< libff::alt_bn128_G2 > > public_shares_all;
+    ShareMatrix< libff::alt_bn128_Fr > secret_shares_all( num_all, num_all );
+    for ( size_t i = 0; i < num_all; i++ ) {
+        DKGTEWrapper dkg_wrap( num_signed, num_all );
+        dkgs.push_back( dkg_wrap );
+        secret_shares_all.SetRow( i, *dkg_wrap.createDKGSecretShares() );
+        public_shares_all.push_back( *dkg_wrap.createDKGPublicShares() );
+    }
+    std::vector< TEPrivateKeyShare > skeys;
+    secret_shares_all.TransposeInPlace();
+    for ( size_t i = 0; i < num_all; i++ ) {
+        auto contribution = std::make_shared< std::vector< libff::alt_bn128_Fr > >(
+            secret_shares_all.RowVector( i ) );
+        skeys.push_back( dkgs[i].CreateTEPrivateKeyShare( i + 1, contribution ) );
+    }
+
+    TEKeyMaterial keys;
+    keys.requiredSigners = num_signed;
+    keys.totalSigners = num_all;
+    keys.signerIndex = skeys[0].getSignerIndex();
+    keys.privateKey = skeys[0].getPrivateKey();
+    keys.commonPublicKey = libff::alt_bn128_G2::zero();
+    for ( size_t i = 0; i < num_all; i++ ) {
+        keys.commonPublicKey = keys.commonPublicKey + public_shares_all[i][0];
+        keys.publicKeyShares.push_back(
+            TEPublicKeyShare( skeys[i], num_signed, num_all ).getPublicKey() );
+    }
+    keys.verificationVectors = public_shares_all;
+    return keys;
+}
+
+// XORs `mask` into the byte at `offset` from `whence` (SEEK_SET or SEEK_END).
+void xorFileByte( const std::string& path, long offset, int whence, int mask ) {
+    FILE* f = fopen( path.c_str(), "r+b" );
+    if ( f == NULL || fseek( f, offset, whence ) != 0 )
+        throw std::runtime_error( "cannot reopen " + path );
+    int c = fgetc( f );
+    fseek( f, offset, whence );
+    fputc( c ^ mask, f );
+    fclose( f );
+}
+
+bool keyFileOpens( const std::string& path, const TESealer* sealer ) {
+    try {
+        TEKeyView::Open( path, sealer );
+    } catch ( const std::runtime_error& ) {
+        return false;
+    }
+    return true;
+}
+
+// signer_index in the key file header; 1 ^ 2 is another valid index for n >= 3.
+const long kHeaderSignerIndex = 24;
+
+// Restart path: DKG once, persist signer 1's key material, then reload it
+// from the mapped file instead of repeating the DKG.
+void test_te_keystore( size_t num_signed, size_t num_all, int loops ) {
+    double s0 = now_us();
+    TEKeyMaterial keys = dealKeyMaterial( num_signed, num_all );
+    double e0 = now_us();
+
+    const std::string path = "te_signer1.key";
+    double s1 = now_us();
+    TEKeyStore::Save( path, keys );
+    double e1 = now_us();
+
+    double load = 0;
+    for ( int l = 0; l < loops; ++l ) {
+        double s2 = now_us();
+        std::unique_ptr< TEKeyView > view = TEKeyView::Open( path );
+        TEPrivateKeyShare skey = view->PrivateKeyShare();
+        load += now_us() - s2;
+
+        if ( !( view->CommonPublicKey() == keys.commonPublicKey ) ||
+             skey.getPrivateKey() != keys.privateKey )
+            throw std::runtime_error( "key file round trip mismatch" );
+    }
+
+    // The checksum covers the header too.
+    xorFileByte( path, kHeaderSignerIndex, SEEK_SET, 2 );
+    if ( keyFileOpens( path, nullptr ) )
+        throw std::runtime_error( "key file with a changed header was accepted" );
+
+    std::cout << "n,dkg(us),save(us),load(us)" << std::endl;
+    std::cout << num_all << ',' << e0 - s0 << ',' << e1 - s1 << ',' << load / loops << std::endl;
+}
+
+#ifdef TCSC_TE_WITH_ENCLAVE
+// Key file sealed by the enclave through TEEnclaveSealer: it must come back
+// intact through the unseal ecall, and be refused without the sealer, once
+// its header is changed, or once a byte of the sealed payload is changed.
+void test_te_sealed_keystore( const char* enclave_path, size_t num_signed, size_t num_all ) {
+    sgx_enclave_id_t eid = 0;
+    if ( sgx_create_enclave( enclave_path, SGX_DEBUG_FLAG, NULL, NULL, &eid, NULL ) !=
+         SGX_SUCCESS )
+        throw std::runtime_error( std::string( "cannot create enclave " ) + enclave_path );
+
+    TEKeyMaterial keys = dealKeyMaterial( num_signed, num_all );
+    TEEnclaveSealer sealer( eid );
+    const std::string path = "te_signer1.sealed.key";
+
+    double s1 = now_us();
+    TEKeyStore::Save( path, keys, &sealer );
+    double e1 = now_us();
+    std::unique_ptr< TEKeyView > view = TEKeyView::Open( path, &sealer );
+    double e2 = now_us();
+
+    bool same = view->Sealed() && view->SignerIndex() == keys.signerIndex &&
+                view->PrivateKey() == keys.privateKey &&
+                view->CommonPublicKey() == keys.commonPublicKey;
+    for ( size_t i = 0; same && i < num_all; ++i )
+        same = view->PublicKeyShares()[i] == keys.publicKeyShares[i];
+    view.reset();
+    if ( !same )
+        throw std::runtime_error( "sealed key file round trip mismatch" );
+
+    if ( keyFileOpens( path, nullptr ) )
+        throw std::runtime_error( "sealed key file opened without the sealer" );
+
+    // The header is bound to the sealed payload.
+    xorFileByte( path, kHeaderSignerIndex, SEEK_SET, 2 );
+    if ( keyFileOpens( path, &sealer ) )
+        throw std::runtime_error( "sealed key file with a changed header was accepted" );
+    xorFileByte( path, kHeaderSignerIndex, SEEK_SET, 2 );
+
+    // The last byte lies inside the sealed payload.
+    xorFileByte( path, -1, SEEK_END, 1 );
+    if ( keyFileOpens( path, &sealer ) )
+        throw std::runtime_error( "tampered sealed key file was accepted" );
+
+    sgx_destroy_enclave( eid );
+    std::cout << "n,sealed save(us),sealed load(us)" << std::endl;
+    std::cout << num_all << ',' << e1 - s1 << ',' << e2 - e1 << std::endl;
+}
+#endif
+
+
 int main( int argc, const char* argv[] ) {
     int loops = 1000;
     for ( int j = 0; j < loops; ++j ) {
@@ -139,4 +409,18 @@ int main( int argc, const char* argv[] ) {
     }
 
     std::cout << "avg: " << enc_sum / loops << ',' << dec_sum / loops<< std::endl;
+
+    for ( size_t batch = 1; batch <= 1024; batch *= 4 ) {
+        test_te_batch( 10, batch, 1, 1 );
+    }
+
+    test_te_hybrid( 1, 1 );
+
+    for ( size_t n = 5; n <= 50; n *= 10 ) {
+        test_te_keystore( 1, n, 100 );
+    }
+
+#ifdef TCSC_TE_WITH_ENCLAVE
+    test_te_sealed_keystore( argc > 1 ? argv[1] : "enclave.signed.so", 1, 5 );
+#endif
 }
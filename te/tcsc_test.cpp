@@ -28,6 +28,8 @@
 #include <bls/BLSPrivateKeyShare.h>
 #include <bls/BLSPublicKeyShare.h>
 
+#include "share_matrix.h"
+
 
 #define EXPAND_AS_STR( x ) __EXPAND_AS_STR__( x )
 #define __EXPAND_AS_STR__( x ) #x
@@ -49,9 +51,9 @@ double keyGeneration( const size_t t, const size_t n) {
         pol = dkg_instance.GeneratePolynomial();
     }
 
-    std::vector< std::vector< libff::alt_bn128_Fr > > secret_key_contribution( n );
+    ShareMatrix< libff::alt_bn128_Fr > secret_key_contribution( n, n );
     for ( size_t i = 0; i < n; ++i ) {
-        secret_key_contribution[i] = dkg_instance.SecretKeyContribution( polynomial[i] );
+        secret_key_contribution.SetRow( i, dkg_instance.SecretKeyContribution( polynomial[i] ) );
     }
 
     std::vector< std::vector< libff::alt_bn128_G2 > > verification_vector( n );
@@ -61,18 +63,14 @@ double keyGeneration( const size_t t, const size_t n) {
 
     e[1] = s[2] = clock();
 
-    for ( size_t i = 0; i < n; ++i ) {
-        for ( size_t j = i; j < n; ++j ) {
-            std::swap( secret_key_contribution[j][i], secret_key_contribution[i][j] );
-        }
-    }
+    secret_key_contribution.TransposeInPlace();
 
     e[2] = s[3] = clock();
 
     for ( size_t i = 0; i < n; ++i ) {
         for ( size_t j = 0; j < n; ++j ) {
             if ( !dkg_instance.Verification(
-                     i, secret_key_contribution[i][j], verification_vector[j] ) ) {
+                     i, secret_key_contribution( i, j ), verification_vector[j] ) ) {
                 throw std::runtime_error( "not verified" );
             }
         }
@@ -85,7 +83,7 @@ double keyGeneration( const size_t t, const size_t n) {
     for ( size_t i = 0; i < n; ++i ) {
         common_public_key = common_public_key + polynomial[i][0] * libff::alt_bn128_G2::one();
         BLSPrivateKeyShare cur_skey(
-            dkg_instance.SecretKeyShareCreate( secret_key_contribution[i] ), t, n );
+            dkg_instance.SecretKeyShareCreate( secret_key_contribution.RowVector( i ) ), t, n );
         skeys.push_back( std::make_shared< BLSPrivateKeyShare >( cur_skey ) );
     }
 
@@ -0,0 +1,164 @@
+#include "te_batch.h"
+#include "te_pairing.h"
+
+#include <threshold_encryption/TEDecryptSet.h>
+#include <tools/utils.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+size_t WorkerCount( size_t threads, size_t jobs ) {
+    if ( threads == 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+    return std::max< size_t >( 1, std::min( threads, jobs ) );
+}
+
+// Runs f(begin, end) over contiguous slices of [0, n). The first exception
+// thrown by a worker is rethrown on the calling thread.
+template < class F >
+void ParallelFor( size_t n, size_t threads, F f ) {
+    size_t workers = WorkerCount( threads, n );
+    if ( workers == 1 ) {
+        f( size_t( 0 ), n );
+        return;
+    }
+    TEInhibitProfiling();
+    std::vector< std::thread > pool;
+    std::vector< std::exception_ptr > errors( workers );
+    size_t step = ( n + workers - 1 ) / workers;
+    for ( size_t w = 0, begin = 0; begin < n; ++w, begin += step ) {
+        size_t end = std::min( n, begin + step );
+        pool.emplace_back( [&f, &errors, w, begin, end]() {
+            try {
+                f( begin, end );
+            } catch ( ... ) {
+                errors[w] = std::current_exception();
+            }
+        } );
+    }
+    for ( auto& t : pool )
+        t.join();
+    for ( auto& e : errors ) {
+        if ( e )
+            std::rethrow_exception( e );
+    }
+}
+
+libff::alt_bn128_G1 HashCiphertext( const libBLS::Ciphertext& cypher ) {
+    return libBLS::ThresholdUtils::HashtoG1(
+        std::make_tuple( std::get< 0 >( cypher ), std::get< 1 >( cypher ) ) );
+}
+
+}  // namespace
+
+bool TEBatch::VerifyCiphertexts( const std::vector< libBLS::Ciphertext >& cyphers ) {
+    // sum r_j W_j paired with P2 against prod e(r_j H_j, U_j).
+    MultiPairing pairing( 0 );
+
+    libff::alt_bn128_G1 w_sum = libff::alt_bn128_G1::zero();
+    for ( const auto& cypher : cyphers ) {
+        const libff::alt_bn128_G2& U = std::get< 0 >( cypher );
+        const libff::alt_bn128_G1& W = std::get< 2 >( cypher );
+        if ( !U.is_well_formed() || !W.is_well_formed() || U.is_zero() || W.is_zero() )
+            return false;
+        libff::alt_bn128_Fr r = libff::alt_bn128_Fr::random_element();
+        w_sum = w_sum + r * W;
+        pairing.Add( -( r * HashCiphertext( cypher ) ), U );
+    }
+    pairing.Add( w_sum, libff::alt_bn128_G2::one() );
+
+    return pairing.IsOne();
+}
+
+TEBatchShares TEBatch::GetDecryptionShares( const TEPrivateKeyShare& skey,
+    const std::vector< libBLS::Ciphertext >& cyphers, size_t threads ) {
+    if ( !VerifyCiphertexts( cyphers ) )
+        throw std::runtime_error( "error during share generation: invalid ciphertext in batch" );
+
+    TEBatchShares out;
+    out.signerIndex = skey.getSignerIndex();
+    out.shares.resize( cyphers.size() );
+
+    libff::alt_bn128_Fr x = skey.getPrivateKey();
+    ParallelFor( cyphers.size(), threads, [&]( size_t begin, size_t end ) {
+        for ( size_t j = begin; j < end; ++j ) {
+            out.shares[j] = x * std::get< 0 >( cyphers[j] );
+        }
+    } );
+    return out;
+}
+
+bool TEBatch::VerifyDecryptionShares( const TEPublicKeyShare& pkey,
+    const std::vector< libBLS::Ciphertext >& cyphers,
+    const std::vector< libff::alt_bn128_G2 >& shares ) {
+    if ( cyphers.size() != shares.size() )
+        return false;
+
+    // e(sum r_j W_j, pk_i) * prod e(-r_j H_j, D_ij) == 1
+    MultiPairing pairing( 0 );
+
+    libff::alt_bn128_G1 w_sum = libff::alt_bn128_G1::zero();
+    for ( size_t j = 0; j < cyphers.size(); ++j ) {
+        if ( shares[j].is_zero() || !shares[j].is_well_formed() )
+            return false;
+        libff::alt_bn128_Fr r = libff::alt_bn128_Fr::random_element();
+        w_sum = w_sum + r * std::get< 2 >( cyphers[j] );
+        pairing.Add( -( r * HashCiphertext( cyphers[j] ) ), shares[j] );
+    }
+    pairing.Add( w_sum, pkey.getPublicKey() );
+
+    return pairing.IsOne();
+}
+
+bool TEBatch::VerifyMessageShares( const libBLS::Ciphertext& cypher,
+    const std::vector< TEPublicKeyShare >& pkeys,
+    const std::vector< libff::alt_bn128_G2 >& shares ) {
+    if ( pkeys.size() != shares.size() )
+        return false;
+
+    // W and H are shared by all k checks e(W, pk_i) == e(H, D_i), so the
+    // randomized product collapses to e(W, sum r_i pk_i) * e(-H, sum r_i D_i).
+    libff::alt_bn128_G2 pk_sum = libff::alt_bn128_G2::zero();
+    libff::alt_bn128_G2 share_sum = libff::alt_bn128_G2::zero();
+    for ( size_t i = 0; i < shares.size(); ++i ) {
+        if ( shares[i].is_zero() || !shares[i].is_well_formed() )
+            return false;
+        libff::alt_bn128_Fr r = libff::alt_bn128_Fr::random_element();
+        pk_sum = pk_sum + r * pkeys[i].getPublicKey();
+        share_sum = share_sum + r * shares[i];
+    }
+
+    MultiPairing pairing;
+    pairing.Add( std::get< 2 >( cypher ), pk_sum );
+    pairing.Add( -HashCiphertext( cypher ), share_sum );
+    return pairing.IsOne();
+}
+
+std::vector< std::string > TEBatch::Merge( const std::vector< libBLS::Ciphertext >& cyphers,
+    const std::vector< TEBatchShares >& shares, size_t requiredSigners, size_t totalSigners,
+    size_t threads ) {
+    if ( shares.size() < requiredSigners )
+        throw std::runtime_error( "not enough decryption shares to merge" );
+    for ( const auto& s : shares ) {
+        if ( s.shares.size() != cyphers.size() )
+            throw std::runtime_error( "decryption share batch does not match ciphertext batch" );
+    }
+
+    std::vector< std::string > messages( cyphers.size() );
+    ParallelFor( cyphers.size(), threads, [&]( size_t begin, size_t end ) {
+        for ( size_t j = begin; j < end; ++j ) {
+            TEDecryptSet decr_set( requiredSigners, totalSigners );
+            for ( size_t i = 0; i < requiredSigners; ++i ) {
+                decr_set.addDecrypt( shares[i].signerIndex,
+                    std::make_shared< libff::alt_bn128_G2 >( shares[i].shares[j] ) );
+            }
+            messages[j] = decr_set.merge( cyphers[j] );
+        }
+    } );
+    return messages;
+}
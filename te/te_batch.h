@@ -0,0 +1,58 @@
+#ifndef TCSC_TE_BATCH_H
+#define TCSC_TE_BATCH_H
+
+#include <threshold_encryption/TEPrivateKeyShare.h>
+#include <threshold_encryption/TEPublicKeyShare.h>
+#include <threshold_encryption/threshold_encryption.h>
+
+#include <string>
+#include <vector>
+
+/* Decryption shares of one share holder for a batch of ciphertexts, stored in
+ * the same order as the ciphertexts they were produced for.
+ */
+struct TEBatchShares {
+    size_t signerIndex;
+    std::vector< libff::alt_bn128_G2 > shares;
+};
+
+/* Batch counterpart of getDecryptionShare / Verify / TEDecryptSet::merge.
+ *
+ * Every per-ciphertext pairing check is folded into a single randomized
+ * pairing product over the whole batch, so a batch of m ciphertexts costs one
+ * final exponentiation instead of m (or 2m). A failing batch is rejected as a
+ * whole; callers that need to find the bad ciphertext fall back to the
+ * single-ciphertext API.
+ *
+ * threads == 0 means std::thread::hardware_concurrency().
+ */
+class TEBatch {
+public:
+    // Checks e(W, P2) == e(H(U, V), U) for every ciphertext.
+    static bool VerifyCiphertexts( const std::vector< libBLS::Ciphertext >& cyphers );
+
+    // One call per share holder: validates the batch once and returns x_i * U
+    // for every ciphertext. Throws std::runtime_error on an invalid batch.
+    static TEBatchShares GetDecryptionShares( const TEPrivateKeyShare& skey,
+        const std::vector< libBLS::Ciphertext >& cyphers, size_t threads = 0 );
+
+    // Checks e(W_j, pk_i) == e(H_j, D_ij) for every ciphertext j of signer i.
+    static bool VerifyDecryptionShares( const TEPublicKeyShare& pkey,
+        const std::vector< libBLS::Ciphertext >& cyphers,
+        const std::vector< libff::alt_bn128_G2 >& shares );
+
+    // All k decryption shares of one ciphertext in one multi-pairing: two
+    // Miller loops and a single final exponentiation, instead of k full
+    // pairing checks through TEPublicKeyShare::Verify.
+    static bool VerifyMessageShares( const libBLS::Ciphertext& cypher,
+        const std::vector< TEPublicKeyShare >& pkeys,
+        const std::vector< libff::alt_bn128_G2 >& shares );
+
+    // Combines the shares of at least requiredSigners holders, one TEDecryptSet
+    // per ciphertext, spread over worker threads.
+    static std::vector< std::string > Merge( const std::vector< libBLS::Ciphertext >& cyphers,
+        const std::vector< TEBatchShares >& shares, size_t requiredSigners, size_t totalSigners,
+        size_t threads = 0 );
+};
+
+#endif  // TCSC_TE_BATCH_H
@@ -0,0 +1,55 @@
+#ifndef TCSC_TE_ENCLAVE_SEALER_H
+#define TCSC_TE_ENCLAVE_SEALER_H
+
+#include "te_keystore.h"
+
+#include "Enclave_u.h"
+#include "sgx_urts.h"
+
+#include <stdexcept>
+#include <string>
+
+/* TESealer backed by the enclave's sealing ecalls. Only files sealed by the
+ * same enclave (MRSIGNER policy of sgx_seal_data) with the same header can be
+ * opened again; the enclave refuses to unseal anything it did not seal for a
+ * key file.
+ */
+class TEEnclaveSealer : public TESealer {
+public:
+    explicit TEEnclaveSealer( sgx_enclave_id_t _eid ) : eid( _eid ) {}
+
+    std::string Seal( const std::string& plain, const std::string& aad ) const override {
+        uint32_t sealed_len = 0;
+        if ( ecall_sealed_size( eid, &sealed_len, uint32_t( plain.size() ),
+                 uint32_t( aad.size() ) ) != SGX_SUCCESS ||
+             sealed_len == UINT32_MAX )
+            throw std::runtime_error( "ecall_sealed_size failed" );
+        std::string sealed( sealed_len, '\0' );
+        sgx_status_t status = SGX_ERROR_UNEXPECTED;
+        if ( ecall_seal_data( eid, &status, reinterpret_cast< const uint8_t* >( plain.data() ),
+                 uint32_t( plain.size() ), reinterpret_cast< const uint8_t* >( aad.data() ),
+                 uint32_t( aad.size() ), reinterpret_cast< uint8_t* >( &sealed[0] ),
+                 sealed_len ) != SGX_SUCCESS ||
+             status != SGX_SUCCESS )
+            throw std::runtime_error( "ecall_seal_data failed" );
+        return sealed;
+    }
+
+    std::string Unseal( const std::string& sealed, const std::string& aad,
+        size_t plain_len ) const override {
+        std::string plain( plain_len, '\0' );
+        sgx_status_t status = SGX_ERROR_UNEXPECTED;
+        if ( ecall_unseal_data( eid, &status, reinterpret_cast< const uint8_t* >( sealed.data() ),
+                 uint32_t( sealed.size() ), reinterpret_cast< const uint8_t* >( aad.data() ),
+                 uint32_t( aad.size() ), reinterpret_cast< uint8_t* >( &plain[0] ),
+                 uint32_t( plain_len ) ) != SGX_SUCCESS ||
+             status != SGX_SUCCESS )
+            throw std::runtime_error( "ecall_unseal_data failed" );
+        return plain;
+    }
+
+private:
+    sgx_enclave_id_t eid;
+};
+
+#endif  // TCSC_TE_ENCLAVE_SEALER_H
@@ -0,0 +1,392 @@
+#include "te_hybrid.h"
+#include "te_serialize.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const char kMagic[8] = {'T', 'C', 'S', 'C', 'H', 'T', 'E', '1'};
+const uint32_t kFinalFlag = 0x80000000u;
+const size_t kKeyBytes = 32;
+const size_t kTagBytes = 16;
+const size_t kAadBytes = 32 + 8 + 1;
+// Upper bound on the encoded key ciphertext accepted by ReadHeader.
+const uint32_t kMaxKeyCypher = 4096;
+
+struct Chunk {
+    uint64_t index;
+    bool final;
+    std::string in;
+    std::string out;
+    uint8_t tag[kTagBytes];
+};
+
+struct CipherCtxDeleter {
+    void operator()( EVP_CIPHER_CTX* ctx ) const { EVP_CIPHER_CTX_free( ctx ); }
+};
+typedef std::unique_ptr< EVP_CIPHER_CTX, CipherCtxDeleter > CipherCtx;
+
+// Wipes key material when the scope is left, by return or by exception.
+class Cleanser {
+public:
+    Cleanser( void* _p, size_t _len ) : p( _p ), len( _len ) {}
+    ~Cleanser() { OPENSSL_cleanse( p, len ); }
+
+private:
+    Cleanser( const Cleanser& );
+    Cleanser& operator=( const Cleanser& );
+
+    void* p;
+    size_t len;
+};
+
+void ChunkNonce( const uint8_t prefix[12], uint64_t index, uint8_t nonce[12] ) {
+    memcpy( nonce, prefix, 12 );
+    for ( int i = 0; i < 8; ++i )
+        nonce[4 + i] ^= uint8_t( index >> ( 8 * ( 7 - i ) ) );
+}
+
+void ChunkAad( const uint8_t digest[32], uint64_t index, bool final, uint8_t aad[kAadBytes] ) {
+    memcpy( aad, digest, 32 );
+    for ( int i = 0; i < 8; ++i )
+        aad[32 + i] = uint8_t( index >> ( 8 * ( 7 - i ) ) );
+    aad[40] = final ? 1 : 0;
+}
+
+bool SealChunk( EVP_CIPHER_CTX* ctx, const uint8_t* key, const TEHybridHeader& h, Chunk& c ) {
+    uint8_t nonce[12], aad[kAadBytes];
+    int len = 0;
+    ChunkNonce( h.nonce_prefix, c.index, nonce );
+    ChunkAad( h.digest, c.index, c.final, aad );
+    c.out.resize( c.in.size() );
+    uint8_t* out = reinterpret_cast< uint8_t* >( &c.out[0] );
+    const uint8_t* in = reinterpret_cast< const uint8_t* >( c.in.data() );
+    return EVP_EncryptInit_ex( ctx, EVP_aes_256_gcm(), NULL, key, nonce ) == 1 &&
+           EVP_EncryptUpdate( ctx, NULL, &len, aad, sizeof aad ) == 1 &&
+           ( c.in.empty() || EVP_EncryptUpdate( ctx, out, &len, in, int( c.in.size() ) ) == 1 ) &&
+           EVP_EncryptFinal_ex( ctx, out + c.in.size(), &len ) == 1 &&
+           EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_GET_TAG, kTagBytes, c.tag ) == 1;
+}
+
+bool OpenChunk( EVP_CIPHER_CTX* ctx, const uint8_t* key, const TEHybridHeader& h, Chunk& c ) {
+    uint8_t nonce[12], aad[kAadBytes];
+    int len = 0;
+    ChunkNonce( h.nonce_prefix, c.index, nonce );
+    ChunkAad( h.digest, c.index, c.final, aad );
+    c.out.resize( c.in.size() );
+    uint8_t* out = reinterpret_cast< uint8_t* >( &c.out[0] );
+    const uint8_t* in = reinterpret_cast< const uint8_t* >( c.in.data() );
+    return EVP_DecryptInit_ex( ctx, EVP_aes_256_gcm(), NULL, key, nonce ) == 1 &&
+           EVP_DecryptUpdate( ctx, NULL, &len, aad, sizeof aad ) == 1 &&
+           ( c.in.empty() || EVP_DecryptUpdate( ctx, out, &len, in, int( c.in.size() ) ) == 1 ) &&
+           EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_SET_TAG, kTagBytes, c.tag ) == 1 &&
+           EVP_DecryptFinal_ex( ctx, out + c.in.size(), &len ) == 1;
+}
+
+/* Workers for one Encrypt or Decrypt call, started once and kept for every
+ * window of the stream; the caller is worker 0. Each worker has its own
+ * cipher context. */
+class WindowPool {
+public:
+    explicit WindowPool( size_t threads );
+    ~WindowPool();
+
+    size_t Size() const { return ctxs.size(); }
+
+    // Runs op over window[0, count), worker w taking chunks w, w + workers,
+    // ...; throws if op fails on any chunk.
+    template < class Op >
+    void Run( std::vector< Chunk >& window, size_t count, Op op );
+
+private:
+    WindowPool( const WindowPool& );
+    WindowPool& operator=( const WindowPool& );
+
+    void Work( size_t w );
+    void Stop();
+
+    std::vector< CipherCtx > ctxs;
+    std::vector< std::thread > threads;
+    std::mutex lock;
+    std::condition_variable start, done;
+    std::function< void( size_t ) > job;
+    uint64_t generation;
+    size_t running;
+    bool stop;
+};
+
+WindowPool::WindowPool( size_t n ) : generation( 0 ), running( 0 ), stop( false ) {
+    if ( n == 0 )
+        n = std::max( 1u, std::thread::hardware_concurrency() );
+    for ( size_t i = 0; i < n; ++i ) {
+        ctxs.emplace_back( EVP_CIPHER_CTX_new() );
+        if ( !ctxs.back() )
+            throw std::runtime_error( "EVP_CIPHER_CTX_new failed" );
+    }
+    try {
+        for ( size_t w = 1; w < n; ++w )
+            threads.emplace_back( &WindowPool::Work, this, w );
+    } catch ( ... ) {
+        Stop();
+        throw;
+    }
+}
+
+WindowPool::~WindowPool() {
+    Stop();
+}
+
+void WindowPool::Stop() {
+    {
+        std::lock_guard< std::mutex > l( lock );
+        stop = true;
+    }
+    start.notify_all();
+    for ( auto& t : threads )
+        t.join();
+    threads.clear();
+}
+
+void WindowPool::Work( size_t w ) {
+    uint64_t seen = 0;
+    std::unique_lock< std::mutex > l( lock );
+    for ( ;; ) {
+        start.wait( l, [&]() { return stop || generation != seen; } );
+        if ( stop )
+            return;
+        seen = generation;
+        l.unlock();
+        job( w );
+        l.lock();
+        if ( --running == 0 )
+            done.notify_one();
+    }
+}
+
+template < class Op >
+void WindowPool::Run( std::vector< Chunk >& window, size_t count, Op op ) {
+    std::vector< char > ok( count, 0 );
+    size_t workers = std::min( count, ctxs.size() );
+    auto run = [&]( size_t w ) {
+        for ( size_t j = w; j < count; j += workers ) {
+            try {
+                ok[j] = op( ctxs[w].get(), window[j] ) ? 1 : 0;
+            } catch ( ... ) {
+                ok[j] = 0;
+            }
+        }
+    };
+    if ( workers > 1 ) {
+        {
+            std::lock_guard< std::mutex > l( lock );
+            job = [&]( size_t w ) {
+                if ( w < workers )
+                    run( w );
+            };
+            running = threads.size();
+            ++generation;
+        }
+        start.notify_all();
+    }
+    run( 0 );
+    if ( workers > 1 ) {
+        std::unique_lock< std::mutex > l( lock );
+        done.wait( l, [&]() { return running == 0; } );
+        job = nullptr;
+    }
+    for ( size_t j = 0; j < count; ++j ) {
+        if ( !ok[j] )
+            throw std::runtime_error( "AES-GCM failed on chunk " + std::to_string( window[j].index ) );
+    }
+}
+
+std::string EncodeHeader( const TEHybridHeader& h ) {
+    TEWriter w;
+    w.PutBytes( kMagic, sizeof kMagic );
+    w.PutU32( kTEHybridVersion );
+    w.PutU32( h.chunk_size );
+    TEWriter cypher;
+    cypher.PutCiphertext( h.key_cypher );
+    w.PutString( cypher.Data() );
+    w.PutBytes( h.nonce_prefix, sizeof h.nonce_prefix );
+    return w.Data();
+}
+
+void ReadExactly( std::istream& in, void* buf, size_t len, const char* what ) {
+    in.read( static_cast< char* >( buf ), std::streamsize( len ) );
+    if ( size_t( in.gcount() ) != len )
+        throw std::runtime_error( std::string( "truncated hybrid container: " ) + what );
+}
+
+void WriteU32( std::ostream& out, uint32_t v ) {
+    char b[4] = {char( v >> 24 ), char( v >> 16 ), char( v >> 8 ), char( v )};
+    out.write( b, 4 );
+}
+
+std::string HexEncode( const uint8_t* p, size_t len ) {
+    static const char digits[] = "0123456789abcdef";
+    std::string s;
+    for ( size_t i = 0; i < len; ++i ) {
+        s += digits[p[i] >> 4];
+        s += digits[p[i] & 0xf];
+    }
+    return s;
+}
+
+void HexDecode( const std::string& s, uint8_t* p, size_t len ) {
+    if ( s.size() != 2 * len )
+        throw std::runtime_error( "hybrid key message has the wrong length" );
+    for ( size_t i = 0; i < 2 * len; ++i ) {
+        char ch = s[i];
+        int v = ( ch >= '0' && ch <= '9' ) ? ch - '0' : ( ch >= 'a' && ch <= 'f' ) ? ch - 'a' + 10 : -1;
+        if ( v < 0 )
+            throw std::runtime_error( "hybrid key message is not hex" );
+        if ( i % 2 == 0 )
+            p[i / 2] = uint8_t( v << 4 );
+        else
+            p[i / 2] |= uint8_t( v );
+    }
+}
+
+}  // namespace
+
+uint64_t TEHybrid::Encrypt( TEPublicKey& common_public, std::istream& in, std::ostream& out,
+    uint32_t chunk_size, size_t threads ) {
+    if ( chunk_size == 0 || chunk_size > kTEHybridMaxChunk )
+        throw std::runtime_error( "invalid hybrid chunk size" );
+
+    uint8_t key[kKeyBytes];
+    Cleanser key_wipe( key, sizeof key );
+    TEHybridHeader h;
+    h.chunk_size = chunk_size;
+    if ( RAND_bytes( key, sizeof key ) != 1 ||
+         RAND_bytes( h.nonce_prefix, sizeof h.nonce_prefix ) != 1 )
+        throw std::runtime_error( "RAND_bytes failed" );
+
+    {
+        auto key_message = std::make_shared< std::string >( HexEncode( key, sizeof key ) );
+        Cleanser message_wipe( &( *key_message )[0], key_message->size() );
+        h.key_cypher = common_public.encrypt( key_message );
+    }
+
+    std::string header = EncodeHeader( h );
+    SHA256( reinterpret_cast< const uint8_t* >( header.data() ), header.size(), h.digest );
+    out.write( header.data(), std::streamsize( header.size() ) );
+
+    WindowPool pool( threads );
+    std::vector< Chunk > window( pool.Size() );
+    uint64_t index = 0, total = 0;
+    bool done = false;
+    while ( !done ) {
+        size_t count = 0;
+        for ( ; count < window.size() && !done; ++count ) {
+            Chunk& c = window[count];
+            c.in.resize( chunk_size );
+            in.read( &c.in[0], chunk_size );
+            if ( in.bad() )
+                throw std::runtime_error( "read error on hybrid plaintext" );
+            c.in.resize( size_t( in.gcount() ) );
+            c.final = c.in.size() < chunk_size ||
+                      in.peek() == std::char_traits< char >::eof();
+            c.index = index++;
+            total += c.in.size();
+            done = c.final;
+        }
+        pool.Run( window, count, [&]( EVP_CIPHER_CTX* ctx, Chunk& c ) {
+            return SealChunk( ctx, key, h, c );
+        } );
+        for ( size_t j = 0; j < count; ++j ) {
+            const Chunk& c = window[j];
+            WriteU32( out, uint32_t( c.out.size() ) | ( c.final ? kFinalFlag : 0 ) );
+            out.write( c.out.data(), std::streamsize( c.out.size() ) );
+            out.write( reinterpret_cast< const char* >( c.tag ), kTagBytes );
+        }
+        if ( !out )
+            throw std::runtime_error( "write error on hybrid container" );
+    }
+    return total;
+}
+
+TEHybridHeader TEHybrid::ReadHeader( std::istream& in ) {
+    TEHybridHeader h;
+    uint8_t fixed[sizeof kMagic + 12];
+    ReadExactly( in, fixed, sizeof fixed, "header" );
+    if ( memcmp( fixed, kMagic, sizeof kMagic ) )
+        throw std::runtime_error( "not a hybrid TE container" );
+
+    TEReader r( fixed + sizeof kMagic, 12 );
+    uint32_t version = r.GetU32();
+    h.chunk_size = r.GetU32();
+    uint32_t cypher_len = r.GetU32();
+    if ( version != kTEHybridVersion )
+        throw std::runtime_error( "unsupported hybrid container version" );
+    if ( h.chunk_size == 0 || h.chunk_size > kTEHybridMaxChunk || cypher_len > kMaxKeyCypher )
+        throw std::runtime_error( "corrupt hybrid container header" );
+
+    std::string cypher( cypher_len, '\0' );
+    ReadExactly( in, &cypher[0], cypher_len, "key ciphertext" );
+    ReadExactly( in, h.nonce_prefix, sizeof h.nonce_prefix, "nonce" );
+
+    TEReader cr( cypher.data(), cypher.size() );
+    h.key_cypher = cr.GetCiphertext();
+    if ( cr.Remaining() )
+        throw std::runtime_error( "trailing bytes after key ciphertext" );
+
+    std::string header = EncodeHeader( h );
+    SHA256( reinterpret_cast< const uint8_t* >( header.data() ), header.size(), h.digest );
+    return h;
+}
+
+uint64_t TEHybrid::Decrypt( const TEHybridHeader& h, const std::string& key_message,
+    std::istream& in, std::ostream& out, size_t threads ) {
+    uint8_t key[kKeyBytes];
+    Cleanser key_wipe( key, sizeof key );
+    HexDecode( key_message, key, sizeof key );
+
+    WindowPool pool( threads );
+    std::vector< Chunk > window( pool.Size() );
+    uint64_t index = 0, total = 0;
+    bool done = false;
+    while ( !done ) {
+        size_t count = 0;
+        for ( ; count < window.size() && !done; ++count ) {
+            Chunk& c = window[count];
+            uint8_t len_be[4];
+            ReadExactly( in, len_be, 4, "chunk length" );
+            uint32_t len = TEReader( len_be, 4 ).GetU32();
+            c.final = ( len & kFinalFlag ) != 0;
+            len &= ~kFinalFlag;
+            if ( len > h.chunk_size || ( !c.final && len != h.chunk_size ) )
+                throw std::runtime_error( "corrupt hybrid chunk length" );
+            c.in.resize( len );
+            if ( len )
+                ReadExactly( in, &c.in[0], len, "chunk" );
+            ReadExactly( in, c.tag, kTagBytes, "chunk tag" );
+            c.index = index++;
+            done = c.final;
+        }
+        pool.Run( window, count, [&]( EVP_CIPHER_CTX* ctx, Chunk& c ) {
+            return OpenChunk( ctx, key, h, c );
+        } );
+        for ( size_t j = 0; j < count; ++j ) {
+            out.write( window[j].out.data(), std::streamsize( window[j].out.size() ) );
+            total += window[j].out.size();
+        }
+    }
+    if ( in.peek() != std::char_traits< char >::eof() )
+        throw std::runtime_error( "trailing data after final hybrid chunk" );
+    return total;
+}
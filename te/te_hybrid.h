@@ -0,0 +1,67 @@
+#ifndef TCSC_TE_HYBRID_H
+#define TCSC_TE_HYBRID_H
+
+#include <threshold_encryption/TEPublicKey.h>
+#include <threshold_encryption/threshold_encryption.h>
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+/* Hybrid threshold encryption for payloads of any size.
+ *
+ * Threshold encryption only encapsulates a fresh AES-256 key (as the 64 hex
+ * characters TEPublicKey::encrypt expects), so the pairing work is paid once
+ * per message. The payload streams through AES-256-GCM in fixed-size chunks
+ * and is never held in memory as a whole.
+ *
+ * Container layout (integers big-endian, see te_serialize.h):
+ *
+ *   "TCSCHTE1"                     magic
+ *   u32 version                    kTEHybridVersion
+ *   u32 chunk_size                 plaintext bytes per chunk
+ *   u32 + bytes                    TE ciphertext of the hex-encoded key
+ *   12 bytes                       nonce prefix
+ *   chunk*                         u32 len (top bit = final chunk),
+ *                                  len ciphertext bytes, 16-byte tag
+ *
+ * Chunk j uses nonce = prefix[0..3] || prefix[4..11] xor be64(j) and
+ * authenticates SHA-256(header) || be64(j) || final flag, so chunks cannot be
+ * reordered, dropped, truncated away or moved to another container. Exactly
+ * one chunk, the last, carries the final flag; an empty payload is a single
+ * empty final chunk.
+ */
+
+const uint32_t kTEHybridVersion = 1;
+const uint32_t kTEHybridDefaultChunk = 64 * 1024;
+const uint32_t kTEHybridMaxChunk = 1u << 30;
+
+struct TEHybridHeader {
+    uint32_t chunk_size;
+    libBLS::Ciphertext key_cypher;
+    uint8_t nonce_prefix[12];
+    uint8_t digest[32];  // SHA-256 of the encoded header, bound into every chunk
+};
+
+class TEHybrid {
+public:
+    // Encrypts `in` to `out`, processing up to `threads` chunks concurrently
+    // (0 = hardware concurrency). Memory use is bounded by threads * chunk_size.
+    // Returns the number of payload bytes encrypted.
+    static uint64_t Encrypt( TEPublicKey& common_public, std::istream& in, std::ostream& out,
+        uint32_t chunk_size = kTEHybridDefaultChunk, size_t threads = 0 );
+
+    // Parses the container header, leaving `in` at the first chunk. The key
+    // ciphertext in the header goes through the normal decryption share /
+    // TEDecryptSet::merge flow to recover the key message.
+    static TEHybridHeader ReadHeader( std::istream& in );
+
+    // Decrypts the chunks following the header with the merged key message.
+    // Throws std::runtime_error on any authentication or framing failure;
+    // output already written for earlier chunks must then be discarded.
+    static uint64_t Decrypt( const TEHybridHeader& header, const std::string& key_message,
+        std::istream& in, std::ostream& out, size_t threads = 0 );
+};
+
+#endif  // TCSC_TE_HYBRID_H
@@ -0,0 +1,307 @@
+#include "te_keystore.h"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct TEKeyFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t required_signers;
+    uint32_t total_signers;
+    uint32_t signer_index;
+    uint32_t fr_size;
+    uint32_t g2_size;
+    uint32_t reserved;
+    uint64_t payload_size;  // plain payload bytes
+    uint64_t stored_size;   // bytes following the header (sealed size if sealed)
+    uint64_t private_key_offset;
+    uint64_t common_key_offset;
+    uint64_t public_shares_offset;
+    uint64_t vvec_offset;
+    uint8_t fq_one[32];  // Montgomery image of Fq::one() in the writing build
+    uint8_t checksum[32];  // SHA-256 of BoundHeader() and the plain payload
+    uint8_t pad[104];
+};
+
+namespace {
+
+const char kMagic[8] = {'T', 'C', 'S', 'C', 'K', 'E', 'Y', '1'};
+// 2: the checksum covers the header, and sealing binds it.
+const uint32_t kVersion = 2;
+const uint32_t kFlagSealed = 1;
+const size_t kAlign = 64;
+// Bounds the layout arithmetic below well away from overflow.
+const uint32_t kMaxSigners = 1u << 16;
+
+static_assert( sizeof( TEKeyFileHeader ) == 256, "key file header must stay 256 bytes" );
+
+size_t AlignUp( size_t v ) {
+    return ( v + kAlign - 1 ) & ~( kAlign - 1 );
+}
+
+// Fills in the section offsets and payload size for the header's signer counts.
+void Layout( TEKeyFileHeader& h ) {
+    const uint64_t g2 = h.g2_size;
+    h.private_key_offset = 0;
+    h.common_key_offset = AlignUp( h.private_key_offset + h.fr_size );
+    h.public_shares_offset = AlignUp( h.common_key_offset + g2 );
+    h.vvec_offset = AlignUp( h.public_shares_offset + g2 * h.total_signers );
+    h.payload_size = h.vvec_offset + g2 * h.total_signers * h.required_signers;
+}
+
+// The header as the checksum and the seal cover it. The checksum cannot cover
+// itself, and stored_size is only known after sealing; Open checks it against
+// the file size, and the enclave takes only a sealed blob of the exact size.
+std::string BoundHeader( const TEKeyFileHeader& h ) {
+    TEKeyFileHeader bound = h;
+    memset( bound.checksum, 0, sizeof bound.checksum );
+    bound.stored_size = 0;
+    return std::string( reinterpret_cast< const char* >( &bound ), sizeof bound );
+}
+
+void Checksum( const TEKeyFileHeader& h, const uint8_t* payload, uint8_t out[32] ) {
+    const std::string bound = BoundHeader( h );
+    SHA256_CTX sha;
+    SHA256_Init( &sha );
+    SHA256_Update( &sha, bound.data(), bound.size() );
+    SHA256_Update( &sha, payload, h.payload_size );
+    SHA256_Final( out, &sha );
+}
+
+void FqOneImage( uint8_t out[32] ) {
+    libff::alt_bn128_Fq one = libff::alt_bn128_Fq::one();
+    memset( out, 0, 32 );
+    memcpy( out, &one, std::min< size_t >( 32, sizeof one ) );
+}
+
+// Z = 1 so that a point read back from the file compares and adds like any
+// freshly constructed affine point.
+libff::alt_bn128_G2 Normalized( libff::alt_bn128_G2 p ) {
+    if ( !p.is_zero() )
+        p.to_affine_coordinates();
+    return p;
+}
+
+void WriteAll( int fd, const void* data, size_t len ) {
+    const char* p = static_cast< const char* >( data );
+    while ( len ) {
+        ssize_t n = write( fd, p, len );
+        if ( n < 0 )
+            throw std::runtime_error( "write failed on key file" );
+        p += n;
+        len -= size_t( n );
+    }
+}
+
+}  // namespace
+
+void TEKeyStore::Save( const std::string& path, const TEKeyMaterial& keys,
+    const TESealer* sealer ) {
+    if ( keys.publicKeyShares.size() != keys.totalSigners ||
+         keys.verificationVectors.size() != keys.totalSigners )
+        throw std::runtime_error( "key material does not match totalSigners" );
+    for ( const auto& vvec : keys.verificationVectors ) {
+        if ( vvec.size() != keys.requiredSigners )
+            throw std::runtime_error( "verification vector does not match requiredSigners" );
+    }
+
+    const size_t g2 = sizeof( libff::alt_bn128_G2 );
+    TEKeyFileHeader h;
+    memset( &h, 0, sizeof h );
+    memcpy( h.magic, kMagic, sizeof kMagic );
+    h.version = kVersion;
+    h.required_signers = uint32_t( keys.requiredSigners );
+    h.total_signers = uint32_t( keys.totalSigners );
+    h.signer_index = uint32_t( keys.signerIndex );
+    h.fr_size = uint32_t( sizeof( libff::alt_bn128_Fr ) );
+    h.g2_size = uint32_t( g2 );
+    Layout( h );
+    FqOneImage( h.fq_one );
+
+    std::string payload( h.payload_size, '\0' );
+    uint8_t* base = reinterpret_cast< uint8_t* >( &payload[0] );
+    memcpy( base + h.private_key_offset, &keys.privateKey, h.fr_size );
+    libff::alt_bn128_G2 p = Normalized( keys.commonPublicKey );
+    memcpy( base + h.common_key_offset, &p, g2 );
+    for ( size_t i = 0; i < keys.totalSigners; ++i ) {
+        p = Normalized( keys.publicKeyShares[i] );
+        memcpy( base + h.public_shares_offset + i * g2, &p, g2 );
+    }
+    uint8_t* vvec = base + h.vvec_offset;
+    for ( const auto& dealer : keys.verificationVectors ) {
+        for ( const auto& coeff : dealer ) {
+            p = Normalized( coeff );
+            memcpy( vvec, &p, g2 );
+            vvec += g2;
+        }
+    }
+    if ( sealer )
+        h.flags |= kFlagSealed;
+    Checksum( h, base, h.checksum );
+
+    if ( sealer )
+        payload = sealer->Seal( payload, BoundHeader( h ) );
+    h.stored_size = payload.size();
+
+    std::string tmp = path + ".tmp";
+    int fd = open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    if ( fd < 0 )
+        throw std::runtime_error( "cannot create key file " + tmp );
+    try {
+        WriteAll( fd, &h, sizeof h );
+        WriteAll( fd, payload.data(), payload.size() );
+        if ( fsync( fd ) != 0 )
+            throw std::runtime_error( "fsync failed on key file" );
+    } catch ( ... ) {
+        close( fd );
+        unlink( tmp.c_str() );
+        throw;
+    }
+    close( fd );
+    if ( rename( tmp.c_str(), path.c_str() ) != 0 ) {
+        unlink( tmp.c_str() );
+        throw std::runtime_error( "cannot move key file into place: " + path );
+    }
+}
+
+TEKeyView::TEKeyView() : map( MAP_FAILED ), map_len( 0 ), unsealed( nullptr ), payload( nullptr ),
+                         header( nullptr ) {}
+
+TEKeyView::~TEKeyView() {
+    if ( unsealed ) {
+        const size_t len = size_t( header->payload_size );
+        volatile uint8_t* p = static_cast< volatile uint8_t* >( unsealed );
+        for ( size_t i = 0; i < len; ++i )
+            p[i] = 0;
+        free( unsealed );
+    }
+    if ( map != MAP_FAILED )
+        munmap( map, map_len );
+}
+
+std::unique_ptr< TEKeyView > TEKeyView::Open( const std::string& path, const TESealer* sealer,
+    bool verify_checksum ) {
+    std::unique_ptr< TEKeyView > view( new TEKeyView() );
+
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        throw std::runtime_error( "cannot open key file " + path );
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || size_t( st.st_size ) < sizeof( TEKeyFileHeader ) ) {
+        close( fd );
+        throw std::runtime_error( "key file too short: " + path );
+    }
+    view->map_len = size_t( st.st_size );
+    view->map = mmap( nullptr, view->map_len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( view->map == MAP_FAILED )
+        throw std::runtime_error( "cannot map key file " + path );
+
+    const TEKeyFileHeader* h = static_cast< const TEKeyFileHeader* >( view->map );
+    view->header = h;
+    uint8_t fq_one[32];
+    FqOneImage( fq_one );
+    const size_t g2 = sizeof( libff::alt_bn128_G2 );
+    if ( memcmp( h->magic, kMagic, sizeof kMagic ) || h->version != kVersion )
+        throw std::runtime_error( "not a TE key file: " + path );
+    if ( h->fr_size != sizeof( libff::alt_bn128_Fr ) || h->g2_size != g2 ||
+         memcmp( h->fq_one, fq_one, sizeof fq_one ) )
+        throw std::runtime_error( "key file written by an incompatible libff build" );
+    if ( h->stored_size != view->map_len - sizeof *h )
+        throw std::runtime_error( "key file size does not match its header" );
+
+    // The layout is fully determined by the signer counts; recomputing it
+    // keeps every section inside the payload before anything points into it.
+    uint64_t n = h->total_signers, t = h->required_signers;
+    if ( n == 0 || t == 0 || t > n || n > kMaxSigners || h->signer_index == 0 ||
+         h->signer_index > n )
+        throw std::runtime_error( "corrupt key file layout" );
+    TEKeyFileHeader expected = *h;
+    Layout( expected );
+    if ( expected.private_key_offset != h->private_key_offset ||
+         expected.common_key_offset != h->common_key_offset ||
+         expected.public_shares_offset != h->public_shares_offset ||
+         expected.vvec_offset != h->vvec_offset || expected.payload_size != h->payload_size )
+        throw std::runtime_error( "corrupt key file layout" );
+
+    const uint8_t* stored = static_cast< const uint8_t* >( view->map ) + sizeof *h;
+    if ( h->flags & kFlagSealed ) {
+        if ( !sealer )
+            throw std::runtime_error( "key file is sealed and no sealer was given" );
+        std::string plain = sealer->Unseal(
+            std::string( reinterpret_cast< const char* >( stored ), h->stored_size ),
+            BoundHeader( *h ), h->payload_size );
+        if ( plain.size() != h->payload_size ||
+             posix_memalign( &view->unsealed, kAlign, plain.size() ) != 0 )
+            throw std::runtime_error( "cannot unseal key file " + path );
+        memcpy( view->unsealed, plain.data(), plain.size() );
+        std::fill( plain.begin(), plain.end(), '\0' );
+        view->payload = static_cast< const uint8_t* >( view->unsealed );
+    } else {
+        if ( h->stored_size != h->payload_size )
+            throw std::runtime_error( "corrupt key file layout" );
+        view->payload = stored;
+    }
+
+    if ( verify_checksum ) {
+        uint8_t digest[32];
+        Checksum( *h, view->payload, digest );
+        if ( memcmp( digest, h->checksum, sizeof digest ) )
+            throw std::runtime_error( "key file checksum mismatch: " + path );
+    }
+    return view;
+}
+
+size_t TEKeyView::RequiredSigners() const {
+    return header->required_signers;
+}
+
+size_t TEKeyView::TotalSigners() const {
+    return header->total_signers;
+}
+
+size_t TEKeyView::SignerIndex() const {
+    return header->signer_index;
+}
+
+bool TEKeyView::Sealed() const {
+    return header->flags & kFlagSealed;
+}
+
+const libff::alt_bn128_Fr& TEKeyView::PrivateKey() const {
+    return *reinterpret_cast< const libff::alt_bn128_Fr* >( payload + header->private_key_offset );
+}
+
+const libff::alt_bn128_G2& TEKeyView::CommonPublicKey() const {
+    return *reinterpret_cast< const libff::alt_bn128_G2* >( payload + header->common_key_offset );
+}
+
+const libff::alt_bn128_G2* TEKeyView::PublicKeyShares() const {
+    return reinterpret_cast< const libff::alt_bn128_G2* >( payload + header->public_shares_offset );
+}
+
+const libff::alt_bn128_G2* TEKeyView::VerificationVector( size_t dealer ) const {
+    if ( dealer >= header->total_signers )
+        throw std::out_of_range( "dealer index out of range" );
+    return reinterpret_cast< const libff::alt_bn128_G2* >( payload + header->vvec_offset ) +
+           dealer * header->required_signers;
+}
+
+TEPrivateKeyShare TEKeyView::PrivateKeyShare() const {
+    return TEPrivateKeyShare( PrivateKey(), SignerIndex(), RequiredSigners(), TotalSigners() );
+}
+
+TEPublicKey TEKeyView::PublicKey() const {
+    return TEPublicKey( CommonPublicKey(), RequiredSigners(), TotalSigners() );
+}
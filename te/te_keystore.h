@@ -0,0 +1,100 @@
+#ifndef TCSC_TE_KEYSTORE_H
+#define TCSC_TE_KEYSTORE_H
+
+#include <threshold_encryption/TEPrivateKeyShare.h>
+#include <threshold_encryption/TEPublicKey.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Everything one share holder needs after DKG: its private key share, the
+ * common public key, every holder's public key share and the dealers'
+ * verification vectors.
+ */
+struct TEKeyMaterial {
+    size_t requiredSigners;
+    size_t totalSigners;
+    size_t signerIndex;  // 1-based, as in TEPrivateKeyShare
+    libff::alt_bn128_Fr privateKey;
+    libff::alt_bn128_G2 commonPublicKey;
+    std::vector< libff::alt_bn128_G2 > publicKeyShares;                   // totalSigners
+    std::vector< std::vector< libff::alt_bn128_G2 > > verificationVectors;  // per dealer
+};
+
+/* Optional sealing of the key file payload, e.g. by TEEnclaveSealer. `aad`
+ * is authenticated with the payload but not encrypted; Unseal must fail
+ * unless it is byte for byte the aad given to Seal.
+ */
+class TESealer {
+public:
+    virtual ~TESealer() {}
+    virtual std::string Seal( const std::string& plain, const std::string& aad ) const = 0;
+    virtual std::string Unseal(
+        const std::string& sealed, const std::string& aad, size_t plain_len ) const = 0;
+};
+
+/* Key file ("TCSCKEY1").
+ *
+ * A 256-byte header is followed by 64-byte aligned sections holding libff
+ * values in their in-memory representation (Montgomery form, points with
+ * Z = 1): the private share, the common public key, the public key shares
+ * and the verification vectors as one dense totalSigners x requiredSigners
+ * array. The header records the element sizes and the Montgomery image of
+ * Fq::one() so a file written by an incompatible libff build is rejected
+ * instead of misread. A SHA-256 over the header and the payload detects
+ * corruption; it is not an integrity check, since anyone who can write the
+ * file can recompute it.
+ *
+ * Sealed files carry the sealed payload instead, with the header bound to it
+ * as additional authenticated data, so a changed header or a payload moved
+ * under another header fails to unseal. The payload is unsealed into an
+ * aligned buffer once and then used exactly like a mapped one.
+ */
+class TEKeyStore {
+public:
+    static void Save( const std::string& path, const TEKeyMaterial& keys,
+        const TESealer* sealer = nullptr );
+};
+
+struct TEKeyFileHeader;
+
+/* Read-only view over a key file. Points are used in place from the mapping;
+ * nothing is parsed or copied beyond the header.
+ */
+class TEKeyView {
+public:
+    // Throws std::runtime_error on format, layout or checksum mismatch. A
+    // sealed file needs `sealer`; verify_checksum may be turned off for files
+    // that were already checked since they were written.
+    static std::unique_ptr< TEKeyView > Open( const std::string& path,
+        const TESealer* sealer = nullptr, bool verify_checksum = true );
+    ~TEKeyView();
+
+    size_t RequiredSigners() const;
+    size_t TotalSigners() const;
+    size_t SignerIndex() const;
+    bool Sealed() const;
+
+    const libff::alt_bn128_Fr& PrivateKey() const;
+    const libff::alt_bn128_G2& CommonPublicKey() const;
+    const libff::alt_bn128_G2* PublicKeyShares() const;          // TotalSigners()
+    const libff::alt_bn128_G2* VerificationVector( size_t dealer ) const;  // RequiredSigners()
+
+    TEPrivateKeyShare PrivateKeyShare() const;
+    TEPublicKey PublicKey() const;
+
+private:
+    TEKeyView();
+    TEKeyView( const TEKeyView& ) = delete;
+    TEKeyView& operator=( const TEKeyView& ) = delete;
+
+    void* map;
+    size_t map_len;
+    void* unsealed;
+    const uint8_t* payload;
+    const TEKeyFileHeader* header;
+};
+
+#endif  // TCSC_TE_KEYSTORE_H
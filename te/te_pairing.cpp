@@ -0,0 +1,87 @@
+#include "te_pairing.h"
+
+#include <libff/common/profiling.hpp>
+
+#include <algorithm>
+#include <thread>
+
+void TEInhibitProfiling() {
+    // Function-local static: initialised once, by the first caller.
+    static const bool inhibited = []() {
+        libff::inhibit_profiling_info = true;
+        libff::inhibit_profiling_counters = true;
+        return true;
+    }();
+    ( void ) inhibited;
+}
+
+MultiPairing::MultiPairing( size_t _threads ) : threads( _threads ) {
+    TEInhibitProfiling();
+    if ( threads == 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+void MultiPairing::Add( const libff::alt_bn128_G1& _P, const libff::alt_bn128_G2& _Q ) {
+    if ( _P.is_zero() || _Q.is_zero() )
+        return;
+    P.push_back( _P );
+    Q.push_back( _Q );
+}
+
+void MultiPairing::Clear() {
+    P.clear();
+    Q.clear();
+}
+
+size_t MultiPairing::Size() const {
+    return P.size();
+}
+
+libff::alt_bn128_Fq12 MultiPairing::MillerLoops( size_t begin, size_t end ) const {
+    libff::alt_bn128_Fq12 acc = libff::alt_bn128_Fq12::one();
+    size_t i = begin;
+    // Two pairs share one Miller loop iteration structure.
+    for ( ; i + 1 < end; i += 2 ) {
+        acc = acc * libff::alt_bn128_ate_double_miller_loop(
+                        libff::alt_bn128_ate_precompute_G1( P[i] ),
+                        libff::alt_bn128_ate_precompute_G2( Q[i] ),
+                        libff::alt_bn128_ate_precompute_G1( P[i + 1] ),
+                        libff::alt_bn128_ate_precompute_G2( Q[i + 1] ) );
+    }
+    if ( i < end ) {
+        acc = acc * libff::alt_bn128_ate_miller_loop( libff::alt_bn128_ate_precompute_G1( P[i] ),
+                        libff::alt_bn128_ate_precompute_G2( Q[i] ) );
+    }
+    return acc;
+}
+
+libff::alt_bn128_GT MultiPairing::Evaluate() const {
+    size_t n = P.size();
+    size_t workers = std::max< size_t >( 1, std::min( threads, n / kMinPairsPerThread ) );
+
+    libff::alt_bn128_Fq12 acc;
+    if ( workers == 1 ) {
+        acc = MillerLoops( 0, n );
+    } else {
+        std::vector< libff::alt_bn128_Fq12 > partial( workers, libff::alt_bn128_Fq12::one() );
+        std::vector< std::thread > pool;
+        size_t step = ( n + workers - 1 ) / workers;
+        for ( size_t w = 0; w < workers; ++w ) {
+            size_t begin = w * step;
+            size_t end = std::min( n, begin + step );
+            pool.emplace_back( [this, &partial, w, begin, end]() {
+                partial[w] = MillerLoops( begin, end );
+            } );
+        }
+        for ( auto& t : pool )
+            t.join();
+        acc = libff::alt_bn128_Fq12::one();
+        for ( const auto& p : partial )
+            acc = acc * p;
+    }
+    return libff::alt_bn128_final_exponentiation( acc );
+}
+
+bool MultiPairing::IsOne() const {
+    return Evaluate() == libff::alt_bn128_GT::one();
+}
@@ -0,0 +1,50 @@
+#ifndef TCSC_TE_PAIRING_H
+#define TCSC_TE_PAIRING_H
+
+#include <libff/algebra/curves/alt_bn128/alt_bn128_pairing.hpp>
+#include <libff/algebra/curves/alt_bn128/alt_bn128_pp.hpp>
+
+#include <vector>
+
+/* Product of pairings prod e(P_i, Q_i) evaluated with one final
+ * exponentiation.
+ *
+ * Pairs are only collected by Add(); the Miller loops run in Evaluate(), which
+ * splits them over `threads` workers when there are enough pairs to amortise
+ * the thread start-up, and multiplies the partial Fq12 products together
+ * before the single final exponentiation. Pairs with a zero point contribute
+ * e(., .) = 1 and are skipped.
+ */
+class MultiPairing {
+public:
+    explicit MultiPairing( size_t threads = 1 );
+
+    void Add( const libff::alt_bn128_G1& P, const libff::alt_bn128_G2& Q );
+    void Clear();
+    size_t Size() const;
+
+    libff::alt_bn128_GT Evaluate() const;
+
+    // Evaluate() == 1, the form every verification equation is rewritten into.
+    bool IsOne() const;
+
+private:
+    // Below this many pairs per worker the Miller loops run on the caller.
+    static const size_t kMinPairsPerThread = 4;
+
+    libff::alt_bn128_Fq12 MillerLoops( size_t begin, size_t end ) const;
+
+    size_t threads;
+    std::vector< libff::alt_bn128_G1 > P;
+    std::vector< libff::alt_bn128_G2 > Q;
+};
+
+/* libff's enter_block/leave_block, which the G2 precomputation and the
+ * Miller loops call, update global std::maps unless profiling is inhibited.
+ * Turns profiling off for the process; the first call does it, so make one
+ * before any worker thread that runs libff code starts. MultiPairing does so
+ * on construction.
+ */
+void TEInhibitProfiling();
+
+#endif  // TCSC_TE_PAIRING_H
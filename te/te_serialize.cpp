@@ -0,0 +1,190 @@
+#include "te_serialize.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const size_t kFieldBytes = 32;
+
+template < class FieldT >
+void PutField( TEWriter& w, const FieldT& v ) {
+    auto b = v.as_bigint();
+    uint8_t out[kFieldBytes] = {0};
+    for ( size_t i = 0; i < kFieldBytes; ++i ) {
+        size_t limb = i / sizeof( b.data[0] );
+        size_t shift = 8 * ( i % sizeof( b.data[0] ) );
+        if ( limb < sizeof( b.data ) / sizeof( b.data[0] ) )
+            out[kFieldBytes - 1 - i] = uint8_t( b.data[limb] >> shift );
+    }
+    w.PutBytes( out, sizeof out );
+}
+
+template < class FieldT >
+FieldT GetField( TEReader& r ) {
+    const uint8_t* in = r.GetBytes( kFieldBytes );
+    decltype( FieldT().as_bigint() ) b;
+    const size_t limbs = sizeof( b.data ) / sizeof( b.data[0] );
+    for ( size_t l = 0; l < limbs; ++l )
+        b.data[l] = 0;
+    for ( size_t i = 0; i < kFieldBytes; ++i ) {
+        size_t limb = i / sizeof( b.data[0] );
+        size_t shift = 8 * ( i % sizeof( b.data[0] ) );
+        if ( limb < limbs )
+            b.data[limb] |= mp_limb_t( in[kFieldBytes - 1 - i] ) << shift;
+    }
+    if ( mpn_cmp( b.data, FieldT::mod.data, limbs ) >= 0 )
+        throw std::runtime_error( "field element out of range" );
+    return FieldT( b );
+}
+
+bool AllZero( const uint8_t* p, size_t len ) {
+    for ( size_t i = 0; i < len; ++i )
+        if ( p[i] )
+            return false;
+    return true;
+}
+
+}  // namespace
+
+void TEWriter::PutU8( uint8_t v ) {
+    buf.push_back( char( v ) );
+}
+
+void TEWriter::PutU32( uint32_t v ) {
+    for ( int i = 3; i >= 0; --i )
+        buf.push_back( char( v >> ( 8 * i ) ) );
+}
+
+void TEWriter::PutU64( uint64_t v ) {
+    for ( int i = 7; i >= 0; --i )
+        buf.push_back( char( v >> ( 8 * i ) ) );
+}
+
+void TEWriter::PutBytes( const void* data, size_t len ) {
+    buf.append( static_cast< const char* >( data ), len );
+}
+
+void TEWriter::PutString( const std::string& s ) {
+    PutU32( uint32_t( s.size() ) );
+    PutBytes( s.data(), s.size() );
+}
+
+void TEWriter::PutFq( const libff::alt_bn128_Fq& v ) {
+    PutField( *this, v );
+}
+
+void TEWriter::PutFr( const libff::alt_bn128_Fr& v ) {
+    PutField( *this, v );
+}
+
+void TEWriter::PutG1( libff::alt_bn128_G1 v ) {
+    if ( v.is_zero() ) {
+        uint8_t zero[2 * kFieldBytes] = {0};
+        PutBytes( zero, sizeof zero );
+        return;
+    }
+    v.to_affine_coordinates();
+    PutFq( v.X );
+    PutFq( v.Y );
+}
+
+void TEWriter::PutG2( libff::alt_bn128_G2 v ) {
+    if ( v.is_zero() ) {
+        uint8_t zero[4 * kFieldBytes] = {0};
+        PutBytes( zero, sizeof zero );
+        return;
+    }
+    v.to_affine_coordinates();
+    PutFq( v.X.c0 );
+    PutFq( v.X.c1 );
+    PutFq( v.Y.c0 );
+    PutFq( v.Y.c1 );
+}
+
+void TEWriter::PutCiphertext( const libBLS::Ciphertext& cypher ) {
+    PutG2( std::get< 0 >( cypher ) );
+    PutString( std::get< 1 >( cypher ) );
+    PutG1( std::get< 2 >( cypher ) );
+}
+
+TEReader::TEReader( const void* data, size_t len )
+    : cur( static_cast< const uint8_t* >( data ) ), left( len ) {}
+
+const uint8_t* TEReader::GetBytes( size_t len ) {
+    if ( len > left )
+        throw std::runtime_error( "truncated TE encoding" );
+    const uint8_t* p = cur;
+    cur += len;
+    left -= len;
+    return p;
+}
+
+uint8_t TEReader::GetU8() {
+    return *GetBytes( 1 );
+}
+
+uint32_t TEReader::GetU32() {
+    const uint8_t* p = GetBytes( 4 );
+    return ( uint32_t( p[0] ) << 24 ) | ( uint32_t( p[1] ) << 16 ) | ( uint32_t( p[2] ) << 8 ) |
+           uint32_t( p[3] );
+}
+
+uint64_t TEReader::GetU64() {
+    uint64_t hi = GetU32();
+    return ( hi << 32 ) | GetU32();
+}
+
+std::string TEReader::GetString() {
+    uint32_t len = GetU32();
+    const uint8_t* p = GetBytes( len );
+    return std::string( reinterpret_cast< const char* >( p ), len );
+}
+
+libff::alt_bn128_Fq TEReader::GetFq() {
+    return GetField< libff::alt_bn128_Fq >( *this );
+}
+
+libff::alt_bn128_Fr TEReader::GetFr() {
+    return GetField< libff::alt_bn128_Fr >( *this );
+}
+
+libff::alt_bn128_G1 TEReader::GetG1() {
+    if ( left >= 2 * kFieldBytes && AllZero( cur, 2 * kFieldBytes ) ) {
+        GetBytes( 2 * kFieldBytes );
+        return libff::alt_bn128_G1::zero();
+    }
+    libff::alt_bn128_Fq x = GetFq();
+    libff::alt_bn128_Fq y = GetFq();
+    libff::alt_bn128_G1 p( x, y, libff::alt_bn128_Fq::one() );
+    if ( !p.is_well_formed() )
+        throw std::runtime_error( "G1 point is not on the curve" );
+    return p;
+}
+
+libff::alt_bn128_G2 TEReader::GetG2() {
+    if ( left >= 4 * kFieldBytes && AllZero( cur, 4 * kFieldBytes ) ) {
+        GetBytes( 4 * kFieldBytes );
+        return libff::alt_bn128_G2::zero();
+    }
+    libff::alt_bn128_Fq x0 = GetFq();
+    libff::alt_bn128_Fq x1 = GetFq();
+    libff::alt_bn128_Fq y0 = GetFq();
+    libff::alt_bn128_Fq y1 = GetFq();
+    libff::alt_bn128_G2 p( libff::alt_bn128_Fq2( x0, x1 ), libff::alt_bn128_Fq2( y0, y1 ),
+        libff::alt_bn128_Fq2::one() );
+    if ( !p.is_well_formed() )
+        throw std::runtime_error( "G2 point is not on the curve" );
+    // The twist has a large cofactor; a U of small order would make the
+    // decryption shares computed on it leak the private share.
+    if ( !( libff::alt_bn128_G2::order() * p == libff::alt_bn128_G2::zero() ) )
+        throw std::runtime_error( "G2 point is not in the order-r subgroup" );
+    return p;
+}
+
+libBLS::Ciphertext TEReader::GetCiphertext() {
+    libff::alt_bn128_G2 U = GetG2();
+    std::string V = GetString();
+    libff::alt_bn128_G1 W = GetG1();
+    return std::make_tuple( U, V, W );
+}
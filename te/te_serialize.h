@@ -0,0 +1,65 @@
+#ifndef TCSC_TE_SERIALIZE_H
+#define TCSC_TE_SERIALIZE_H
+
+#include <threshold_encryption/threshold_encryption.h>
+
+#include <cstdint>
+#include <string>
+
+/* Portable binary encoding of TE values.
+ *
+ * Integers are big-endian. Field elements are 32-byte big-endian canonical
+ * (non-Montgomery) integers; points are written in affine form, x then y,
+ * with Fq2 coordinates as c0 then c1. The point at infinity is encoded as all
+ * zero bytes, which is not on either curve.
+ */
+class TEWriter {
+public:
+    void PutU8( uint8_t v );
+    void PutU32( uint32_t v );
+    void PutU64( uint64_t v );
+    void PutBytes( const void* data, size_t len );
+    // u32 length prefix followed by the bytes.
+    void PutString( const std::string& s );
+
+    void PutFq( const libff::alt_bn128_Fq& v );
+    void PutFr( const libff::alt_bn128_Fr& v );
+    void PutG1( libff::alt_bn128_G1 v );
+    void PutG2( libff::alt_bn128_G2 v );
+    void PutCiphertext( const libBLS::Ciphertext& cypher );
+
+    const std::string& Data() const { return buf; }
+    std::string& Data() { return buf; }
+
+private:
+    std::string buf;
+};
+
+/* Reads what TEWriter wrote. Every getter throws std::runtime_error when the
+ * input is truncated or a decoded point is not on its curve; G2 points must
+ * also lie in the order-r subgroup.
+ */
+class TEReader {
+public:
+    TEReader( const void* data, size_t len );
+
+    uint8_t GetU8();
+    uint32_t GetU32();
+    uint64_t GetU64();
+    const uint8_t* GetBytes( size_t len );
+    std::string GetString();
+
+    libff::alt_bn128_Fq GetFq();
+    libff::alt_bn128_Fr GetFr();
+    libff::alt_bn128_G1 GetG1();
+    libff::alt_bn128_G2 GetG2();
+    libBLS::Ciphertext GetCiphertext();
+
+    size_t Remaining() const { return left; }
+
+private:
+    const uint8_t* cur;
+    size_t left;
+};
+
+#endif  // TCSC_TE_SERIALIZE_H